@@ -6,6 +6,7 @@
 
 #include "visitor.hpp"
 #include "indirect_iterator.hpp"
+#include "lexer.hpp"
 
 namespace li1I
 {
@@ -24,6 +25,7 @@ class DeclExpr;
 class OpExpr;
 class IfExpr;
 class Expr;
+class ExternFunction;
 
     template <typename T>
     using UniqueIterator = 
@@ -44,6 +46,12 @@ class Expr;
     {
     public:
         virtual ~ASTNode() {}
+
+        // Where the node's first token starts.
+        inline const TokenLocation &location() const { return m_location; }
+
+    protected:
+        TokenLocation m_location {};
     };
 
     template <typename NodeType>
@@ -134,6 +142,15 @@ class Expr;
     {
     public:
         Function();
+
+        // A function of no arguments which evaluates expr, for evaluating
+        // an expression parsed on its own.
+        Function(std::string name, std::unique_ptr<RPNExpr> expr)
+            : m_name(std::move(name)), m_args(), m_expr(std::move(expr))
+        {
+            m_location = m_expr->location();
+        }
+
         inline const std::string &name() const { return m_name; }
         inline UniqueIterator<VarExpr> begin() const { return m_args.cbegin(); }
         inline UniqueIterator<VarExpr> end() const { return m_args.cend(); }
@@ -145,15 +162,47 @@ class Expr;
         std::unique_ptr<RPNExpr> m_expr;
     };
 
+    // A function defined outside the program, by C or anything else
+    // following the platform's calling convention, which takes nArgs()
+    // int32_ts and returns one. As with li1I functions, its first argument
+    // is the top of the stack.
+    class ExternFunction
+    {
+    public:
+        ExternFunction();
+        inline const std::string &name() const { return m_name; }
+        inline size_t nArgs() const { return m_n_args; }
+        inline const TokenLocation &location() const { return m_location; }
+    private:
+        std::string m_name;
+        size_t m_n_args;
+        TokenLocation m_location;
+    };
+
     class Program : public VisitableASTNode<Program>
     {
     public:
         Program(std::string name);
         inline UniqueIterator<Function> begin() const { return m_functions.cbegin(); }
         inline UniqueIterator<Function> end() const { return m_functions.cend(); }
+        inline const std::vector<std::unique_ptr<ExternFunction> > &externs() const
+        {
+            return m_externs;
+        }
         inline const std::string &name() const { return m_name; }
+
+        // Where the closing brace is.
+        inline const TokenLocation &endLocation() const { return m_end; }
     private:
+        // Which replace definitions as they are edited, and as they are
+        // typed at --repl's prompt, starting from none.
+        friend class IncrementalParser;
+        friend class ReplSession;
+        Program() {}
+
         std::vector<std::unique_ptr<Function> > m_functions;
+        std::vector<std::unique_ptr<ExternFunction> > m_externs;
         std::string m_name;
+        TokenLocation m_end {};
     };
 }
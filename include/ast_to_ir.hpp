@@ -1,10 +1,19 @@
 #pragma once
 
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "ast.hpp"
+#include "bigint_ir.hpp"
+#include "partial_eval.hpp"
+#include "profile.hpp"
+#include "tiny_runtime.hpp"
 
 namespace li1I
 {
@@ -27,7 +36,11 @@ IRTransformError (std::string message) : m_message(message) {}
     {
     public:
         ASTToIRVisitor() :
-            m_module(NULL), m_context(), m_builder(m_context), m_environment()
+            m_module(NULL), m_context(), m_builder(m_context), m_environment(),
+            m_profile(nullptr), m_function_profile(nullptr), m_counters(nullptr),
+            m_n_ifs(0), m_debug_builder(), m_debug_file(nullptr), m_debug_int(nullptr),
+            m_subprogram(nullptr), m_eval_budget(0), m_evaluator(), m_specializations(),
+            m_bigint(), m_extern_functions(), m_tiny_runtime(), m_main(true)
         {}
         void visit(const Program &node);
         void visit(const Function &node);
@@ -40,16 +53,97 @@ IRTransformError (std::string message) : m_message(message) {}
         void visit(const IfExpr &node);
         llvm::Module *codegenIR(const Program &program);
 
+        // Modules holding just one function of program, or just main, with
+        // every other function declared, for compiling a function at a time.
+        llvm::Module *codegenFunction(const Program &program, const Function &function);
+        llvm::Module *codegenFunctions(const Program &program,
+                                       const std::vector<const Function*> &functions);
+        llvm::Module *codegenMain(const Program &program);
+
+        // Counts function entries and IfExpr branches, for main to write
+        // to profile_path when the program exits.
+        void setProfileGenerate(std::string profile_path);
+
+        // Attaches counts from an earlier -fprofile-generate run as entry
+        // counts and branch weights.
+        void setProfileUse(const ProfileData *profile);
+
+        // Describes every function, operator and call with its line and
+        // column in source_path, as DWARF.
+        void setDebugInfo(std::string source_path);
+
+        // Replaces calls with constant arguments which finish within budget
+        // calls by their results, and specialises the functions called on
+        // whatever arguments are constant otherwise. Ifs on a constant only
+        // generate the branch taken. Zero turns it off.
+        void setPartialEvaluation(uint64_t budget);
+
+        // Makes values integers of any size, as BigintIR describes. Extern
+        // functions still take and return 32 bit ints.
+        void setBigint(bool enabled);
+
+        // Makes main a _start which needs no C library, as TinyRuntimeIR
+        // describes.
+        void setTinyRuntime(bool enabled);
+
+        // Whether codegenIR defines main, which programs whose functions
+        // are linked into a C program leave out.
+        void setMain(bool enabled);
+
+        // Each instrumented function's FID and number of counters.
+        inline const std::vector<std::pair<std::string, size_t> > &profileCounters() const
+        {
+            return m_profile_counters;
+        }
+
     private:
         llvm::Value *codegen(const ASTNode &node);
+        llvm::Type *valueType();
+        llvm::Constant *constant(Value value);
         llvm::Value *codegenOperation (Operator op,
                                            llvm::Value *lhs, llvm::Value *rhs);
+        void declareFunction(const std::string &fid, size_t n_args, bool is_extern);
+        void declareFunctions(const Program &node, const std::set<std::string> *only = nullptr);
+        void createModule(const std::string &name);
+        llvm::Module *finishModule();
+        void createSubprogram(llvm::Function *f, const TokenLocation *location);
+        void setDebugLocation(const TokenLocation &location);
+        void describeVariable(const std::string &vid, const TokenLocation &location,
+                              llvm::Value *value, unsigned arg_no);
+        llvm::Value *evaluateCall(const std::string &fid, std::vector<llvm::Value*> &args);
+        llvm::Function *specialize(const Function &function, const std::vector<llvm::Value*> &args);
+        llvm::Value *callMain();
         void createMain();
+        void createProfileDump();
+        void incrementCounter(size_t index);
 
         llvm::Module *m_module;
         llvm::LLVMContext m_context;
         llvm::IRBuilder<> m_builder;
         std::map <std::string, llvm::Value*> m_environment;
         llvm::Value *m_value;
+
+        std::string m_profile_path;
+        const ProfileData *m_profile;
+        const FunctionProfile *m_function_profile;
+        llvm::GlobalVariable *m_counters;
+        size_t m_n_ifs;
+        std::vector<std::pair<std::string, size_t> > m_profile_counters;
+
+        std::string m_debug_path;
+        std::unique_ptr<llvm::DIBuilder> m_debug_builder;
+        llvm::DIFile *m_debug_file;
+        llvm::DIType *m_debug_int;
+        llvm::DISubprogram *m_subprogram;
+
+        uint64_t m_eval_budget;
+        std::unique_ptr<PartialEvaluator> m_evaluator;
+        std::map<std::string, llvm::Function*> m_specializations;
+
+        std::unique_ptr<BigintIR> m_bigint;
+        std::set<std::string> m_extern_functions;
+
+        std::unique_ptr<TinyRuntimeIR> m_tiny_runtime;
+        bool m_main;
     };
 }
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+#include "interpreter.hpp"
+
+namespace li1I
+{
+    class BaselineJITError : public std::exception
+    {
+    public:
+        BaselineJITError (std::string message) : m_message(message) {}
+        ~BaselineJITError() throw() {}
+
+        virtual const char* what() const throw()
+        {
+            return m_message.c_str();
+        }
+    private:
+        std::string m_message;
+    };
+
+    // Copy-and-patch compiler for x86-64. Each AST operation is a fixed
+    // machine code stencil which is copied into a buffer with its immediate,
+    // frame offset or branch displacement patched in, so code is produced in
+    // a single walk over the AST without going through LLVM.
+    //
+    // RPN operands live on the machine stack. li1I functions take their
+    // arguments on the stack too, the first argument on top, and return in
+    // eax; every function also gets an entry point taking an argument array.
+    // Extern functions are looked up on compiling, and called with the
+    // platform's calling convention.
+    //
+    // Under --tier it is the middle tier: see compileTier().
+    class BaselineJIT : public ASTNodeVisitor
+    {
+    public:
+        struct Stencil;
+        using HotHandler = Interpreter::HotHandler;
+
+        BaselineJIT();
+        ~BaselineJIT();
+        BaselineJIT(const BaselineJIT&) =delete;
+        BaselineJIT &operator=(const BaselineJIT&) =delete;
+
+        void visit(const Program &node);
+        void visit(const Function &node);
+        void visit(const VarExpr &node);
+        void visit(const RPNExpr &node);
+        void visit(const IntExpr &node);
+        void visit(const CallExpr &node);
+        void visit(const DeclExpr &node);
+        void visit(const OpExpr &node);
+        void visit(const IfExpr &node);
+
+        void compile(const Program &program);
+
+        // Compiles program as the tier between the Interpreter whose slots
+        // these are and LLVM. Calls from one function to another go through
+        // a cell per callee, which redirect() can point elsewhere, and each
+        // function counts the calls to its code, calling handler the first
+        // time they reach threshold.
+        void compileTier(const Program &program, std::vector<FunctionSlot> &slots,
+                         uint64_t threshold, HotHandler handler);
+
+        // Sends calls from baseline code to slot's function to slot.native
+        // from now on. May be called while the code runs on another thread.
+        void redirect(const FunctionSlot &slot);
+
+        NativeEntry entry(const std::string &fid) const;
+        Value run() const;
+        inline size_t codeSize() const { return m_code_size; }
+
+    private:
+        struct CallFixup
+        {
+            size_t hole;
+            std::string fid;
+        };
+
+        // What calls to a function go through under compileTier().
+        struct TierCell
+        {
+            std::atomic<const uint8_t*> target;
+            int64_t calls_left;
+            FunctionSlot *slot;
+            BaselineJIT *jit;
+        };
+
+        static void hot(TierCell *cell);
+
+        size_t emit(const Stencil &stencil, int32_t patch = 0);
+        void patch(size_t hole, int32_t value);
+        void patchBranch(size_t hole, size_t target);
+        void patchPointer(size_t hole, const void *pointer);
+        void emitOperation(Operator op);
+        void emitCall(const std::string &fid);
+        void emitExternCall(void *address, size_t n_args);
+        void emitEntry(const Function &node);
+        void emitCallCount(TierCell &cell);
+        void emitThunk(const Function &node);
+        int32_t slot(const std::string &vid);
+
+        std::vector<uint8_t> m_buffer;
+        std::map<std::string, size_t> m_functions;
+        std::map<std::string, size_t> m_entries;
+        std::map<std::string, size_t> m_arities;
+        std::map<std::string, void*> m_externs;
+        std::vector<CallFixup> m_call_fixups;
+
+        std::unique_ptr<TierCell[]> m_cells;
+        std::map<std::string, TierCell*> m_tier_cells;
+        std::map<std::string, size_t> m_thunks;
+        HotHandler m_hot_handler;
+
+        std::map<std::string, int32_t> m_slots;
+        int32_t m_n_locals;
+        size_t m_depth;
+        size_t m_last_label;
+        size_t m_last_push_imm;
+
+        uint8_t *m_code;
+        size_t m_code_size;
+    };
+}
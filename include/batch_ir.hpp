@@ -0,0 +1,68 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+
+#include "ast.hpp"
+#include "ast_to_ir.hpp"
+
+namespace li1I
+{
+    // Adds a batch entry point to a module produced by ASTToIRVisitor for
+    // every li1I function:
+    //
+    //     void <fid>_batch(const int32_t *args[], int32_t *out, size_t n)
+    //
+    // args[k] points at n values of the function's k'th declared argument
+    // and out receives the n results.
+    //
+    // Functions which never recurse, directly or through their callees, get
+    // a second copy of their body working on <width x i32> vectors, with
+    // both sides of each IfExpr evaluated and the result picked with a
+    // select; the batch loop runs that over width rows at a time and the
+    // scalar function over what is left. Recursive functions only get the
+    // scalar loop.
+    class BatchIRGenerator : public ASTNodeVisitor
+    {
+    public:
+        BatchIRGenerator(llvm::Module &module, unsigned width = 8);
+
+        void visit(const Program &node);
+        void visit(const Function &node);
+        void visit(const VarExpr &node);
+        void visit(const RPNExpr &node);
+        void visit(const IntExpr &node);
+        void visit(const CallExpr &node);
+        void visit(const DeclExpr &node);
+        void visit(const OpExpr &node);
+        void visit(const IfExpr &node);
+
+        void generate(const Program &program);
+        inline bool isVectorized(const std::string &fid) const
+        {
+            return m_vectorizable.count(fid);
+        }
+
+    private:
+        void findVectorizable(const Program &program);
+        void createBatchEntry(const Function &node);
+        llvm::Value *codegen(const ASTNode &node);
+        llvm::Value *codegenOperation(Operator op, llvm::Value *lhs, llvm::Value *rhs);
+
+        llvm::Module &m_module;
+        llvm::LLVMContext &m_context;
+        llvm::IRBuilder<> m_builder;
+        unsigned m_width;
+        llvm::Type *m_value_type;
+        llvm::Type *m_vector_type;
+
+        std::set<std::string> m_vectorizable;
+        std::map<std::string, llvm::Function*> m_vector_functions;
+        std::map<std::string, llvm::Value*> m_environment;
+        llvm::Value *m_value;
+    };
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+#include "operations.hpp"
+
+namespace llvm
+{
+    class ExecutionEngine;
+}
+
+namespace li1I
+{
+    class ASTToIRVisitor;
+
+    class BatchError : public std::exception
+    {
+    public:
+        BatchError (std::string message) : m_message(message) {}
+        ~BatchError() throw() {}
+
+        virtual const char* what() const throw()
+        {
+            return m_message.c_str();
+        }
+    private:
+        std::string m_message;
+    };
+
+    // Evaluates one function over every row of an input file. The program
+    // is JIT compiled once with BatchIRGenerator's entry points, then the
+    // mapped input is cut into chunks which a pool of threads evaluates
+    // while the calling thread writes the results out in input order. At
+    // most a few chunks per thread are in flight, so memory use doesn't
+    // grow with the input.
+    //
+    // A row holds the function's arguments in declaration order, either as
+    // a line of comma separated integers (with the results written one per
+    // line, as -e prints them) or, for .bin files, as native endian int32s
+    // (with the results written as int32s too).
+    class BatchRunner
+    {
+    public:
+        BatchRunner(const Program &program, const std::string &fid, unsigned n_threads);
+        ~BatchRunner();
+
+        void run(const std::string &input_path, std::ostream &out);
+
+    private:
+        using BatchEntry = void (*)(const Value **args, Value *out, size_t n);
+
+        struct Chunk
+        {
+            const char *begin;
+            const char *end;
+            size_t rows;
+            std::string output;
+            std::string error;
+            bool done;
+        };
+
+        void work();
+        void nextChunk(Chunk &chunk);
+        void evaluate(Chunk &chunk, std::vector<std::vector<Value> > &columns);
+        void parseBinary(Chunk &chunk, std::vector<std::vector<Value> > &columns);
+        void parseCSV(Chunk &chunk, std::vector<std::vector<Value> > &columns);
+
+        std::unique_ptr<ASTToIRVisitor> m_codegenner;
+        std::unique_ptr<llvm::ExecutionEngine> m_engine;
+        BatchEntry m_entry;
+        size_t m_n_args;
+        unsigned m_n_threads;
+
+        bool m_binary;
+        const char *m_cursor;
+        const char *m_end;
+
+        std::mutex m_mutex;
+        std::condition_variable m_chunk_done;
+        std::condition_variable m_space_free;
+        std::deque<Chunk> m_in_flight;
+        bool m_stop;
+    };
+}
@@ -2,12 +2,20 @@
 
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/ADT/Triple.h"
+#include <memory>
 
 namespace llvm
 {
     class ToolOutputFile;
     class Module;
     class LLVMContext;
+    class StringRef;
+    class MemoryBuffer;
+}
+
+namespace li1I
+{
+    class DiskObjectCache;
 }
 
 class BCCompileError : public std::exception
@@ -29,12 +37,39 @@ class BCCompiler
 public:
     BCCompiler (llvm::CodeGenOpt::Level opt_level,
                 llvm::CodeGenFileType file_type)
-        : m_opt_level(opt_level), m_file_type(file_type) {};
+        : m_opt_level(opt_level), m_file_type(file_type), m_cache(nullptr),
+          m_target_machine(), m_optimize(0), m_default_output(false) {};
     std::string compile(llvm::Module *module);
+
+    // Compiles to memory rather than to the output file.
+    std::unique_ptr<llvm::MemoryBuffer> emit(llvm::Module *module);
+
+    // Writes bitcode with a ThinLTO summary instead of an object, for
+    // clang/lld to link with LTO.
+    std::string compileBitcode(llvm::Module *module, const std::string &suffix);
+    std::string writeOutput(llvm::StringRef object, const std::string &prog_name);
+
+    // Object files are stored in cache under key as they are compiled.
+    void setCache(li1I::DiskObjectCache *cache, std::string key);
+    std::unique_ptr<llvm::MemoryBuffer> lookupCache();
+
+    // Runs the IR optimisation pipeline at level before emitting anything;
+    // 0, the default, leaves modules as they are.
+    void setOptimization(unsigned level) { m_optimize = level; }
+
+    // Names output files after the program whatever -o says, without
+    // looking at the options, so that it can run on several threads.
+    void useDefaultOutput() { m_default_output = true; }
 private:
     llvm::CodeGenOpt::Level m_opt_level;
     llvm::CodeGenFileType m_file_type;
+    li1I::DiskObjectCache *m_cache;
+    std::string m_cache_key;
+    std::unique_ptr<llvm::TargetMachine> m_target_machine;
+    unsigned m_optimize;
+    bool m_default_output;
 
+    llvm::TargetMachine *getTargetMachine(const llvm::Triple &triple);
     llvm::ToolOutputFile *getOutputStream(const std::string &target_name,
                                             llvm::Triple::OSType os_type,
                                             const std::string &prog_name,
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+
+#include "ast.hpp"
+#include "operations.hpp"
+
+namespace li1I
+{
+    // Code for --bigint values, which are i64 tagged words as described in
+    // li1I_bigint.h. Arithmetic and comparisons on two small values are
+    // done inline, with overflow checks, and only big operands or
+    // overflowing results reach the runtime, so programs whose values stay
+    // small run nearly as fast as with i32.
+    //
+    // Values are ordinary signed integers: comparisons are signed and
+    // division rounds towards zero, which only differs from the 32 bit
+    // semantics for values which would be negative there.
+    class BigintIR
+    {
+    public:
+        BigintIR(llvm::IRBuilder<> &builder);
+
+        llvm::Type *valueType() const;
+        llvm::Constant *constant(Value value) const;
+        llvm::Value *operation(Operator op, llvm::Value *lhs, llvm::Value *rhs);
+
+        // The value modulo 2^32, for passing to extern functions, and back.
+        llvm::Value *lowBits(llvm::Value *value);
+        llvm::Value *fromInt32(llvm::Value *value);
+
+        // As the i32 truncated to i1 that an IfExpr tests otherwise.
+        llvm::Value *isTruthy(llvm::Value *value);
+
+        // Prints value and a newline, for main.
+        void print(llvm::Value *value);
+
+    private:
+        llvm::FunctionCallee runtimeFunction(const char *name, llvm::Type *result, size_t n_args);
+        llvm::Value *isSmall(llvm::Value *value);
+        llvm::Value *overflowing(llvm::Intrinsic::ID id, llvm::Value *lhs, llvm::Value *rhs,
+                                 llvm::Value *&overflow);
+
+        llvm::IRBuilder<> &m_builder;
+    };
+
+    // Makes the runtime, which the driver is linked with, visible to
+    // MCJIT.
+    void registerBigintRuntime();
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+#include "operations.hpp"
+
+namespace li1I
+{
+    class BytecodeError : public std::exception
+    {
+    public:
+        BytecodeError (std::string message) : m_message(message) {}
+        ~BytecodeError() throw() {}
+
+        virtual const char* what() const throw()
+        {
+            return m_message.c_str();
+        }
+    private:
+        std::string m_message;
+    };
+
+    // Register bytecode. Registers are numbered from the base of the current
+    // frame: arguments first, then declared variables, then RPN temporaries.
+    enum class Opcode : uint16_t
+    {
+        LOADI,      // r[a] = imm
+        MOVE,       // r[a] = r[b]
+        ADD, SUB, MUL, DIV, EXP, GT, LT, EQ, NEQ,           // r[a] = r[b] op r[c]
+        ADDI, SUBI, MULI, DIVI, EXPI, GTI, LTI, EQI, NEQI,  // r[a] = r[b] op imm
+        JUMP,       // pc = target
+        JUMPF,      // if !isTruthy(r[a]) pc = target
+        JNGT, JNLT, JNEQ, JNNE,         // if !(r[a] op r[b]) pc = target
+        JNGTI, JNLTI, JNEQI, JNNEI,     // if !(r[a] op imm) pc = target
+        CALL,       // r[a] = functions[b](r[c]...), the callee's frame starts at r[c]
+        CALLX,      // r[a] = externs[b](r[c]...)
+        RET,        // return r[a]
+        RETI,       // return imm
+        N_OPCODES
+    };
+
+    struct Instruction
+    {
+        Opcode op;
+        uint16_t a;
+        uint16_t b;
+        uint16_t c;
+        int32_t imm;
+        int32_t target;
+    };
+
+    struct BytecodeFunction
+    {
+        std::string name;
+        uint16_t n_args;
+        uint16_t frame_size;
+        std::vector<Instruction> code;
+    };
+
+    // Resolved by the VM, so that bytecode can be dumped without them.
+    struct BytecodeExtern
+    {
+        std::string name;
+        uint16_t n_args;
+    };
+
+    struct BytecodeProgram
+    {
+        std::vector<BytecodeFunction> functions;
+        std::vector<BytecodeExtern> externs;
+        size_t main_index;
+
+        void dump(std::ostream &out) const;
+    };
+
+    class BytecodeCompiler : public ASTNodeVisitor
+    {
+    public:
+        BytecodeCompiler() : m_program(), m_function_indices(), m_extern_indices(),
+                             m_function(NULL), m_variables(), m_operands(),
+                             m_temporary_base(0), m_last_target(0) {}
+        void visit(const Program &node);
+        void visit(const Function &node);
+        void visit(const VarExpr &node);
+        void visit(const RPNExpr &node);
+        void visit(const IntExpr &node);
+        void visit(const CallExpr &node);
+        void visit(const DeclExpr &node);
+        void visit(const OpExpr &node);
+        void visit(const IfExpr &node);
+        BytecodeProgram compile(const Program &program);
+
+    private:
+        // A value on the compile-time RPN stack: a register, or a constant
+        // which has not been loaded yet so that it can be fused into its user.
+        struct Operand
+        {
+            bool is_constant;
+            uint16_t reg;
+            Value constant;
+        };
+
+        Operand compileRPN(const RPNExpr &node);
+        void materialise(const Operand &operand, uint16_t reg);
+        void materialiseAliases(uint16_t reg);
+        uint16_t temporary(size_t position);
+        uint16_t reserve(size_t n_registers);
+        void emitOperation(Operator op, const Operand &lhs, const Operand &rhs, uint16_t target);
+        size_t emitBranchUnless(const Operand &condition);
+        size_t emit(Opcode op, uint16_t a, uint16_t b = 0, uint16_t c = 0, int32_t imm = 0);
+
+        BytecodeProgram m_program;
+        std::map<std::string, size_t> m_function_indices;
+        std::map<std::string, size_t> m_extern_indices;
+        BytecodeFunction *m_function;
+        std::map<std::string, uint16_t> m_variables;
+        std::vector<Operand> m_operands;
+        uint16_t m_temporary_base;
+        size_t m_last_target;
+    };
+}
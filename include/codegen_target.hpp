@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+
+namespace llvm
+{
+    class EngineBuilder;
+    class Module;
+}
+
+namespace li1I
+{
+    // The CPU and features code is generated for, in the form LLVM's
+    // TargetMachine takes them: a CPU name and "+feature,-feature".
+    struct CodegenTarget
+    {
+        std::string cpu;
+        std::string features;
+
+        std::vector<std::string> featureList() const;
+    };
+
+    // Resolves -march, -mcpu and -mattr values. "native" for either of the
+    // first two means the host CPU with all of its features; without any,
+    // code is generic.
+    CodegenTarget selectTarget(llvm::StringRef march, llvm::StringRef mcpu,
+                               llvm::StringRef mattr);
+
+    // The target every JIT and the AOT compiler in this process use.
+    const CodegenTarget &codegenTarget();
+    void setCodegenTarget(CodegenTarget target);
+
+    void applyTarget(llvm::EngineBuilder &builder);
+
+    // Records the target in the "target-cpu" and "target-features"
+    // attributes of every function defined in module, as clang does, and
+    // in li1I.target metadata.
+    void recordTarget(llvm::Module &module);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+#include "operations.hpp"
+
+namespace li1I
+{
+    // What an RPN stack slot is known to hold: a constant, an argument
+    // plus a constant, an argument divided by a constant, or anything.
+    struct Symbolic
+    {
+        enum class Kind { UNKNOWN, CONSTANT, AFFINE, QUOTIENT };
+
+        Kind kind;
+        Value value;
+        size_t arg;
+
+        bool operator==(const Symbolic &other) const;
+        bool operator!=(const Symbolic &other) const { return !(*this == other); }
+    };
+
+    // Static estimates of what calling a function costs, for --cost-report
+    // and for deciding whether to run something at all. Work is counted in
+    // ops: constants, variables, operators, declarations and calls. Each
+    // function is walked with the ops and calls on the cheapest and dearest
+    // path through its ifs, following only the branch taken where the
+    // condition is constant, and the call graph is split into strongly
+    // connected components to find recursion.
+    //
+    // A recursion's depth is bounded if one argument shrinks on every call
+    // within it, by at least a constant or divided by one, assuming it
+    // stops by the time that argument reaches zero. Entering a recursion
+    // with that argument constant, as IIII's callees usually are, bounds its
+    // work and stack. Anything else is unbounded, which is infinity.
+    class CostModel
+    {
+    public:
+        CostModel(const Program &program);
+
+        // Upper bounds on the ops calling fid with args runs, its callees'
+        // included, and on the bytes of stack it takes.
+        double work(const std::string &fid, const std::vector<Value> &args) const;
+        double stack(const std::string &fid, const std::vector<Value> &args) const;
+
+        void report(std::ostream &out) const;
+
+    private:
+        class PathWalker;
+        using Context = std::vector<Symbolic>;
+
+        struct Range
+        {
+            double min;
+            double max;
+        };
+
+        struct FunctionCost
+        {
+            const Function *function;
+            Range ops;
+            Range calls;
+            size_t frame_bytes;
+            size_t component;
+            // Callees, with their arguments in terms of this function's.
+            std::vector<std::pair<std::string, Context> > call_sites;
+        };
+
+        struct Component
+        {
+            std::vector<std::string> members;
+            bool recursive;
+            // The argument which shrinks on every call within the
+            // component, by at least step or divided by it, or -1.
+            int shrinking_arg;
+            Value step;
+            bool divides;
+            // The most calls within the component on any path through one
+            // of its functions.
+            double branching;
+            // What one level costs at most, counting calls out of the
+            // component with their arguments unknown.
+            double level_work;
+            size_t frame_bytes;
+            double outside_stack;
+        };
+
+        void findComponents();
+        void analyseComponent(size_t index);
+        double depth(const Component &component, const Context &args) const;
+        std::pair<double, double> costs(const std::string &fid, const Context &args,
+                                        unsigned level) const;
+        std::pair<double, double> computeCosts(const FunctionCost &cost, const Context &args,
+                                               unsigned level) const;
+        std::string describeRecursion(const FunctionCost &cost) const;
+
+        std::string m_name;
+        std::vector<std::string> m_fids;
+        std::map<std::string, size_t> m_arities;
+        std::map<std::string, FunctionCost> m_costs;
+        std::vector<Component> m_components;
+
+        // Each function's work and stack with its arguments unknown, and
+        // with some of them constant.
+        std::map<std::string, std::pair<double, double> > m_free_costs;
+        mutable std::map<std::pair<std::string, std::vector<std::pair<bool, Value> > >,
+                         std::pair<double, double> > m_costs_memo;
+    };
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "operations.hpp"
+
+namespace llvm
+{
+    class ExecutionEngine;
+}
+
+namespace li1I
+{
+    class ASTToIRVisitor;
+
+    constexpr const char *default_socket_path = "/tmp/li1I.sock";
+
+    class DaemonError : public std::exception
+    {
+    public:
+        DaemonError (std::string message) : m_message(message) {}
+        ~DaemonError() throw() {}
+
+        virtual const char* what() const throw()
+        {
+            return m_message.c_str();
+        }
+    private:
+        std::string m_message;
+    };
+
+    // Serves compile and evaluate requests on a Unix domain socket, so that
+    // target initialisation is paid once and a program which has been seen
+    // before is run straight from the JITted code kept in memory. Compiled
+    // programs are keyed by a hash of their source and evicted least
+    // recently used first once their objects take more than the memory cap.
+    //
+    // Each connection carries any number of requests, one per line:
+    //
+    //     load <length>\n<source>          compiles, replies with its key
+    //     call <key> <fid> <arg>*\n        calls fid in a loaded program
+    //     eval <fid> <arg>* <length>\n<source>
+    //                                      load and call in one go
+    //
+    // Replies are `ok <length>\n<payload>` or `error <length>\n<message>`,
+    // where the payload is a key or the result as -e prints it.
+    //
+    // Connections are served by a fixed number of threads, and wait for one
+    // to be free. Calls run on the thread serving the connection, straight
+    // into the compiled code. With isolate, each call runs in a child
+    // process forked from the daemon instead, which shares the compiled
+    // code, so that a program which crashes, overflows its stack or runs
+    // past the time limit only fails its own request, at the cost of a
+    // fork per call. Sources bigger than the memory cap are refused
+    // before they are read.
+    class Daemon
+    {
+    public:
+        Daemon(std::string socket_path, size_t memory_cap, unsigned n_threads,
+               unsigned time_limit, bool isolate);
+        ~Daemon();
+
+        void serve();
+
+    private:
+        // Functions are called through their BatchIRGenerator entry
+        // points, which take arguments the same way whatever the arity.
+        struct EntryPoint
+        {
+            size_t n_args;
+            void (*batch)(const Value **args, Value *out, size_t n);
+        };
+
+        struct CompiledProgram
+        {
+            std::unique_ptr<ASTToIRVisitor> codegenner;
+            std::unique_ptr<llvm::ExecutionEngine> engine;
+            std::map<std::string, EntryPoint> entries;
+            size_t size;
+        };
+
+        struct PoolEntry
+        {
+            std::shared_ptr<CompiledProgram> program;
+            std::list<std::string>::iterator lru;
+        };
+
+        void work();
+        void handle(int fd);
+        std::string respond(const std::vector<std::string> &request, const std::string &source);
+        std::shared_ptr<CompiledProgram> load(const std::string &source, std::string &key);
+        std::shared_ptr<CompiledProgram> find(const std::string &key);
+        std::shared_ptr<CompiledProgram> compile(const std::string &source);
+        Value call(CompiledProgram &program, const std::string &fid,
+                   const std::vector<std::string> &args);
+        Value run(const EntryPoint &entry, std::vector<Value> &args);
+        Value runIsolated(const EntryPoint &entry, const Value **args);
+
+        std::string m_socket_path;
+        size_t m_memory_cap;
+        unsigned m_n_threads;
+        // In seconds.
+        unsigned m_time_limit;
+        bool m_isolate;
+
+        std::mutex m_connections_mutex;
+        std::condition_variable m_connections_changed;
+        std::deque<int> m_connections;
+
+        std::mutex m_mutex;
+        std::map<std::string, PoolEntry> m_pool;
+        std::list<std::string> m_lru;
+        size_t m_memory;
+    };
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "operations.hpp"
+
+namespace li1I
+{
+    class ExternError : public std::exception
+    {
+    public:
+        ExternError (std::string message) : m_message(message) {}
+        ~ExternError() throw() {}
+
+        virtual const char* what() const throw()
+        {
+            return m_message.c_str();
+        }
+    private:
+        std::string m_message;
+    };
+
+    // The backends which don't go through LLVM pass extern functions their
+    // arguments in registers only, so can't call ones taking more.
+    const size_t max_extern_args = 6;
+
+    // Looks for the extern function name, taking n_args arguments, among
+    // everything loaded into the global namespace, the libraries given to
+    // --load included.
+    void *findExtern(const std::string &name, size_t n_args);
+
+    // Calls an extern function taking n_args arguments, args[0] first.
+    Value callExtern(void *function, const Value *args, size_t n_args);
+}
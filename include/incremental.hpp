@@ -0,0 +1,54 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+#include "object_cache.hpp"
+#include "profile.hpp"
+
+class BCCompiler;
+
+namespace li1I
+{
+    // Compiles a program a function at a time into a build directory,
+    // keying each function's object on its AST, the signatures of the
+    // functions it calls and config. After an edit, only the functions
+    // which changed and the callers of functions whose arity changed are
+    // compiled again; every other object is reused from the directory.
+    class IncrementalBuilder
+    {
+    public:
+        IncrementalBuilder(std::string build_dir, BCCompiler &bc_compiler, std::string config);
+
+        // The objects which together make up program, main's included
+        // unless setMain() turned it off.
+        std::vector<std::string> build(const Program &program, const ProfileData *profile);
+
+        // As ASTToIRVisitor::setDebugInfo. Functions are then compiled
+        // again when they move, too.
+        void setDebugInfo(std::string source_path);
+
+        // As ASTToIRVisitor::setTinyRuntime, which only changes main.
+        void setTinyRuntime(bool enabled);
+
+        // As ASTToIRVisitor::setMain: without it, no object defines main.
+        void setMain(bool enabled);
+
+        // How many of those objects the last build had to compile.
+        inline size_t compiled() const { return m_compiled; }
+
+    private:
+        std::string functionKey(const Function &function,
+                                const std::map<std::string, size_t> &arities);
+
+        DiskObjectCache m_objects;
+        BCCompiler &m_bc_compiler;
+        std::string m_config;
+        std::string m_debug_path;
+        bool m_tiny_runtime;
+        bool m_main;
+        size_t m_compiled;
+    };
+}
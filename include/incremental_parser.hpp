@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+
+namespace li1I
+{
+    struct Definition;
+
+    // length bytes from offset replaced with text.
+    struct TextEdit
+    {
+        size_t offset;
+        size_t length;
+        std::string text;
+    };
+
+    // What a parse did to the program's definitions, by name.
+    struct DefinitionChanges
+    {
+        std::vector<std::string> changed;
+        std::vector<std::string> removed;
+        size_t reparsed_bytes = 0;
+    };
+
+    // Keeps a program parsed as its source is edited, for editors and
+    // --watch. The source is split into definitions, each running from its
+    // lI1i or lI1l to the next one, and an edit only lexes and parses the
+    // definitions it touches and one either side again, so it costs about
+    // as much as the definitions do rather than the whole file. Edits to
+    // the program's braces, or which leave it without an IIII, parse it all
+    // again.
+    //
+    // Definitions whose text hasn't changed keep their Functions, so
+    // whatever was done with them can be reused, but their locations are
+    // where they were when they were parsed.
+    class IncrementalParser
+    {
+    public:
+        IncrementalParser(std::string program_name);
+        ~IncrementalParser();
+
+        // These throw ParseError or LexError as Parser::parse does, after
+        // the edit has been made, so that a later edit can fix it.
+        DefinitionChanges parse(const std::string &source);
+        DefinitionChanges edit(const TextEdit &edit);
+
+        // Whether the source parses, and so whether there is a program.
+        bool valid() const;
+        const Program &program() const;
+
+        std::string source() const;
+        size_t size() const;
+
+    private:
+        enum class ChunkKind { FUNCTION, EXTERN, BROKEN };
+
+        struct Chunk
+        {
+            Chunk(std::string text, ChunkKind kind);
+
+            std::string text;
+            ChunkKind kind;
+            int64_t n_lines;
+        };
+
+        // Sums over chunks, kept in a Fenwick tree so that finding and
+        // resizing chunks doesn't touch the ones after them.
+        struct ChunkCounts
+        {
+            int64_t bytes;
+            int64_t lines;
+            int64_t functions;
+            int64_t externs;
+
+            inline void add(const ChunkCounts &other, int64_t sign = 1)
+            {
+                bytes += sign * other.bytes;
+                lines += sign * other.lines;
+                functions += sign * other.functions;
+                externs += sign * other.externs;
+            }
+        };
+
+        std::vector<Definition> parseChunks(size_t first, size_t next, const std::string &text,
+                                            bool &program_ends) const;
+        void replaceChunks(size_t first, size_t count, std::vector<Chunk> chunks);
+
+        ChunkCounts countChunk(const Chunk &chunk) const;
+        void indexChunks();
+        void addCounts(size_t index, const ChunkCounts &delta);
+        ChunkCounts countsBefore(size_t index) const;
+        size_t findChunk(size_t offset) const;
+        TokenLocation chunkLocation(size_t index) const;
+
+        std::string m_name;
+        std::unique_ptr<Program> m_program;
+        std::string m_header;
+        std::string m_trailer;
+        std::vector<Chunk> m_chunks;
+        std::vector<ChunkCounts> m_counts;
+        size_t m_n_broken = 0;
+        size_t m_n_mains = 0;
+    };
+}
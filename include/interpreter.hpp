@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.hpp"
+#include "operations.hpp"
+
+namespace li1I
+{
+    class InterpretError : public std::exception
+    {
+    public:
+        InterpretError (std::string message) : m_message(message) {}
+        ~InterpretError() throw() {}
+
+        virtual const char* what() const throw()
+        {
+            return m_message.c_str();
+        }
+    private:
+        std::string m_message;
+    };
+
+    // Thrown when a call runs out of the budget given to setBudget().
+    class BudgetError : public InterpretError
+    {
+    public:
+        BudgetError (std::string message) : InterpretError(message) {}
+    };
+
+    // Compiled code for a function, taking its arguments as an array.
+    using NativeEntry = Value (*)(const Value *args);
+
+    // Per-function state shared between the interpreter and whatever tiers
+    // it up: execution counters and the dispatch table entry.
+    struct FunctionSlot
+    {
+        const Function *function;
+        uint64_t calls;
+        uint64_t back_edges;
+        size_t active;  // interpreted calls not yet returned
+        std::atomic<NativeEntry> native;
+    };
+
+    class Interpreter : public ASTNodeVisitor
+    {
+    public:
+        using HotHandler = std::function<void(FunctionSlot &slot)>;
+
+        Interpreter(const Program &program);
+        void visit(const Program &node);
+        void visit(const Function &node);
+        void visit(const VarExpr &node);
+        void visit(const RPNExpr &node);
+        void visit(const IntExpr &node);
+        void visit(const CallExpr &node);
+        void visit(const DeclExpr &node);
+        void visit(const OpExpr &node);
+        void visit(const IfExpr &node);
+
+        Value run();
+        Value call(FunctionSlot &slot, const std::vector<Value> &args);
+
+        // Calls handler once for each function whose calls plus back edges
+        // reach threshold. Recursive calls are the only back edges in li1I,
+        // so a call is one if the function is already being interpreted
+        // further up the stack, directly or through other functions.
+        void setHotHandler(uint64_t threshold, HotHandler handler);
+
+        // Makes call() throw a BudgetError once max_calls more calls have
+        // been made, or calls nest deeper than max_depth, and division by zero throw
+        // rather than trap, for evaluating calls which may never finish.
+        // Extern functions throw too, as they may have side effects. A
+        // max_depth of zero lifts the budget. Also forgets whatever an
+        // earlier exception left half evaluated.
+        void setBudget(uint64_t max_calls, size_t max_depth);
+        inline uint64_t budget() const { return m_calls_left; }
+
+        FunctionSlot &slot(const std::string &fid);
+        inline std::vector<FunctionSlot> &slots() { return m_slots; }
+
+    private:
+        // Looked up when first called, so that programs which never call
+        // one don't need it loaded.
+        struct ExternSlot
+        {
+            size_t n_args;
+            void *address;
+        };
+
+        Value evaluate(const ASTNode &node);
+        Value callExtern(const std::string &fid, ExternSlot &slot, const std::vector<Value> &args);
+
+        std::vector<FunctionSlot> m_slots;
+        std::map<std::string, size_t> m_slot_indices;
+        std::map<std::string, ExternSlot> m_externs;
+        std::unordered_map<std::string, Value> m_environment;
+        uint64_t m_hot_threshold;
+        HotHandler m_hot_handler;
+        uint64_t m_calls_left;
+        size_t m_max_depth;
+        size_t m_depth;
+        Value m_value;
+    };
+}
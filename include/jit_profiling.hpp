@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <llvm/ExecutionEngine/JITEventListener.h>
+
+namespace llvm
+{
+    class ExecutionEngine;
+    class Module;
+}
+
+namespace li1I
+{
+    // Where JIT compiled functions ended up, as MCJIT reports each object
+    // it loads. Safe to use from several compiling threads.
+    class JITSymbolTable : public llvm::JITEventListener
+    {
+    public:
+        struct Symbol
+        {
+            uint64_t address;
+            uint64_t size;
+            std::string name;
+        };
+
+        void notifyObjectLoaded(ObjectKey key, const llvm::object::ObjectFile &object,
+                                const llvm::RuntimeDyld::LoadedObjectInfo &info) override;
+
+        void add(uint64_t address, uint64_t size, const std::string &name);
+
+        // The lowest and one past the highest address of any function.
+        void range(uint64_t &low, uint64_t &high) const;
+
+        // The function containing address, or null.
+        const Symbol *find(uint64_t address) const;
+
+    private:
+        mutable std::mutex m_mutex;
+        std::vector<Symbol> m_symbols;
+    };
+
+    // With --perf every JIT, the baseline JIT included, writes the code it
+    // loads to /tmp/perf-<pid>.map, and MCJIT writes jitdump records too
+    // when LLVM was built with perf support, so that `perf report` can
+    // name li1I functions.
+    void setPerfListeners(bool enabled);
+
+    // With -g MCJIT hands its objects' debug info to GDB through the GDB
+    // JIT interface as well.
+    void setGDBListener(bool enabled);
+
+    void registerJITListeners(llvm::ExecutionEngine &engine);
+    void recordJITFunction(uint64_t address, uint64_t size, const std::string &name);
+
+    // Makes every function in module keep a frame pointer, which is how
+    // SamplingProfiler finds callers.
+    void keepFramePointers(llvm::Module &module);
+
+    // --profile: samples the running program on SIGPROF, walking frame
+    // pointers up the stack of the thread which started it, and reports a
+    // flat profile and call graph by li1I function. One can run at a time.
+    class SamplingProfiler
+    {
+    public:
+        SamplingProfiler(const JITSymbolTable &symbols);
+        ~SamplingProfiler();
+
+        void start();
+        void stop();
+        void report(std::ostream &out) const;
+
+    private:
+        const JITSymbolTable &m_symbols;
+        bool m_running;
+    };
+}
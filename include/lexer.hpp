@@ -2,17 +2,12 @@
 
 #include <string>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <queue>
 #include <exception>
 #include <memory>
 
-namespace llvm
-{
-    class raw_ostream;
-}
-
-
 namespace li1I
 {
     enum class TokenTag
@@ -28,6 +23,7 @@ namespace li1I
         LPAREN,
         RPAREN,
         FUNCTION,
+        EXTERN,
         SEMI,
         PLUS,
         MINUS,
@@ -76,7 +72,7 @@ namespace li1I
         }
 
 
-        void print(llvm::raw_ostream &out) const;
+        void print(std::ostream &out) const;
         inline const TokenTag &token() const { return m_token; }
         inline const TokenLocation &location() const { return m_location; }
         inline const std::string &string_data() const { return *m_string_data; }
@@ -93,10 +89,15 @@ namespace li1I
         };
     };
 
+    // The line of in around pos, and how far into it pos is, for error
+    // messages. in is rewound, so it must be seekable.
+    std::string lineAt (std::istream &in, std::streamoff pos, std::streamoff &column);
+
     class LexError : public std::exception
     {
     public:
-        LexError (const TokenLocation &loc, std::string expected, std::istream &in);
+        LexError (const TokenLocation &loc, std::string expected, std::istream &in,
+                  std::streamoff offset = 0);
         ~LexError() throw() {}
         virtual const char* what() const throw()
         {
@@ -109,7 +110,18 @@ namespace li1I
     class Lexer
     {
     public:
-        Lexer (std::istream &in) : m_in(in), m_buf(), m_cache(), m_location(), m_start_location() {}
+        Lexer (std::istream &in, bool emit_tokens = false)
+            : m_in(in), m_buf(), m_cache(), m_location(), m_start_location(),
+              m_emit_tokens(emit_tokens), m_offset(0),
+              m_end(std::numeric_limits<std::streamoff>::max()) {}
+
+        // Lexes in, from where it is, as the part of a file from start up
+        // to end, for lexing a piece of a file again.
+        Lexer (std::istream &in, const TokenLocation &start, std::streampos end)
+            : m_in(in), m_buf(), m_cache(), m_location(start), m_start_location(start),
+              m_emit_tokens(false), m_offset(start.file_pos - in.tellg()), m_end(end) {}
+
+        inline std::streamoff offset() const { return m_offset; }
         std::unique_ptr<const Token> lex();
         const Token &peekLex();
 
@@ -122,11 +134,16 @@ namespace li1I
         Token *lexNum ();
         Token *lexKeyword ();
         void eatWhitespace();
+        void endLine(char c);
+        std::streampos position();
 
         std::istream &m_in;
         std::stringstream m_buf;
         std::queue<std::unique_ptr<const Token> > m_cache;
         TokenLocation m_location;
         TokenLocation m_start_location;
+        bool m_emit_tokens;
+        std::streamoff m_offset;
+        std::streamoff m_end;
     };
 }
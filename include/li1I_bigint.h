@@ -0,0 +1,37 @@
+#pragma once
+
+/* The runtime behind --bigint, in C so that programs compiled with it link
+   with nothing more than cc. Values are tagged words: a small integer x is
+   stored as 2x + 1, and anything which doesn't fit in 63 bits is a pointer
+   to limbs allocated from an arena. Compiled code does small arithmetic
+   inline and only calls these when an operand is big or a result
+   overflows, so they accept any value. */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint64_t li1I_value;
+
+li1I_value li1I_bigint_add(li1I_value lhs, li1I_value rhs);
+li1I_value li1I_bigint_sub(li1I_value lhs, li1I_value rhs);
+li1I_value li1I_bigint_mul(li1I_value lhs, li1I_value rhs);
+
+/* Rounds towards zero. Division by zero aborts the program. */
+li1I_value li1I_bigint_div(li1I_value lhs, li1I_value rhs);
+
+/* -1, 0 or 1 as lhs is less than, equal to or greater than rhs. */
+int32_t li1I_bigint_compare(li1I_value lhs, li1I_value rhs);
+
+/* The value modulo 2^32, as two's complement, which is what extern
+   functions are passed and what an if tests the low bit of. */
+int32_t li1I_bigint_low_bits(li1I_value value);
+
+/* Writes the value in decimal and a newline to stdout. */
+void li1I_bigint_print(li1I_value value);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,10 +1,57 @@
+#pragma once
+
 #include <string>
+#include <vector>
+
+namespace llvm
+{
+    class MemoryBufferRef;
+}
 
 namespace li1I
 {
+    class LinkError : public std::exception
+    {
+    public:
+        LinkError (std::string message) : m_message(message) {}
+        ~LinkError() throw() {}
+
+        virtual const char* what() const throw()
+        {
+            return m_message.c_str();
+        }
+    private:
+        std::string m_message;
+    };
+
+    // Links li1I objects, whose main calls printf, against the C runtime
+    // using the system compiler driver. Libraries, or objects, defining the
+    // program's extern functions are linked in after its own objects.
+    // Objects made with --tiny-runtime have their own _start and are
+    // linked statically with no C runtime at all.
     class Linker
     {
     public:
+        Linker(std::vector<std::string> libraries = {}, bool tiny_runtime = false)
+            : m_libraries(std::move(libraries)), m_tiny_runtime(tiny_runtime) {}
+
         void link(std::string input_object, std::string output_file);
+
+        // Links an object which only exists in memory. On Linux the object
+        // is handed to the linker through a memfd, so it never touches disk.
+        void link(llvm::MemoryBufferRef object, std::string output_file);
+
+        void link(const std::vector<std::string> &input_objects, std::string output_file);
+
+        // Merges objects into one relocatable object rather than an
+        // executable.
+        void combine(const std::vector<std::string> &input_objects, std::string output_file);
+
+    private:
+        void runLinker(const std::vector<std::string> &input_objects,
+                       const std::string &output_file, bool relocatable = false);
+
+        std::vector<std::string> m_libraries;
+        bool m_tiny_runtime;
     };
 }
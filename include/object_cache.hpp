@@ -0,0 +1,42 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+namespace li1I
+{
+    // Content-addressed store of compiled objects, one file per key.
+    // MCJIT consults it through the llvm::ObjectCache interface for modules
+    // which have been given a key with assign(); BCCompiler and the driver
+    // use lookup() and store() directly so a hit skips the frontend too.
+    class DiskObjectCache : public llvm::ObjectCache
+    {
+    public:
+        DiskObjectCache(std::string directory);
+
+        // Hashes the program source together with everything else which
+        // affects the object: compiler and LLVM version plus config, which
+        // should name the opt level, target and JIT or AOT.
+        static std::string key(llvm::StringRef source, llvm::StringRef config);
+
+        void assign(const llvm::Module *module, std::string key);
+        std::unique_ptr<llvm::MemoryBuffer> lookup(const std::string &key);
+        void store(const std::string &key, llvm::StringRef object);
+
+        void notifyObjectCompiled(const llvm::Module *module, llvm::MemoryBufferRef object) override;
+        std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *module) override;
+
+        // Where key's object is stored, whether or not it has been yet.
+        std::string path(const std::string &key);
+
+    private:
+
+        std::string m_directory;
+        std::map<const llvm::Module*, std::string> m_keys;
+    };
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+#include "ast.hpp"
+
+namespace li1I
+{
+    // The value of an li1I expression, matching the i32 emitted by ASTToIRVisitor.
+    using Value = int32_t;
+
+    // Evaluates an operator with the same semantics as
+    // ASTToIRVisitor::codegenOperation: division and comparisons are unsigned
+    // and a true comparison is sign-extended to -1.
+    inline Value applyOperator(Operator op, Value lhs, Value rhs)
+    {
+        uint32_t l = static_cast<uint32_t>(lhs);
+        uint32_t r = static_cast<uint32_t>(rhs);
+
+        switch (op)
+        {
+        case Operator::PLUS: return static_cast<Value>(l + r);
+        case Operator::MINUS: return static_cast<Value>(l - r);
+        case Operator::TIMES: return static_cast<Value>(l * r);
+        case Operator::DIV: return static_cast<Value>(l / r);
+        case Operator::EXP: return static_cast<Value>(l + r); //TODO, as in codegen
+        case Operator::GT: return l > r ? -1 : 0;
+        case Operator::LT: return l < r ? -1 : 0;
+        case Operator::EQ: return l == r ? -1 : 0;
+        case Operator::NEQ: return l != r ? -1 : 0;
+        }
+
+        return 0;
+    }
+
+    // IfExpr conditions are truncated to i1, so only the low bit counts.
+    inline bool isTruthy(Value value)
+    {
+        return value & 1;
+    }
+}
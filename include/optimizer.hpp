@@ -0,0 +1,17 @@
+#pragma once
+
+namespace llvm
+{
+    class Module;
+    class TargetMachine;
+}
+
+namespace li1I
+{
+    // Runs the usual -O<level> pipeline over module, inlining included.
+    // Modules carrying a profile summary from -fprofile-use are also split
+    // into hot and cold parts, and branch weights and entry counts steer
+    // the inliner and, through target_machine, block layout.
+    void optimizeModule(llvm::Module &module, unsigned level,
+                        llvm::TargetMachine *target_machine);
+}
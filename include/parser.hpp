@@ -4,13 +4,14 @@
 #include <exception>
 #include <sstream>
 #include <queue>
+#include <memory>
+#include <vector>
 
 #include "ast.hpp"
 
 namespace li1I
 {
     class Token;
-    class TokenLocation;
     class Lexer;
 
     class ParseError : public std::exception
@@ -22,14 +23,35 @@ namespace li1I
         {
             return m_message.c_str();
         }
+
+        // Where the token which wasn't expected starts.
+        inline const TokenLocation &location() const { return m_location; }
     private:
         std::string m_message;
+        TokenLocation m_location;
+    };
+
+    // A function or extern definition, parsed on its own.
+    struct Definition
+    {
+        std::unique_ptr<Function> function;
+        std::unique_ptr<ExternFunction> extern_function;
+        std::streampos start;
     };
 
     class Parser
     {
     public:
         Program *parse (Lexer *lexer, std::istream *in, std::string program_name);
+
+        // The definitions from the lexer's position up to the end of the
+        // program or of in, for parsing part of a program again.
+        std::vector<Definition> parseDefinitions (Lexer *lexer, std::istream *in);
+
+        // A single definition, or expression up to its l1ii, from the
+        // lexer's position, for input which mixes the two.
+        Definition parseDefinition (Lexer *lexer, std::istream *in);
+        std::unique_ptr<RPNExpr> parseExpression (Lexer *lexer, std::istream *in);
     private:
         std::queue<Token*> m_cache;
     };
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+#include "interpreter.hpp"
+
+namespace li1I
+{
+    // Runs calls with constant arguments at compile time, for
+    // --partial-eval. li1I functions have no side effects, so any call
+    // which finishes can be replaced by its result. Calls which divide by
+    // zero or reach an extern function are left alone, while those which
+    // run out of budget can still be specialised on their arguments.
+    class PartialEvaluator
+    {
+    public:
+        enum class Outcome { EVALUATED, OUT_OF_BUDGET, FAILED };
+
+        PartialEvaluator(const Program &program, uint64_t budget);
+
+        // Whether fid, which may be extern, is defined by the program.
+        bool defines(const std::string &fid) const;
+        const Function &function(const std::string &fid) const;
+
+        // Evaluates fid with args, remembering the outcome either way.
+        // Every evaluation draws on the same budget of calls, so that
+        // compile time stays bounded however many calls there are.
+        Outcome evaluate(const std::string &fid, const std::vector<Value> &args, Value &result);
+
+    private:
+        Interpreter m_interpreter;
+        uint64_t m_budget;
+        std::map<std::string, const Function*> m_functions;
+        std::map<std::pair<std::string, std::vector<Value> >, std::pair<Outcome, Value> > m_results;
+    };
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+namespace llvm
+{
+    struct TimeTraceScope;
+}
+
+namespace li1I
+{
+    // Times the phases of one run of the compiler for --time-phases and
+    // --trace-out. The report goes to stderr when the PhaseTiming is
+    // destroyed, followed by LLVM's own pass timers; the trace is written
+    // in Chrome's trace event format, with LLVM's passes nested inside the
+    // phases which ran them.
+    class PhaseTiming
+    {
+    public:
+        PhaseTiming(bool report, std::string trace_path);
+        ~PhaseTiming();
+    };
+
+    // Adds the time from its construction to its destruction to the phase
+    // called name: wall time, CPU time on this thread, and the peak
+    // resident set size of the process so far. Scopes on several threads
+    // all count towards the same phases, but only the thread which set up
+    // the PhaseTiming appears in the trace.
+    class PhaseScope
+    {
+    public:
+        PhaseScope(const char *name);
+        ~PhaseScope();
+
+    private:
+        const char *m_name;
+        bool m_active;
+        double m_wall_start;
+        double m_cpu_start;
+        std::unique_ptr<llvm::TimeTraceScope> m_trace;
+    };
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm
+{
+    class LLVMContext;
+    class Metadata;
+}
+
+namespace li1I
+{
+    class ProfileError : public std::exception
+    {
+    public:
+        ProfileError (std::string message) : m_message(message) {}
+        ~ProfileError() throw() {}
+
+        virtual const char* what() const throw()
+        {
+            return m_message.c_str();
+        }
+    private:
+        std::string m_message;
+    };
+
+    // How often a function was entered, then how often each of its IfExprs
+    // took the then and else branch, in the order ASTToIRVisitor reaches
+    // them. A -fprofile-generate build keeps exactly these counters, in an
+    // i64 array named by counterName().
+    struct FunctionProfile
+    {
+        uint64_t entry;
+        std::vector<uint64_t> branches;
+    };
+
+    inline std::string counterName(const std::string &fid)
+    {
+        return fid + ".profile";
+    }
+
+    // Execution counts from a -fprofile-generate run, for -fprofile-use.
+    // The file has one line per function, holding its FID followed by its
+    // counters in decimal:
+    //
+    //     <fid> <entry> (<then> <else>)*
+    class ProfileData
+    {
+    public:
+        static ProfileData read(const std::string &path);
+        void write(const std::string &path) const;
+
+        void add(const std::string &fid, FunctionProfile profile);
+        const FunctionProfile *find(const std::string &fid) const;
+
+        // The ProfileSummary for Module::setProfileSummary, which is what
+        // lets the inliner and hot/cold splitting tell hot code from cold.
+        llvm::Metadata *summary(llvm::LLVMContext &context) const;
+
+    private:
+        std::map<std::string, FunctionProfile> m_functions;
+    };
+}
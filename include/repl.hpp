@@ -0,0 +1,97 @@
+#pragma once
+
+#include <llvm/Support/CodeGen.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+#include "ast_to_ir.hpp"
+
+namespace llvm
+{
+    class ExecutionEngine;
+    class TargetMachine;
+}
+
+namespace li1I
+{
+    struct Definition;
+
+    class ReplError : public std::exception
+    {
+    public:
+        ReplError (std::string message) : m_message(message) {}
+        ~ReplError() throw() {}
+
+        virtual const char* what() const throw()
+        {
+            return m_message.c_str();
+        }
+    private:
+        std::string m_message;
+    };
+
+    // One JIT session which functions are added to as they are typed at
+    // --repl's prompt, and expressions are evaluated in. Each definition is
+    // compiled into a module of its own, and calls between functions load
+    // their callee from a slot, so defining a function again only compiles
+    // the new definition and points its slot at it; nothing compiled
+    // earlier is compiled again.
+    //
+    // Functions are compiled along with whatever uncompiled functions they
+    // can reach, so compiled code only ever calls compiled code. A loaded
+    // program's functions wait to be compiled until something can reach
+    // them, and so do functions which can reach one that isn't defined
+    // yet, so that functions which call each other can be typed one at a
+    // time. A function's callers are compiled for its arity, so if it is
+    // defined again with a different number of arguments they keep calling
+    // the old definition until they are defined again too.
+    class ReplSession
+    {
+    public:
+        ReplSession(std::string name, unsigned opt_level, llvm::CodeGenOpt::Level codegen_level,
+                    bool bigint);
+        ~ReplSession();
+
+        // Starts from program's functions, for exploring a program which
+        // already exists. Only what expressions need is compiled.
+        void load(std::unique_ptr<Program> program);
+
+        // Defines the functions and evaluates the expressions in input, in
+        // order, printing each expression's value as -e would. A run of
+        // definitions is added together, and if any of them doesn't compile
+        // none of them is.
+        //
+        // Returns false, having done nothing, if input stops partway
+        // through a definition or expression, so that more can be read.
+        bool evaluate(const std::string &input);
+
+    private:
+        void define(std::vector<Definition> definitions);
+        void evaluateExpression(std::unique_ptr<RPNExpr> expr);
+        std::vector<const Function*> uncompiledFrom(std::set<std::string> fids,
+                                                    std::pair<std::string, std::string> &missing) const;
+        void install(std::unique_ptr<llvm::Module> module);
+        bool isExtern(const std::string &fid) const;
+        void *&slot(const std::string &fid, size_t n_args);
+
+        std::unique_ptr<Program> m_program;
+        std::map<std::string, const Function*> m_functions;
+        std::set<std::string> m_uncompiled;
+
+        ASTToIRVisitor m_codegenner;
+        std::unique_ptr<llvm::TargetMachine> m_target_machine;
+        std::unique_ptr<llvm::ExecutionEngine> m_engine;
+        unsigned m_opt_level;
+        llvm::CodeGenOpt::Level m_codegen_level;
+        bool m_bigint;
+
+        // Map nodes don't move, so compiled code can hold their addresses.
+        std::map<std::pair<std::string, size_t>, void*> m_slots;
+        size_t m_n_modules;
+    };
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "ast.hpp"
+#include "baseline_jit.hpp"
+#include "interpreter.hpp"
+
+namespace llvm
+{
+    class ExecutionEngine;
+}
+
+namespace li1I
+{
+    class ASTToIRVisitor;
+
+    // Runs a program in the Interpreter, moves functions that become hot to
+    // the BaselineJIT's code, and compiles those which get hotter still
+    // there with LLVM on a background thread. Each step points the
+    // function's FunctionSlot at the new code, which the interpreter and
+    // baseline code both call through, so later calls (including those
+    // from calls already in flight) switch over. Without the baseline JIT,
+    // as off x86-64, functions go straight from the interpreter to LLVM.
+    class TieredExecutor
+    {
+    public:
+        TieredExecutor(const Program &program, uint64_t threshold, uint64_t llvm_threshold);
+        ~TieredExecutor();
+        Value run();
+
+    private:
+        void promote(FunctionSlot &slot);
+        void enqueue(FunctionSlot &slot);
+        void compileLoop();
+        void compileProgram();
+
+        const Program &m_program;
+        Interpreter m_interpreter;
+        uint64_t m_llvm_threshold;
+        std::unique_ptr<BaselineJIT> m_baseline;
+        bool m_baseline_failed;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wakeup;
+        std::deque<FunctionSlot*> m_queue;
+        bool m_done;
+        std::thread m_compiler;
+
+        std::unique_ptr<ASTToIRVisitor> m_codegenner;
+        std::unique_ptr<llvm::ExecutionEngine> m_engine;
+        std::string m_compile_error;
+    };
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <llvm/IR/IRBuilder.h>
+
+namespace li1I
+{
+    class TinyRuntimeError : public std::exception
+    {
+    public:
+        TinyRuntimeError (std::string message) : m_message(message) {}
+        ~TinyRuntimeError() throw() {}
+
+        virtual const char* what() const throw()
+        {
+            return m_message.c_str();
+        }
+    private:
+        std::string m_message;
+    };
+
+    // What --tiny-runtime executables have instead of the C library: their
+    // _start writes the result itself, with the write system call, and
+    // exits with exit_group, so they are linked with -nostdlib -static and
+    // start without running any libc or dynamic loader code. Only Linux on
+    // x86-64 and AArch64 is supported.
+    class TinyRuntimeIR
+    {
+    public:
+        TinyRuntimeIR(llvm::IRBuilder<> &builder);
+
+        // Defines an empty _start in module, leaving the builder in it.
+        llvm::Function *createStart(llvm::Module &module);
+
+        // Writes value as printf's "%d\n" would to standard output, then
+        // exits with status 0.
+        void printAndExit(llvm::Value *value);
+
+    private:
+        llvm::Value *syscall(uint64_t number, llvm::ArrayRef<llvm::Value*> args);
+
+        llvm::IRBuilder<> &m_builder;
+        bool m_aarch64;
+    };
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bytecode.hpp"
+
+namespace li1I
+{
+    class VMError : public std::exception
+    {
+    public:
+        VMError (std::string message) : m_message(message) {}
+        ~VMError() throw() {}
+
+        virtual const char* what() const throw()
+        {
+            return m_message.c_str();
+        }
+    private:
+        std::string m_message;
+    };
+
+    // Executes a BytecodeProgram. The value and frame stacks are allocated
+    // once up front and never touched until a call reaches them. Extern
+    // functions are looked up on construction, throwing an ExternError if
+    // one isn't loaded.
+    class VM
+    {
+    public:
+        VM(const BytecodeProgram &program, size_t stack_size = 1 << 22);
+        Value run();
+        Value call(size_t function, const std::vector<Value> &args);
+
+    private:
+        struct Frame
+        {
+            const Instruction *return_pc;
+            const Instruction *code;
+            Value *base;
+            uint16_t result;
+        };
+
+        const BytecodeProgram &m_program;
+        std::vector<const Instruction*> m_entries;
+        std::vector<void*> m_externs;
+        size_t m_stack_size;
+        std::unique_ptr<Value[]> m_stack;
+        std::unique_ptr<Frame[]> m_frames;
+    };
+}
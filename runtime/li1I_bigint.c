@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "li1I_bigint.h"
+
+/* Bigints are always too big to be small, with no leading zero limbs, so
+   every integer has exactly one value and big values are never zero. Being
+   8 byte aligned, their pointers have the low bit clear. */
+struct bigint
+{
+    uint32_t size;
+    uint32_t negative;
+    uint32_t limbs[];
+};
+
+/* An operand, big or small, as a sign and magnitude. */
+struct view
+{
+    const uint32_t *limbs;
+    uint32_t size;
+    uint32_t negative;
+    uint32_t small[2];
+};
+
+static const uint64_t small_limit = (uint64_t) 1 << 62;
+static const size_t arena_chunk = 1 << 20;
+
+/* li1I values are never freed, as nothing can tell when they die, so they
+   are just carved out of large chunks one after another. Results are
+   allocated at their largest possible size and then given back whatever
+   they turn out not to need, all of it when they are small after all. */
+static char *arena_next = NULL;
+static char *arena_end = NULL;
+
+static void fail(const char *message)
+{
+    fprintf(stderr, "%s\n", message);
+    abort();
+}
+
+static size_t bigintBytes(uint32_t size)
+{
+    return (sizeof(struct bigint) + size * sizeof(uint32_t) + 7) & ~(size_t) 7;
+}
+
+static struct bigint *allocate(uint32_t size)
+{
+    size_t bytes = bigintBytes(size);
+    if ((size_t) (arena_end - arena_next) < bytes)
+    {
+        size_t chunk = bytes > arena_chunk ? bytes : arena_chunk;
+        arena_next = malloc(chunk);
+        if (!arena_next)
+        {
+            fail("Out of memory for bigints");
+        }
+        arena_end = arena_next + chunk;
+    }
+
+    struct bigint *result = (struct bigint *) arena_next;
+    arena_next += bytes;
+    return result;
+}
+
+/* Only the most recent allocation can give anything back. */
+static void shrink(struct bigint *result, uint32_t capacity, uint32_t size)
+{
+    if ((char *) result + bigintBytes(capacity) == arena_next)
+    {
+        arena_next = (char *) result + (size ? bigintBytes(size) : 0);
+    }
+}
+
+static li1I_value tag(int64_t x)
+{
+    return ((uint64_t) x << 1) | 1;
+}
+
+static void load(li1I_value value, struct view *view)
+{
+    if (value & 1)
+    {
+        int64_t x = (int64_t) value >> 1;
+        uint64_t magnitude = x < 0 ? -(uint64_t) x : (uint64_t) x;
+        view->small[0] = (uint32_t) magnitude;
+        view->small[1] = (uint32_t) (magnitude >> 32);
+        view->size = view->small[1] ? 2 : view->small[0] ? 1 : 0;
+        view->negative = x < 0;
+        view->limbs = view->small;
+        return;
+    }
+
+    const struct bigint *big = (const struct bigint *) (uintptr_t) value;
+    view->limbs = big->limbs;
+    view->size = big->size;
+    view->negative = big->negative;
+}
+
+/* Trims result, which was allocated with capacity limbs, and makes it
+   small if it fits. */
+static li1I_value finish(struct bigint *result, uint32_t capacity)
+{
+    uint32_t size = capacity;
+    while (size && !result->limbs[size - 1])
+    {
+        size--;
+    }
+
+    if (size <= 2)
+    {
+        uint64_t magnitude = size ? result->limbs[0] : 0;
+        if (size == 2)
+        {
+            magnitude |= (uint64_t) result->limbs[1] << 32;
+        }
+
+        if (magnitude < small_limit || (result->negative && magnitude == small_limit))
+        {
+            int64_t x = result->negative ? (int64_t) -magnitude : (int64_t) magnitude;
+            shrink(result, capacity, 0);
+            return tag(x);
+        }
+    }
+
+    result->size = size;
+    shrink(result, capacity, size);
+    return (li1I_value) (uintptr_t) result;
+}
+
+static int compareMagnitudes(const struct view *a, const struct view *b)
+{
+    if (a->size != b->size)
+    {
+        return a->size < b->size ? -1 : 1;
+    }
+
+    for (uint32_t i = a->size; i--;)
+    {
+        if (a->limbs[i] != b->limbs[i])
+        {
+            return a->limbs[i] < b->limbs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/* a plus or minus b, with b's sign flipped by negate_b. */
+static li1I_value addViews(const struct view *a, const struct view *b, uint32_t negate_b)
+{
+    uint32_t b_negative = b->negative ^ negate_b;
+    if (a->negative == b_negative)
+    {
+        const struct view *longer = a->size >= b->size ? a : b;
+        const struct view *shorter = longer == a ? b : a;
+        struct bigint *result = allocate(longer->size + 1);
+        result->negative = a->negative;
+
+        uint64_t carry = 0;
+        for (uint32_t i = 0; i < longer->size; i++)
+        {
+            carry += longer->limbs[i];
+            carry += i < shorter->size ? shorter->limbs[i] : 0;
+            result->limbs[i] = (uint32_t) carry;
+            carry >>= 32;
+        }
+        result->limbs[longer->size] = (uint32_t) carry;
+        return finish(result, longer->size + 1);
+    }
+
+    /* Opposite signs: the smaller magnitude comes off the larger, which
+       decides the sign. */
+    int order = compareMagnitudes(a, b);
+    const struct view *larger = order >= 0 ? a : b;
+    const struct view *smaller = order >= 0 ? b : a;
+    struct bigint *result = allocate(larger->size);
+    result->negative = order >= 0 ? a->negative : b_negative;
+
+    int64_t borrow = 0;
+    for (uint32_t i = 0; i < larger->size; i++)
+    {
+        int64_t difference = (int64_t) larger->limbs[i] - borrow
+            - (i < smaller->size ? smaller->limbs[i] : 0);
+        borrow = difference < 0;
+        result->limbs[i] = (uint32_t) difference;
+    }
+    return finish(result, larger->size);
+}
+
+li1I_value li1I_bigint_add(li1I_value lhs, li1I_value rhs)
+{
+    struct view a, b;
+    load(lhs, &a);
+    load(rhs, &b);
+    return addViews(&a, &b, 0);
+}
+
+li1I_value li1I_bigint_sub(li1I_value lhs, li1I_value rhs)
+{
+    struct view a, b;
+    load(lhs, &a);
+    load(rhs, &b);
+    return addViews(&a, &b, 1);
+}
+
+li1I_value li1I_bigint_mul(li1I_value lhs, li1I_value rhs)
+{
+    struct view a, b;
+    load(lhs, &a);
+    load(rhs, &b);
+    if (!a.size || !b.size)
+    {
+        return tag(0);
+    }
+
+    uint32_t size = a.size + b.size;
+    struct bigint *result = allocate(size);
+    result->negative = a.negative ^ b.negative;
+    memset(result->limbs, 0, size * sizeof(uint32_t));
+    for (uint32_t i = 0; i < a.size; i++)
+    {
+        uint64_t carry = 0;
+        for (uint32_t j = 0; j < b.size; j++)
+        {
+            carry += (uint64_t) a.limbs[i] * b.limbs[j] + result->limbs[i + j];
+            result->limbs[i + j] = (uint32_t) carry;
+            carry >>= 32;
+        }
+        result->limbs[i + b.size] = (uint32_t) carry;
+    }
+    return finish(result, size);
+}
+
+/* Knuth's algorithm D, as in Hacker's Delight: q gets u / v, for u at
+   least as long as v and v at least two limbs long. */
+static void divideMagnitudes(uint32_t *q, const uint32_t *u, uint32_t m,
+                             const uint32_t *v, uint32_t n)
+{
+    const uint64_t b = (uint64_t) 1 << 32;
+    uint32_t *un = malloc((m + 1 + n) * sizeof(uint32_t));
+    uint32_t *vn = un + m + 1;
+    if (!un)
+    {
+        fail("Out of memory for bigints");
+    }
+
+    /* Shifting both left until v's top bit is set keeps each estimated
+       quotient digit within two of the truth. */
+    int s = __builtin_clz(v[n - 1]);
+    for (uint32_t i = n - 1; i > 0; i--)
+    {
+        vn[i] = (v[i] << s) | (uint32_t) ((uint64_t) v[i - 1] >> (32 - s));
+    }
+    vn[0] = v[0] << s;
+    un[m] = (uint32_t) ((uint64_t) u[m - 1] >> (32 - s));
+    for (uint32_t i = m - 1; i > 0; i--)
+    {
+        un[i] = (u[i] << s) | (uint32_t) ((uint64_t) u[i - 1] >> (32 - s));
+    }
+    un[0] = u[0] << s;
+
+    for (int64_t j = (int64_t) m - n; j >= 0; j--)
+    {
+        uint64_t top = ((uint64_t) un[j + n] << 32) | un[j + n - 1];
+        uint64_t qhat = top / vn[n - 1];
+        uint64_t rhat = top % vn[n - 1];
+        while (qhat >= b || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2]))
+        {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >= b)
+            {
+                break;
+            }
+        }
+
+        int64_t k = 0;
+        int64_t t;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            uint64_t p = qhat * vn[i];
+            t = (int64_t) un[i + j] - k - (int64_t) (p & 0xFFFFFFFF);
+            un[i + j] = (uint32_t) t;
+            k = (int64_t) (p >> 32) - (t >> 32);
+        }
+        t = (int64_t) un[j + n] - k;
+        un[j + n] = (uint32_t) t;
+
+        /* qhat was one too big; add v back. */
+        q[j] = (uint32_t) qhat;
+        if (t < 0)
+        {
+            q[j]--;
+            uint64_t carry = 0;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                carry += (uint64_t) un[i + j] + vn[i];
+                un[i + j] = (uint32_t) carry;
+                carry >>= 32;
+            }
+            un[j + n] += (uint32_t) carry;
+        }
+    }
+
+    free(un);
+}
+
+li1I_value li1I_bigint_div(li1I_value lhs, li1I_value rhs)
+{
+    struct view a, b;
+    load(lhs, &a);
+    load(rhs, &b);
+    if (!b.size)
+    {
+        fail("Division by zero");
+    }
+    if (compareMagnitudes(&a, &b) < 0)
+    {
+        return tag(0);
+    }
+
+    uint32_t size = a.size - b.size + 1;
+    struct bigint *result = allocate(size);
+    result->negative = a.negative ^ b.negative;
+    if (b.size == 1)
+    {
+        uint64_t remainder = 0;
+        for (uint32_t i = a.size; i--;)
+        {
+            uint64_t dividend = (remainder << 32) | a.limbs[i];
+            if (i < size)
+            {
+                result->limbs[i] = (uint32_t) (dividend / b.limbs[0]);
+            }
+            remainder = dividend % b.limbs[0];
+        }
+    }
+    else
+    {
+        divideMagnitudes(result->limbs, a.limbs, a.size, b.limbs, b.size);
+    }
+    return finish(result, size);
+}
+
+int32_t li1I_bigint_compare(li1I_value lhs, li1I_value rhs)
+{
+    struct view a, b;
+    load(lhs, &a);
+    load(rhs, &b);
+    if (a.negative != b.negative)
+    {
+        return a.negative ? -1 : 1;
+    }
+
+    int order = compareMagnitudes(&a, &b);
+    return a.negative ? -order : order;
+}
+
+int32_t li1I_bigint_low_bits(li1I_value value)
+{
+    struct view a;
+    load(value, &a);
+    uint32_t low = a.size ? a.limbs[0] : 0;
+    return (int32_t) (a.negative ? -low : low);
+}
+
+void li1I_bigint_print(li1I_value value)
+{
+    if (value & 1)
+    {
+        printf("%lld\n", (long long) ((int64_t) value >> 1));
+        return;
+    }
+
+    /* Nine decimal digits at a time, least significant first. */
+    const struct bigint *big = (const struct bigint *) (uintptr_t) value;
+    uint32_t size = big->size;
+    uint32_t *magnitude = malloc(size * sizeof(uint32_t));
+    uint32_t *digits = malloc((size * 10 / 9 + 2) * sizeof(uint32_t));
+    if (!magnitude || !digits)
+    {
+        fail("Out of memory for bigints");
+    }
+    memcpy(magnitude, big->limbs, size * sizeof(uint32_t));
+
+    size_t n_digits = 0;
+    while (size)
+    {
+        uint64_t remainder = 0;
+        for (uint32_t i = size; i--;)
+        {
+            uint64_t dividend = (remainder << 32) | magnitude[i];
+            magnitude[i] = (uint32_t) (dividend / 1000000000);
+            remainder = dividend % 1000000000;
+        }
+        digits[n_digits++] = (uint32_t) remainder;
+        while (size && !magnitude[size - 1])
+        {
+            size--;
+        }
+    }
+
+    printf("%s%u", big->negative ? "-" : "", digits[n_digits - 1]);
+    while (--n_digits)
+    {
+        printf("%09u", digits[n_digits - 1]);
+    }
+    printf("\n");
+
+    free(digits);
+    free(magnitude);
+}
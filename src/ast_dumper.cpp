@@ -46,6 +46,16 @@ void ASTDumper::visit(const Program &node)
 {
     output("Program");
 
+    for (auto &extern_function : node.externs())
+    {
+        m_level++;
+        output("(", false);
+        output("ExternFunction " + extern_function->name() + " "
+               + std::to_string(extern_function->nArgs()), false);
+        output(")", true);
+        m_level--;
+    }
+
     for (auto &function : node)
     {
         dumpNode(function);
@@ -1,13 +1,20 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/ProfileSummary.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Support/Host.h>
+#include <llvm/Support/Path.h>
+#include <algorithm>
+#include <cstdint>
+#include <set>
 #include <sstream>
 #include <stack>
 #include <iostream>
 #include <memory>
 
 #include "ast_to_ir.hpp"
+#include "codegen_target.hpp"
 
 using namespace li1I;
 using llvm::ConstantInt;
@@ -16,53 +23,364 @@ using llvm::FunctionType;
 using llvm::BasicBlock;
 using llvm::Type;
 
+static size_t countIfs(const RPNExpr &node)
+{
+    size_t n = 0;
+    for (auto &expr : node)
+    {
+        if (auto decl = dynamic_cast<const DeclExpr*>(&expr))
+        {
+            n += countIfs(decl->value());
+        }
+        else if (auto if_expr = dynamic_cast<const IfExpr*>(&expr))
+        {
+            n += 1 + countIfs(if_expr->condition()) + countIfs(if_expr->if_forms())
+                + countIfs(if_expr->else_forms());
+        }
+    }
+    return n;
+}
+
+// Branch weights are 32 bits, so large counts are scaled down the way
+// clang does, keeping every weight above zero.
+static uint32_t branchWeight(uint64_t count, uint64_t scale)
+{
+    return static_cast<uint32_t>(count / scale + 1);
+}
+
+void ASTToIRVisitor::setProfileGenerate(std::string profile_path)
+{
+    m_profile_path = std::move(profile_path);
+}
+
+void ASTToIRVisitor::setProfileUse(const ProfileData *profile)
+{
+    m_profile = profile;
+}
+
+void ASTToIRVisitor::setPartialEvaluation(uint64_t budget)
+{
+    m_eval_budget = budget;
+}
+
+void ASTToIRVisitor::setBigint(bool enabled)
+{
+    m_bigint.reset(enabled ? new BigintIR(m_builder) : nullptr);
+}
+
+void ASTToIRVisitor::setTinyRuntime(bool enabled)
+{
+    m_tiny_runtime.reset(enabled ? new TinyRuntimeIR(m_builder) : nullptr);
+}
+
+void ASTToIRVisitor::setMain(bool enabled)
+{
+    m_main = enabled;
+}
+
+llvm::Type *ASTToIRVisitor::valueType()
+{
+    return m_bigint ? m_bigint->valueType() : m_builder.getInt32Ty();
+}
+
+llvm::Constant *ASTToIRVisitor::constant(Value value)
+{
+    return m_bigint ? m_bigint->constant(value) : m_builder.getInt32(value);
+}
+
+void ASTToIRVisitor::setDebugInfo(std::string source_path)
+{
+    m_debug_path = std::move(source_path);
+}
+
+// Each module gets a compile unit of its own, so functions compiled a
+// module at a time still have their line tables.
+void ASTToIRVisitor::createModule(const std::string &name)
+{
+    m_module = new llvm::Module(name, m_context);
+    m_evaluator.reset();
+    m_specializations.clear();
+    m_extern_functions.clear();
+    m_subprogram = nullptr;
+    m_builder.SetCurrentDebugLocation(llvm::DebugLoc());
+    m_debug_builder.reset();
+    if (m_debug_path.empty())
+    {
+        return;
+    }
+
+    m_module->addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                            llvm::DEBUG_METADATA_VERSION);
+    m_module->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+    m_debug_builder.reset(new llvm::DIBuilder(*m_module));
+    m_debug_file = m_debug_builder->createFile(llvm::sys::path::filename(m_debug_path),
+                                               llvm::sys::path::parent_path(m_debug_path));
+    m_debug_builder->createCompileUnit(llvm::dwarf::DW_LANG_C, m_debug_file, "li1I", false, "", 0);
+    m_debug_int = m_bigint ? m_debug_builder->createBasicType("bigint", 64, llvm::dwarf::DW_ATE_signed)
+                           : m_debug_builder->createBasicType("int", 32, llvm::dwarf::DW_ATE_signed);
+}
+
+// Functions without a location of their own, like main, are marked
+// artificial so debuggers step straight through them.
+void ASTToIRVisitor::createSubprogram(llvm::Function *f, const TokenLocation *location)
+{
+    m_subprogram = nullptr;
+    m_builder.SetCurrentDebugLocation(llvm::DebugLoc());
+    if (!m_debug_builder)
+    {
+        return;
+    }
+
+    llvm::SmallVector<llvm::Metadata*, 8> types (f->arg_size() + 1, m_debug_int);
+    llvm::DISubroutineType *type =
+        m_debug_builder->createSubroutineType(m_debug_builder->getOrCreateTypeArray(types));
+    unsigned line = location ? location->line + 1 : 0;
+    m_subprogram = m_debug_builder->createFunction(
+        m_debug_file, f->getName(), llvm::StringRef(), m_debug_file, line, type, line,
+        location ? llvm::DINode::FlagPrototyped : llvm::DINode::FlagArtificial,
+        llvm::DISubprogram::SPFlagDefinition);
+    f->setSubprogram(m_subprogram);
+    m_builder.SetCurrentDebugLocation(llvm::DILocation::get(m_context, line, 0, m_subprogram));
+}
+
+// Lines and columns count from zero in TokenLocation but from one in
+// DWARF.
+void ASTToIRVisitor::setDebugLocation(const TokenLocation &location)
+{
+    if (m_subprogram)
+    {
+        m_builder.SetCurrentDebugLocation(
+            llvm::DILocation::get(m_context, location.line + 1, location.column + 1, m_subprogram));
+    }
+}
+
+// Arguments are numbered from one; zero makes a local variable. Bigints
+// are shown untagged, which is right as long as they are small.
+void ASTToIRVisitor::describeVariable(const std::string &vid, const TokenLocation &location,
+                                      llvm::Value *value, unsigned arg_no)
+{
+    if (!m_subprogram)
+    {
+        return;
+    }
+
+    llvm::DILocalVariable *variable = arg_no
+        ? m_debug_builder->createParameterVariable(m_subprogram, vid, arg_no, m_debug_file,
+                                                   location.line + 1, m_debug_int, true)
+        : m_debug_builder->createAutoVariable(m_subprogram, vid, m_debug_file,
+                                              location.line + 1, m_debug_int, true);
+    llvm::SmallVector<uint64_t, 3> untag;
+    if (m_bigint)
+    {
+        untag = {llvm::dwarf::DW_OP_constu, 1, llvm::dwarf::DW_OP_shra};
+    }
+    m_debug_builder->insertDbgValueIntrinsic(
+        value, variable, m_debug_builder->createExpression(untag),
+        llvm::DILocation::get(m_context, location.line + 1, location.column + 1, m_subprogram),
+        m_builder.GetInsertBlock());
+}
+
+void ASTToIRVisitor::incrementCounter(size_t index)
+{
+    llvm::Value *counter = m_builder.CreateConstInBoundsGEP2_64(m_counters->getValueType(), m_counters, 0, index);
+    llvm::Value *count = m_builder.CreateLoad(m_builder.getInt64Ty(), counter);
+    m_builder.CreateStore(m_builder.CreateAdd(count, m_builder.getInt64(1)), counter);
+}
+
+// Writes every counter out in ProfileData's format. The path is fixed at
+// compile time, relative to wherever the program is run.
+void ASTToIRVisitor::createProfileDump()
+{
+    Type *i8_ptr = llvm::Type::getInt8PtrTy(m_context);
+    auto fopen = m_module->getOrInsertFunction(
+        "fopen", FunctionType::get(i8_ptr, {i8_ptr, i8_ptr}, false));
+    auto fprintf = m_module->getOrInsertFunction(
+        "fprintf", FunctionType::get(m_builder.getInt32Ty(), {i8_ptr, i8_ptr}, true));
+    auto fclose = m_module->getOrInsertFunction(
+        "fclose", FunctionType::get(m_builder.getInt32Ty(), {i8_ptr}, false));
+
+    FunctionType *ft = FunctionType::get(m_builder.getVoidTy(), false);
+    llvm::Function *f = llvm::Function::Create(ft, llvm::Function::InternalLinkage,
+                                               "li1I.profile.dump", m_module);
+    createSubprogram(f, nullptr);
+    BasicBlock *entry = BasicBlock::Create(m_context, "entry", f);
+    BasicBlock *write = BasicBlock::Create(m_context, "write", f);
+    BasicBlock *done = BasicBlock::Create(m_context, "done", f);
+
+    m_builder.SetInsertPoint(entry);
+    llvm::Value *file = m_builder.CreateCall(fopen, {m_builder.CreateGlobalStringPtr(m_profile_path),
+                                                     m_builder.CreateGlobalStringPtr("w")});
+    m_builder.CreateCondBr(m_builder.CreateIsNull(file), done, write);
+
+    m_builder.SetInsertPoint(write);
+    for (auto &counters : m_profile_counters)
+    {
+        llvm::GlobalVariable *array = m_module->getNamedGlobal(counterName(counters.first));
+        std::string format = counters.first;
+        std::vector<llvm::Value*> args {file, nullptr};
+        for (size_t i = 0; i < counters.second; i++)
+        {
+            format += " %llu";
+            args.push_back(m_builder.CreateLoad(m_builder.getInt64Ty(),
+                                                m_builder.CreateConstInBoundsGEP2_64(array->getValueType(), array, 0, i)));
+        }
+        args[1] = m_builder.CreateGlobalStringPtr(format + "\n");
+        m_builder.CreateCall(fprintf, args);
+    }
+    m_builder.CreateCall(fclose, {file});
+    m_builder.CreateBr(done);
+
+    m_builder.SetInsertPoint(done);
+    m_builder.CreateRetVoid();
+}
+
+// A program which could be run at compile time just prints its answer.
+llvm::Value *ASTToIRVisitor::callMain()
+{
+    Value answer;
+    if (m_evaluator
+        && m_evaluator->evaluate("IIII", {}, answer) == PartialEvaluator::Outcome::EVALUATED)
+    {
+        return constant(answer);
+    }
+    return m_builder.CreateCall(m_module->getFunction("IIII"));
+}
+
 void ASTToIRVisitor::createMain()
 {
+    if (m_tiny_runtime)
+    {
+        createSubprogram(m_tiny_runtime->createStart(*m_module), nullptr);
+        m_tiny_runtime->printAndExit(callMain());
+        return;
+    }
+
     FunctionType *ft = FunctionType::get(llvm::Type::getInt32Ty(m_context),
                                                      false);
     llvm::Function *f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, "main", m_module);
-    
+    createSubprogram(f, nullptr);
+
     BasicBlock *entry = BasicBlock::Create(m_context, "entry", f);
     m_builder.SetInsertPoint(entry);
-    llvm::Function *callee = m_module->getFunction("IIII");
 
     llvm::ArrayRef<Type*> args (llvm::Type::getInt8PtrTy(m_context));
     ft = FunctionType::get(llvm::Type::getInt32Ty(m_context),
                            args,
                            true);
     f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, "printf", m_module);
-    m_builder.CreateCall(f, {m_builder.CreateGlobalStringPtr("%d\n"), m_builder.CreateCall(callee)});
-    
+
+    llvm::Value *result = callMain();
+    if (m_bigint)
+    {
+        m_bigint->print(result);
+    }
+    else
+    {
+        m_builder.CreateCall(f, {m_builder.CreateGlobalStringPtr("%d\n"), result});
+    }
+
+    if (!m_profile_path.empty())
+    {
+        m_builder.CreateCall(m_module->getFunction("li1I.profile.dump"));
+    }
+
     m_builder.CreateRet(ConstantInt::get(IntegerType::get(m_context,32), llvm::APInt(32, 0, true)));
 }
 
+static void collectCalls(const RPNExpr &node, std::set<std::string> &callees)
+{
+    for (auto &expr : node)
+    {
+        if (auto call = dynamic_cast<const CallExpr*>(&expr))
+        {
+            callees.insert(call->fid());
+        }
+        else if (auto decl = dynamic_cast<const DeclExpr*>(&expr))
+        {
+            collectCalls(decl->value(), callees);
+        }
+        else if (auto if_expr = dynamic_cast<const IfExpr*>(&expr))
+        {
+            collectCalls(if_expr->condition(), callees);
+            collectCalls(if_expr->if_forms(), callees);
+            collectCalls(if_expr->else_forms(), callees);
+        }
+    }
+}
+
+void ASTToIRVisitor::declareFunction(const std::string &fid, size_t n_args, bool is_extern)
+{
+    if (m_module->getFunction(fid))
+    {
+        throw IRTransformError("Function redefinition");
+    }
+
+    llvm::Type *type = is_extern ? m_builder.getInt32Ty() : valueType();
+    if (is_extern)
+    {
+        m_extern_functions.insert(fid);
+    }
+    std::vector<llvm::Type*> arg_types (n_args, type);
+    llvm::FunctionType *ft = llvm::FunctionType::get(type, arg_types, false);
+    llvm::Function::Create(ft, llvm::Function::ExternalLinkage, fid, m_module);
+}
+
+// Every function is declared before any is defined, so calls can go to
+// functions defined further down, or in another module altogether. Only
+// is given to declare just the functions it names. Extern functions are
+// left for the linker, or the JIT's symbol lookup, to find.
+void ASTToIRVisitor::declareFunctions(const Program &node, const std::set<std::string> *only)
+{
+    for (auto &extern_function : node.externs())
+    {
+        if (!only || only->count(extern_function->name()))
+        {
+            declareFunction(extern_function->name(), extern_function->nArgs(), true);
+        }
+    }
+
+    for (auto &func : node)
+    {
+        if (!only || only->count(func.name()))
+        {
+            declareFunction(func.name(), func.nArgs(), false);
+        }
+    }
+}
+
 void ASTToIRVisitor::visit(const Program &node)
 {
-    m_module = new llvm::Module(node.name(), m_context);
+    createModule(node.name());
+    if (m_eval_budget)
+    {
+        m_evaluator.reset(new PartialEvaluator(node, m_eval_budget));
+    }
+    declareFunctions(node);
 
     for (auto &func : node)
     {
        func.accept(this);
     }
 
-    createMain();
+    if (!m_profile_path.empty())
+    {
+        createProfileDump();
+    }
+    if (m_main)
+    {
+        createMain();
+    }
 }
 
 void ASTToIRVisitor::visit(const Function &node)
 {
     m_environment.clear();
 
-    std::vector<llvm::Type*> arg_types (node.nArgs(),
-                                        llvm::Type::getInt32Ty(m_context));
-    llvm::FunctionType *ft = llvm::FunctionType::get(llvm::Type::getInt32Ty(m_context),
-                                         arg_types, false);
+    llvm::Function *f = m_module->getFunction(node.name());
+    createSubprogram(f, &node.location());
 
-    llvm::Function *f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, node.name(), m_module);
-
-    if (f->getName() != node.name())
-    {
-        throw IRTransformError("Function redefinition");
-    }
+    llvm::BasicBlock *entry = llvm::BasicBlock::Create(m_context, "entry", f);
+    m_builder.SetInsertPoint(entry);
 
     auto p_arg = node.begin();
     for (auto f_arg = f->arg_begin(); p_arg != node.end();
@@ -70,10 +388,44 @@ void ASTToIRVisitor::visit(const Function &node)
     {
         f_arg->setName(p_arg->vid());
         m_environment[p_arg->vid()] = static_cast<llvm::Argument*>(f_arg);
+        describeVariable(p_arg->vid(), p_arg->location(), &*f_arg, f_arg->getArgNo() + 1);
     }
 
-    llvm::BasicBlock *entry = llvm::BasicBlock::Create(m_context, "entry", f);
-    m_builder.SetInsertPoint(entry);
+    // Counter 0 is the entry count, then a pair for each IfExpr.
+    size_t n_ifs = countIfs(node.expr());
+    m_n_ifs = 0;
+    m_counters = nullptr;
+    if (!m_profile_path.empty())
+    {
+        llvm::ArrayType *array_type = llvm::ArrayType::get(m_builder.getInt64Ty(), 1 + 2 * n_ifs);
+        m_counters = new llvm::GlobalVariable(*m_module, array_type, false,
+                                              llvm::GlobalValue::ExternalLinkage,
+                                              llvm::ConstantAggregateZero::get(array_type),
+                                              counterName(node.name()));
+        m_profile_counters.emplace_back(node.name(), 1 + 2 * n_ifs);
+        incrementCounter(0);
+    }
+
+    // A profile of an older version of the function is still good for its
+    // entry count, but its branch counts can't be matched up.
+    m_function_profile = m_profile ? m_profile->find(node.name()) : nullptr;
+    if (m_function_profile)
+    {
+        f->setEntryCount(llvm::Function::ProfileCount(m_function_profile->entry,
+                                                      llvm::Function::PCT_Real));
+        if (m_function_profile->branches.size() != 2 * n_ifs)
+        {
+            m_function_profile = nullptr;
+        }
+    }
+
+    Value result;
+    if (m_evaluator && node.nArgs() == 0
+        && m_evaluator->evaluate(node.name(), {}, result) == PartialEvaluator::Outcome::EVALUATED)
+    {
+        m_builder.CreateRet(constant(result));
+        return;
+    }
 
     llvm::Value *ret;
     if ((ret = codegen(node.expr())))
@@ -98,6 +450,11 @@ void ASTToIRVisitor::visit(const VarExpr &node)
 
 llvm::Value *ASTToIRVisitor::codegenOperation (Operator op, llvm::Value *lhs, llvm::Value *rhs)
 {
+    if (m_bigint)
+    {
+        return m_bigint->operation(op, lhs, rhs);
+    }
+
     llvm::Value *v;
     switch (op)
     {
@@ -122,6 +479,7 @@ void ASTToIRVisitor::visit(const RPNExpr &node)
     std::stack<llvm::Value*> rpn_stack;
     for (auto &expr : node)
     {
+        setDebugLocation(expr.location());
         const OpExpr *op = dynamic_cast<const OpExpr*>(&expr);
         const CallExpr *call = dynamic_cast<const CallExpr*>(&expr);
         if (op)
@@ -142,6 +500,13 @@ void ASTToIRVisitor::visit(const RPNExpr &node)
         else if(call)
         {
             llvm::Function *callee = m_module->getFunction(call->fid());
+            if (!callee)
+            {
+                std::stringstream ss;
+                ss << "No such function as " << call->fid();
+                throw IRTransformError(ss.str());
+            }
+
             if (rpn_stack.size() < callee->arg_size())
             {
                 throw IRTransformError("Not enough items on stack to call function");
@@ -154,7 +519,19 @@ void ASTToIRVisitor::visit(const RPNExpr &node)
                 rpn_stack.pop();
             }
 
-            rpn_stack.push(m_builder.CreateCall(callee, arg_values));
+            // Extern functions always deal in 32 bit ints.
+            bool convert = m_bigint && m_extern_functions.count(call->fid());
+            if (convert)
+            {
+                for (llvm::Value *&arg : arg_values)
+                {
+                    arg = m_bigint->lowBits(arg);
+                }
+            }
+
+            llvm::Value *result = m_evaluator ? evaluateCall(call->fid(), arg_values) : nullptr;
+            result = result ? result : m_builder.CreateCall(callee, arg_values);
+            rpn_stack.push(convert ? m_bigint->fromInt32(result) : result);
         }
         else
         {
@@ -175,6 +552,124 @@ void ASTToIRVisitor::visit(const RPNExpr &node)
     m_value = rpn_stack.top();
 }
 
+// With partial evaluation, calls whose arguments are all constant are run
+// now, and calls with some constant arguments go to a version of the callee
+// specialised on them, as do constant calls which ran out of budget. Null
+// means an ordinary call is needed, which is also what a call that failed
+// to evaluate gets, so that it still traps on division by zero.
+llvm::Value *ASTToIRVisitor::evaluateCall(const std::string &fid, std::vector<llvm::Value*> &args)
+{
+    if (!m_evaluator->defines(fid))
+    {
+        return nullptr;
+    }
+
+    std::vector<Value> values;
+    std::vector<llvm::Value*> remaining;
+    for (llvm::Value *arg : args)
+    {
+        if (auto constant = llvm::dyn_cast<llvm::ConstantInt>(arg))
+        {
+            values.push_back(static_cast<Value>(constant->getSExtValue()));
+        }
+        else
+        {
+            remaining.push_back(arg);
+        }
+    }
+
+    Value result;
+    if (remaining.empty())
+    {
+        switch (m_evaluator->evaluate(fid, values, result))
+        {
+        case PartialEvaluator::Outcome::EVALUATED: return constant(result);
+        case PartialEvaluator::Outcome::OUT_OF_BUDGET: break;
+        case PartialEvaluator::Outcome::FAILED: return nullptr;
+        }
+    }
+
+    llvm::Function *specialized = values.empty() ? nullptr
+        : specialize(m_evaluator->function(fid), args);
+    return specialized ? m_builder.CreateCall(specialized, remaining) : nullptr;
+}
+
+// Specialisations of recursive functions on a changing argument would go on
+// forever, so there is a limit on how many a module gets.
+static const size_t max_specializations = 256;
+
+llvm::Function *ASTToIRVisitor::specialize(const Function &function,
+                                           const std::vector<llvm::Value*> &args)
+{
+    std::string name = function.name() + ".specialized";
+    std::vector<llvm::Type*> arg_types;
+    for (llvm::Value *arg : args)
+    {
+        if (auto constant = llvm::dyn_cast<llvm::ConstantInt>(arg))
+        {
+            name += "." + std::to_string(static_cast<Value>(constant->getSExtValue()));
+        }
+        else
+        {
+            name += "._";
+            arg_types.push_back(valueType());
+        }
+    }
+
+    auto it = m_specializations.find(name);
+    if (it != m_specializations.end())
+    {
+        return it->second;
+    }
+    if (m_specializations.size() >= max_specializations)
+    {
+        return nullptr;
+    }
+
+    FunctionType *ft = FunctionType::get(valueType(), arg_types, false);
+    llvm::Function *f = llvm::Function::Create(ft, llvm::Function::InternalLinkage, name, m_module);
+    m_specializations[name] = f;
+
+    // The caller is only part way through being generated.
+    llvm::IRBuilderBase::InsertPointGuard guard (m_builder);
+    std::map<std::string, llvm::Value*> environment;
+    std::swap(environment, m_environment);
+    llvm::GlobalVariable *counters = m_counters;
+    const FunctionProfile *function_profile = m_function_profile;
+    size_t n_ifs = m_n_ifs;
+    llvm::DISubprogram *subprogram = m_subprogram;
+    m_counters = nullptr;
+    m_function_profile = nullptr;
+
+    createSubprogram(f, &function.location());
+    BasicBlock *entry = BasicBlock::Create(m_context, "entry", f);
+    m_builder.SetInsertPoint(entry);
+
+    auto f_arg = f->arg_begin();
+    auto p_arg = function.begin();
+    for (size_t i = 0; i < args.size(); ++i, ++p_arg)
+    {
+        if (llvm::isa<llvm::ConstantInt>(args[i]))
+        {
+            m_environment[p_arg->vid()] = args[i];
+            continue;
+        }
+
+        f_arg->setName(p_arg->vid());
+        m_environment[p_arg->vid()] = &*f_arg;
+        describeVariable(p_arg->vid(), p_arg->location(), &*f_arg, f_arg->getArgNo() + 1);
+        ++f_arg;
+    }
+    m_builder.CreateRet(codegen(function.expr()));
+
+    std::swap(environment, m_environment);
+    m_counters = counters;
+    m_function_profile = function_profile;
+    m_n_ifs = n_ifs;
+    m_subprogram = subprogram;
+    return f;
+}
+
 void ASTToIRVisitor::visit(const CallExpr &node)
 {
     throw IRTransformError("CallExprs shouldn't be visited");
@@ -184,6 +679,8 @@ void ASTToIRVisitor::visit(const DeclExpr &node)
 {
     llvm::Value *value = codegen(node.value());
     m_environment[node.vid()] = value;
+    setDebugLocation(node.location());
+    describeVariable(node.vid(), node.location(), value, 0);
     m_value = value;
 }
 
@@ -194,11 +691,28 @@ void ASTToIRVisitor::visit(const OpExpr &node)
 
 void ASTToIRVisitor::visit (const IfExpr &node)
 {
+    size_t index = m_n_ifs++;
     llvm::Value *cond = codegen(node.condition());
+    setDebugLocation(node.location());
 
-    m_builder.CreateICmpNE(cond,
-                           llvm::ConstantInt::get(llvm::IntegerType::get(m_context,32), llvm::APInt(32, 0, true)),
-                         "ifcond");
+    // Only the branch a constant condition takes is worth generating. The
+    // ifs in the other still have their counters.
+    auto constant = m_evaluator ? llvm::dyn_cast<llvm::ConstantInt>(cond) : nullptr;
+    if (constant)
+    {
+        bool taken = isTruthy(static_cast<Value>(constant->getSExtValue()));
+        if (m_counters)
+        {
+            incrementCounter(taken ? 1 + 2 * index : 2 + 2 * index);
+        }
+        m_n_ifs += taken ? 0 : countIfs(node.if_forms());
+        llvm::Value *value = codegen(taken ? node.if_forms() : node.else_forms());
+        m_n_ifs += taken ? countIfs(node.else_forms()) : 0;
+        m_value = value;
+        return;
+    }
+
+    m_builder.CreateICmpNE(cond, llvm::Constant::getNullValue(cond->getType()), "ifcond");
 
     llvm::Function *fun = m_builder.GetInsertBlock()->getParent();
 
@@ -206,10 +720,24 @@ void ASTToIRVisitor::visit (const IfExpr &node)
     llvm::BasicBlock *else_block = llvm::BasicBlock::Create(m_context, "else");
     llvm::BasicBlock *merge_block = llvm::BasicBlock::Create(m_context, "ifcont");
 
-    llvm::Value *br_cond = m_builder.CreateIntCast(cond, llvm::IntegerType::get(m_context, 1), false);
-    m_builder.CreateCondBr(br_cond, then_block, else_block);
+    llvm::Value *br_cond = m_bigint ? m_bigint->isTruthy(cond)
+        : m_builder.CreateIntCast(cond, llvm::IntegerType::get(m_context, 1), false);
+    llvm::BranchInst *branch = m_builder.CreateCondBr(br_cond, then_block, else_block);
+    if (m_function_profile)
+    {
+        uint64_t then_count = m_function_profile->branches[2 * index];
+        uint64_t else_count = m_function_profile->branches[2 * index + 1];
+        uint64_t scale = std::max(then_count, else_count) / UINT32_MAX + 1;
+        branch->setMetadata(llvm::LLVMContext::MD_prof,
+                            llvm::MDBuilder(m_context).createBranchWeights(
+                                branchWeight(then_count, scale), branchWeight(else_count, scale)));
+    }
 
     m_builder.SetInsertPoint(then_block);
+    if (m_counters)
+    {
+        incrementCounter(1 + 2 * index);
+    }
 
     llvm::Value *then_value = codegen(node.if_forms());
 
@@ -218,6 +746,10 @@ void ASTToIRVisitor::visit (const IfExpr &node)
 
     fun->getBasicBlockList().push_back(else_block);
     m_builder.SetInsertPoint(else_block);
+    if (m_counters)
+    {
+        incrementCounter(2 + 2 * index);
+    }
 
     llvm::Value *else_value = codegen(node.else_forms());
 
@@ -226,7 +758,7 @@ void ASTToIRVisitor::visit (const IfExpr &node)
 
     fun->getBasicBlockList().push_back(merge_block);
     m_builder.SetInsertPoint(merge_block);
-    llvm::PHINode *phi = m_builder.CreatePHI(llvm::Type::getInt32Ty(m_context), 2,
+    llvm::PHINode *phi = m_builder.CreatePHI(valueType(), 2,
                                     "iftmp");
 
     phi->addIncoming(then_value, then_block);
@@ -237,7 +769,7 @@ void ASTToIRVisitor::visit (const IfExpr &node)
 
 void ASTToIRVisitor::visit(const IntExpr &node)
 {
-    m_value = llvm::ConstantInt::get(m_context, llvm::APInt(32, node.value(), true));
+    m_value = constant(node.value());
 }
 
 llvm::Value *ASTToIRVisitor::codegen (const ASTNode &node)
@@ -251,6 +783,55 @@ llvm::Value *ASTToIRVisitor::codegen (const ASTNode &node)
 llvm::Module *ASTToIRVisitor::codegenIR(const Program &program)
 {
     program.accept(this);
+    return finishModule();
+}
+
+llvm::Module *ASTToIRVisitor::codegenFunction(const Program &program, const Function &function)
+{
+    return codegenFunctions(program, {&function});
+}
+
+llvm::Module *ASTToIRVisitor::codegenFunctions(const Program &program,
+                                               const std::vector<const Function*> &functions)
+{
+    std::set<std::string> declared;
+    for (const Function *function : functions)
+    {
+        declared.insert(function->name());
+        collectCalls(function->expr(), declared);
+    }
+
+    createModule(program.name() + "." + functions.front()->name());
+    declareFunctions(program, &declared);
+    for (const Function *function : functions)
+    {
+        function->accept(this);
+    }
+    return finishModule();
+}
+
+llvm::Module *ASTToIRVisitor::codegenMain(const Program &program)
+{
+    std::set<std::string> declared {"IIII"};
+    createModule(program.name() + ".main");
+    declareFunctions(program, &declared);
+    createMain();
+    return finishModule();
+}
+
+llvm::Module *ASTToIRVisitor::finishModule()
+{
+    if (m_debug_builder)
+    {
+        m_debug_builder->finalize();
+        m_debug_builder.reset();
+    }
+
+    if (m_profile)
+    {
+        m_module->setProfileSummary(m_profile->summary(m_context), llvm::ProfileSummary::PSK_Instr);
+    }
     m_module->setTargetTriple(llvm::sys::getDefaultTargetTriple());
+    recordTarget(*m_module);
     return m_module;
 }
@@ -0,0 +1,560 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <sys/mman.h>
+
+#include "baseline_jit.hpp"
+#include "extern_call.hpp"
+#include "jit_profiling.hpp"
+
+using namespace li1I;
+
+struct BaselineJIT::Stencil
+{
+    const uint8_t *code;
+    size_t size;
+    int hole;   // offset of the 32-bit value to patch, or -1
+};
+
+#define STENCIL(name, hole, ...) \
+    static const uint8_t name##_code[] = { __VA_ARGS__ }; \
+    static const BaselineJIT::Stencil name = { name##_code, sizeof(name##_code), hole };
+
+// push rbp; mov rbp, rsp; sub rsp, <locals>
+STENCIL(prologue, 7, 0x55, 0x48, 0x89, 0xe5, 0x48, 0x81, 0xec, 0, 0, 0, 0)
+// pop rax; mov rsp, rbp; pop rbp; ret
+STENCIL(epilogue, -1, 0x58, 0x48, 0x89, 0xec, 0x5d, 0xc3)
+
+// push <imm>
+STENCIL(push_imm, 1, 0x68, 0, 0, 0, 0)
+// mov eax, [rbp + <slot>]; push rax
+STENCIL(push_slot, 2, 0x8b, 0x85, 0, 0, 0, 0, 0x50)
+// mov rax, [rsp]; mov [rbp + <slot>], eax
+STENCIL(store_slot, 6, 0x48, 0x8b, 0x04, 0x24, 0x89, 0x85, 0, 0, 0, 0)
+
+// pop rcx; pop rax; <op> eax, ecx; push rax
+STENCIL(add, -1, 0x59, 0x58, 0x01, 0xc8, 0x50)
+STENCIL(sub, -1, 0x59, 0x58, 0x29, 0xc8, 0x50)
+STENCIL(mul, -1, 0x59, 0x58, 0x0f, 0xaf, 0xc1, 0x50)
+STENCIL(udiv, -1, 0x59, 0x58, 0x31, 0xd2, 0xf7, 0xf1, 0x50)
+// pop rcx; pop rax; cmp eax, ecx; set<cc> al; movzx eax, al; neg eax; push rax
+STENCIL(gt, -1, 0x59, 0x58, 0x39, 0xc8, 0x0f, 0x97, 0xc0, 0x0f, 0xb6, 0xc0, 0xf7, 0xd8, 0x50)
+STENCIL(lt, -1, 0x59, 0x58, 0x39, 0xc8, 0x0f, 0x92, 0xc0, 0x0f, 0xb6, 0xc0, 0xf7, 0xd8, 0x50)
+STENCIL(eq, -1, 0x59, 0x58, 0x39, 0xc8, 0x0f, 0x94, 0xc0, 0x0f, 0xb6, 0xc0, 0xf7, 0xd8, 0x50)
+STENCIL(neq, -1, 0x59, 0x58, 0x39, 0xc8, 0x0f, 0x95, 0xc0, 0x0f, 0xb6, 0xc0, 0xf7, 0xd8, 0x50)
+
+// The same with the right hand side an immediate, replacing a push_imm.
+STENCIL(add_imm, 2, 0x58, 0x05, 0, 0, 0, 0, 0x50)
+STENCIL(sub_imm, 2, 0x58, 0x2d, 0, 0, 0, 0, 0x50)
+STENCIL(mul_imm, 3, 0x58, 0x69, 0xc0, 0, 0, 0, 0, 0x50)
+STENCIL(gt_imm, 2, 0x58, 0x3d, 0, 0, 0, 0, 0x0f, 0x97, 0xc0, 0x0f, 0xb6, 0xc0, 0xf7, 0xd8, 0x50)
+STENCIL(lt_imm, 2, 0x58, 0x3d, 0, 0, 0, 0, 0x0f, 0x92, 0xc0, 0x0f, 0xb6, 0xc0, 0xf7, 0xd8, 0x50)
+STENCIL(eq_imm, 2, 0x58, 0x3d, 0, 0, 0, 0, 0x0f, 0x94, 0xc0, 0x0f, 0xb6, 0xc0, 0xf7, 0xd8, 0x50)
+STENCIL(neq_imm, 2, 0x58, 0x3d, 0, 0, 0, 0, 0x0f, 0x95, 0xc0, 0x0f, 0xb6, 0xc0, 0xf7, 0xd8, 0x50)
+
+// pop rax; test al, 1; jz <rel>
+STENCIL(branch_unless, 5, 0x58, 0xa8, 0x01, 0x0f, 0x84, 0, 0, 0, 0)
+// jmp <rel>
+STENCIL(jump, 1, 0xe9, 0, 0, 0, 0)
+// call <rel>
+STENCIL(call, 1, 0xe8, 0, 0, 0, 0)
+// add rsp, <bytes>
+STENCIL(drop, 3, 0x48, 0x81, 0xc4, 0, 0, 0, 0)
+// push rax
+STENCIL(push_result, -1, 0x50)
+
+// Extern calls pop their arguments into the SysV argument registers,
+// first argument first, then align the stack for C:
+// pop rdi/rsi/rdx/rcx/r8/r9
+STENCIL(pop_rdi, -1, 0x5f)
+STENCIL(pop_rsi, -1, 0x5e)
+STENCIL(pop_rdx, -1, 0x5a)
+STENCIL(pop_rcx, -1, 0x59)
+STENCIL(pop_r8, -1, 0x41, 0x58)
+STENCIL(pop_r9, -1, 0x41, 0x59)
+// mov rax, rsp; and rsp, -16; push rax; push rax; mov r11, <imm64>;
+// call r11; pop rcx; pop rsp
+STENCIL(call_extern, 11, 0x48, 0x89, 0xe0, 0x48, 0x83, 0xe4, 0xf0, 0x50, 0x50,
+        0x49, 0xbb, 0, 0, 0, 0, 0, 0, 0, 0, 0x41, 0xff, 0xd3, 0x59, 0x5c)
+
+// Array entry points: push rbp; mov rbp, rsp; then per argument
+// mov eax, [rdi + <offset>]; push rax; then call; mov rsp, rbp; pop rbp; ret
+STENCIL(entry_prologue, -1, 0x55, 0x48, 0x89, 0xe5)
+STENCIL(entry_push_arg, 2, 0x8b, 0x87, 0, 0, 0, 0, 0x50)
+STENCIL(entry_epilogue, -1, 0x48, 0x89, 0xec, 0x5d, 0xc3)
+
+// Under compileTier(), calls go through the callee's cell:
+// mov rax, <imm64>; call [rax]
+STENCIL(call_cell, 2, 0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0x10)
+// and functions start by counting down their calls, calling the hot
+// handler at zero: mov rax, <imm64>; dec qword [rax]; jnz <rel>; then
+// mov rdi, <imm64>; and a call_extern
+STENCIL(count_call, 2, 0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0x48, 0xff, 0x08,
+        0x0f, 0x85, 0, 0, 0, 0)
+STENCIL(mov_rdi_imm, 2, 0x48, 0xbf, 0, 0, 0, 0, 0, 0, 0, 0)
+// Thunks which a cell is redirected to copy the arguments into an array
+// for whatever is in the FunctionSlot: push rbp; mov rbp, rsp;
+// sub rsp, <bytes>; and rsp, -16; then per argument
+// mov eax, [rbp + <offset>]; mov [rsp + <offset>], eax; then
+// mov rdi, rsp; mov rax, <imm64>; call [rax]; and an entry_epilogue
+STENCIL(thunk_prologue, 7, 0x55, 0x48, 0x89, 0xe5, 0x48, 0x81, 0xec, 0, 0, 0, 0,
+        0x48, 0x83, 0xe4, 0xf0)
+STENCIL(thunk_load_arg, 2, 0x8b, 0x85, 0, 0, 0, 0)
+STENCIL(thunk_store_arg, 3, 0x89, 0x84, 0x24, 0, 0, 0, 0)
+STENCIL(thunk_call, 5, 0x48, 0x89, 0xe7, 0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0x10)
+
+#undef STENCIL
+
+static const BaselineJIT::Stencil *const pop_args[] = {
+    &pop_rdi, &pop_rsi, &pop_rdx, &pop_rcx, &pop_r8, &pop_r9
+};
+static_assert(sizeof(pop_args) / sizeof(pop_args[0]) == max_extern_args,
+              "Extern argument registers out of sync with max_extern_args");
+
+static const size_t no_push = std::numeric_limits<size_t>::max();
+
+BaselineJIT::BaselineJIT()
+    : m_buffer(), m_functions(), m_entries(), m_arities(), m_externs(), m_call_fixups(),
+      m_cells(), m_tier_cells(), m_thunks(), m_hot_handler(), m_slots(), m_n_locals(0), m_depth(0), m_last_label(0),
+      m_last_push_imm(no_push), m_code(NULL), m_code_size(0)
+{}
+
+BaselineJIT::~BaselineJIT()
+{
+    if (m_code)
+    {
+        munmap(m_code, m_code_size);
+    }
+}
+
+size_t BaselineJIT::emit(const Stencil &stencil, int32_t value)
+{
+    size_t start = m_buffer.size();
+    m_buffer.insert(m_buffer.end(), stencil.code, stencil.code + stencil.size);
+    m_last_push_imm = &stencil == &push_imm ? start : no_push;
+
+    if (stencil.hole < 0)
+    {
+        return start;
+    }
+
+    size_t hole = start + stencil.hole;
+    patch(hole, value);
+    return hole;
+}
+
+void BaselineJIT::patch(size_t hole, int32_t value)
+{
+    std::memcpy(&m_buffer[hole], &value, sizeof(value));
+}
+
+void BaselineJIT::patchBranch(size_t hole, size_t target)
+{
+    patch(hole, static_cast<int32_t>(target - (hole + sizeof(int32_t))));
+}
+
+void BaselineJIT::patchPointer(size_t hole, const void *pointer)
+{
+    std::memcpy(&m_buffer[hole], &pointer, sizeof(pointer));
+}
+
+void BaselineJIT::emitOperation(Operator op)
+{
+    const Stencil *immediate = NULL;
+    switch (op)
+    {
+    case Operator::PLUS:
+    case Operator::EXP: immediate = &add_imm; break;
+    case Operator::MINUS: immediate = &sub_imm; break;
+    case Operator::TIMES: immediate = &mul_imm; break;
+    case Operator::GT: immediate = &gt_imm; break;
+    case Operator::LT: immediate = &lt_imm; break;
+    case Operator::EQ: immediate = &eq_imm; break;
+    case Operator::NEQ: immediate = &neq_imm; break;
+    case Operator::DIV: break;
+    }
+
+    // Fold a constant right hand side into the operation, unless a branch
+    // lands between the push and here.
+    if (immediate && m_last_push_imm != no_push
+        && m_last_push_imm + push_imm.size == m_buffer.size()
+        && m_last_label != m_buffer.size())
+    {
+        int32_t value;
+        std::memcpy(&value, &m_buffer[m_last_push_imm + push_imm.hole], sizeof(value));
+        m_buffer.resize(m_last_push_imm);
+        emit(*immediate, value);
+        return;
+    }
+
+    switch (op)
+    {
+    case Operator::PLUS: emit(add); break;
+    case Operator::MINUS: emit(sub); break;
+    case Operator::TIMES: emit(mul); break;
+    case Operator::DIV: emit(udiv); break;
+    case Operator::EXP: emit(add); break; //TODO, as in codegen
+    case Operator::GT: emit(gt); break;
+    case Operator::LT: emit(lt); break;
+    case Operator::EQ: emit(eq); break;
+    case Operator::NEQ: emit(neq); break;
+    }
+}
+
+void BaselineJIT::emitCall(const std::string &fid)
+{
+    auto cell = m_tier_cells.find(fid);
+    if (cell != m_tier_cells.end())
+    {
+        patchPointer(emit(call_cell), &cell->second->target);
+        return;
+    }
+
+    m_call_fixups.push_back(CallFixup{emit(call), fid});
+}
+
+void BaselineJIT::emitExternCall(void *address, size_t n_args)
+{
+    for (size_t i = 0; i < n_args; i++)
+    {
+        emit(*pop_args[i]);
+    }
+    patchPointer(emit(call_extern), address);
+}
+
+void BaselineJIT::emitCallCount(TierCell &cell)
+{
+    size_t hole = emit(count_call);
+    patchPointer(hole, &cell.calls_left);
+    // The jnz's displacement follows the dec.
+    size_t skip = hole + sizeof(void*) + 5;
+
+    patchPointer(emit(mov_rdi_imm), &cell);
+    emitExternCall(reinterpret_cast<void*>(&BaselineJIT::hot), 0);
+    patchBranch(skip, m_buffer.size());
+}
+
+void BaselineJIT::emitThunk(const Function &node)
+{
+    m_thunks[node.name()] = m_buffer.size();
+    emit(thunk_prologue, node.nArgs() * sizeof(Value));
+    for (size_t i = 0; i < node.nArgs(); i++)
+    {
+        emit(thunk_load_arg, 16 + 8 * i);
+        emit(thunk_store_arg, i * sizeof(Value));
+    }
+    patchPointer(emit(thunk_call), &m_tier_cells[node.name()]->slot->native);
+    emit(entry_epilogue);
+}
+
+void BaselineJIT::emitEntry(const Function &node)
+{
+    m_entries[node.name()] = m_buffer.size();
+    emit(entry_prologue);
+    for (size_t i = node.nArgs(); i > 0; --i)
+    {
+        emit(entry_push_arg, (i - 1) * sizeof(Value));
+    }
+    emitCall(node.name());
+    emit(entry_epilogue);
+}
+
+int32_t BaselineJIT::slot(const std::string &vid)
+{
+    auto it = m_slots.find(vid);
+    if (it == m_slots.end())
+    {
+        std::stringstream ss;
+        ss << "No such variable as " << vid;
+        throw BaselineJITError(ss.str());
+    }
+
+    return it->second;
+}
+
+void BaselineJIT::visit(const Program &node)
+{
+    for (auto &external : node.externs())
+    {
+        if (!m_arities.emplace(external->name(), external->nArgs()).second)
+        {
+            throw BaselineJITError("Function redefinition");
+        }
+        m_externs[external->name()] = findExtern(external->name(), external->nArgs());
+    }
+
+    for (auto &func : node)
+    {
+        if (!m_arities.emplace(func.name(), func.nArgs()).second)
+        {
+            throw BaselineJITError("Function redefinition");
+        }
+    }
+
+    for (auto &func : node)
+    {
+        func.accept(this);
+        emitEntry(func);
+        if (m_cells)
+        {
+            emitThunk(func);
+        }
+    }
+
+    for (auto &fixup : m_call_fixups)
+    {
+        patchBranch(fixup.hole, m_functions[fixup.fid]);
+    }
+}
+
+void BaselineJIT::visit(const Function &node)
+{
+    m_functions[node.name()] = m_buffer.size();
+    m_slots.clear();
+    m_n_locals = 0;
+    m_depth = 0;
+
+    // Above the saved rbp and return address, the first argument is on top.
+    int32_t offset = 16;
+    for (auto &arg : node)
+    {
+        m_slots[arg.vid()] = offset;
+        offset += 8;
+    }
+
+    auto cell = m_tier_cells.find(node.name());
+    if (cell != m_tier_cells.end())
+    {
+        emitCallCount(*cell->second);
+    }
+
+    size_t frame_hole = emit(prologue);
+    node.expr().accept(this);
+    emit(epilogue);
+
+    patch(frame_hole, m_n_locals * 8);
+}
+
+void BaselineJIT::visit(const VarExpr &node)
+{
+    emit(push_slot, slot(node.vid()));
+}
+
+void BaselineJIT::visit(const RPNExpr &node)
+{
+    size_t start = m_depth;
+
+    for (auto &expr : node)
+    {
+        const OpExpr *op = dynamic_cast<const OpExpr*>(&expr);
+        const CallExpr *call_expr = dynamic_cast<const CallExpr*>(&expr);
+        if (op)
+        {
+            if (m_depth - start < 2)
+            {
+                throw BaselineJITError("Not enough items on stack");
+            }
+
+            emitOperation(op->op());
+            --m_depth;
+        }
+        else if (call_expr)
+        {
+            auto arity = m_arities.find(call_expr->fid());
+            if (arity == m_arities.end())
+            {
+                std::stringstream ss;
+                ss << "No such function as " << call_expr->fid();
+                throw BaselineJITError(ss.str());
+            }
+
+            if (m_depth - start < arity->second)
+            {
+                throw BaselineJITError("Not enough items on stack to call function");
+            }
+
+            auto external = m_externs.find(call_expr->fid());
+            if (external != m_externs.end())
+            {
+                emitExternCall(external->second, arity->second);
+            }
+            else
+            {
+                emitCall(call_expr->fid());
+                if (arity->second > 0)
+                {
+                    emit(drop, arity->second * 8);
+                }
+            }
+            emit(push_result);
+            m_depth -= arity->second;
+            ++m_depth;
+        }
+        else
+        {
+            expr.accept(this);
+            ++m_depth;
+        }
+    }
+
+    if (m_depth - start > 1)
+    {
+        throw BaselineJITError("Too many items on stack after RPN expression");
+    }
+
+    if (m_depth - start == 0)
+    {
+        throw BaselineJITError("No items on stack after RPN expression");
+    }
+
+    m_depth = start;
+}
+
+void BaselineJIT::visit(const IntExpr &node)
+{
+    emit(push_imm, node.value());
+}
+
+void BaselineJIT::visit(const CallExpr &node)
+{
+    throw BaselineJITError("CallExprs shouldn't be visited");
+}
+
+void BaselineJIT::visit(const DeclExpr &node)
+{
+    node.value().accept(this);
+
+    if (m_slots.find(node.vid()) == m_slots.end())
+    {
+        m_slots[node.vid()] = -8 * ++m_n_locals;
+    }
+    emit(store_slot, m_slots[node.vid()]);
+}
+
+void BaselineJIT::visit(const OpExpr &node)
+{
+    throw BaselineJITError("OpExprs shouldn't be visited");
+}
+
+void BaselineJIT::visit(const IfExpr &node)
+{
+    node.condition().accept(this);
+    size_t branch = emit(branch_unless);
+
+    node.if_forms().accept(this);
+    size_t skip_else = emit(jump);
+
+    m_last_label = m_buffer.size();
+    patchBranch(branch, m_last_label);
+    node.else_forms().accept(this);
+
+    m_last_label = m_buffer.size();
+    patchBranch(skip_else, m_last_label);
+}
+
+void BaselineJIT::compile(const Program &program)
+{
+#if !defined(__x86_64__)
+    throw BaselineJITError("The baseline JIT only supports x86-64");
+#endif
+
+    program.accept(this);
+
+    m_code_size = m_buffer.size();
+    void *code = mmap(NULL, m_code_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+    {
+        throw BaselineJITError("Cannot allocate executable memory");
+    }
+
+    std::memcpy(code, m_buffer.data(), m_code_size);
+    if (mprotect(code, m_code_size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(code, m_code_size);
+        throw BaselineJITError("Cannot make code executable");
+    }
+
+    m_code = static_cast<uint8_t*>(code);
+    m_buffer.clear();
+
+    // Functions are laid out one after another in the order visited.
+    std::vector<std::pair<size_t, std::string> > offsets;
+    for (auto &function : m_functions)
+    {
+        offsets.emplace_back(function.second, function.first);
+    }
+    std::sort(offsets.begin(), offsets.end());
+    for (size_t i = 0; i < offsets.size(); i++)
+    {
+        size_t end = i + 1 < offsets.size() ? offsets[i + 1].first : m_code_size;
+        recordJITFunction(reinterpret_cast<uint64_t>(m_code + offsets[i].first),
+                          end - offsets[i].first, offsets[i].second);
+    }
+}
+
+void BaselineJIT::compileTier(const Program &program, std::vector<FunctionSlot> &slots,
+                              uint64_t threshold, HotHandler handler)
+{
+    m_cells.reset(new TierCell[slots.size()]);
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        TierCell &cell = m_cells[i];
+        cell.target = NULL;
+        cell.calls_left = std::min<uint64_t>(std::max<uint64_t>(threshold, 1),
+                                             std::numeric_limits<int64_t>::max());
+        cell.slot = &slots[i];
+        cell.jit = this;
+        m_tier_cells[slots[i].function->name()] = &cell;
+    }
+    m_hot_handler = std::move(handler);
+
+    compile(program);
+
+    for (auto &cell : m_tier_cells)
+    {
+        cell.second->target.store(m_code + m_functions[cell.first], std::memory_order_release);
+    }
+}
+
+void BaselineJIT::redirect(const FunctionSlot &slot)
+{
+    auto cell = m_tier_cells.find(slot.function->name());
+    auto thunk = m_thunks.find(slot.function->name());
+    if (!m_code || cell == m_tier_cells.end() || thunk == m_thunks.end())
+    {
+        throw BaselineJITError("No such function as " + slot.function->name());
+    }
+
+    cell->second->target.store(m_code + thunk->second, std::memory_order_release);
+}
+
+// Called from baseline code, which exceptions can't unwind through, so a
+// function whose handler fails just stays in baseline code.
+void BaselineJIT::hot(TierCell *cell)
+{
+    try
+    {
+        cell->jit->m_hot_handler(*cell->slot);
+    }
+    catch (std::exception &e)
+    {
+    }
+}
+
+NativeEntry BaselineJIT::entry(const std::string &fid) const
+{
+    auto it = m_entries.find(fid);
+    if (!m_code || it == m_entries.end())
+    {
+        throw BaselineJITError("No such function as " + fid);
+    }
+
+    return reinterpret_cast<NativeEntry>(m_code + it->second);
+}
+
+Value BaselineJIT::run() const
+{
+    return entry("IIII")(NULL);
+}
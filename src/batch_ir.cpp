@@ -0,0 +1,359 @@
+#include <llvm/IR/Verifier.h>
+#include <sstream>
+#include <stack>
+
+#include "batch_ir.hpp"
+#include "codegen_target.hpp"
+
+using namespace li1I;
+
+static void collectCalls(const RPNExpr &node, std::set<std::string> &callees)
+{
+    for (auto &expr : node)
+    {
+        if (auto call = dynamic_cast<const CallExpr*>(&expr))
+        {
+            callees.insert(call->fid());
+        }
+        else if (auto decl = dynamic_cast<const DeclExpr*>(&expr))
+        {
+            collectCalls(decl->value(), callees);
+        }
+        else if (auto if_expr = dynamic_cast<const IfExpr*>(&expr))
+        {
+            collectCalls(if_expr->condition(), callees);
+            collectCalls(if_expr->if_forms(), callees);
+            collectCalls(if_expr->else_forms(), callees);
+        }
+    }
+}
+
+BatchIRGenerator::BatchIRGenerator(llvm::Module &module, unsigned width)
+    : m_module(module), m_context(module.getContext()), m_builder(m_context),
+      m_width(width), m_value_type(llvm::Type::getInt32Ty(m_context)),
+      m_vector_type(llvm::VectorType::get(m_value_type, width)),
+      m_vectorizable(), m_vector_functions(), m_environment(), m_value(nullptr)
+{}
+
+void BatchIRGenerator::generate(const Program &program)
+{
+    program.accept(this);
+    recordTarget(m_module);
+}
+
+// A function is vectorizable once everything it calls is, so anything on a
+// call cycle never is.
+void BatchIRGenerator::findVectorizable(const Program &program)
+{
+    std::map<std::string, std::set<std::string> > callees;
+    for (auto &func : program)
+    {
+        collectCalls(func.expr(), callees[func.name()]);
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto &entry : callees)
+        {
+            if (m_vectorizable.count(entry.first))
+            {
+                continue;
+            }
+
+            bool ready = true;
+            for (auto &callee : entry.second)
+            {
+                ready = ready && m_vectorizable.count(callee);
+            }
+
+            if (ready)
+            {
+                m_vectorizable.insert(entry.first);
+                changed = true;
+            }
+        }
+    }
+}
+
+void BatchIRGenerator::visit(const Program &node)
+{
+    findVectorizable(node);
+
+    for (auto &func : node)
+    {
+        if (isVectorized(func.name()))
+        {
+            std::vector<llvm::Type*> arg_types (func.nArgs(), m_vector_type);
+            llvm::FunctionType *ft = llvm::FunctionType::get(m_vector_type, arg_types, false);
+            m_vector_functions[func.name()] =
+                llvm::Function::Create(ft, llvm::Function::InternalLinkage,
+                                       func.name() + ".vec", &m_module);
+        }
+    }
+
+    for (auto &func : node)
+    {
+        if (isVectorized(func.name()))
+        {
+            func.accept(this);
+        }
+        createBatchEntry(func);
+    }
+}
+
+void BatchIRGenerator::visit(const Function &node)
+{
+    m_environment.clear();
+
+    llvm::Function *f = m_vector_functions[node.name()];
+    auto p_arg = node.begin();
+    for (auto f_arg = f->arg_begin(); p_arg != node.end(); ++f_arg, ++p_arg)
+    {
+        f_arg->setName(p_arg->vid());
+        m_environment[p_arg->vid()] = &*f_arg;
+    }
+
+    m_builder.SetInsertPoint(llvm::BasicBlock::Create(m_context, "entry", f));
+    m_builder.CreateRet(codegen(node.expr()));
+
+    llvm::verifyFunction(*f);
+}
+
+void BatchIRGenerator::createBatchEntry(const Function &node)
+{
+    llvm::Type *size_type = llvm::Type::getInt64Ty(m_context);
+    llvm::Type *value_ptr_type = m_value_type->getPointerTo();
+    llvm::FunctionType *ft =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(m_context),
+                                {value_ptr_type->getPointerTo(), value_ptr_type, size_type},
+                                false);
+    llvm::Function *f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage,
+                                               node.name() + "_batch", &m_module);
+
+    auto f_arg = f->arg_begin();
+    llvm::Value *args = &*f_arg++;
+    llvm::Value *out = &*f_arg++;
+    llvm::Value *n = &*f_arg;
+    args->setName("args");
+    out->setName("out");
+    n->setName("n");
+
+    llvm::BasicBlock *entry = llvm::BasicBlock::Create(m_context, "entry", f);
+    llvm::BasicBlock *scalar_check = llvm::BasicBlock::Create(m_context, "scalar.check", f);
+    llvm::BasicBlock *scalar_body = llvm::BasicBlock::Create(m_context, "scalar.body", f);
+    llvm::BasicBlock *exit = llvm::BasicBlock::Create(m_context, "exit", f);
+
+    m_builder.SetInsertPoint(entry);
+    std::vector<llvm::Value*> columns;
+    for (unsigned k = 0; k < node.nArgs(); k++)
+    {
+        llvm::Value *column_ptr = m_builder.CreateConstGEP1_32(value_ptr_type, args, k);
+        columns.push_back(m_builder.CreateLoad(value_ptr_type, column_ptr, "column"));
+    }
+
+    llvm::Value *zero = llvm::ConstantInt::get(size_type, 0);
+    llvm::BasicBlock *vector_exit = entry;
+    llvm::Value *vector_end = zero;
+
+    if (isVectorized(node.name()))
+    {
+        llvm::BasicBlock *vector_check = llvm::BasicBlock::Create(m_context, "vector.check", f, scalar_check);
+        llvm::BasicBlock *vector_body = llvm::BasicBlock::Create(m_context, "vector.body", f, scalar_check);
+        llvm::Value *width = llvm::ConstantInt::get(size_type, m_width);
+        llvm::Type *vector_ptr_type = m_vector_type->getPointerTo();
+
+        m_builder.CreateBr(vector_check);
+        m_builder.SetInsertPoint(vector_check);
+        llvm::PHINode *i = m_builder.CreatePHI(size_type, 2, "i");
+        i->addIncoming(zero, entry);
+        llvm::Value *remaining = m_builder.CreateSub(n, i);
+        m_builder.CreateCondBr(m_builder.CreateICmpUGE(remaining, width), vector_body, scalar_check);
+
+        m_builder.SetInsertPoint(vector_body);
+        std::vector<llvm::Value*> vector_args;
+        for (llvm::Value *column : columns)
+        {
+            llvm::Value *ptr = m_builder.CreateGEP(m_value_type, column, i);
+            ptr = m_builder.CreateBitCast(ptr, vector_ptr_type);
+            vector_args.push_back(m_builder.CreateAlignedLoad(m_vector_type, ptr, llvm::MaybeAlign(4)));
+        }
+        llvm::Value *result = m_builder.CreateCall(m_vector_functions[node.name()], vector_args);
+        llvm::Value *out_ptr = m_builder.CreateGEP(m_value_type, out, i);
+        m_builder.CreateAlignedStore(result, m_builder.CreateBitCast(out_ptr, vector_ptr_type),
+                                     llvm::MaybeAlign(4));
+        i->addIncoming(m_builder.CreateAdd(i, width), vector_body);
+        m_builder.CreateBr(vector_check);
+
+        vector_exit = vector_check;
+        vector_end = i;
+    }
+    else
+    {
+        m_builder.CreateBr(scalar_check);
+    }
+
+    m_builder.SetInsertPoint(scalar_check);
+    llvm::PHINode *i = m_builder.CreatePHI(size_type, 2, "i");
+    i->addIncoming(vector_end, vector_exit);
+    m_builder.CreateCondBr(m_builder.CreateICmpULT(i, n), scalar_body, exit);
+
+    m_builder.SetInsertPoint(scalar_body);
+    std::vector<llvm::Value*> scalar_args;
+    for (llvm::Value *column : columns)
+    {
+        llvm::Value *ptr = m_builder.CreateGEP(m_value_type, column, i);
+        scalar_args.push_back(m_builder.CreateLoad(m_value_type, ptr));
+    }
+    llvm::Value *result = m_builder.CreateCall(m_module.getFunction(node.name()), scalar_args);
+    m_builder.CreateStore(result, m_builder.CreateGEP(m_value_type, out, i));
+    i->addIncoming(m_builder.CreateAdd(i, llvm::ConstantInt::get(size_type, 1)), scalar_body);
+    m_builder.CreateBr(scalar_check);
+
+    m_builder.SetInsertPoint(exit);
+    m_builder.CreateRetVoid();
+
+    llvm::verifyFunction(*f);
+}
+
+void BatchIRGenerator::visit(const VarExpr &node)
+{
+    m_value = m_environment[node.vid()];
+
+    if (!m_value)
+    {
+        std::stringstream ss;
+        ss << "No such variable as " << node.vid();
+        throw IRTransformError(ss.str());
+    }
+}
+
+// Both sides of an IfExpr are evaluated for every lane, so a division on
+// the side a lane doesn't take must not trap: zero divisors are replaced
+// with one.
+llvm::Value *BatchIRGenerator::codegenOperation(Operator op, llvm::Value *lhs, llvm::Value *rhs)
+{
+    llvm::Value *v;
+    switch (op)
+    {
+    case Operator::PLUS: v = m_builder.CreateAdd(lhs, rhs); break;
+    case Operator::MINUS: v = m_builder.CreateSub(lhs, rhs); break;
+    case Operator::TIMES: v = m_builder.CreateMul(lhs, rhs); break;
+    case Operator::DIV:
+    {
+        llvm::Value *zero = llvm::Constant::getNullValue(m_vector_type);
+        llvm::Value *one = m_builder.CreateVectorSplat(m_width, llvm::ConstantInt::get(m_value_type, 1));
+        rhs = m_builder.CreateSelect(m_builder.CreateICmpEQ(rhs, zero), one, rhs);
+        v = m_builder.CreateUDiv(lhs, rhs);
+        break;
+    }
+    case Operator::EXP: v = m_builder.CreateAdd(lhs, rhs); break; //TODO, as in ASTToIRVisitor
+    case Operator::GT: v = m_builder.CreateICmpUGT(lhs, rhs); break;
+    case Operator::LT: v = m_builder.CreateICmpULT(lhs, rhs); break;
+    case Operator::EQ: v = m_builder.CreateICmpEQ(lhs, rhs); break;
+    case Operator::NEQ: v = m_builder.CreateICmpNE(lhs, rhs); break;
+    }
+
+    return m_builder.CreateSExtOrTrunc(v, m_vector_type);
+}
+
+void BatchIRGenerator::visit(const RPNExpr &node)
+{
+    std::stack<llvm::Value*> rpn_stack;
+    for (auto &expr : node)
+    {
+        const OpExpr *op = dynamic_cast<const OpExpr*>(&expr);
+        const CallExpr *call = dynamic_cast<const CallExpr*>(&expr);
+        if (op)
+        {
+            if (rpn_stack.size() < 2)
+            {
+                throw IRTransformError("Not enough items on stack");
+            }
+
+            llvm::Value *rhs = rpn_stack.top();
+            rpn_stack.pop();
+
+            llvm::Value *lhs = rpn_stack.top();
+            rpn_stack.pop();
+
+            rpn_stack.push(codegenOperation(op->op(), lhs, rhs));
+        }
+        else if (call)
+        {
+            llvm::Function *callee = m_vector_functions[call->fid()];
+            if (rpn_stack.size() < callee->arg_size())
+            {
+                throw IRTransformError("Not enough items on stack to call function");
+            }
+
+            std::vector<llvm::Value*> arg_values;
+            for (size_t i = 0; i < callee->arg_size(); i++)
+            {
+                arg_values.push_back(rpn_stack.top());
+                rpn_stack.pop();
+            }
+
+            rpn_stack.push(m_builder.CreateCall(callee, arg_values));
+        }
+        else
+        {
+            rpn_stack.push(codegen(expr));
+        }
+    }
+
+    if (rpn_stack.size() > 1)
+    {
+        throw IRTransformError("Too many items on stack after RPN expression");
+    }
+
+    if (rpn_stack.size() == 0)
+    {
+        throw IRTransformError("No items on stack after RPN expression");
+    }
+
+    m_value = rpn_stack.top();
+}
+
+void BatchIRGenerator::visit(const CallExpr &node)
+{
+    throw IRTransformError("CallExprs shouldn't be visited");
+}
+
+void BatchIRGenerator::visit(const DeclExpr &node)
+{
+    llvm::Value *value = codegen(node.value());
+    m_environment[node.vid()] = value;
+    m_value = value;
+}
+
+void BatchIRGenerator::visit(const OpExpr &node)
+{
+    throw IRTransformError("OpExprs shouldn't be visited");
+}
+
+void BatchIRGenerator::visit(const IfExpr &node)
+{
+    llvm::Value *cond = codegen(node.condition());
+    llvm::Value *mask = m_builder.CreateTrunc(cond, llvm::VectorType::get(m_builder.getInt1Ty(), m_width),
+                                              "ifcond");
+
+    llvm::Value *then_value = codegen(node.if_forms());
+    llvm::Value *else_value = codegen(node.else_forms());
+
+    m_value = m_builder.CreateSelect(mask, then_value, else_value, "iftmp");
+}
+
+void BatchIRGenerator::visit(const IntExpr &node)
+{
+    m_value = m_builder.CreateVectorSplat(m_width, llvm::ConstantInt::get(m_value_type, node.value(), true));
+}
+
+llvm::Value *BatchIRGenerator::codegen(const ASTNode &node)
+{
+    node.accept(this);
+    llvm::Value *value = m_value;
+    m_value = nullptr;
+    return value;
+}
@@ -0,0 +1,337 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#include "batch_runner.hpp"
+#include "batch_ir.hpp"
+#include "ast_to_ir.hpp"
+#include "codegen_target.hpp"
+#include "jit_profiling.hpp"
+
+using namespace li1I;
+
+static const size_t binary_chunk_rows = 1 << 16;
+static const size_t csv_chunk_bytes = 1 << 20;
+static const size_t chunks_per_thread = 4;
+
+BatchRunner::BatchRunner(const Program &program, const std::string &fid, unsigned n_threads)
+    : m_entry(nullptr), m_n_args(0), m_n_threads(n_threads ? n_threads : 1),
+      m_binary(false), m_cursor(nullptr), m_end(nullptr), m_stop(false)
+{
+    const Function *function = nullptr;
+    for (auto &func : program)
+    {
+        if (func.name() == fid)
+        {
+            function = &func;
+        }
+    }
+
+    if (!function)
+    {
+        throw BatchError("No such function as " + fid);
+    }
+
+    m_n_args = function->nArgs();
+    if (m_n_args == 0)
+    {
+        throw BatchError("Function " + fid + " takes no arguments to batch over");
+    }
+
+    m_codegenner.reset(new ASTToIRVisitor);
+    std::unique_ptr<llvm::Module> module {m_codegenner->codegenIR(program)};
+    BatchIRGenerator batch_generator (*module);
+    batch_generator.generate(program);
+
+    std::string error;
+    llvm::EngineBuilder builder(std::move(module));
+    builder.setErrorStr(&error).setOptLevel(llvm::CodeGenOpt::Aggressive);
+    applyTarget(builder);
+    m_engine.reset(builder.create());
+    if (!m_engine)
+    {
+        throw BatchError(error);
+    }
+    registerJITListeners(*m_engine);
+
+    m_entry = reinterpret_cast<BatchEntry>(m_engine->getFunctionAddress(fid + "_batch"));
+}
+
+BatchRunner::~BatchRunner()
+{
+}
+
+void BatchRunner::run(const std::string &input_path, std::ostream &out)
+{
+    auto buffer = llvm::MemoryBuffer::getFile(input_path, -1, false);
+    if (!buffer)
+    {
+        throw BatchError("Could not read " + input_path + ": " + buffer.getError().message());
+    }
+
+    m_binary = llvm::sys::path::extension(input_path) == ".bin";
+    m_cursor = (*buffer)->getBufferStart();
+    m_end = (*buffer)->getBufferEnd();
+    m_stop = false;
+
+    if (m_binary && (*buffer)->getBufferSize() % (m_n_args * sizeof(Value)))
+    {
+        std::stringstream ss;
+        ss << input_path << " is not a whole number of " << m_n_args * sizeof(Value) << " byte rows";
+        throw BatchError(ss.str());
+    }
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < m_n_threads; i++)
+    {
+        workers.emplace_back(&BatchRunner::work, this);
+    }
+
+    size_t rows = 0;
+    std::string error;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_chunk_done.wait(lock, [this]
+        {
+            return m_in_flight.empty() ? m_cursor == m_end : m_in_flight.front().done;
+        });
+        if (m_in_flight.empty())
+        {
+            break;
+        }
+
+        Chunk chunk = std::move(m_in_flight.front());
+        m_in_flight.pop_front();
+        m_space_free.notify_one();
+
+        if (!chunk.error.empty())
+        {
+            std::stringstream ss;
+            ss << input_path << ":" << rows + chunk.rows + 1 << ": " << chunk.error;
+            error = ss.str();
+            m_stop = true;
+            break;
+        }
+
+        lock.unlock();
+        out.write(chunk.output.data(), chunk.output.size());
+        rows += chunk.rows;
+        lock.lock();
+    }
+    m_space_free.notify_all();
+    lock.unlock();
+
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    m_in_flight.clear();
+
+    if (!error.empty())
+    {
+        throw BatchError(error);
+    }
+}
+
+void BatchRunner::work()
+{
+    std::vector<std::vector<Value> > columns (m_n_args);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_space_free.wait(lock, [this]
+        {
+            return m_stop || m_cursor == m_end || m_in_flight.size() < chunks_per_thread * m_n_threads;
+        });
+        if (m_stop || m_cursor == m_end)
+        {
+            return;
+        }
+
+        // Chunks are queued as they are cut, so the writer sees them in
+        // input order whichever thread finishes first.
+        m_in_flight.push_back(Chunk{m_cursor, m_end, 0, std::string(), std::string(), false});
+        Chunk &chunk = m_in_flight.back();
+        nextChunk(chunk);
+        lock.unlock();
+
+        try
+        {
+            evaluate(chunk, columns);
+        }
+        catch (BatchError &e)
+        {
+            chunk.error = e.what();
+        }
+
+        lock.lock();
+        chunk.done = true;
+        m_chunk_done.notify_one();
+    }
+}
+
+// Cuts the next chunk off the front of the input. CSV chunks always end on
+// a line boundary.
+void BatchRunner::nextChunk(Chunk &chunk)
+{
+    size_t remaining = m_end - m_cursor;
+    chunk.begin = m_cursor;
+
+    if (m_binary)
+    {
+        size_t row_size = m_n_args * sizeof(Value);
+        chunk.end = m_cursor + std::min(remaining, binary_chunk_rows * row_size);
+    }
+    else if (remaining <= csv_chunk_bytes)
+    {
+        chunk.end = m_end;
+    }
+    else
+    {
+        const char *newline = static_cast<const char*>(
+            std::memchr(m_cursor + csv_chunk_bytes, '\n', remaining - csv_chunk_bytes));
+        chunk.end = newline ? newline + 1 : m_end;
+    }
+
+    m_cursor = chunk.end;
+}
+
+void BatchRunner::evaluate(Chunk &chunk, std::vector<std::vector<Value> > &columns)
+{
+    for (auto &column : columns)
+    {
+        column.clear();
+    }
+
+    if (m_binary)
+    {
+        parseBinary(chunk, columns);
+    }
+    else
+    {
+        parseCSV(chunk, columns);
+    }
+
+    size_t n = columns[0].size();
+    std::vector<const Value*> args;
+    for (auto &column : columns)
+    {
+        args.push_back(column.data());
+    }
+    std::vector<Value> results (n);
+    m_entry(args.data(), results.data(), n);
+
+    if (m_binary)
+    {
+        chunk.output.assign(reinterpret_cast<const char*>(results.data()), n * sizeof(Value));
+        return;
+    }
+
+    chunk.output.reserve(n * 11);
+    for (Value result : results)
+    {
+        char digits[16];
+        char *p = digits + sizeof(digits);
+        *--p = '\n';
+        uint32_t v = static_cast<uint32_t>(result);
+        do
+        {
+            *--p = '0' + v % 10;
+            v /= 10;
+        } while (v);
+        chunk.output.append(p, digits + sizeof(digits));
+    }
+}
+
+void BatchRunner::parseBinary(Chunk &chunk, std::vector<std::vector<Value> > &columns)
+{
+    size_t row_size = m_n_args * sizeof(Value);
+    chunk.rows = (chunk.end - chunk.begin) / row_size;
+
+    for (size_t k = 0; k < m_n_args; k++)
+    {
+        columns[k].resize(chunk.rows);
+        const char *field = chunk.begin + k * sizeof(Value);
+        for (size_t row = 0; row < chunk.rows; row++, field += row_size)
+        {
+            std::memcpy(&columns[k][row], field, sizeof(Value));
+        }
+    }
+}
+
+// Rows are integers separated by commas, optionally signed, which wrap to
+// 32 bits like every other li1I value. Blank lines are skipped. chunk.rows
+// counts lines, so it gives the position of any error.
+void BatchRunner::parseCSV(Chunk &chunk, std::vector<std::vector<Value> > &columns)
+{
+    const char *p = chunk.begin;
+    for (chunk.rows = 0; p != chunk.end; chunk.rows++)
+    {
+        const char *line_end = static_cast<const char*>(std::memchr(p, '\n', chunk.end - p));
+        if (!line_end)
+        {
+            line_end = chunk.end;
+        }
+
+        auto skipSpace = [&]
+        {
+            while (p != line_end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            {
+                p++;
+            }
+        };
+
+        skipSpace();
+        if (p != line_end)
+        {
+            for (size_t k = 0; k < m_n_args; k++)
+            {
+                if (k > 0)
+                {
+                    if (p == line_end || *p != ',')
+                    {
+                        std::stringstream ss;
+                        ss << "expected " << m_n_args << " values";
+                        throw BatchError(ss.str());
+                    }
+                    p++;
+                    skipSpace();
+                }
+
+                bool negative = p != line_end && *p == '-';
+                if (p != line_end && (*p == '-' || *p == '+'))
+                {
+                    p++;
+                }
+
+                if (p == line_end || *p < '0' || *p > '9')
+                {
+                    throw BatchError("expected an integer");
+                }
+
+                uint32_t value = 0;
+                while (p != line_end && *p >= '0' && *p <= '9')
+                {
+                    value = value * 10 + (*p++ - '0');
+                }
+                columns[k].push_back(static_cast<Value>(negative ? 0u - value : value));
+                skipSpace();
+            }
+
+            if (p != line_end)
+            {
+                std::stringstream ss;
+                ss << "expected " << m_n_args << " values";
+                throw BatchError(ss.str());
+            }
+        }
+
+        p = line_end == chunk.end ? line_end : line_end + 1;
+    }
+}
@@ -1,5 +1,8 @@
 #include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/ModuleSummaryAnalysis.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 // #include "llvm/CodeGen/CommandFlags.h"
 #include "llvm/CodeGen/LinkAllAsmWriterComponents.h"
 #include "llvm/CodeGen/LinkAllCodegenComponents.h"
@@ -17,6 +20,7 @@
 #include "llvm/Support/PluginLoader.h"
 #include "llvm/Support/PrettyStackTrace.h"
 #include "llvm/Support/Signals.h"
+#include "llvm/Support/SmallVectorMemoryBuffer.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/TargetRegistry.h"
@@ -25,6 +29,10 @@
 
 #include "bc_compiler.hpp"
 #include "driver_options.hpp"
+#include "object_cache.hpp"
+#include "codegen_target.hpp"
+#include "optimizer.hpp"
+#include "phase_timer.hpp"
 using namespace llvm;
 using options::opts;
 
@@ -68,77 +76,152 @@ ToolOutputFile *BCCompiler::getOutputStream(const std::string &target_name,
         break;
     }
 
-    ToolOutputFile *out_fd;
-    if(opts->hasArg(options::OPT_c))
+    std::error_code error;
+    sys::fs::OpenFlags open_flags = sys::fs::F_Text;
+    if (binary)
+        open_flags |= sys::fs::F_None;
+    std::string output_file = program_name + '.' + suffix;
+    if (!m_default_output)
     {
-        std::error_code error;
-        sys::fs::OpenFlags open_flags = sys::fs::F_Text;
-        if (binary)
-            open_flags |= sys::fs::F_None;
-        std::string output_file = program_name + '.' + suffix;
         output_file = opts->getLastArgValue(options::OPT_o, output_file);
-        out_fd = new ToolOutputFile(output_file.c_str(), error,
-                                      open_flags);
-        output_path = std::move(output_file);
-        
-        if (error) 
-        {
-            throw BCCompileError ("Failed to open out fd");
-        }
     }
-    else
-    {
-        int fd;
-        SmallString<128> result_path;
-        llvm::sys::fs::createTemporaryFile (program_name, suffix, fd, result_path);
-        out_fd = new ToolOutputFile(result_path.c_str(), fd);
-        output_path = std::move(result_path.c_str());
+    ToolOutputFile *out_fd = new ToolOutputFile(output_file.c_str(), error,
+                                                open_flags);
+    output_path = std::move(output_file);
 
+    if (error)
+    {
+        delete out_fd;
+        throw BCCompileError ("Failed to open out fd");
     }
 
     return out_fd;
 }
 
-std::string BCCompiler::compile(Module *module)
+void BCCompiler::setCache(li1I::DiskObjectCache *cache, std::string key)
 {
+    m_cache = cache;
+    m_cache_key = std::move(key);
+}
 
-    std::string target_triple (module->getTargetTriple());
-    Triple triple (target_triple);
-
-    // Get the target specific parser.
-    std::string error;
-    const Target *target = TargetRegistry::lookupTarget(target_triple,
-                                                        error);
-    if (!target)
+std::unique_ptr<MemoryBuffer> BCCompiler::lookupCache()
+{
+    if (!m_cache || m_file_type != CGFT_ObjectFile)
     {
-        throw BCCompileError(error);
+        return nullptr;
     }
 
+    return m_cache->lookup(m_cache_key);
+}
 
-    TargetOptions options;
-    auto RM = Optional<CodeModel::Model>();
-    std::unique_ptr<TargetMachine>
-        target_machine(target->createTargetMachine(triple.getTriple(),
-                                                  "generic", "", options,
-                                                  NoneType{}, RM, m_opt_level));
-    assert(target_machine.get() && "Could not allocate target machine!");
-
-
-    // Figure out where we are going to send the output.
+std::string BCCompiler::writeOutput(StringRef object, const std::string &program_name)
+{
+    Triple triple (sys::getDefaultTargetTriple());
     std::string output_path;
     std::unique_ptr<ToolOutputFile> out
-        (getOutputStream(target->getName(), triple.getOS(), module->getModuleIdentifier(), output_path));
+        (getOutputStream(triple.getArchName().str(), triple.getOS(), program_name, output_path));
     if (!out)
     {
         throw BCCompileError("Cannot open output file");
     }
 
+    out->os() << object;
+    out->keep();
+
+    return output_path;
+}
+
+std::string BCCompiler::compile(Module *module)
+{
+    std::unique_ptr<MemoryBuffer> object = emit(module);
+    return writeOutput(object->getBuffer(), module->getModuleIdentifier());
+}
+
+std::string BCCompiler::compileBitcode(Module *module, const std::string &suffix)
+{
+    // LTO needs the target's data layout to merge with other modules.
+    TargetMachine *target_machine = getTargetMachine(Triple(module->getTargetTriple()));
+    module->setDataLayout(target_machine->createDataLayout());
+    if (m_optimize)
+    {
+        li1I::optimizeModule(*module, m_optimize, target_machine);
+    }
+
+    // The summary is what lets a ThinLTO link import li1I functions into
+    // other modules without loading all of this one.
+    ProfileSummaryInfo profile_summary (*module);
+    ModuleSummaryIndex index = buildModuleSummaryIndex(*module, nullptr, &profile_summary);
+
+    std::string output_path = module->getModuleIdentifier() + '.' + suffix;
+    if (!m_default_output)
+    {
+        output_path = opts->getLastArgValue(options::OPT_o, output_path).str();
+    }
+
+    std::error_code error;
+    ToolOutputFile out (output_path, error, sys::fs::F_None);
+    if (error)
+    {
+        throw BCCompileError ("Failed to open out fd");
+    }
+
+    li1I::PhaseScope phase("emit bitcode");
+    WriteBitcodeToFile(*module, out.os(), false, &index);
+    out.keep();
+
+    return output_path;
+}
+
+TargetMachine *BCCompiler::getTargetMachine(const Triple &triple)
+{
+    std::string target_triple = triple.getTriple();
+
+    // The target machine is kept for the next module, which is almost
+    // always for the same triple.
+    if (!m_target_machine || m_target_machine->getTargetTriple() != triple)
+    {
+        // Get the target specific parser.
+        std::string error;
+        const Target *target = TargetRegistry::lookupTarget(target_triple,
+                                                            error);
+        if (!target)
+        {
+            throw BCCompileError(error);
+        }
+
+        TargetOptions options;
+        auto RM = Optional<CodeModel::Model>();
+        m_target_machine.reset(target->createTargetMachine(triple.getTriple(),
+                                                           li1I::codegenTarget().cpu,
+                                                           li1I::codegenTarget().features,
+                                                           options,
+                                                           NoneType{}, RM, m_opt_level));
+        assert(m_target_machine.get() && "Could not allocate target machine!");
+    }
+
+    return m_target_machine.get();
+}
+
+std::unique_ptr<MemoryBuffer> BCCompiler::emit(Module *module)
+{
+    Triple triple (module->getTargetTriple());
+    TargetMachine *target_machine = getTargetMachine(triple);
+    module->setDataLayout(target_machine->createDataLayout());
+    if (m_optimize)
+    {
+        li1I::optimizeModule(*module, m_optimize, target_machine);
+    }
+
     // Build up all of the passes that we want to do to the module.
     legacy::PassManager pm;
+    SmallVector<char, 0> buffer;
+    raw_svector_ostream buffer_os(buffer);
 
     {
+        li1I::PhaseScope phase("emit object");
+
         // Ask the target to add backend passes as necessary.
-        if (target_machine->addPassesToEmitFile(pm, out->os(), nullptr, m_file_type))
+        if (target_machine->addPassesToEmitFile(pm, buffer_os, nullptr, m_file_type))
         {
             throw BCCompileError("Target does not support generation of this file type");
         }
@@ -146,7 +229,12 @@ std::string BCCompiler::compile(Module *module)
         pm.run(*module);
     }
 
-    out->keep();
+    std::unique_ptr<MemoryBuffer> object
+        {new SmallVectorMemoryBuffer(std::move(buffer), module->getModuleIdentifier())};
+    if (m_cache && m_file_type == CGFT_ObjectFile)
+    {
+        m_cache->store(m_cache_key, object->getBuffer());
+    }
 
-    return output_path;
+    return object;
 }
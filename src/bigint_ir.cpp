@@ -0,0 +1,223 @@
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <utility>
+#include <vector>
+
+#include "bigint_ir.hpp"
+#include "li1I_bigint.h"
+
+using namespace li1I;
+
+// Small operands are what the inline code is for, so the runtime is laid
+// out of the way.
+static const uint32_t small_weight = 2000;
+static const uint32_t big_weight = 1;
+
+BigintIR::BigintIR(llvm::IRBuilder<> &builder)
+    : m_builder(builder)
+{}
+
+llvm::Type *BigintIR::valueType() const
+{
+    return m_builder.getInt64Ty();
+}
+
+llvm::Constant *BigintIR::constant(Value value) const
+{
+    return m_builder.getInt64((static_cast<uint64_t>(static_cast<int64_t>(value)) << 1) | 1);
+}
+
+// Nothing the runtime writes to is visible to li1I code, so as far as
+// LLVM need know its functions are as pure as the operators they
+// implement.
+llvm::FunctionCallee BigintIR::runtimeFunction(const char *name, llvm::Type *result, size_t n_args)
+{
+    llvm::Module *module = m_builder.GetInsertBlock()->getModule();
+    std::vector<llvm::Type*> args (n_args, valueType());
+    llvm::FunctionCallee callee = module->getOrInsertFunction(
+        name, llvm::FunctionType::get(result, args, false));
+    if (auto function = llvm::dyn_cast<llvm::Function>(callee.getCallee()))
+    {
+        function->setDoesNotThrow();
+        if (!result->isVoidTy())
+        {
+            function->setDoesNotAccessMemory();
+        }
+    }
+    return callee;
+}
+
+llvm::Value *BigintIR::isSmall(llvm::Value *value)
+{
+    return m_builder.CreateTrunc(value, m_builder.getInt1Ty());
+}
+
+// The result of id, an arithmetic with overflow intrinsic, setting
+// overflow to its overflow bit.
+llvm::Value *BigintIR::overflowing(llvm::Intrinsic::ID id, llvm::Value *lhs, llvm::Value *rhs,
+                                   llvm::Value *&overflow)
+{
+    llvm::Value *pair = m_builder.CreateBinaryIntrinsic(id, lhs, rhs);
+    overflow = m_builder.CreateExtractValue(pair, 1);
+    return m_builder.CreateExtractValue(pair, 0);
+}
+
+// With a small x stored as 2x + 1, sums, differences and products of two
+// small values can be worked out from the tagged words with one overflow
+// checked instruction, and tagging keeps their order.
+llvm::Value *BigintIR::operation(Operator op, llvm::Value *lhs, llvm::Value *rhs)
+{
+    llvm::LLVMContext &context = m_builder.getContext();
+    llvm::Function *function = m_builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock *small_block = llvm::BasicBlock::Create(context, "small", function);
+    llvm::BasicBlock *big_block = llvm::BasicBlock::Create(context, "big", function);
+    llvm::BasicBlock *done_block = llvm::BasicBlock::Create(context, "bigint.done", function);
+    llvm::MDBuilder weights (context);
+
+    llvm::Value *small = isSmall(m_builder.CreateAnd(lhs, rhs));
+    if (op == Operator::DIV)
+    {
+        small = m_builder.CreateAnd(small, m_builder.CreateICmpNE(rhs, constant(0)));
+    }
+    m_builder.CreateCondBr(small, small_block, big_block,
+                           weights.createBranchWeights(small_weight, big_weight));
+
+    m_builder.SetInsertPoint(small_block);
+    llvm::Value *one = m_builder.getInt64(1);
+    llvm::Value *overflow = nullptr;
+    llvm::Value *result = nullptr;
+    const char *runtime = nullptr;
+    llvm::CmpInst::Predicate predicate = llvm::CmpInst::ICMP_EQ;
+    switch (op)
+    {
+    case Operator::PLUS:
+    case Operator::EXP:
+        result = overflowing(llvm::Intrinsic::sadd_with_overflow, lhs,
+                             m_builder.CreateSub(rhs, one), overflow);
+        runtime = "li1I_bigint_add";
+        break;
+    case Operator::MINUS:
+        result = overflowing(llvm::Intrinsic::ssub_with_overflow, lhs,
+                             m_builder.CreateSub(rhs, one), overflow);
+        runtime = "li1I_bigint_sub";
+        break;
+    case Operator::TIMES:
+        result = overflowing(llvm::Intrinsic::smul_with_overflow, m_builder.CreateSub(lhs, one),
+                             m_builder.CreateAShr(rhs, one), overflow);
+        result = m_builder.CreateOr(result, one);
+        runtime = "li1I_bigint_mul";
+        break;
+    case Operator::DIV:
+    {
+        // Only the smallest small value divided by -1 overflows.
+        llvm::Value *quotient = m_builder.CreateSDiv(m_builder.CreateAShr(lhs, one),
+                                                     m_builder.CreateAShr(rhs, one));
+        result = overflowing(llvm::Intrinsic::sadd_with_overflow, quotient, quotient, overflow);
+        result = m_builder.CreateOr(result, one);
+        runtime = "li1I_bigint_div";
+        break;
+    }
+    case Operator::GT: predicate = llvm::CmpInst::ICMP_SGT; break;
+    case Operator::LT: predicate = llvm::CmpInst::ICMP_SLT; break;
+    case Operator::EQ: predicate = llvm::CmpInst::ICMP_EQ; break;
+    case Operator::NEQ: predicate = llvm::CmpInst::ICMP_NE; break;
+    }
+
+    if (!runtime)
+    {
+        result = m_builder.CreateSelect(m_builder.CreateICmp(predicate, lhs, rhs),
+                                        constant(-1), constant(0));
+    }
+    small_block = m_builder.GetInsertBlock();
+    if (overflow)
+    {
+        m_builder.CreateCondBr(overflow, big_block, done_block,
+                               weights.createBranchWeights(big_weight, small_weight));
+    }
+    else
+    {
+        m_builder.CreateBr(done_block);
+    }
+
+    m_builder.SetInsertPoint(big_block);
+    llvm::Value *big_result;
+    if (runtime)
+    {
+        big_result = m_builder.CreateCall(runtimeFunction(runtime, valueType(), 2), {lhs, rhs});
+    }
+    else
+    {
+        llvm::Value *order = m_builder.CreateCall(
+            runtimeFunction("li1I_bigint_compare", m_builder.getInt32Ty(), 2), {lhs, rhs});
+        big_result = m_builder.CreateSelect(m_builder.CreateICmp(predicate, order, m_builder.getInt32(0)),
+                                            constant(-1), constant(0));
+    }
+    m_builder.CreateBr(done_block);
+
+    m_builder.SetInsertPoint(done_block);
+    llvm::PHINode *phi = m_builder.CreatePHI(valueType(), 2, "bigint");
+    phi->addIncoming(result, small_block);
+    phi->addIncoming(big_result, big_block);
+    return phi;
+}
+
+llvm::Value *BigintIR::lowBits(llvm::Value *value)
+{
+    llvm::LLVMContext &context = m_builder.getContext();
+    llvm::Function *function = m_builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock *small_block = llvm::BasicBlock::Create(context, "small", function);
+    llvm::BasicBlock *big_block = llvm::BasicBlock::Create(context, "big", function);
+    llvm::BasicBlock *done_block = llvm::BasicBlock::Create(context, "bigint.done", function);
+    m_builder.CreateCondBr(isSmall(value), small_block, big_block,
+                           llvm::MDBuilder(context).createBranchWeights(small_weight, big_weight));
+
+    m_builder.SetInsertPoint(small_block);
+    llvm::Value *small_result = m_builder.CreateTrunc(
+        m_builder.CreateAShr(value, m_builder.getInt64(1)), m_builder.getInt32Ty());
+    m_builder.CreateBr(done_block);
+
+    m_builder.SetInsertPoint(big_block);
+    llvm::Value *big_result = m_builder.CreateCall(
+        runtimeFunction("li1I_bigint_low_bits", m_builder.getInt32Ty(), 1), {value});
+    m_builder.CreateBr(done_block);
+
+    m_builder.SetInsertPoint(done_block);
+    llvm::PHINode *phi = m_builder.CreatePHI(m_builder.getInt32Ty(), 2, "low");
+    phi->addIncoming(small_result, small_block);
+    phi->addIncoming(big_result, big_block);
+    return phi;
+}
+
+llvm::Value *BigintIR::fromInt32(llvm::Value *value)
+{
+    llvm::Value *wide = m_builder.CreateSExt(value, valueType());
+    return m_builder.CreateOr(m_builder.CreateShl(wide, 1), 1);
+}
+
+llvm::Value *BigintIR::isTruthy(llvm::Value *value)
+{
+    return m_builder.CreateTrunc(lowBits(value), m_builder.getInt1Ty());
+}
+
+void BigintIR::print(llvm::Value *value)
+{
+    m_builder.CreateCall(runtimeFunction("li1I_bigint_print", m_builder.getVoidTy(), 1), {value});
+}
+
+void li1I::registerBigintRuntime()
+{
+    static const std::pair<const char*, void*> symbols[] = {
+        {"li1I_bigint_add", reinterpret_cast<void*>(&li1I_bigint_add)},
+        {"li1I_bigint_sub", reinterpret_cast<void*>(&li1I_bigint_sub)},
+        {"li1I_bigint_mul", reinterpret_cast<void*>(&li1I_bigint_mul)},
+        {"li1I_bigint_div", reinterpret_cast<void*>(&li1I_bigint_div)},
+        {"li1I_bigint_compare", reinterpret_cast<void*>(&li1I_bigint_compare)},
+        {"li1I_bigint_low_bits", reinterpret_cast<void*>(&li1I_bigint_low_bits)},
+        {"li1I_bigint_print", reinterpret_cast<void*>(&li1I_bigint_print)},
+    };
+    for (auto &symbol : symbols)
+    {
+        llvm::sys::DynamicLibrary::AddSymbol(symbol.first, symbol.second);
+    }
+}
@@ -0,0 +1,503 @@
+#include <limits>
+#include <sstream>
+
+#include "bytecode.hpp"
+
+using namespace li1I;
+
+static const char *opcodeName(Opcode op)
+{
+    switch (op)
+    {
+    case Opcode::LOADI: return "LOADI";
+    case Opcode::MOVE: return "MOVE";
+    case Opcode::ADD: return "ADD";
+    case Opcode::SUB: return "SUB";
+    case Opcode::MUL: return "MUL";
+    case Opcode::DIV: return "DIV";
+    case Opcode::EXP: return "EXP";
+    case Opcode::GT: return "GT";
+    case Opcode::LT: return "LT";
+    case Opcode::EQ: return "EQ";
+    case Opcode::NEQ: return "NEQ";
+    case Opcode::ADDI: return "ADDI";
+    case Opcode::SUBI: return "SUBI";
+    case Opcode::MULI: return "MULI";
+    case Opcode::DIVI: return "DIVI";
+    case Opcode::EXPI: return "EXPI";
+    case Opcode::GTI: return "GTI";
+    case Opcode::LTI: return "LTI";
+    case Opcode::EQI: return "EQI";
+    case Opcode::NEQI: return "NEQI";
+    case Opcode::JUMP: return "JUMP";
+    case Opcode::JUMPF: return "JUMPF";
+    case Opcode::JNGT: return "JNGT";
+    case Opcode::JNLT: return "JNLT";
+    case Opcode::JNEQ: return "JNEQ";
+    case Opcode::JNNE: return "JNNE";
+    case Opcode::JNGTI: return "JNGTI";
+    case Opcode::JNLTI: return "JNLTI";
+    case Opcode::JNEQI: return "JNEQI";
+    case Opcode::JNNEI: return "JNNEI";
+    case Opcode::CALL: return "CALL";
+    case Opcode::CALLX: return "CALLX";
+    case Opcode::RET: return "RET";
+    case Opcode::RETI: return "RETI";
+    case Opcode::N_OPCODES: break;
+    }
+
+    return "?";
+}
+
+void BytecodeProgram::dump(std::ostream &out) const
+{
+    for (auto &external : externs)
+    {
+        out << "extern " << external.name << " (args " << external.n_args << ")" << std::endl;
+    }
+
+    for (auto &function : functions)
+    {
+        out << function.name << " (args " << function.n_args
+            << ", frame " << function.frame_size << ")" << std::endl;
+
+        for (size_t pc = 0; pc < function.code.size(); ++pc)
+        {
+            const Instruction &inst = function.code[pc];
+            out << "    " << pc << "\t" << opcodeName(inst.op) << "\t"
+                << inst.a << " " << inst.b << " " << inst.c
+                << " #" << inst.imm << " @" << inst.target << std::endl;
+        }
+    }
+}
+
+static Opcode registerOpcode(Operator op)
+{
+    switch (op)
+    {
+    case Operator::PLUS: return Opcode::ADD;
+    case Operator::MINUS: return Opcode::SUB;
+    case Operator::TIMES: return Opcode::MUL;
+    case Operator::DIV: return Opcode::DIV;
+    case Operator::EXP: return Opcode::EXP;
+    case Operator::GT: return Opcode::GT;
+    case Operator::LT: return Opcode::LT;
+    case Operator::EQ: return Opcode::EQ;
+    case Operator::NEQ: return Opcode::NEQ;
+    }
+
+    return Opcode::ADD;
+}
+
+static Opcode immediateOpcode(Operator op)
+{
+    return static_cast<Opcode>(static_cast<uint16_t>(registerOpcode(op))
+                               - static_cast<uint16_t>(Opcode::ADD)
+                               + static_cast<uint16_t>(Opcode::ADDI));
+}
+
+static bool isCommutative(Operator op)
+{
+    switch (op)
+    {
+    case Operator::PLUS:
+    case Operator::TIMES:
+    case Operator::EXP:
+    case Operator::EQ:
+    case Operator::NEQ: return true;
+    default: return false;
+    }
+}
+
+// Maps a compare to the branch which skips the then block if it is false.
+static bool fusedBranch(Opcode compare, Opcode &branch)
+{
+    switch (compare)
+    {
+    case Opcode::GT: branch = Opcode::JNGT; return true;
+    case Opcode::LT: branch = Opcode::JNLT; return true;
+    case Opcode::EQ: branch = Opcode::JNEQ; return true;
+    case Opcode::NEQ: branch = Opcode::JNNE; return true;
+    case Opcode::GTI: branch = Opcode::JNGTI; return true;
+    case Opcode::LTI: branch = Opcode::JNLTI; return true;
+    case Opcode::EQI: branch = Opcode::JNEQI; return true;
+    case Opcode::NEQI: branch = Opcode::JNNEI; return true;
+    default: return false;
+    }
+}
+
+static void collectDeclarations(const RPNExpr &node, std::vector<std::string> &vids)
+{
+    for (auto &expr : node)
+    {
+        if (const DeclExpr *decl = dynamic_cast<const DeclExpr*>(&expr))
+        {
+            collectDeclarations(decl->value(), vids);
+            vids.push_back(decl->vid());
+        }
+        else if (const IfExpr *if_expr = dynamic_cast<const IfExpr*>(&expr))
+        {
+            collectDeclarations(if_expr->condition(), vids);
+            collectDeclarations(if_expr->if_forms(), vids);
+            collectDeclarations(if_expr->else_forms(), vids);
+        }
+    }
+}
+
+size_t BytecodeCompiler::emit(Opcode op, uint16_t a, uint16_t b, uint16_t c, int32_t imm)
+{
+    m_function->code.push_back(Instruction{op, a, b, c, imm, 0});
+    return m_function->code.size() - 1;
+}
+
+uint16_t BytecodeCompiler::temporary(size_t position)
+{
+    size_t reg = m_temporary_base + position;
+    if (reg >= std::numeric_limits<uint16_t>::max())
+    {
+        throw BytecodeError("Too many registers needed in " + m_function->name);
+    }
+
+    if (reg >= m_function->frame_size)
+    {
+        m_function->frame_size = reg + 1;
+    }
+
+    return reg;
+}
+
+void BytecodeCompiler::materialise(const Operand &operand, uint16_t reg)
+{
+    if (operand.is_constant)
+    {
+        emit(Opcode::LOADI, reg, 0, 0, operand.constant);
+    }
+    else if (operand.reg != reg)
+    {
+        emit(Opcode::MOVE, reg, operand.reg);
+    }
+}
+
+// Operands naming a variable's register are only copied out lazily, so do
+// that before the variable is overwritten.
+void BytecodeCompiler::materialiseAliases(uint16_t reg)
+{
+    for (size_t position = 0; position < m_operands.size(); ++position)
+    {
+        Operand &operand = m_operands[position];
+        if (!operand.is_constant && operand.reg == reg)
+        {
+            uint16_t copy = temporary(position);
+            materialise(operand, copy);
+            operand.reg = copy;
+        }
+    }
+}
+
+void BytecodeCompiler::emitOperation(Operator op, const Operand &lhs, const Operand &rhs,
+                                     uint16_t target)
+{
+    if (lhs.is_constant && rhs.is_constant
+        && !(op == Operator::DIV && rhs.constant == 0))
+    {
+        emit(Opcode::LOADI, target, 0, 0, applyOperator(op, lhs.constant, rhs.constant));
+    }
+    else if (!lhs.is_constant && rhs.is_constant)
+    {
+        emit(immediateOpcode(op), target, lhs.reg, 0, rhs.constant);
+    }
+    else if (lhs.is_constant && !rhs.is_constant && isCommutative(op))
+    {
+        emit(immediateOpcode(op), target, rhs.reg, 0, lhs.constant);
+    }
+    else
+    {
+        uint16_t lhs_reg = lhs.reg;
+        uint16_t rhs_reg = rhs.reg;
+        if (lhs.is_constant)
+        {
+            lhs_reg = target;
+            materialise(lhs, lhs_reg);
+        }
+        if (rhs.is_constant)
+        {
+            rhs_reg = temporary(m_operands.size() + 1);
+            materialise(rhs, rhs_reg);
+        }
+        emit(registerOpcode(op), target, lhs_reg, rhs_reg);
+    }
+}
+
+size_t BytecodeCompiler::emitBranchUnless(const Operand &condition)
+{
+    std::vector<Instruction> &code = m_function->code;
+    Opcode branch;
+
+    // A compare whose only use is the branch becomes a compare-and-branch,
+    // unless the compare is the end of an inner IfExpr's else block.
+    if (!condition.is_constant && !code.empty()
+        && m_last_target != code.size()
+        && code.back().a == condition.reg
+        && condition.reg >= m_temporary_base
+        && fusedBranch(code.back().op, branch))
+    {
+        Instruction &compare = code.back();
+        compare.op = branch;
+        compare.a = compare.b;
+        compare.b = compare.c;
+        return code.size() - 1;
+    }
+
+    uint16_t reg = condition.reg;
+    if (condition.is_constant)
+    {
+        reg = temporary(m_operands.size());
+        materialise(condition, reg);
+    }
+    return emit(Opcode::JUMPF, reg);
+}
+
+void BytecodeCompiler::visit(const Program &node)
+{
+    for (auto &external : node.externs())
+    {
+        if (!m_extern_indices.emplace(external->name(), m_program.externs.size()).second)
+        {
+            throw BytecodeError("Function redefinition");
+        }
+        m_program.externs.push_back(BytecodeExtern{external->name(),
+                                                   static_cast<uint16_t>(external->nArgs())});
+    }
+
+    for (auto &func : node)
+    {
+        if (m_extern_indices.count(func.name())
+            || !m_function_indices.emplace(func.name(), m_program.functions.size()).second)
+        {
+            throw BytecodeError("Function redefinition");
+        }
+
+        BytecodeFunction function;
+        function.name = func.name();
+        function.n_args = func.nArgs();
+        function.frame_size = 0;
+        m_program.functions.push_back(std::move(function));
+    }
+
+    auto main = m_function_indices.find("IIII");
+    if (main == m_function_indices.end())
+    {
+        throw BytecodeError("No IIII function");
+    }
+    m_program.main_index = main->second;
+
+    for (auto &func : node)
+    {
+        func.accept(this);
+    }
+}
+
+void BytecodeCompiler::visit(const Function &node)
+{
+    m_function = &m_program.functions[m_function_indices[node.name()]];
+    m_variables.clear();
+    m_operands.clear();
+    m_last_target = 0;
+
+    uint16_t reg = 0;
+    for (auto &arg : node)
+    {
+        m_variables[arg.vid()] = reg++;
+    }
+
+    std::vector<std::string> declarations;
+    collectDeclarations(node.expr(), declarations);
+    for (auto &vid : declarations)
+    {
+        if (m_variables.emplace(vid, reg).second)
+        {
+            ++reg;
+        }
+    }
+
+    m_temporary_base = reg;
+    m_function->frame_size = reg;
+
+    Operand result = compileRPN(node.expr());
+    if (result.is_constant)
+    {
+        emit(Opcode::RETI, 0, 0, 0, result.constant);
+    }
+    else
+    {
+        emit(Opcode::RET, result.reg);
+    }
+}
+
+void BytecodeCompiler::visit(const VarExpr &node)
+{
+    auto it = m_variables.find(node.vid());
+    if (it == m_variables.end())
+    {
+        std::stringstream ss;
+        ss << "No such variable as " << node.vid();
+        throw BytecodeError(ss.str());
+    }
+
+    m_operands.push_back(Operand{false, it->second, 0});
+}
+
+void BytecodeCompiler::visit(const RPNExpr &node)
+{
+    size_t start = m_operands.size();
+
+    for (auto &expr : node)
+    {
+        const OpExpr *op = dynamic_cast<const OpExpr*>(&expr);
+        const CallExpr *call = dynamic_cast<const CallExpr*>(&expr);
+        if (op)
+        {
+            if (m_operands.size() - start < 2)
+            {
+                throw BytecodeError("Not enough items on stack");
+            }
+
+            Operand rhs = m_operands.back();
+            m_operands.pop_back();
+            Operand lhs = m_operands.back();
+            m_operands.pop_back();
+
+            uint16_t target = temporary(m_operands.size());
+            emitOperation(op->op(), lhs, rhs, target);
+            m_operands.push_back(Operand{false, target, 0});
+        }
+        else if (call)
+        {
+            auto callee = m_function_indices.find(call->fid());
+            auto external = m_extern_indices.find(call->fid());
+            size_t n_args;
+            if (callee != m_function_indices.end())
+            {
+                n_args = m_program.functions[callee->second].n_args;
+            }
+            else if (external != m_extern_indices.end())
+            {
+                n_args = m_program.externs[external->second].n_args;
+            }
+            else
+            {
+                std::stringstream ss;
+                ss << "No such function as " << call->fid();
+                throw BytecodeError(ss.str());
+            }
+
+            if (m_operands.size() - start < n_args)
+            {
+                throw BytecodeError("Not enough items on stack to call function");
+            }
+
+            // Arguments are copied above the live temporaries, which is
+            // where the callee's frame will start.
+            size_t depth = m_operands.size();
+            uint16_t frame = temporary(depth);
+            for (size_t i = 0; i < n_args; i++)
+            {
+                materialise(m_operands[depth - 1 - i], temporary(depth + i));
+            }
+            m_operands.resize(depth - n_args);
+
+            uint16_t target = temporary(m_operands.size());
+            if (callee != m_function_indices.end())
+            {
+                emit(Opcode::CALL, target, callee->second, frame);
+            }
+            else
+            {
+                emit(Opcode::CALLX, target, external->second, frame);
+            }
+            m_operands.push_back(Operand{false, target, 0});
+        }
+        else
+        {
+            expr.accept(this);
+        }
+    }
+
+    if (m_operands.size() - start > 1)
+    {
+        throw BytecodeError("Too many items on stack after RPN expression");
+    }
+
+    if (m_operands.size() - start == 0)
+    {
+        throw BytecodeError("No items on stack after RPN expression");
+    }
+}
+
+void BytecodeCompiler::visit(const IntExpr &node)
+{
+    m_operands.push_back(Operand{true, 0, node.value()});
+}
+
+void BytecodeCompiler::visit(const CallExpr &node)
+{
+    throw BytecodeError("CallExprs shouldn't be visited");
+}
+
+void BytecodeCompiler::visit(const DeclExpr &node)
+{
+    Operand value = compileRPN(node.value());
+    uint16_t reg = m_variables[node.vid()];
+
+    materialiseAliases(reg);
+    materialise(value, reg);
+    m_operands.push_back(Operand{false, reg, 0});
+}
+
+void BytecodeCompiler::visit(const OpExpr &node)
+{
+    throw BytecodeError("OpExprs shouldn't be visited");
+}
+
+void BytecodeCompiler::visit(const IfExpr &node)
+{
+    // Only one branch runs, so lazily copied operands must be copied first.
+    for (size_t position = 0; position < m_operands.size(); ++position)
+    {
+        Operand &operand = m_operands[position];
+        if (!operand.is_constant && operand.reg < m_temporary_base)
+        {
+            uint16_t copy = temporary(position);
+            materialise(operand, copy);
+            operand.reg = copy;
+        }
+    }
+
+    uint16_t result = temporary(m_operands.size());
+    std::vector<Instruction> &code = m_function->code;
+
+    size_t branch = emitBranchUnless(compileRPN(node.condition()));
+
+    materialise(compileRPN(node.if_forms()), result);
+    size_t jump = emit(Opcode::JUMP, 0);
+    code[branch].target = m_last_target = code.size();
+
+    materialise(compileRPN(node.else_forms()), result);
+    code[jump].target = m_last_target = code.size();
+
+    m_operands.push_back(Operand{false, result, 0});
+}
+
+BytecodeCompiler::Operand BytecodeCompiler::compileRPN(const RPNExpr &node)
+{
+    node.accept(this);
+    Operand operand = m_operands.back();
+    m_operands.pop_back();
+    return operand;
+}
+
+BytecodeProgram BytecodeCompiler::compile(const Program &program)
+{
+    program.accept(this);
+    return std::move(m_program);
+}
@@ -0,0 +1,100 @@
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Support/Host.h>
+
+#include "codegen_target.hpp"
+
+using namespace li1I;
+
+static CodegenTarget the_target {"generic", ""};
+
+std::vector<std::string> CodegenTarget::featureList() const
+{
+    return llvm::SubtargetFeatures(features).getFeatures();
+}
+
+CodegenTarget li1I::selectTarget(llvm::StringRef march, llvm::StringRef mcpu,
+                                 llvm::StringRef mattr)
+{
+    CodegenTarget target {"generic", ""};
+    llvm::SubtargetFeatures features;
+
+    // -march names a CPU on x86, as it does for clang; -mcpu wins if both
+    // are given.
+    llvm::StringRef cpu = mcpu.empty() ? march : mcpu;
+    if (cpu == "native")
+    {
+        target.cpu = llvm::sys::getHostCPUName().str();
+
+        llvm::StringMap<bool> host_features;
+        if (llvm::sys::getHostCPUFeatures(host_features))
+        {
+            for (auto &feature : host_features)
+            {
+                features.AddFeature(feature.getKey(), feature.getValue());
+            }
+        }
+    }
+    else if (!cpu.empty())
+    {
+        target.cpu = cpu.str();
+    }
+
+    llvm::SmallVector<llvm::StringRef, 8> attrs;
+    mattr.split(attrs, ',', -1, false);
+    for (llvm::StringRef attr : attrs)
+    {
+        // Bare names are taken as enabling the feature.
+        if (attr[0] == '+' || attr[0] == '-')
+        {
+            features.AddFeature(attr);
+        }
+        else
+        {
+            features.AddFeature(attr, true);
+        }
+    }
+
+    target.features = features.getString();
+    return target;
+}
+
+const CodegenTarget &li1I::codegenTarget()
+{
+    return the_target;
+}
+
+void li1I::setCodegenTarget(CodegenTarget target)
+{
+    the_target = std::move(target);
+}
+
+void li1I::applyTarget(llvm::EngineBuilder &builder)
+{
+    builder.setMCPU(the_target.cpu);
+    builder.setMAttrs(the_target.featureList());
+}
+
+void li1I::recordTarget(llvm::Module &module)
+{
+    for (llvm::Function &function : module)
+    {
+        if (!function.isDeclaration())
+        {
+            function.addFnAttr("target-cpu", the_target.cpu);
+            if (!the_target.features.empty())
+            {
+                function.addFnAttr("target-features", the_target.features);
+            }
+        }
+    }
+
+    llvm::LLVMContext &context = module.getContext();
+    llvm::NamedMDNode *metadata = module.getOrInsertNamedMetadata("li1I.target");
+    metadata->clearOperands();
+    metadata->addOperand(llvm::MDNode::get(context, {llvm::MDString::get(context, the_target.cpu),
+                                                     llvm::MDString::get(context, the_target.features)}));
+}
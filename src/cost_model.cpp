@@ -0,0 +1,742 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <set>
+
+#include "cost_model.hpp"
+
+using namespace li1I;
+
+static const double unbounded = std::numeric_limits<double>::infinity();
+
+// Deeper than this, callees are costed with their arguments unknown, so
+// long chains of calls with constant arguments don't recurse without end.
+static const unsigned max_level = 64;
+
+static const size_t frame_overhead = 16;
+static const size_t slot_bytes = 8;
+
+bool Symbolic::operator==(const Symbolic &other) const
+{
+    switch (kind)
+    {
+    case Kind::UNKNOWN: return other.kind == Kind::UNKNOWN;
+    case Kind::CONSTANT: return other.kind == kind && other.value == value;
+    default: return other.kind == kind && other.value == value && other.arg == arg;
+    }
+}
+
+static Symbolic unknown()
+{
+    return Symbolic {Symbolic::Kind::UNKNOWN, 0, 0};
+}
+
+static Symbolic constant(Value value)
+{
+    return Symbolic {Symbolic::Kind::CONSTANT, value, 0};
+}
+
+static Symbolic affine(size_t arg, Value offset)
+{
+    return Symbolic {Symbolic::Kind::AFFINE, offset, arg};
+}
+
+static Symbolic combine(Operator op, const Symbolic &lhs, const Symbolic &rhs)
+{
+    using Kind = Symbolic::Kind;
+
+    if (lhs.kind == Kind::CONSTANT && rhs.kind == Kind::CONSTANT)
+    {
+        if (op == Operator::DIV && rhs.value == 0)
+        {
+            return unknown();
+        }
+        return constant(applyOperator(op, lhs.value, rhs.value));
+    }
+
+    if (lhs.kind == Kind::AFFINE && rhs.kind == Kind::CONSTANT)
+    {
+        switch (op)
+        {
+        case Operator::PLUS:
+        case Operator::MINUS:
+        case Operator::EXP:
+            return affine(lhs.arg, applyOperator(op, lhs.value, rhs.value));
+        case Operator::DIV:
+            if (lhs.value != 0 || rhs.value == 0)
+            {
+                return unknown();
+            }
+            if (rhs.value == 1)
+            {
+                return lhs;
+            }
+            return Symbolic {Kind::QUOTIENT, rhs.value, lhs.arg};
+        default:
+            return unknown();
+        }
+    }
+
+    if (lhs.kind == Kind::CONSTANT && rhs.kind == Kind::AFFINE
+        && (op == Operator::PLUS || op == Operator::EXP))
+    {
+        return affine(rhs.arg, applyOperator(op, lhs.value, rhs.value));
+    }
+
+    return unknown();
+}
+
+// Walks one function along every path its ifs could take, with its
+// arguments as given, adding up op_cost for each op and whatever
+// call_cost says each call costs.
+class CostModel::PathWalker
+{
+public:
+    using CallCost = std::function<double(const std::string&, const Context&)>;
+
+    PathWalker(const CostModel &model, double op_cost, CallCost call_cost)
+        : m_model(model), m_op_cost(op_cost), m_call_cost(call_cost)
+    {}
+
+    Range walk(const Function &function, const Context &args)
+    {
+        m_environment.clear();
+        size_t i = 0;
+        for (auto &arg : function)
+        {
+            m_environment[arg.vid()] = i < args.size() ? args[i] : unknown();
+            i++;
+        }
+
+        Symbolic result;
+        return walk(function.expr(), result);
+    }
+
+    const std::vector<std::pair<std::string, Context> > &callSites() const
+    {
+        return m_call_sites;
+    }
+
+    size_t nDecls() const
+    {
+        return m_decls.size();
+    }
+
+private:
+    Range walk(const RPNExpr &rpn, Symbolic &result)
+    {
+        Range range {0, 0};
+        std::vector<Symbolic> stack;
+        auto pop = [&stack]()
+        {
+            if (stack.empty())
+            {
+                return unknown();
+            }
+            Symbolic top = stack.back();
+            stack.pop_back();
+            return top;
+        };
+        auto add = [&range](const Range &other)
+        {
+            range.min += other.min;
+            range.max += other.max;
+        };
+
+        for (auto &expr : rpn)
+        {
+            if (auto op = dynamic_cast<const OpExpr*>(&expr))
+            {
+                Symbolic rhs = pop();
+                Symbolic lhs = pop();
+                stack.push_back(combine(op->op(), lhs, rhs));
+                add(Range {m_op_cost, m_op_cost});
+            }
+            else if (auto call = dynamic_cast<const CallExpr*>(&expr))
+            {
+                auto arity = m_model.m_arities.find(call->fid());
+                size_t n_args = arity == m_model.m_arities.end() ? 0 : arity->second;
+
+                Context args;
+                for (size_t i = 0; i < n_args; i++)
+                {
+                    args.push_back(pop());
+                }
+                m_call_sites.push_back(std::make_pair(call->fid(), args));
+
+                double cost = m_call_cost(call->fid(), args);
+                add(Range {cost, cost});
+                stack.push_back(unknown());
+            }
+            else if (auto integer = dynamic_cast<const IntExpr*>(&expr))
+            {
+                stack.push_back(constant(integer->value()));
+                add(Range {m_op_cost, m_op_cost});
+            }
+            else if (auto var = dynamic_cast<const VarExpr*>(&expr))
+            {
+                auto it = m_environment.find(var->vid());
+                stack.push_back(it == m_environment.end() ? unknown() : it->second);
+                add(Range {m_op_cost, m_op_cost});
+            }
+            else if (auto decl = dynamic_cast<const DeclExpr*>(&expr))
+            {
+                Symbolic value;
+                add(walk(decl->value(), value));
+                add(Range {m_op_cost, m_op_cost});
+                m_environment[decl->vid()] = value;
+                m_decls.insert(decl->vid());
+                stack.push_back(value);
+            }
+            else if (auto if_expr = dynamic_cast<const IfExpr*>(&expr))
+            {
+                Symbolic condition;
+                add(walk(if_expr->condition(), condition));
+
+                Symbolic value;
+                if (condition.kind == Symbolic::Kind::CONSTANT)
+                {
+                    add(walk(isTruthy(condition.value) ? if_expr->if_forms()
+                                                       : if_expr->else_forms(), value));
+                }
+                else
+                {
+                    auto before = m_environment;
+                    Range then_range = walk(if_expr->if_forms(), value);
+                    auto after_then = m_environment;
+
+                    m_environment = before;
+                    Symbolic else_value;
+                    Range else_range = walk(if_expr->else_forms(), else_value);
+
+                    for (auto &binding : m_environment)
+                    {
+                        auto it = after_then.find(binding.first);
+                        if (it == after_then.end() || it->second != binding.second)
+                        {
+                            binding.second = unknown();
+                        }
+                    }
+                    for (auto &binding : after_then)
+                    {
+                        if (!m_environment.count(binding.first))
+                        {
+                            m_environment[binding.first] = unknown();
+                        }
+                    }
+
+                    if (value != else_value)
+                    {
+                        value = unknown();
+                    }
+                    add(Range {std::min(then_range.min, else_range.min),
+                               std::max(then_range.max, else_range.max)});
+                }
+                stack.push_back(value);
+            }
+        }
+
+        result = stack.empty() ? unknown() : stack.back();
+        return range;
+    }
+
+    const CostModel &m_model;
+    double m_op_cost;
+    CallCost m_call_cost;
+
+    std::map<std::string, Symbolic> m_environment;
+    std::set<std::string> m_decls;
+    std::vector<std::pair<std::string, Context> > m_call_sites;
+};
+
+static std::vector<Symbolic> freeArgs(size_t n_args)
+{
+    std::vector<Symbolic> args;
+    for (size_t i = 0; i < n_args; i++)
+    {
+        args.push_back(affine(i, 0));
+    }
+    return args;
+}
+
+CostModel::CostModel(const Program &program)
+    : m_name(program.name()), m_fids(), m_arities(), m_costs(), m_components(),
+      m_free_costs(), m_costs_memo()
+{
+    for (auto &ext : program.externs())
+    {
+        m_arities[ext->name()] = ext->nArgs();
+    }
+    for (auto &function : program)
+    {
+        m_fids.push_back(function.name());
+        m_arities[function.name()] = function.nArgs();
+    }
+
+    for (auto &function : program)
+    {
+        FunctionCost &cost = m_costs[function.name()];
+        cost.function = &function;
+
+        PathWalker ops_walker(*this, 1, [](const std::string&, const Context&) { return 1.0; });
+        cost.ops = ops_walker.walk(function, freeArgs(function.nArgs()));
+        cost.call_sites = ops_walker.callSites();
+        cost.frame_bytes = frame_overhead + slot_bytes * (function.nArgs() + ops_walker.nDecls());
+
+        PathWalker calls_walker(*this, 0, [](const std::string&, const Context&) { return 1.0; });
+        cost.calls = calls_walker.walk(function, freeArgs(function.nArgs()));
+    }
+
+    findComponents();
+    for (size_t i = 0; i < m_components.size(); i++)
+    {
+        analyseComponent(i);
+    }
+}
+
+// Tarjan's algorithm, without recursing so that long call chains don't
+// overflow the stack. Components come out callees first.
+void CostModel::findComponents()
+{
+    std::map<std::string, size_t> index;
+    for (size_t i = 0; i < m_fids.size(); i++)
+    {
+        index[m_fids[i]] = i;
+    }
+
+    std::vector<std::vector<size_t> > edges (m_fids.size());
+    for (size_t i = 0; i < m_fids.size(); i++)
+    {
+        for (auto &site : m_costs.at(m_fids[i]).call_sites)
+        {
+            auto it = index.find(site.first);
+            if (it != index.end())
+            {
+                edges[i].push_back(it->second);
+            }
+        }
+    }
+
+    const size_t unvisited = std::numeric_limits<size_t>::max();
+    std::vector<size_t> order (m_fids.size(), unvisited);
+    std::vector<size_t> low (m_fids.size(), 0);
+    std::vector<bool> on_stack (m_fids.size(), false);
+    std::vector<size_t> stack;
+    size_t next_order = 0;
+
+    for (size_t root = 0; root < m_fids.size(); root++)
+    {
+        if (order[root] != unvisited)
+        {
+            continue;
+        }
+
+        std::vector<std::pair<size_t, size_t> > work {{root, 0}};
+        while (!work.empty())
+        {
+            size_t node = work.back().first;
+            size_t &edge = work.back().second;
+
+            if (edge == 0)
+            {
+                order[node] = low[node] = next_order++;
+                stack.push_back(node);
+                on_stack[node] = true;
+            }
+
+            if (edge < edges[node].size())
+            {
+                size_t callee = edges[node][edge++];
+                if (order[callee] == unvisited)
+                {
+                    work.push_back(std::make_pair(callee, 0));
+                }
+                else if (on_stack[callee])
+                {
+                    low[node] = std::min(low[node], order[callee]);
+                }
+                continue;
+            }
+
+            if (low[node] == order[node])
+            {
+                Component component {};
+                component.shrinking_arg = -1;
+
+                size_t member;
+                do
+                {
+                    member = stack.back();
+                    stack.pop_back();
+                    on_stack[member] = false;
+                    component.members.push_back(m_fids[member]);
+                    m_costs.at(m_fids[member]).component = m_components.size();
+                }
+                while (member != node);
+
+                std::reverse(component.members.begin(), component.members.end());
+                component.recursive = component.members.size() > 1
+                    || std::find(edges[node].begin(), edges[node].end(), node) != edges[node].end();
+                m_components.push_back(component);
+            }
+
+            work.pop_back();
+            if (!work.empty())
+            {
+                size_t caller = work.back().first;
+                low[caller] = std::min(low[caller], low[node]);
+            }
+        }
+    }
+}
+
+void CostModel::analyseComponent(size_t index)
+{
+    Component &component = m_components[index];
+    auto within = [this, index](const std::string &fid)
+    {
+        auto it = m_costs.find(fid);
+        return it != m_costs.end() && it->second.component == index;
+    };
+
+    if (component.recursive)
+    {
+        size_t n_args = std::numeric_limits<size_t>::max();
+        for (auto &fid : component.members)
+        {
+            const FunctionCost &cost = m_costs.at(fid);
+            n_args = std::min(n_args, cost.function->nArgs());
+
+            PathWalker walker(*this, 0, [&within](const std::string &callee, const Context&)
+            {
+                return within(callee) ? 1.0 : 0.0;
+            });
+            component.branching = std::max(component.branching,
+                                           walker.walk(*cost.function,
+                                                       freeArgs(cost.function->nArgs())).max);
+        }
+
+        // Prefer an argument which is divided on every call, then whichever
+        // shrinks by the most.
+        for (size_t k = 0; k < n_args; k++)
+        {
+            bool shrinks = true;
+            bool divides = true;
+            uint32_t step = std::numeric_limits<uint32_t>::max();
+            for (auto &fid : component.members)
+            {
+                for (auto &site : m_costs.at(fid).call_sites)
+                {
+                    if (!within(site.first))
+                    {
+                        continue;
+                    }
+
+                    const Symbolic &arg = site.second.at(k);
+                    if (arg.kind == Symbolic::Kind::AFFINE && arg.arg == k && arg.value < 0)
+                    {
+                        divides = false;
+                        step = std::min(step, static_cast<uint32_t>(-static_cast<int64_t>(arg.value)));
+                    }
+                    else if (arg.kind == Symbolic::Kind::QUOTIENT && arg.arg == k
+                             && static_cast<uint32_t>(arg.value) >= 2)
+                    {
+                        step = std::min(step, static_cast<uint32_t>(arg.value));
+                    }
+                    else
+                    {
+                        shrinks = false;
+                    }
+                }
+            }
+
+            if (!shrinks)
+            {
+                continue;
+            }
+            if (!divides)
+            {
+                // Dividing only takes one off when it gets down to one.
+                for (auto &fid : component.members)
+                {
+                    for (auto &site : m_costs.at(fid).call_sites)
+                    {
+                        if (within(site.first) && site.second.at(k).kind == Symbolic::Kind::QUOTIENT)
+                        {
+                            step = 1;
+                        }
+                    }
+                }
+            }
+
+            bool better = component.shrinking_arg < 0
+                || (divides && !component.divides)
+                || (divides == component.divides
+                    && step > static_cast<uint32_t>(component.step));
+            if (better)
+            {
+                component.shrinking_arg = static_cast<int>(k);
+                component.step = static_cast<Value>(step);
+                component.divides = divides;
+            }
+        }
+    }
+
+    for (auto &fid : component.members)
+    {
+        const FunctionCost &cost = m_costs.at(fid);
+        component.frame_bytes = std::max(component.frame_bytes, cost.frame_bytes);
+
+        double outside_stack = 0;
+        PathWalker walker(*this, 1, [&](const std::string &callee, const Context &args)
+        {
+            if (within(callee))
+            {
+                return 1.0;
+            }
+            auto callee_costs = costs(callee, args, 0);
+            outside_stack = std::max(outside_stack, callee_costs.second);
+            return 1 + callee_costs.first;
+        });
+        component.level_work = std::max(component.level_work,
+                                        walker.walk(*cost.function,
+                                                    freeArgs(cost.function->nArgs())).max);
+        component.outside_stack = std::max(component.outside_stack, outside_stack);
+    }
+
+    for (auto &fid : component.members)
+    {
+        const FunctionCost &cost = m_costs.at(fid);
+        m_free_costs[fid] = computeCosts(cost, freeArgs(cost.function->nArgs()), 0);
+    }
+}
+
+double CostModel::depth(const Component &component, const Context &args) const
+{
+    if (component.shrinking_arg < 0)
+    {
+        return unbounded;
+    }
+
+    const Symbolic &arg = args.at(component.shrinking_arg);
+    if (arg.kind != Symbolic::Kind::CONSTANT)
+    {
+        return unbounded;
+    }
+
+    double value = static_cast<uint32_t>(arg.value);
+    double step = static_cast<uint32_t>(component.step);
+    if (component.divides)
+    {
+        return value < 1 ? 1 : std::floor(std::log(value) / std::log(step)) + 2;
+    }
+    return std::floor(value / step) + 1;
+}
+
+std::pair<double, double> CostModel::costs(const std::string &fid, const Context &args,
+                                           unsigned level) const
+{
+    auto cost = m_costs.find(fid);
+    if (cost == m_costs.end())
+    {
+        return std::make_pair(0.0, 0.0);
+    }
+
+    // Only constant arguments tell anything about a call which the
+    // function's own walk doesn't, so the rest are left unknown.
+    Context context = freeArgs(cost->second.function->nArgs());
+    std::vector<std::pair<bool, Value> > key;
+    bool any_constant = false;
+    for (size_t i = 0; i < context.size() && i < args.size(); i++)
+    {
+        bool is_constant = args[i].kind == Symbolic::Kind::CONSTANT;
+        if (is_constant)
+        {
+            context[i] = args[i];
+            any_constant = true;
+        }
+        key.push_back(std::make_pair(is_constant, is_constant ? args[i].value : 0));
+    }
+
+    if (!any_constant || level > max_level)
+    {
+        auto it = m_free_costs.find(fid);
+        return it == m_free_costs.end() ? std::make_pair(unbounded, unbounded) : it->second;
+    }
+
+    auto memo_key = std::make_pair(fid, key);
+    auto it = m_costs_memo.find(memo_key);
+    if (it != m_costs_memo.end())
+    {
+        return it->second;
+    }
+
+    auto result = computeCosts(cost->second, context, level);
+    m_costs_memo[memo_key] = result;
+    return result;
+}
+
+std::pair<double, double> CostModel::computeCosts(const FunctionCost &cost, const Context &args,
+                                                  unsigned level) const
+{
+    const Component &component = m_components[cost.component];
+    if (component.recursive)
+    {
+        double levels = depth(component, args);
+        if (std::isinf(levels))
+        {
+            return std::make_pair(unbounded, unbounded);
+        }
+
+        double b = component.branching;
+        double activations = b <= 1 ? levels : (std::pow(b, levels) - 1) / (b - 1);
+        return std::make_pair(activations * component.level_work,
+                              levels * component.frame_bytes + component.outside_stack);
+    }
+
+    double deepest = 0;
+    PathWalker walker(*this, 1, [&](const std::string &callee, const Context &callee_args)
+    {
+        auto callee_costs = costs(callee, callee_args, level + 1);
+        deepest = std::max(deepest, callee_costs.second);
+        return 1 + callee_costs.first;
+    });
+    Range work = walker.walk(*cost.function, args);
+    return std::make_pair(work.max, cost.frame_bytes + deepest);
+}
+
+double CostModel::work(const std::string &fid, const std::vector<Value> &args) const
+{
+    Context context;
+    for (Value arg : args)
+    {
+        context.push_back(constant(arg));
+    }
+    return costs(fid, context, 0).first;
+}
+
+double CostModel::stack(const std::string &fid, const std::vector<Value> &args) const
+{
+    Context context;
+    for (Value arg : args)
+    {
+        context.push_back(constant(arg));
+    }
+    return costs(fid, context, 0).second;
+}
+
+std::string CostModel::describeRecursion(const FunctionCost &cost) const
+{
+    const Component &component = m_components[cost.component];
+    if (!component.recursive)
+    {
+        return "-";
+    }
+
+    std::string description;
+    if (component.members.size() == 1)
+    {
+        description = "self";
+    }
+    else
+    {
+        description = "with";
+        for (auto &fid : component.members)
+        {
+            if (fid != cost.function->name())
+            {
+                description += " " + fid;
+            }
+        }
+    }
+
+    char line[256];
+    if (component.shrinking_arg < 0)
+    {
+        description += ", depth unbounded";
+    }
+    else
+    {
+        auto arg = cost.function->begin();
+        for (int i = 0; i < component.shrinking_arg; i++)
+        {
+            ++arg;
+        }
+        uint32_t step = static_cast<uint32_t>(component.step);
+        if (component.divides)
+        {
+            std::snprintf(line, sizeof(line), ", depth <= log%u(%s) + 2", step, arg->vid().c_str());
+        }
+        else
+        {
+            std::snprintf(line, sizeof(line), ", depth <= %s / %u + 1", arg->vid().c_str(), step);
+        }
+        description += line;
+    }
+
+    std::snprintf(line, sizeof(line), ", %.0f call%s per level", component.branching,
+                  component.branching == 1 ? "" : "s");
+    return description + line;
+}
+
+static std::string formatRange(double min, double max)
+{
+    char text[64];
+    if (min == max)
+    {
+        std::snprintf(text, sizeof(text), "%.0f", max);
+    }
+    else
+    {
+        std::snprintf(text, sizeof(text), "%.0f-%.0f", min, max);
+    }
+    return text;
+}
+
+void CostModel::report(std::ostream &out) const
+{
+    char line[512];
+    out << "Static cost of " << m_name
+        << ", in ops (constants, variables, operators, declarations and calls) per call:\n";
+    std::snprintf(line, sizeof(line), "  %-16s %4s %12s %8s %6s  %s\n",
+                  "function", "args", "ops", "calls", "frame", "recursion");
+    out << line;
+
+    for (auto &fid : m_fids)
+    {
+        const FunctionCost &cost = m_costs.at(fid);
+        std::snprintf(line, sizeof(line), "  %-16s %4zu %12s %8s %6zu  %s\n",
+                      fid.c_str(), cost.function->nArgs(),
+                      formatRange(cost.ops.min, cost.ops.max).c_str(),
+                      formatRange(cost.calls.min, cost.calls.max).c_str(),
+                      cost.frame_bytes, describeRecursion(cost).c_str());
+        out << line;
+    }
+
+    if (m_costs.count("IIII"))
+    {
+        double total_work = work("IIII", {});
+        double total_stack = stack("IIII", {});
+        out << "\nRunning the program: ";
+        if (std::isinf(total_work))
+        {
+            out << "unbounded work";
+        }
+        else
+        {
+            std::snprintf(line, sizeof(line), "at most %.4g ops", total_work);
+            out << line;
+        }
+        if (std::isinf(total_stack))
+        {
+            out << ", unbounded stack\n";
+        }
+        else
+        {
+            std::snprintf(line, sizeof(line), " and %.4g bytes of stack\n", total_stack);
+            out << line;
+        }
+    }
+}
@@ -0,0 +1,548 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/IR/Module.h>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "daemon.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "ast_to_ir.hpp"
+#include "batch_ir.hpp"
+#include "object_cache.hpp"
+#include "codegen_target.hpp"
+#include "jit_profiling.hpp"
+
+using namespace li1I;
+
+namespace
+{
+    // Only here to find out how much memory MCJIT's object takes up.
+    class ObjectSizeRecorder : public llvm::ObjectCache
+    {
+    public:
+        ObjectSizeRecorder() : m_size(0) {}
+
+        void notifyObjectCompiled(const llvm::Module *module, llvm::MemoryBufferRef object) override
+        {
+            m_size += object.getBufferSize();
+        }
+
+        std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *module) override
+        {
+            return nullptr;
+        }
+
+        inline size_t size() const { return m_size; }
+
+    private:
+        size_t m_size;
+    };
+
+    class Connection
+    {
+    public:
+        Connection(int fd) : m_fd(fd), m_buffer() {}
+        ~Connection() { close(m_fd); }
+
+        bool readLine(std::string &line)
+        {
+            size_t newline;
+            while ((newline = m_buffer.find('\n')) == std::string::npos)
+            {
+                if (!fill())
+                {
+                    return false;
+                }
+            }
+
+            line = m_buffer.substr(0, newline);
+            m_buffer.erase(0, newline + 1);
+            return true;
+        }
+
+        bool readBytes(size_t n, std::string &bytes)
+        {
+            while (m_buffer.size() < n)
+            {
+                if (!fill())
+                {
+                    return false;
+                }
+            }
+
+            bytes = m_buffer.substr(0, n);
+            m_buffer.erase(0, n);
+            return true;
+        }
+
+        bool write(const std::string &bytes)
+        {
+            for (size_t done = 0; done < bytes.size();)
+            {
+                ssize_t n = ::write(m_fd, bytes.data() + done, bytes.size() - done);
+                if (n < 0 && errno != EINTR)
+                {
+                    return false;
+                }
+                done += n > 0 ? n : 0;
+            }
+            return true;
+        }
+
+    private:
+        bool fill()
+        {
+            char chunk[4096];
+            ssize_t n;
+            do
+            {
+                n = read(m_fd, chunk, sizeof(chunk));
+            } while (n < 0 && errno == EINTR);
+
+            if (n <= 0)
+            {
+                return false;
+            }
+            m_buffer.append(chunk, n);
+            return true;
+        }
+
+        int m_fd;
+        std::string m_buffer;
+    };
+}
+
+static std::string reply(const std::string &status, const std::string &payload)
+{
+    std::stringstream ss;
+    ss << status << " " << payload.size() << "\n" << payload;
+    return ss.str();
+}
+
+// Requests with a source give its length as their last word.
+static bool hasSource(const std::vector<std::string> &request)
+{
+    return !request.empty() && (request[0] == "load" || request[0] == "eval");
+}
+
+// Connections accepted but not yet being served, beyond which accepting
+// waits.
+static const size_t max_waiting_connections = 64;
+
+Daemon::Daemon(std::string socket_path, size_t memory_cap, unsigned n_threads,
+               unsigned time_limit, bool isolate)
+    : m_socket_path(std::move(socket_path)), m_memory_cap(memory_cap),
+      m_n_threads(n_threads), m_time_limit(time_limit), m_isolate(isolate), m_connections(),
+      m_pool(), m_lru(), m_memory(0)
+{
+}
+
+Daemon::~Daemon()
+{
+    unlink(m_socket_path.c_str());
+}
+
+void Daemon::serve()
+{
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        throw DaemonError(std::string("Could not create socket: ") + std::strerror(errno));
+    }
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (m_socket_path.size() >= sizeof(address.sun_path))
+    {
+        throw DaemonError("Socket path too long: " + m_socket_path);
+    }
+    std::strcpy(address.sun_path, m_socket_path.c_str());
+
+    unlink(m_socket_path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+        || listen(listener, 64) < 0)
+    {
+        throw DaemonError("Could not listen on " + m_socket_path + ": " + std::strerror(errno));
+    }
+
+    // A client going away mid-reply shouldn't take the daemon with it.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // The workers never finish, as the daemon is only ever killed.
+    for (unsigned i = 0; i < m_n_threads; i++)
+    {
+        std::thread(&Daemon::work, this).detach();
+    }
+
+    while (true)
+    {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw DaemonError(std::string("accept failed: ") + std::strerror(errno));
+        }
+
+        std::unique_lock<std::mutex> lock(m_connections_mutex);
+        m_connections_changed.wait(lock, [this]
+        {
+            return m_connections.size() < max_waiting_connections;
+        });
+        m_connections.push_back(fd);
+        m_connections_changed.notify_all();
+    }
+}
+
+void Daemon::work()
+{
+    while (true)
+    {
+        int fd;
+        {
+            std::unique_lock<std::mutex> lock(m_connections_mutex);
+            m_connections_changed.wait(lock, [this] { return !m_connections.empty(); });
+            fd = m_connections.front();
+            m_connections.pop_front();
+            m_connections_changed.notify_all();
+        }
+        handle(fd);
+    }
+}
+
+void Daemon::handle(int fd)
+{
+    Connection connection(fd);
+    std::string line;
+    while (connection.readLine(line))
+    {
+        std::vector<std::string> request;
+        std::istringstream words(line);
+        for (std::string word; words >> word;)
+        {
+            request.push_back(word);
+        }
+
+        std::string source;
+        if (hasSource(request))
+        {
+            size_t length;
+            std::istringstream length_word(request.size() > 1 ? request.back() : "");
+            if (!(length_word >> length))
+            {
+                connection.write(reply("error", "Missing source length"));
+                return;
+            }
+            // Checked before reading, so a client can't make the daemon
+            // allocate whatever it likes.
+            if (length > m_memory_cap)
+            {
+                std::stringstream ss;
+                ss << "Source of " << length << " bytes is bigger than the daemon's memory cap";
+                connection.write(reply("error", ss.str()));
+                return;
+            }
+            if (!connection.readBytes(length, source))
+            {
+                connection.write(reply("error", "Truncated source"));
+                return;
+            }
+            request.pop_back();
+        }
+
+        std::string response;
+        try
+        {
+            response = reply("ok", respond(request, source));
+        }
+        catch (std::exception &e)
+        {
+            response = reply("error", e.what());
+        }
+
+        if (!connection.write(response))
+        {
+            return;
+        }
+    }
+}
+
+std::string Daemon::respond(const std::vector<std::string> &request, const std::string &source)
+{
+    if (request.empty())
+    {
+        throw DaemonError("Empty request");
+    }
+
+    const std::string &command = request[0];
+    std::string key;
+    if (command == "load")
+    {
+        load(source, key);
+        return key;
+    }
+
+    std::shared_ptr<CompiledProgram> program;
+    std::vector<std::string> call_args;
+    if (command == "call" && request.size() >= 3)
+    {
+        program = find(request[1]);
+        call_args.assign(request.begin() + 2, request.end());
+    }
+    else if (command == "eval" && request.size() >= 2)
+    {
+        program = load(source, key);
+        call_args.assign(request.begin() + 1, request.end());
+    }
+    else
+    {
+        throw DaemonError("Bad request: " + command);
+    }
+
+    std::vector<std::string> args (call_args.begin() + 1, call_args.end());
+    Value result = call(*program, call_args[0], args);
+    return std::to_string(static_cast<uint32_t>(result));
+}
+
+std::shared_ptr<Daemon::CompiledProgram> Daemon::find(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_pool.find(key);
+    if (it == m_pool.end())
+    {
+        throw DaemonError("No loaded program " + key);
+    }
+
+    m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+    return it->second.program;
+}
+
+std::shared_ptr<Daemon::CompiledProgram> Daemon::load(const std::string &source, std::string &key)
+{
+    key = DiskObjectCache::key(source, "daemon");
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_pool.find(key);
+        if (it != m_pool.end())
+        {
+            m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+            return it->second.program;
+        }
+    }
+
+    // Compiling happens outside the lock, so two connections sending the
+    // same new program may both compile it; the first one in wins.
+    std::shared_ptr<CompiledProgram> program = compile(source);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_pool.find(key);
+    if (it != m_pool.end())
+    {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+        return it->second.program;
+    }
+
+    m_lru.push_front(key);
+    m_pool[key] = PoolEntry{program, m_lru.begin()};
+    m_memory += program->size;
+
+    // Programs still running in another connection stay alive until
+    // they return, through their shared_ptr.
+    while (m_memory > m_memory_cap && m_lru.size() > 1)
+    {
+        auto victim = m_pool.find(m_lru.back());
+        m_memory -= victim->second.program->size;
+        m_pool.erase(victim);
+        m_lru.pop_back();
+    }
+
+    return program;
+}
+
+std::shared_ptr<Daemon::CompiledProgram> Daemon::compile(const std::string &source)
+{
+    std::istringstream in(source);
+    Lexer lexer(in);
+    Parser parser;
+    std::unique_ptr<Program> ast {parser.parse(&lexer, &in, "daemon")};
+
+    auto program = std::make_shared<CompiledProgram>();
+    program->codegenner.reset(new ASTToIRVisitor);
+    std::unique_ptr<llvm::Module> module {program->codegenner->codegenIR(*ast)};
+    BatchIRGenerator batch_generator (*module);
+    batch_generator.generate(*ast);
+
+    std::string error;
+    llvm::EngineBuilder builder(std::move(module));
+    builder.setErrorStr(&error);
+    applyTarget(builder);
+    program->engine.reset(builder.create());
+    if (!program->engine)
+    {
+        throw DaemonError(error);
+    }
+    registerJITListeners(*program->engine);
+
+    ObjectSizeRecorder recorder;
+    program->engine->setObjectCache(&recorder);
+    program->engine->finalizeObject();
+    program->engine->setObjectCache(nullptr);
+    program->size = recorder.size() + source.size();
+
+    for (auto &func : *ast)
+    {
+        uint64_t address = program->engine->getFunctionAddress(func.name() + "_batch");
+        program->entries[func.name()] =
+            EntryPoint{func.nArgs(), reinterpret_cast<decltype(EntryPoint::batch)>(address)};
+    }
+
+    return program;
+}
+
+Value Daemon::call(CompiledProgram &program, const std::string &fid,
+                   const std::vector<std::string> &args)
+{
+    auto it = program.entries.find(fid);
+    if (it == program.entries.end())
+    {
+        throw DaemonError("No such function as " + fid);
+    }
+
+    if (args.size() != it->second.n_args)
+    {
+        std::stringstream ss;
+        ss << fid << " takes " << it->second.n_args << " arguments";
+        throw DaemonError(ss.str());
+    }
+
+    std::vector<Value> values;
+    for (const std::string &arg : args)
+    {
+        size_t end = 0;
+        long long value = 0;
+        try
+        {
+            value = std::stoll(arg, &end);
+        }
+        catch (std::exception &e)
+        {
+        }
+
+        if (end == 0 || end != arg.size())
+        {
+            throw DaemonError("Bad argument " + arg);
+        }
+        values.push_back(static_cast<Value>(static_cast<uint32_t>(value)));
+    }
+
+    return run(it->second, values);
+}
+
+Value Daemon::run(const EntryPoint &entry, std::vector<Value> &args)
+{
+    std::vector<const Value*> columns;
+    for (Value &value : args)
+    {
+        columns.push_back(&value);
+    }
+
+    if (m_isolate)
+    {
+        return runIsolated(entry, columns.data());
+    }
+
+    Value result;
+    entry.batch(columns.data(), &result, 1);
+    return result;
+}
+
+Value Daemon::runIsolated(const EntryPoint &entry, const Value **args)
+{
+    int result_pipe[2];
+    if (pipe(result_pipe) < 0)
+    {
+        throw DaemonError(std::string("Could not create pipe: ") + std::strerror(errno));
+    }
+
+    // The child only runs compiled code and writes its result, so it
+    // doesn't matter what the daemon's other threads held when it forked.
+    pid_t child = fork();
+    if (child < 0)
+    {
+        close(result_pipe[0]);
+        close(result_pipe[1]);
+        throw DaemonError(std::string("Could not fork: ") + std::strerror(errno));
+    }
+    if (child == 0)
+    {
+        close(result_pipe[0]);
+        Value result;
+        entry.batch(args, &result, 1);
+        ssize_t written = write(result_pipe[1], &result, sizeof(result));
+        _exit(written == sizeof(result) ? 0 : 1);
+    }
+    close(result_pipe[1]);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(m_time_limit);
+    bool timed_out = false;
+    while (true)
+    {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        pollfd readable {result_pipe[0], POLLIN, 0};
+        int ready = poll(&readable, 1, std::max<long long>(left, 0));
+        if (ready < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ready == 0)
+        {
+            timed_out = true;
+            kill(child, SIGKILL);
+        }
+        break;
+    }
+
+    Value result = 0;
+    ssize_t n_read = timed_out ? 0 : read(result_pipe[0], &result, sizeof(result));
+    close(result_pipe[0]);
+
+    int status = 0;
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+
+    if (timed_out)
+    {
+        std::stringstream ss;
+        ss << "Call killed after running for " << m_time_limit << " seconds";
+        throw DaemonError(ss.str());
+    }
+    if (WIFSIGNALED(status))
+    {
+        std::stringstream ss;
+        ss << "Call crashed: " << strsignal(WTERMSIG(status));
+        throw DaemonError(ss.str());
+    }
+    if (n_read != sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        throw DaemonError("Call failed without a result");
+    }
+    return result;
+}
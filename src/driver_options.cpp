@@ -5,6 +5,8 @@
 using namespace options;
 using namespace llvm::opt;
 
+InputArgList *options::opts;
+
 #define PREFIX(NAME, VALUE) static const char *const NAME[] = VALUE;
 #include "driver_options.inc"
 #undef PREFIX
@@ -19,5 +21,5 @@ static const OptTable::Info InfoTable[] = {
 };
 
 DriverOptTable::DriverOptTable()
-    : OptTable(InfoTable, llvm::array_lengthof(InfoTable)) {}
+    : OptTable(InfoTable) {}
 
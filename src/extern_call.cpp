@@ -0,0 +1,50 @@
+#include <dlfcn.h>
+#include <sstream>
+
+#include "extern_call.hpp"
+
+using namespace li1I;
+
+void *li1I::findExtern(const std::string &name, size_t n_args)
+{
+    if (n_args > max_extern_args)
+    {
+        std::stringstream ss;
+        ss << "Extern function " << name << " takes " << n_args
+           << " arguments, but only the LLVM backends can pass more than "
+           << max_extern_args;
+        throw ExternError(ss.str());
+    }
+
+    void *address = dlsym(RTLD_DEFAULT, name.c_str());
+    if (!address)
+    {
+        throw ExternError("Cannot find extern function " + name
+                          + ", --load the library defining it");
+    }
+
+    return address;
+}
+
+Value li1I::callExtern(void *function, const Value *args, size_t n_args)
+{
+    using V = Value;
+    switch (n_args)
+    {
+    case 0: return reinterpret_cast<V (*)()>(function)();
+    case 1: return reinterpret_cast<V (*)(V)>(function)(args[0]);
+    case 2: return reinterpret_cast<V (*)(V, V)>(function)(args[0], args[1]);
+    case 3: return reinterpret_cast<V (*)(V, V, V)>(function)(args[0], args[1], args[2]);
+    case 4:
+        return reinterpret_cast<V (*)(V, V, V, V)>(function)(args[0], args[1], args[2],
+                                                             args[3]);
+    case 5:
+        return reinterpret_cast<V (*)(V, V, V, V, V)>(function)(args[0], args[1], args[2],
+                                                                args[3], args[4]);
+    case 6:
+        return reinterpret_cast<V (*)(V, V, V, V, V, V)>(function)(args[0], args[1], args[2],
+                                                                   args[3], args[4], args[5]);
+    }
+
+    throw ExternError("Too many arguments to an extern function");
+}
@@ -0,0 +1,171 @@
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <memory>
+#include <sstream>
+
+#include "incremental.hpp"
+#include "ast_to_ir.hpp"
+#include "bc_compiler.hpp"
+#include "phase_timer.hpp"
+
+using namespace li1I;
+
+// Writes out everything about expr which can change the code generated
+// for it. Callees are written with their arity, as that is all a caller's
+// code depends on. Debug info depends on where everything is as well.
+static void describe(const RPNExpr &node, const std::map<std::string, size_t> &arities,
+                     bool positions, std::ostream &out)
+{
+    out << "(";
+    for (auto &expr : node)
+    {
+        if (positions)
+        {
+            out << " @" << expr.location().line << ":" << expr.location().column;
+        }
+
+        if (auto integer = dynamic_cast<const IntExpr*>(&expr))
+        {
+            out << " int " << integer->value();
+        }
+        else if (auto var = dynamic_cast<const VarExpr*>(&expr))
+        {
+            out << " var " << var->vid();
+        }
+        else if (auto op = dynamic_cast<const OpExpr*>(&expr))
+        {
+            out << " op " << static_cast<int>(op->op());
+        }
+        else if (auto call = dynamic_cast<const CallExpr*>(&expr))
+        {
+            auto arity = arities.find(call->fid());
+            out << " call " << call->fid() << "/";
+            if (arity == arities.end())
+            {
+                out << "?";
+            }
+            else
+            {
+                out << arity->second;
+            }
+        }
+        else if (auto decl = dynamic_cast<const DeclExpr*>(&expr))
+        {
+            out << " decl " << decl->vid() << " ";
+            describe(decl->value(), arities, positions, out);
+        }
+        else if (auto if_expr = dynamic_cast<const IfExpr*>(&expr))
+        {
+            out << " if ";
+            describe(if_expr->condition(), arities, positions, out);
+            describe(if_expr->if_forms(), arities, positions, out);
+            describe(if_expr->else_forms(), arities, positions, out);
+        }
+    }
+    out << " )";
+}
+
+IncrementalBuilder::IncrementalBuilder(std::string build_dir, BCCompiler &bc_compiler,
+                                       std::string config)
+    : m_objects(std::move(build_dir)), m_bc_compiler(bc_compiler),
+      m_config(std::move(config)), m_debug_path(), m_tiny_runtime(false), m_main(true),
+      m_compiled(0)
+{
+}
+
+void IncrementalBuilder::setDebugInfo(std::string source_path)
+{
+    m_debug_path = std::move(source_path);
+}
+
+void IncrementalBuilder::setTinyRuntime(bool enabled)
+{
+    m_tiny_runtime = enabled;
+}
+
+void IncrementalBuilder::setMain(bool enabled)
+{
+    m_main = enabled;
+}
+
+std::string IncrementalBuilder::functionKey(const Function &function,
+                                            const std::map<std::string, size_t> &arities)
+{
+    std::stringstream ss;
+    ss << "function " << function.name();
+    bool positions = !m_debug_path.empty();
+    if (positions)
+    {
+        ss << " @" << function.location().line << ":" << function.location().column;
+    }
+    for (auto &arg : function)
+    {
+        ss << " " << arg.vid();
+    }
+    ss << " ";
+    describe(function.expr(), arities, positions, ss);
+    return DiskObjectCache::key(ss.str(), m_config);
+}
+
+std::vector<std::string> IncrementalBuilder::build(const Program &program,
+                                                   const ProfileData *profile)
+{
+    std::map<std::string, size_t> arities;
+    for (auto &extern_function : program.externs())
+    {
+        arities[extern_function->name()] = extern_function->nArgs();
+    }
+    for (auto &func : program)
+    {
+        arities[func.name()] = func.nArgs();
+    }
+
+    // main only needs IIII to exist with no arguments.
+    auto entry = arities.find("IIII");
+    std::string main_key = DiskObjectCache::key(
+        entry == arities.end() ? "main" : "main IIII/" + std::to_string(entry->second),
+        m_config);
+
+    std::vector<std::string> objects;
+    ASTToIRVisitor codegenner;
+    codegenner.setProfileUse(profile);
+    codegenner.setDebugInfo(m_debug_path);
+    codegenner.setTinyRuntime(m_tiny_runtime);
+    m_compiled = 0;
+
+    auto build_object = [&](const std::string &key, const Function *function)
+    {
+        std::string path = m_objects.path(key);
+        objects.push_back(path);
+        if (llvm::sys::fs::exists(path))
+        {
+            return;
+        }
+
+        std::unique_ptr<llvm::Module> module;
+        {
+            PhaseScope phase("codegen");
+            module.reset(function ? codegenner.codegenFunction(program, *function)
+                                  : codegenner.codegenMain(program));
+        }
+        std::unique_ptr<llvm::MemoryBuffer> object = m_bc_compiler.emit(module.get());
+        m_objects.store(key, object->getBuffer());
+        if (!llvm::sys::fs::exists(path))
+        {
+            throw BCCompileError("Cannot write " + path);
+        }
+        m_compiled++;
+    };
+
+    for (auto &func : program)
+    {
+        build_object(functionKey(func, arities), &func);
+    }
+    if (m_main)
+    {
+        build_object(main_key, nullptr);
+    }
+
+    return objects;
+}
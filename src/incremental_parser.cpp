@@ -0,0 +1,537 @@
+#include <algorithm>
+#include <cctype>
+#include <exception>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#include "incremental_parser.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+using namespace li1I;
+
+using std::string;
+using std::vector;
+
+IncrementalParser::Chunk::Chunk(std::string text, ChunkKind kind)
+    : text(std::move(text)), kind(kind),
+      n_lines(std::count(this->text.begin(), this->text.end(), '\n'))
+{}
+
+IncrementalParser::IncrementalParser(std::string program_name)
+    : m_name(std::move(program_name))
+{
+    indexChunks();
+}
+
+IncrementalParser::~IncrementalParser() {}
+
+bool IncrementalParser::valid() const
+{
+    return m_program && !m_n_broken;
+}
+
+const Program &IncrementalParser::program() const
+{
+    if (!valid())
+    {
+        throw std::logic_error("There is no program, as its source doesn't parse");
+    }
+    return *m_program;
+}
+
+std::string IncrementalParser::source() const
+{
+    string source;
+    source.reserve(size());
+    source += m_header;
+    for (const Chunk &chunk : m_chunks)
+    {
+        source += chunk.text;
+    }
+    source += m_trailer;
+    return source;
+}
+
+size_t IncrementalParser::size() const
+{
+    return m_header.size() + countsBefore(m_chunks.size()).bytes + m_trailer.size();
+}
+
+IncrementalParser::ChunkCounts IncrementalParser::countChunk(const Chunk &chunk) const
+{
+    return {static_cast<int64_t>(chunk.text.size()), chunk.n_lines,
+            chunk.kind == ChunkKind::FUNCTION, chunk.kind == ChunkKind::EXTERN};
+}
+
+// m_counts[i] sums the (i & -i) chunks up to and including chunk i - 1.
+void IncrementalParser::indexChunks()
+{
+    m_counts.assign(m_chunks.size() + 1, ChunkCounts{0, 0, 0, 0});
+    for (size_t i = 1; i < m_counts.size(); i++)
+    {
+        m_counts[i].add(countChunk(m_chunks[i - 1]));
+        size_t parent = i + (i & -i);
+        if (parent < m_counts.size())
+        {
+            m_counts[parent].add(m_counts[i]);
+        }
+    }
+}
+
+void IncrementalParser::addCounts(size_t index, const ChunkCounts &delta)
+{
+    for (size_t i = index + 1; i < m_counts.size(); i += i & -i)
+    {
+        m_counts[i].add(delta);
+    }
+}
+
+IncrementalParser::ChunkCounts IncrementalParser::countsBefore(size_t index) const
+{
+    ChunkCounts counts {0, 0, 0, 0};
+    for (size_t i = index; i > 0; i -= i & -i)
+    {
+        counts.add(m_counts[i]);
+    }
+    return counts;
+}
+
+// The chunk offset bytes after the header is in, or the number of chunks
+// if it is past them.
+size_t IncrementalParser::findChunk(size_t offset) const
+{
+    size_t step = 1;
+    while (step * 2 < m_counts.size())
+    {
+        step *= 2;
+    }
+
+    size_t index = 0;
+    int64_t remaining = offset;
+    for (; step; step /= 2)
+    {
+        if (index + step < m_counts.size() && m_counts[index + step].bytes <= remaining)
+        {
+            index += step;
+            remaining -= m_counts[index].bytes;
+        }
+    }
+    return index;
+}
+
+// As the lexer would have it at the start of the chunk, which is only
+// ever needed near an edit, so the column is found from the chunks just
+// before it.
+TokenLocation IncrementalParser::chunkLocation(size_t index) const
+{
+    ChunkCounts before = countsBefore(index);
+    TokenLocation location {};
+    location.file_pos = m_header.size() + before.bytes;
+    location.line = std::count(m_header.begin(), m_header.end(), '\n') + before.lines;
+
+    for (size_t i = index; i > 0; i--)
+    {
+        const string &text = m_chunks[i - 1].text;
+        size_t newline = text.rfind('\n');
+        if (newline != string::npos)
+        {
+            location.column += text.size() - newline - 1;
+            return location;
+        }
+        location.column += text.size();
+    }
+    size_t newline = m_header.rfind('\n');
+    location.column += newline == string::npos ? m_header.size() : m_header.size() - newline - 1;
+    return location;
+}
+
+// Parses text in place of the chunks from first up to next, noting
+// whether it has a closing brace, after which a full parse would ignore
+// the rest. The lexer is given the rest of the lines at either end too,
+// so errors there can show them.
+vector<Definition> IncrementalParser::parseChunks(size_t first, size_t next,
+                                                  const std::string &text, bool &program_ends) const
+{
+    TokenLocation start = chunkLocation(first);
+    string line_start;
+    for (size_t i = first; i > 0 && line_start.size() < start.column; i--)
+    {
+        const string &before = m_chunks[i - 1].text;
+        size_t n = std::min<size_t>(start.column - line_start.size(), before.size());
+        line_start.insert(0, before, before.size() - n, n);
+    }
+    size_t n = start.column - line_start.size();
+    line_start.insert(0, m_header, m_header.size() - n, n);
+
+    string line_end;
+    for (size_t i = next; i <= m_chunks.size() && line_end.find('\n') == string::npos; i++)
+    {
+        line_end += i < m_chunks.size() ? m_chunks[i].text : m_trailer;
+    }
+    line_end.resize(std::min(line_end.size(), line_end.find('\n')));
+
+    std::istringstream in(line_start + text + line_end);
+    in.seekg(line_start.size());
+    Lexer lexer(in, start, start.file_pos + std::streamoff(text.size()));
+    Parser parser;
+    vector<Definition> definitions = parser.parseDefinitions(&lexer, &in);
+    program_ends = lexer.peekLex().token() != TokenTag::END;
+    return definitions;
+}
+
+void IncrementalParser::replaceChunks(size_t first, size_t count, vector<Chunk> chunks)
+{
+    for (size_t i = first; i < first + count; i++)
+    {
+        m_n_broken -= m_chunks[i].kind == ChunkKind::BROKEN;
+    }
+    for (const Chunk &chunk : chunks)
+    {
+        m_n_broken += chunk.kind == ChunkKind::BROKEN;
+    }
+
+    if (chunks.size() == count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            ChunkCounts delta = countChunk(chunks[i]);
+            delta.add(countChunk(m_chunks[first + i]), -1);
+            m_chunks[first + i] = std::move(chunks[i]);
+            addCounts(first + i, delta);
+        }
+        return;
+    }
+
+    m_chunks.erase(m_chunks.begin() + first, m_chunks.begin() + first + count);
+    m_chunks.insert(m_chunks.begin() + first, std::make_move_iterator(chunks.begin()),
+                    std::make_move_iterator(chunks.end()));
+    indexChunks();
+}
+
+// A chunk without the whitespace after its definition, which is what
+// tells whether the definition has changed.
+static string definitionText(const string &text)
+{
+    size_t end = text.size();
+    while (end && isspace(static_cast<unsigned char>(text[end - 1])))
+    {
+        end--;
+    }
+    return text.substr(0, end);
+}
+
+// Replaces count items from first with items, moving them into place
+// rather than shifting the rest when there are as many.
+template <typename T>
+static void replaceRange(vector<std::unique_ptr<T> > &all, size_t first, size_t count,
+                         vector<std::unique_ptr<T> > items)
+{
+    if (items.size() == count)
+    {
+        std::move(items.begin(), items.end(), all.begin() + first);
+        return;
+    }
+    all.erase(all.begin() + first, all.begin() + first + count);
+    all.insert(all.begin() + first, std::make_move_iterator(items.begin()),
+               std::make_move_iterator(items.end()));
+}
+
+template <typename T>
+static vector<std::unique_ptr<T> > takeRange(vector<std::unique_ptr<T> > &all, size_t first,
+                                             size_t count)
+{
+    return vector<std::unique_ptr<T> >(std::make_move_iterator(all.begin() + first),
+                                       std::make_move_iterator(all.begin() + first + count));
+}
+
+DefinitionChanges IncrementalParser::parse(const std::string &source)
+{
+    // The old definitions' text, to tell which have changed.
+    std::unordered_map<string, size_t> old_texts;
+    std::set<string> old_names;
+    if (m_program)
+    {
+        size_t n_functions = 0;
+        size_t n_externs = 0;
+        for (const Chunk &chunk : m_chunks)
+        {
+            if (chunk.kind == ChunkKind::FUNCTION)
+            {
+                old_names.insert(m_program->m_functions[n_functions++]->name());
+                old_texts[definitionText(chunk.text)]++;
+            }
+            else if (chunk.kind == ChunkKind::EXTERN)
+            {
+                old_names.insert(m_program->m_externs[n_externs++]->name());
+                old_texts[definitionText(chunk.text)]++;
+            }
+        }
+    }
+
+    // Until it parses, the source is kept as it is, for the next edit.
+    m_program.reset();
+    m_chunks.clear();
+    m_header = source;
+    m_trailer.clear();
+    m_n_broken = 0;
+    m_n_mains = 0;
+    indexChunks();
+
+    std::istringstream in(source);
+    Lexer lexer(in);
+    Parser parser;
+    m_program.reset(parser.parse(&lexer, &in, m_name));
+
+    vector<std::pair<size_t, ChunkKind> > starts;
+    for (auto &function : m_program->m_functions)
+    {
+        starts.emplace_back(std::streamoff(function->location().file_pos), ChunkKind::FUNCTION);
+        m_n_mains += function->name() == "IIII";
+    }
+    for (auto &extern_function : m_program->m_externs)
+    {
+        starts.emplace_back(std::streamoff(extern_function->location().file_pos), ChunkKind::EXTERN);
+    }
+    std::sort(starts.begin(), starts.end());
+
+    size_t end = std::streamoff(m_program->endLocation().file_pos);
+    m_header = source.substr(0, starts.front().first);
+    m_trailer = source.substr(end);
+    for (size_t i = 0; i < starts.size(); i++)
+    {
+        size_t next = i + 1 < starts.size() ? starts[i + 1].first : end;
+        m_chunks.emplace_back(source.substr(starts[i].first, next - starts[i].first), starts[i].second);
+    }
+    indexChunks();
+
+    DefinitionChanges changes;
+    changes.reparsed_bytes = source.size();
+    std::set<string> names;
+    size_t n_functions = 0;
+    size_t n_externs = 0;
+    for (const Chunk &chunk : m_chunks)
+    {
+        const string &name = chunk.kind == ChunkKind::FUNCTION
+            ? m_program->m_functions[n_functions++]->name()
+            : m_program->m_externs[n_externs++]->name();
+        names.insert(name);
+
+        auto old = old_texts.find(definitionText(chunk.text));
+        if (old != old_texts.end() && old->second)
+        {
+            old->second--;
+        }
+        else
+        {
+            changes.changed.push_back(name);
+        }
+    }
+    for (const string &name : old_names)
+    {
+        if (!names.count(name))
+        {
+            changes.removed.push_back(name);
+        }
+    }
+    return changes;
+}
+
+DefinitionChanges IncrementalParser::edit(const TextEdit &edit)
+{
+    if (edit.offset > size() || edit.length > size() - edit.offset)
+    {
+        throw std::out_of_range("Edit past the end of the source");
+    }
+
+    // Edits to the program around the definitions change what they are
+    // parsed as, so those parse everything again.
+    size_t chunks_start = m_header.size();
+    size_t chunks_end = chunks_start + countsBefore(m_chunks.size()).bytes;
+    if (!m_program || edit.offset <= chunks_start || edit.offset + edit.length >= chunks_end)
+    {
+        string source = this->source();
+        source.replace(edit.offset, edit.length, edit.text);
+        return parse(source);
+    }
+
+    // With the definitions either side too, tokens which the edit runs
+    // into from them are lexed again.
+    size_t first = findChunk(edit.offset - chunks_start);
+    size_t last = findChunk(edit.offset + edit.length - chunks_start);
+    first = first ? first - 1 : 0;
+    last = std::min(last + 1, m_chunks.size() - 1);
+    size_t count = last - first + 1;
+
+    std::streamoff start = m_header.size() + countsBefore(first).bytes;
+    string text;
+    for (size_t i = first; i <= last; i++)
+    {
+        text += m_chunks[i].text;
+    }
+    text.replace(edit.offset - start, edit.length, edit.text);
+
+    DefinitionChanges changes;
+    changes.reparsed_bytes = text.size();
+
+    vector<Definition> definitions;
+    bool program_ends = false;
+    bool error = false;
+    try
+    {
+        definitions = parseChunks(first, last + 1, text, program_ends);
+    }
+    catch (const std::exception &)
+    {
+        error = true;
+    }
+
+    if (program_ends)
+    {
+        string source = this->source();
+        source.replace(edit.offset, edit.length, edit.text);
+        return parse(source);
+    }
+
+    ChunkCounts before = countsBefore(first);
+    ChunkCounts old_counts = countsBefore(last + 1);
+    old_counts.add(before, -1);
+    vector<std::unique_ptr<Function> > old_functions =
+        takeRange(m_program->m_functions, before.functions, old_counts.functions);
+    vector<std::unique_ptr<ExternFunction> > old_externs =
+        takeRange(m_program->m_externs, before.externs, old_counts.externs);
+
+    // Unchanged definitions are found by their text, wherever they moved.
+    std::unordered_map<string, vector<size_t> > old_by_text;
+    vector<size_t> old_index;
+    vector<string> old_names;
+    size_t n_functions = 0;
+    size_t n_externs = 0;
+    for (size_t i = first; i <= last; i++)
+    {
+        const Chunk &chunk = m_chunks[i];
+        if (chunk.kind == ChunkKind::BROKEN)
+        {
+            old_index.push_back(0);
+            old_names.push_back("");
+            continue;
+        }
+        if (chunk.kind == ChunkKind::FUNCTION)
+        {
+            old_index.push_back(n_functions);
+            old_names.push_back(old_functions[n_functions++]->name());
+            m_n_mains -= old_names.back() == "IIII";
+        }
+        else
+        {
+            old_index.push_back(n_externs);
+            old_names.push_back(old_externs[n_externs++]->name());
+        }
+        old_by_text[definitionText(chunk.text)].push_back(i - first);
+    }
+
+    vector<Chunk> chunks;
+    vector<std::unique_ptr<Function> > functions;
+    vector<std::unique_ptr<ExternFunction> > externs;
+    vector<bool> reused (count, false);
+    std::set<string> names;
+    if (error)
+    {
+        chunks.emplace_back(std::move(text), ChunkKind::BROKEN);
+    }
+    else
+    {
+        // Whatever is before the first definition is whitespace, which
+        // belongs with what is before it.
+        size_t prefix = definitions.empty()
+            ? text.size() : std::streamoff(definitions.front().start) - start;
+        if (first)
+        {
+            ChunkCounts delta {static_cast<int64_t>(prefix),
+                               std::count(text.begin(), text.begin() + prefix, '\n'), 0, 0};
+            m_chunks[first - 1].text.append(text, 0, prefix);
+            m_chunks[first - 1].n_lines += delta.lines;
+            addCounts(first - 1, delta);
+        }
+        else
+        {
+            m_header.append(text, 0, prefix);
+        }
+
+        for (size_t i = 0; i < definitions.size(); i++)
+        {
+            Definition &definition = definitions[i];
+            size_t begin = std::streamoff(definition.start) - start;
+            size_t end = i + 1 < definitions.size()
+                ? std::streamoff(definitions[i + 1].start) - start : text.size();
+            Chunk chunk (text.substr(begin, end - begin),
+                         definition.function ? ChunkKind::FUNCTION : ChunkKind::EXTERN);
+
+            size_t old = count;
+            auto found = old_by_text.find(definitionText(chunk.text));
+            if (found != old_by_text.end() && !found->second.empty())
+            {
+                old = found->second.back();
+                found->second.pop_back();
+                reused[old] = true;
+            }
+
+            string name;
+            if (chunk.kind == ChunkKind::FUNCTION)
+            {
+                functions.push_back(old < count ? std::move(old_functions[old_index[old]])
+                                    : std::move(definition.function));
+                name = functions.back()->name();
+                m_n_mains += name == "IIII";
+            }
+            else
+            {
+                externs.push_back(old < count ? std::move(old_externs[old_index[old]])
+                                  : std::move(definition.extern_function));
+                name = externs.back()->name();
+            }
+            if (old == count)
+            {
+                changes.changed.push_back(name);
+            }
+            names.insert(name);
+            chunks.push_back(std::move(chunk));
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!reused[i] && !old_names[i].empty() && !names.count(old_names[i]))
+        {
+            changes.removed.push_back(old_names[i]);
+            names.insert(old_names[i]);
+        }
+    }
+
+    replaceRange(m_program->m_functions, before.functions, old_counts.functions, std::move(functions));
+    replaceRange(m_program->m_externs, before.externs, old_counts.externs, std::move(externs));
+    replaceChunks(first, count, std::move(chunks));
+
+    if (m_n_broken)
+    {
+        // The error is the first in the source, which can be before the
+        // edit, so parsing where it is broken again gives it with the
+        // locations as they are now.
+        size_t broken = 0;
+        while (m_chunks[broken].kind != ChunkKind::BROKEN)
+        {
+            broken++;
+        }
+        parseChunks(broken, broken + 1, m_chunks[broken].text, program_ends);
+        return parse(source());
+    }
+    if (!m_n_mains)
+    {
+        return parse(source());
+    }
+    return changes;
+}
@@ -0,0 +1,298 @@
+#include <sstream>
+#include <vector>
+
+#include "interpreter.hpp"
+#include "extern_call.hpp"
+
+using namespace li1I;
+
+Interpreter::Interpreter(const Program &program)
+    : m_slots(), m_slot_indices(), m_externs(), m_environment(), m_hot_threshold(0),
+      m_hot_handler(), m_calls_left(0), m_max_depth(0), m_depth(0), m_value(0)
+{
+    size_t n_functions = 0;
+    for (auto it = program.begin(); it != program.end(); ++it)
+    {
+        ++n_functions;
+    }
+
+    m_slots = std::vector<FunctionSlot>(n_functions);
+
+    for (auto &external : program.externs())
+    {
+        if (!m_externs.emplace(external->name(), ExternSlot{external->nArgs(), NULL}).second)
+        {
+            throw InterpretError("Function redefinition");
+        }
+    }
+
+    size_t index = 0;
+    for (auto &func : program)
+    {
+        FunctionSlot &slot = m_slots[index];
+        slot.function = &func;
+        slot.calls = 0;
+        slot.back_edges = 0;
+        slot.active = 0;
+        slot.native = NULL;
+
+        if (m_externs.count(func.name()) || !m_slot_indices.emplace(func.name(), index).second)
+        {
+            throw InterpretError("Function redefinition");
+        }
+        ++index;
+    }
+}
+
+void Interpreter::setHotHandler(uint64_t threshold, HotHandler handler)
+{
+    m_hot_threshold = threshold;
+    m_hot_handler = std::move(handler);
+}
+
+void Interpreter::setBudget(uint64_t max_calls, size_t max_depth)
+{
+    m_calls_left = max_calls;
+    m_max_depth = max_depth;
+    m_depth = 0;
+    m_environment.clear();
+    for (auto &slot : m_slots)
+    {
+        slot.active = 0;
+    }
+}
+
+FunctionSlot &Interpreter::slot(const std::string &fid)
+{
+    auto it = m_slot_indices.find(fid);
+    if (it == m_slot_indices.end())
+    {
+        std::stringstream ss;
+        ss << "No such function as " << fid;
+        throw InterpretError(ss.str());
+    }
+
+    return m_slots[it->second];
+}
+
+Value Interpreter::run()
+{
+    return call(slot("IIII"), {});
+}
+
+Value Interpreter::call(FunctionSlot &slot, const std::vector<Value> &args)
+{
+    if (m_max_depth)
+    {
+        if (m_calls_left == 0 || m_depth >= m_max_depth)
+        {
+            throw BudgetError("Evaluation budget exhausted in " + slot.function->name());
+        }
+        --m_calls_left;
+    }
+
+    uint64_t previous_heat = slot.calls + slot.back_edges;
+    ++slot.calls;
+    if (slot.active)
+    {
+        ++slot.back_edges;
+    }
+
+    if (m_hot_handler && previous_heat < m_hot_threshold
+        && slot.calls + slot.back_edges >= m_hot_threshold)
+    {
+        m_hot_handler(slot);
+    }
+
+    NativeEntry native = slot.native.load(std::memory_order_acquire);
+    if (native)
+    {
+        return native(args.data());
+    }
+
+    const Function &function = *slot.function;
+    if (args.size() != function.nArgs())
+    {
+        throw InterpretError("Wrong number of arguments to " + function.name());
+    }
+
+    std::unordered_map<std::string, Value> environment;
+    auto p_arg = function.begin();
+    for (size_t i = 0; p_arg != function.end(); ++i, ++p_arg)
+    {
+        environment[p_arg->vid()] = args[i];
+    }
+
+    std::swap(m_environment, environment);
+    ++slot.active;
+    ++m_depth;
+
+    Value result = evaluate(function.expr());
+
+    --m_depth;
+    --slot.active;
+    std::swap(m_environment, environment);
+
+    return result;
+}
+
+Value Interpreter::callExtern(const std::string &fid, ExternSlot &slot,
+                              const std::vector<Value> &args)
+{
+    if (m_max_depth)
+    {
+        throw InterpretError("Cannot evaluate extern function " + fid);
+    }
+
+    if (!slot.address)
+    {
+        slot.address = findExtern(fid, slot.n_args);
+    }
+    return li1I::callExtern(slot.address, args.data(), args.size());
+}
+
+void Interpreter::visit(const Program &node)
+{
+    m_value = run();
+}
+
+void Interpreter::visit(const Function &node)
+{
+    m_value = call(slot(node.name()), {});
+}
+
+void Interpreter::visit(const VarExpr &node)
+{
+    auto it = m_environment.find(node.vid());
+
+    if (it == m_environment.end())
+    {
+        std::stringstream ss;
+        ss << "No such variable as " << node.vid();
+        throw InterpretError(ss.str());
+    }
+
+    m_value = it->second;
+}
+
+void Interpreter::visit(const RPNExpr &node)
+{
+    std::vector<Value> rpn_stack;
+    for (auto &expr : node)
+    {
+        const OpExpr *op = dynamic_cast<const OpExpr*>(&expr);
+        const CallExpr *call_expr = dynamic_cast<const CallExpr*>(&expr);
+        if (op)
+        {
+            if (rpn_stack.size() < 2)
+            {
+                throw InterpretError("Not enough items on stack");
+            }
+
+            Value rhs = rpn_stack.back();
+            rpn_stack.pop_back();
+
+            Value lhs = rpn_stack.back();
+            rpn_stack.pop_back();
+
+            if (m_max_depth && op->op() == Operator::DIV && rhs == 0)
+            {
+                throw InterpretError("Division by zero");
+            }
+
+            rpn_stack.push_back(applyOperator(op->op(), lhs, rhs));
+        }
+        else if (call_expr)
+        {
+            auto external = m_externs.find(call_expr->fid());
+            FunctionSlot *callee = NULL;
+            size_t n_args;
+            if (external != m_externs.end())
+            {
+                n_args = external->second.n_args;
+            }
+            else
+            {
+                callee = &slot(call_expr->fid());
+                n_args = callee->function->nArgs();
+            }
+
+            if (rpn_stack.size() < n_args)
+            {
+                throw InterpretError("Not enough items on stack to call function");
+            }
+
+            std::vector<Value> arg_values;
+            for (size_t i = 0; i < n_args; i++)
+            {
+                arg_values.push_back(rpn_stack.back());
+                rpn_stack.pop_back();
+            }
+
+            if (callee)
+            {
+                rpn_stack.push_back(call(*callee, arg_values));
+            }
+            else
+            {
+                rpn_stack.push_back(callExtern(call_expr->fid(), external->second, arg_values));
+            }
+        }
+        else
+        {
+            rpn_stack.push_back(evaluate(expr));
+        }
+    }
+
+    if (rpn_stack.size() > 1)
+    {
+        throw InterpretError("Too many items on stack after RPN expression");
+    }
+
+    if (rpn_stack.size() == 0)
+    {
+        throw InterpretError("No items on stack after RPN expression");
+    }
+
+    m_value = rpn_stack.back();
+}
+
+void Interpreter::visit(const IntExpr &node)
+{
+    m_value = node.value();
+}
+
+void Interpreter::visit(const CallExpr &node)
+{
+    throw InterpretError("CallExprs shouldn't be visited");
+}
+
+void Interpreter::visit(const DeclExpr &node)
+{
+    Value value = evaluate(node.value());
+    m_environment[node.vid()] = value;
+    m_value = value;
+}
+
+void Interpreter::visit(const OpExpr &node)
+{
+    throw InterpretError("OpExprs shouldn't be visited");
+}
+
+void Interpreter::visit(const IfExpr &node)
+{
+    if (isTruthy(evaluate(node.condition())))
+    {
+        m_value = evaluate(node.if_forms());
+    }
+    else
+    {
+        m_value = evaluate(node.else_forms());
+    }
+}
+
+Value Interpreter::evaluate(const ASTNode &node)
+{
+    node.accept(this);
+    return m_value;
+}
@@ -0,0 +1,398 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Object/SymbolSize.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <pthread.h>
+#include <set>
+#include <signal.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "jit_profiling.hpp"
+
+using namespace li1I;
+
+static const long sample_interval_us = 1000;
+static const size_t sample_words = 1 << 20;
+static const size_t max_depth = 64;
+
+namespace
+{
+    // Appends to /tmp/perf-<pid>.map, which perf reads when it finds
+    // samples in anonymous executable memory.
+    class PerfMap
+    {
+    public:
+        PerfMap() : m_file(nullptr) {}
+
+        void write(uint64_t address, uint64_t size, const std::string &name)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_file)
+            {
+                char path[64];
+                std::snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+                m_file = std::fopen(path, "w");
+                if (!m_file)
+                {
+                    return;
+                }
+            }
+
+            std::fprintf(m_file, "%llx %llx %s\n", static_cast<unsigned long long>(address),
+                         static_cast<unsigned long long>(size), name.c_str());
+            std::fflush(m_file);
+        }
+
+    private:
+        std::mutex m_mutex;
+        FILE *m_file;
+    };
+
+    bool perf_enabled = false;
+    bool gdb_enabled = false;
+    PerfMap perf_map;
+
+    // MCJIT's engines each notify their own listeners, so a single table
+    // feeds the perf map for all of them.
+    JITSymbolTable perf_symbols;
+
+    // Filled in by the SIGPROF handler, so nothing here may allocate. A
+    // sample is its program counter followed by the return addresses of
+    // the frames below it, up to the outermost JIT compiled one, ending
+    // with a zero.
+    std::vector<uint64_t> samples;
+    std::atomic<size_t> samples_used (0);
+    std::atomic<size_t> samples_taken (0);
+    std::atomic<size_t> samples_dropped (0);
+    uint64_t jit_low = 0;
+    uint64_t jit_high = 0;
+
+    // The stack of the thread which started sampling, which frame
+    // pointers have to stay within to be followed.
+    uint64_t stack_low = 0;
+    uint64_t stack_high = 0;
+}
+
+void JITSymbolTable::notifyObjectLoaded(ObjectKey key, const llvm::object::ObjectFile &object,
+                                        const llvm::RuntimeDyld::LoadedObjectInfo &info)
+{
+    // The debug object has every section at its loaded address.
+    llvm::object::OwningBinary<llvm::object::ObjectFile> debug_object = info.getObjectForDebug(object);
+    const llvm::object::ObjectFile *loaded = debug_object.getBinary();
+    if (!loaded)
+    {
+        return;
+    }
+
+    for (auto &symbol_size : llvm::object::computeSymbolSizes(*loaded))
+    {
+        const llvm::object::SymbolRef &symbol = symbol_size.first;
+        auto type = symbol.getType();
+        auto name = symbol.getName();
+        auto address = symbol.getAddress();
+        if (!type || !name || !address || *type != llvm::object::SymbolRef::ST_Function)
+        {
+            llvm::consumeError(type.takeError());
+            llvm::consumeError(name.takeError());
+            llvm::consumeError(address.takeError());
+            continue;
+        }
+
+        add(*address, symbol_size.second, name->str());
+    }
+}
+
+void JITSymbolTable::add(uint64_t address, uint64_t size, const std::string &name)
+{
+    if (this == &perf_symbols)
+    {
+        perf_map.write(address, size, name);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Symbol symbol {address, size, name};
+    auto it = std::upper_bound(m_symbols.begin(), m_symbols.end(), address,
+                               [](uint64_t a, const Symbol &s) { return a < s.address; });
+    m_symbols.insert(it, std::move(symbol));
+}
+
+void JITSymbolTable::range(uint64_t &low, uint64_t &high) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    low = UINT64_MAX;
+    high = 0;
+    for (const Symbol &symbol : m_symbols)
+    {
+        low = std::min(low, symbol.address);
+        high = std::max(high, symbol.address + symbol.size);
+    }
+}
+
+const JITSymbolTable::Symbol *JITSymbolTable::find(uint64_t address) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = std::upper_bound(m_symbols.begin(), m_symbols.end(), address,
+                               [](uint64_t a, const Symbol &s) { return a < s.address; });
+    if (it == m_symbols.begin())
+    {
+        return nullptr;
+    }
+
+    --it;
+    return address < it->address + std::max<uint64_t>(it->size, 1) ? &*it : nullptr;
+}
+
+void li1I::setPerfListeners(bool enabled)
+{
+    perf_enabled = enabled;
+}
+
+void li1I::setGDBListener(bool enabled)
+{
+    gdb_enabled = enabled;
+}
+
+void li1I::registerJITListeners(llvm::ExecutionEngine &engine)
+{
+    if (gdb_enabled)
+    {
+        engine.RegisterJITEventListener(llvm::JITEventListener::createGDBRegistrationListener());
+    }
+
+    if (!perf_enabled)
+    {
+        return;
+    }
+
+    engine.RegisterJITEventListener(&perf_symbols);
+
+    // Only there when LLVM was built with LLVM_USE_PERF.
+    static llvm::JITEventListener *jitdump = llvm::JITEventListener::createPerfJITEventListener();
+    if (jitdump)
+    {
+        engine.RegisterJITEventListener(jitdump);
+    }
+}
+
+void li1I::recordJITFunction(uint64_t address, uint64_t size, const std::string &name)
+{
+    if (perf_enabled)
+    {
+        perf_symbols.add(address, size, name);
+    }
+}
+
+void li1I::keepFramePointers(llvm::Module &module)
+{
+    for (llvm::Function &function : module)
+    {
+        if (!function.isDeclaration())
+        {
+            function.addFnAttr("frame-pointer", "all");
+        }
+    }
+}
+
+static void takeSample(int signal, siginfo_t *info, void *context)
+{
+#if defined(__x86_64__) && defined(__linux__)
+    const greg_t *registers = static_cast<ucontext_t*>(context)->uc_mcontext.gregs;
+    uint64_t pc = registers[REG_RIP];
+    uint64_t frame = registers[REG_RBP];
+
+    uint64_t stack[max_depth + 1];
+    size_t depth = 0;
+    stack[depth++] = pc;
+
+    // Frames are followed through externs and the bigint runtime as well
+    // as JIT compiled code, for as long as each frame pointer is further up
+    // this thread's stack than the last; code without frame pointers leaves
+    // something else there, which stops the walk. Whatever called the
+    // outermost JIT compiled frame is the driver, so is left off.
+    uint64_t sp = registers[REG_RSP];
+    size_t jit_depth = pc >= jit_low && pc < jit_high ? depth : 0;
+    while (sp >= stack_low && sp < stack_high && depth < max_depth
+           && frame >= sp && frame % sizeof(uint64_t) == 0
+           && frame + 2 * sizeof(uint64_t) <= stack_high)
+    {
+        const uint64_t *saved = reinterpret_cast<const uint64_t*>(frame);
+        pc = saved[1];
+        stack[depth++] = pc;
+        if (pc >= jit_low && pc < jit_high)
+        {
+            jit_depth = depth;
+        }
+        if (saved[0] <= frame)
+        {
+            break;
+        }
+        frame = saved[0];
+    }
+    depth = std::max<size_t>(jit_depth, 1);
+    stack[depth++] = 0;
+
+    samples_taken++;
+    size_t start = samples_used.fetch_add(depth);
+    if (start + depth > samples.size())
+    {
+        samples_dropped++;
+        return;
+    }
+    std::copy(stack, stack + depth, samples.begin() + start);
+#endif
+}
+
+SamplingProfiler::SamplingProfiler(const JITSymbolTable &symbols)
+    : m_symbols(symbols), m_running(false)
+{
+}
+
+SamplingProfiler::~SamplingProfiler()
+{
+    stop();
+}
+
+void SamplingProfiler::start()
+{
+    samples.assign(sample_words, 0);
+    samples_used = 0;
+    samples_taken = 0;
+    samples_dropped = 0;
+
+    m_symbols.range(jit_low, jit_high);
+
+    pthread_attr_t attributes;
+    void *stack_address;
+    size_t stack_size;
+    if (pthread_getattr_np(pthread_self(), &attributes) == 0)
+    {
+        if (pthread_attr_getstack(&attributes, &stack_address, &stack_size) == 0)
+        {
+            stack_low = reinterpret_cast<uint64_t>(stack_address);
+            stack_high = stack_low + stack_size;
+        }
+        pthread_attr_destroy(&attributes);
+    }
+
+    struct sigaction action;
+    action.sa_sigaction = takeSample;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+
+    itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = sample_interval_us;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    m_running = true;
+}
+
+void SamplingProfiler::stop()
+{
+    if (!m_running)
+    {
+        return;
+    }
+
+    itimerval timer {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    signal(SIGPROF, SIG_IGN);
+    m_running = false;
+}
+
+void SamplingProfiler::report(std::ostream &out) const
+{
+    struct Counts
+    {
+        size_t self;
+        size_t total;
+    };
+    std::map<std::string, Counts> functions;
+    std::map<std::pair<std::string, std::string>, size_t> calls;
+
+    // Each function and call counts once per sample however deep it
+    // recurses, so totals are the share of time something was on the
+    // stack.
+    size_t n_samples = 0;
+    size_t used = std::min(samples_used.load(), samples.size());
+    for (size_t i = 0; i < used && samples[i];)
+    {
+        std::vector<std::string> stack;
+        for (; i < used && samples[i]; i++)
+        {
+            const JITSymbolTable::Symbol *symbol = m_symbols.find(samples[i]);
+            stack.push_back(symbol ? symbol->name : "[outside JIT code]");
+        }
+        i++;
+        n_samples++;
+
+        functions[stack[0]].self++;
+        for (const std::string &name : std::set<std::string>(stack.begin(), stack.end()))
+        {
+            functions[name].total++;
+        }
+
+        std::set<std::pair<std::string, std::string> > edges;
+        for (size_t k = 0; k + 1 < stack.size(); k++)
+        {
+            edges.insert(std::make_pair(stack[k + 1], stack[k]));
+        }
+        for (auto &edge : edges)
+        {
+            calls[edge]++;
+        }
+    }
+
+    std::vector<std::pair<std::string, Counts> > flat (functions.begin(), functions.end());
+    std::sort(flat.begin(), flat.end(), [](const std::pair<std::string, Counts> &a,
+                                           const std::pair<std::string, Counts> &b)
+    {
+        return a.second.self != b.second.self ? a.second.self > b.second.self
+                                              : a.second.total > b.second.total;
+    });
+
+    char line[256];
+    std::snprintf(line, sizeof(line), "Flat profile, %zu samples every %ld us",
+                  n_samples, sample_interval_us);
+    out << line;
+    if (samples_dropped)
+    {
+        out << " (" << samples_dropped << " more dropped)";
+    }
+    out << ":\n";
+    std::snprintf(line, sizeof(line), "  %7s %8s %8s %8s  %s\n",
+                  "self %", "self", "total %", "total", "function");
+    out << line;
+    for (auto &function : flat)
+    {
+        std::snprintf(line, sizeof(line), "  %6.2f%% %8zu %7.2f%% %8zu  %s\n",
+                      100.0 * function.second.self / std::max<size_t>(n_samples, 1),
+                      function.second.self,
+                      100.0 * function.second.total / std::max<size_t>(n_samples, 1),
+                      function.second.total, function.first.c_str());
+        out << line;
+    }
+
+    std::vector<std::pair<std::pair<std::string, std::string>, size_t> > graph (calls.begin(), calls.end());
+    std::sort(graph.begin(), graph.end(), [](const std::pair<std::pair<std::string, std::string>, size_t> &a,
+                                             const std::pair<std::pair<std::string, std::string>, size_t> &b)
+    {
+        return a.second > b.second;
+    });
+
+    out << "\nCall graph, samples in which the caller was calling the callee:\n";
+    std::snprintf(line, sizeof(line), "  %8s  %s\n", "samples", "caller -> callee");
+    out << line;
+    for (auto &call : graph)
+    {
+        std::snprintf(line, sizeof(line), "  %8zu  %s -> %s\n", call.second,
+                      call.first.first.c_str(), call.first.second.c_str());
+        out << line;
+    }
+}
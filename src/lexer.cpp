@@ -1,6 +1,4 @@
 #include "lexer.hpp"
-#include "driver_options.hpp"
-#include "llvm/Support/raw_ostream.h"
 
 using namespace li1I;
 using std::string;
@@ -8,22 +6,45 @@ using std::istream;
 using std::ostream;
 using std::endl;
 
-LexError::LexError (const TokenLocation &loc, std::string expected, istream &in)
+// Errors at the end of the file have no position, as tellg gives -1
+// there, so they point at the end of the last line.
+string li1I::lineAt (istream &in, std::streamoff pos, std::streamoff &column)
 {
-    std::stringstream ss;
-    ss << endl << "Lex error: expected " << expected << endl;
+    in.clear();
+    in.seekg(0, std::ios_base::end);
+    std::streamoff size = in.tellg();
+    if (pos < 0 || pos > size)
+    {
+        pos = size;
+    }
 
-    std::streampos pos = loc.file_pos;
-    in.seekg(loc.file_pos);
-    while (in.peek() != '\n')
+    std::streamoff start = pos;
+    while (start > 0)
     {
-        in.seekg(-1, std::ios_base::cur);
+        in.seekg(start - 1);
+        if (in.peek() == '\n')
+        {
+            break;
+        }
+        start--;
     }
-    in.get();
-    std::streamoff token_start = pos-in.tellg();
+    column = pos - start;
 
-    char line[256];
+    in.seekg(start);
+    char line[256] = "";
     in.getline(line, 256);
+    in.clear();
+    return line;
+}
+
+LexError::LexError (const TokenLocation &loc, std::string expected, istream &in,
+                    std::streamoff offset)
+{
+    std::stringstream ss;
+    ss << endl << "Lex error: expected " << expected << endl;
+
+    std::streamoff token_start;
+    string line = lineAt(in, loc.file_pos - offset, token_start);
     ss << "At location " << loc.line << ":" << loc.column << endl;
     ss << line << endl;
     string carat (token_start+1, ' ');
@@ -48,6 +69,7 @@ string li1I::tokenTagToString (TokenTag tag)
     case TokenTag::LPAREN: s = "LPAREN"; break;
     case TokenTag::RPAREN: s = "RPAREN"; break;
     case TokenTag::FUNCTION: s = "FUNCTION"; break;
+    case TokenTag::EXTERN: s = "EXTERN"; break;
     case TokenTag::SEMI: s = "SEMI"; break;
     case TokenTag::PLUS: s = "PLUS"; break;
     case TokenTag::MINUS: s = "MINUS"; break;
@@ -66,7 +88,7 @@ string li1I::tokenTagToString (TokenTag tag)
     return s;
 }
 
-void Token::print (llvm::raw_ostream &out) const
+void Token::print (std::ostream &out) const
 {
     out << tokenTagToString(m_token);
 
@@ -110,11 +132,12 @@ Token *Lexer::lexId (TokenTag token)
     {
         if (!isCharValid(c))
         {
-            throw LexError(m_start_location, "identifier", m_in);
+            throw LexError(m_start_location, "identifier", m_in, m_offset);
         }
 
         (*name) += c;
     }
+    endLine(c);
 
     Token *t = new Token(token, m_start_location, name);
     return t;
@@ -143,11 +166,12 @@ Token *Lexer::lexNum ()
     {
         if (c != '1')
         {
-            throw LexError(m_start_location, "more 1s", m_in);
+            throw LexError(m_start_location, "more 1s", m_in, m_offset);
         }
 
         (*num)++;
     }
+    endLine(c);
 
     Token *t = new Token(TokenTag::NUM, m_start_location, num);
     return t;
@@ -168,24 +192,29 @@ Token *Lexer::lexKeyword ()
             {
             case '1': tt = TokenTag::VAR; goto end;
             }
+            break;
         case '1':
             switch (getChar())
             {
             case 'I': tt = TokenTag::PROGRAM; goto end;
             case 'l': tt = TokenTag::LPAREN; goto end;
             }
+            break;
         case 'l':
             switch (getChar())
             {
             case '1': tt = TokenTag::RPAREN; goto end;
             }
+            break;
         case 'i':
             switch (getChar())
             {
             case 'l': tt = TokenTag::TIMES; goto end;
             case 'i': tt = TokenTag::EXP; goto end;
             }
+            break;
         }
+        break;
     case 'I':
         switch (getChar())
         {
@@ -194,12 +223,16 @@ Token *Lexer::lexKeyword ()
             {
             case '1': tt = TokenTag::ASSIGN; goto end;
             }
+            break;
         case '1':
             switch (getChar())
             {
             case 'i': tt = TokenTag::FUNCTION; goto end;
+            case 'l': tt = TokenTag::EXTERN; goto end;
             }
+            break;
         }
+        break;
     case '1':
         switch (getChar())
         {
@@ -211,18 +244,21 @@ Token *Lexer::lexKeyword ()
             case 'l': tt = TokenTag::ELSE; goto end;
             case 'i': tt = TokenTag::SEMI; goto end;
             }
-
+            break;
         case 'I':
             switch (getChar())
             {
             case 'i': tt = TokenTag::RBRACE; goto end;
             }
+            break;
         case '1':
             switch (getChar())
             {
             case '1': tt = TokenTag::NEQ; goto end;
             }
+            break;
         }
+        break;
 
     case 'l':
         switch (getChar())
@@ -232,12 +268,14 @@ Token *Lexer::lexKeyword ()
             {
             case 'i': tt = TokenTag::PLUS; goto end;
             }
+            break;
         case 'i':
             switch (getChar())
             {
             case 'i': tt = TokenTag::MINUS; goto end;
             case 'l': tt = TokenTag::DIV; goto end;
             }
+            break;
         case '1':
             switch (getChar())
             {
@@ -245,8 +283,10 @@ Token *Lexer::lexKeyword ()
             case '1': tt = TokenTag::EQ; goto end;
             case 'I': tt = TokenTag::LT; goto end;
             }
+            break;
         }
         }
+    throw LexError(m_start_location, "keyword", m_in, m_offset);
 
 end:
     Token *t = new Token(tt, m_start_location);
@@ -257,17 +297,28 @@ void Lexer::eatWhitespace()
 {
     while (isspace(m_in.peek()))
     {
-        if (getChar() == '\n')
-        {
-            m_location.column = 0;
-            m_location.line += 1;
-        }
+        endLine(getChar());
+    }
+}
+
+void Lexer::endLine (char c)
+{
+    if (c == '\n')
+    {
+        m_location.column = 0;
+        m_location.line += 1;
     }
 }
 
+std::streampos Lexer::position ()
+{
+    std::streampos pos = m_in.tellg();
+    return pos == std::streampos(-1) ? pos : pos + m_offset;
+}
+
 std::unique_ptr<const Token> Lexer::lex ()
 {
-    m_location.file_pos = m_in.tellg();
+    m_location.file_pos = position();
     m_start_location = m_location;
     if (!m_cache.empty())
     {
@@ -278,9 +329,16 @@ std::unique_ptr<const Token> Lexer::lex ()
 
     eatWhitespace();
 
+    // Tokens start after the whitespace in front of them.
+    if (!m_in.eof())
+    {
+        m_location.file_pos = position();
+        m_start_location = m_location;
+    }
+
     Token *t;
 
-    if (m_in.eof())
+    if (m_in.eof() || m_location.file_pos >= m_end)
     {
         t = new Token(TokenTag::END, m_start_location);
     }
@@ -292,13 +350,13 @@ std::unique_ptr<const Token> Lexer::lex ()
         case 'I': t = lexFid(); break;
         case '1': t = lexNum(); break;
         case 'l': t = lexKeyword(); break;
-        default: throw LexError(m_start_location, "valid chars", m_in);
+        default: throw LexError(m_start_location, "valid chars", m_in, m_offset);
         }
     }
 
-    if (options::opts->getLastArg(options::OPT_emit_tokens))
+    if (m_emit_tokens)
     {
-        t->print(llvm::outs());
+        t->print(std::cout);
     }
      
     return std::unique_ptr<const Token>(t);
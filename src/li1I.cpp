@@ -4,10 +4,17 @@
 #include <iostream>
 #include <sstream>
 #include <iterator>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <set>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
 #include <llvm/Support/TargetSelect.h>
 #include "llvm/Support/TargetRegistry.h"
 #include <llvm/ADT/Triple.h>
@@ -18,19 +25,819 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Signals.h"
+#include "llvm/Object/ObjectFile.h"
 
 #include "lexer.hpp"
 #include "parser.hpp"
 #include "ast_dumper.hpp"
 #include "ast_to_ir.hpp"
+#include "bigint_ir.hpp"
 #include "bc_compiler.hpp"
 #include "linker.hpp"
+#include "tiered_executor.hpp"
+#include "bytecode.hpp"
+#include "vm.hpp"
+#include "baseline_jit.hpp"
+#include "extern_call.hpp"
+#include "object_cache.hpp"
+#include "batch_ir.hpp"
+#include "batch_runner.hpp"
+#include "daemon.hpp"
+#include "codegen_target.hpp"
+#include "optimizer.hpp"
+#include "incremental.hpp"
+#include "incremental_parser.hpp"
+#include "repl.hpp"
+#include "cost_model.hpp"
+#include "phase_timer.hpp"
+#include "profile.hpp"
+#include "jit_profiling.hpp"
 #include "driver_options.hpp"
+#include "li1I_bigint.h"
 
-llvm::opt::InputArgList *options::opts;
 using options::opts;
 using namespace li1I;
 
+// From -O, checked once at the start of main.
+static unsigned opt_level = 0;
+
+// A bare -O is -O1, as for cc. With a profile to go on, optimising is the
+// point, so -fprofile-use alone means -O2.
+static bool parseOptLevel()
+{
+    opt_level = opts->hasArg(options::OPT_fprofile_use_EQ) ? 2 : 0;
+    if (!opts->hasArg(options::OPT_O))
+    {
+        return true;
+    }
+
+    opt_level = 1;
+    llvm::StringRef level_arg = opts->getLastArgValue(options::OPT_O);
+    if (!level_arg.empty() && (level_arg.getAsInteger(10, opt_level) || opt_level > 3))
+    {
+        std::cerr << "Invalid optimisation level -O" << level_arg.str() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static llvm::CodeGenOpt::Level codegenLevel()
+{
+    switch (opt_level)
+    {
+    case 0: return llvm::CodeGenOpt::None;
+    case 1: return llvm::CodeGenOpt::Less;
+    case 2: return llvm::CodeGenOpt::Default;
+    default: return llvm::CodeGenOpt::Aggressive;
+    }
+}
+
+static std::string profileGeneratePath()
+{
+    if (opts->hasArg(options::OPT_fprofile_generate_EQ))
+    {
+        return opts->getLastArgValue(options::OPT_fprofile_generate_EQ).str();
+    }
+    return opts->hasArg(options::OPT_fprofile_generate) ? "li1I.profile" : "";
+}
+
+// From --partial-eval and --eval-budget, zero when not partially
+// evaluating. Counters from -fprofile-generate have to count what the
+// program would have done, so it turns partial evaluation off, as does
+// --bigint, whose answers the interpreter can't give.
+static uint64_t eval_budget = 0;
+
+static bool parseEvalBudget()
+{
+    eval_budget = 0;
+    if (!opts->hasArg(options::OPT_partial_eval) || !profileGeneratePath().empty()
+        || opts->hasArg(options::OPT_bigint))
+    {
+        return true;
+    }
+
+    eval_budget = 100000;
+    llvm::StringRef budget_arg = opts->getLastArgValue(options::OPT_eval_budget);
+    if (!budget_arg.empty() && (budget_arg.getAsInteger(10, eval_budget) || eval_budget == 0))
+    {
+        std::cerr << "Invalid evaluation budget " << budget_arg.str() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Only code compiled by LLVM knows about bigints; the interpreters, the
+// baseline JIT and batch entry points all work on 32 bit values.
+static bool checkBigint()
+{
+    if (!opts->hasArg(options::OPT_bigint))
+    {
+        return true;
+    }
+
+    for (unsigned id : {options::OPT_interp, options::OPT_baseline, options::OPT_tier,
+                        options::OPT_batch, options::OPT_emit_batch, options::OPT_daemon})
+    {
+        if (const llvm::opt::Arg *arg = opts->getLastArg(id))
+        {
+            std::cerr << "--bigint can't be used with " << arg->getSpelling().str() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Without libc there's no printf for --bigint's runtime, and nothing to
+// write -fprofile-generate's counts with.
+static bool checkTinyRuntime()
+{
+    if (!opts->hasArg(options::OPT_tiny_runtime))
+    {
+        return true;
+    }
+
+    for (unsigned id : {options::OPT_bigint, options::OPT_fprofile_generate,
+                        options::OPT_fprofile_generate_EQ})
+    {
+        if (const llvm::opt::Arg *arg = opts->getLastArg(id))
+        {
+            std::cerr << "--tiny-runtime can't be used with " << arg->getSpelling().str() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// The baseline compiler, the tiers and the profiler only ever run a program,
+// so without -e they would be ignored and an executable built through LLVM
+// instead.
+static bool checkRunOptions()
+{
+    if (opts->hasArg(options::OPT_e))
+    {
+        return true;
+    }
+
+    for (unsigned id : {options::OPT_baseline, options::OPT_tier, options::OPT_profile})
+    {
+        if (const llvm::opt::Arg *arg = opts->getLastArg(id))
+        {
+            std::cerr << arg->getSpelling().str() << " can only be used with -e" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Executables get the bignum runtime from next to the driver, where the
+// build puts it.
+static std::string bigint_runtime;
+
+static std::vector<std::string> linkLibraries()
+{
+    std::vector<std::string> libraries = opts->getAllArgValues(options::OPT_load);
+    if (opts->hasArg(options::OPT_bigint))
+    {
+        libraries.push_back(bigint_runtime);
+    }
+    return libraries;
+}
+
+// Everything compiling a .li file takes from the options, read once up
+// front: ArgList's lookups mark the arguments they find as claimed, so
+// nothing which the -j workers run may touch opts.
+struct CompileSettings
+{
+    unsigned opt_level;
+    llvm::CodeGenOpt::Level codegen_level;
+    bool emit_batch;
+    bool emit_bc;
+    bool lto;
+    bool main;
+    bool debug;
+    bool bigint;
+    bool tiny_runtime;
+    uint64_t eval_budget;
+    std::string profile_generate;
+    const ProfileData *profile;
+    // What besides the source, the backend and the path -g gives changes
+    // the object, -fprofile-use's profile included.
+    std::string config;
+};
+
+// -g names the source by its absolute path, so debuggers can find it from
+// wherever they run.
+static std::string debugSourcePath(const CompileSettings &settings,
+                                   const std::string &in_filename)
+{
+    if (!settings.debug)
+    {
+        return "";
+    }
+
+    llvm::SmallString<256> path (in_filename);
+    llvm::sys::fs::make_absolute(path);
+    return path.str().str();
+}
+
+// MCJIT would call address zero for a function nothing defines, so they
+// are looked for up front.
+static std::string findMissingExtern(const llvm::Module &module)
+{
+    llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+    for (const llvm::Function &function : module)
+    {
+        if (function.isDeclaration() && !function.isIntrinsic()
+            && !llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(function.getName().str()))
+        {
+            return function.getName().str();
+        }
+    }
+    return "";
+}
+
+// --interp, --baseline and --tier look them up with dlsym instead, and are
+// checked up front in the same way.
+static bool findExterns(const Program &program)
+{
+    try
+    {
+        for (auto &external : program.externs())
+        {
+            findExtern(external->name(), external->nArgs());
+        }
+    }
+    catch (ExternError &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Anything else given to --load, like an archive, object or C source,
+// can only be handed to the linker.
+static bool isSharedLibrary(const std::string &path)
+{
+    llvm::StringRef filename = llvm::sys::path::filename(path);
+    return filename.endswith(".so") || filename.contains(".so.") || filename.endswith(".dylib");
+}
+
+static bool loadProfile(std::unique_ptr<ProfileData> &profile)
+{
+    if (!opts->hasArg(options::OPT_fprofile_use_EQ))
+    {
+        return true;
+    }
+
+    std::string path = opts->getLastArgValue(options::OPT_fprofile_use_EQ).str();
+    try
+    {
+        profile.reset(new ProfileData(ProfileData::read(path)));
+    }
+    catch (ProfileError &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static void setUpCodegen(ASTToIRVisitor &codegenner, const CompileSettings &settings)
+{
+    codegenner.setProfileGenerate(settings.profile_generate);
+    codegenner.setProfileUse(settings.profile);
+    codegenner.setPartialEvaluation(settings.eval_budget);
+    codegenner.setBigint(settings.bigint);
+    codegenner.setTinyRuntime(settings.tiny_runtime);
+    codegenner.setMain(settings.main);
+}
+
+// Programs run with -e never reach main, so the driver writes out what
+// their counters hold instead.
+static void writeJITProfile(llvm::ExecutionEngine &ee, const ASTToIRVisitor &codegenner)
+{
+    ProfileData data;
+    for (auto &counters : codegenner.profileCounters())
+    {
+        auto array = reinterpret_cast<const uint64_t*>(
+            ee.getGlobalValueAddress(counterName(counters.first)));
+        data.add(counters.first, FunctionProfile{array[0], {array + 1, array + counters.second}});
+    }
+    data.write(profileGeneratePath());
+}
+
+static bool hasEmitOption()
+{
+    for (const llvm::opt::Arg *arg : *opts)
+    {
+        if (arg->getOption().hasFlag(options::EmitOption))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// -flto writes bitcode named like an object, which only an LTO capable
+// link could take, and without main an executable would have nothing to
+// run, so neither links one.
+static bool checkNoLink()
+{
+    if (opts->hasArg(options::OPT_c) || opts->hasArg(options::OPT_e) || hasEmitOption()
+        || opts->getAllArgValues(options::OPT_INPUT).size() > 1)
+    {
+        return true;
+    }
+
+    for (unsigned id : {options::OPT_flto, options::OPT_no_main})
+    {
+        if (const llvm::opt::Arg *arg = opts->getLastArg(id))
+        {
+            std::cerr << arg->getSpelling().str() << " doesn't link an executable, so needs -c"
+                      << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static CompileSettings compileSettings(const ProfileData *profile)
+{
+    CompileSettings settings;
+    settings.opt_level = opt_level;
+    settings.codegen_level = codegenLevel();
+    settings.emit_batch = opts->hasArg(options::OPT_emit_batch);
+    settings.emit_bc = opts->hasArg(options::OPT_emit_bc);
+    settings.lto = opts->hasArg(options::OPT_flto);
+    settings.main = !opts->hasArg(options::OPT_no_main);
+    settings.debug = opts->hasArg(options::OPT_g);
+    settings.bigint = opts->hasArg(options::OPT_bigint);
+    settings.tiny_runtime = opts->hasArg(options::OPT_tiny_runtime);
+    settings.eval_budget = eval_budget;
+    settings.profile_generate = profileGeneratePath();
+    settings.profile = profile;
+
+    std::string &config = settings.config;
+    config = " -O" + std::to_string(opt_level) + " ";
+    config += llvm::sys::getDefaultTargetTriple();
+    config += " " + codegenTarget().cpu + " " + codegenTarget().features;
+    if (settings.emit_batch)
+    {
+        config += " batch";
+    }
+    if (settings.lto)
+    {
+        config += " lto";
+    }
+    if (!settings.main)
+    {
+        config += " no-main";
+    }
+    if (settings.eval_budget)
+    {
+        config += " partial-eval=" + std::to_string(settings.eval_budget);
+    }
+    if (settings.bigint)
+    {
+        config += " bigint";
+    }
+    if (settings.tiny_runtime)
+    {
+        config += " tiny-runtime";
+    }
+    if (!settings.profile_generate.empty())
+    {
+        config += " profile-generate=" + settings.profile_generate;
+    }
+    if (opts->hasArg(options::OPT_fprofile_use_EQ))
+    {
+        auto profile = llvm::MemoryBuffer::getFile(opts->getLastArgValue(options::OPT_fprofile_use_EQ));
+        config += " profile-use ";
+        config += profile ? (*profile)->getBuffer().str() : "";
+    }
+    return settings;
+}
+
+// Everything besides the source which changes the object we would produce.
+static std::string cacheConfig(const CompileSettings &settings, bool jit,
+                               const std::string &in_filename)
+{
+    std::string config = (jit ? "jit" : "aot") + settings.config;
+    if (settings.debug)
+    {
+        config += " -g " + debugSourcePath(settings, in_filename);
+    }
+    return config;
+}
+
+// -e prints a blank line then the result, which is unsigned unless it
+// is a bigint.
+static void printResult(uint64_t result)
+{
+    std::cout << std::endl;
+    if (opts->hasArg(options::OPT_bigint))
+    {
+        li1I_bigint_print(result);
+    }
+    else
+    {
+        std::cout << static_cast<uint32_t>(result) << std::endl;
+    }
+}
+
+static uint64_t runObject(std::unique_ptr<llvm::MemoryBuffer> object)
+{
+    auto object_file = llvm::object::ObjectFile::createObjectFile(object->getMemBufferRef());
+    if (!object_file)
+    {
+        throw std::runtime_error{llvm::toString(object_file.takeError())};
+    }
+
+    llvm::LLVMContext context;
+    llvm::EngineBuilder builder(std::make_unique<llvm::Module>("cached", context));
+    applyTarget(builder);
+    std::unique_ptr<llvm::ExecutionEngine> ee {builder.create()};
+    registerJITListeners(*ee);
+    ee->addObjectFile(llvm::object::OwningBinary<llvm::object::ObjectFile>(
+                          std::move(*object_file), std::move(object)));
+
+    uint64_t address = ee->getFunctionAddress("IIII");
+    PhaseScope phase("run");
+    if (opts->hasArg(options::OPT_bigint))
+    {
+        return reinterpret_cast<uint64_t (*)()>(address)();
+    }
+    return static_cast<uint32_t>(reinterpret_cast<Value (*)()>(address)());
+}
+
+// --emit-bc and -flto write bitcode for an LTO capable linker instead of
+// an object.
+static bool emitBitcode(const CompileSettings &settings, BCCompiler &bc_compiler,
+                        llvm::Module *module)
+{
+    if (settings.emit_bc || settings.lto)
+    {
+        bc_compiler.compileBitcode(module, settings.lto ? "o" : "bc");
+        return true;
+    }
+    return false;
+}
+
+// Objects only reach disk when -c asks for them; otherwise they are
+// linked straight from memory.
+static void outputObject(BCCompiler &bc_compiler, const llvm::MemoryBuffer &object,
+                         const std::string &program_name)
+{
+    if (opts->hasArg(options::OPT_c))
+    {
+        bc_compiler.writeOutput(object.getBuffer(), program_name);
+    }
+    else
+    {
+        li1I::Linker linker (linkLibraries(), opts->hasArg(options::OPT_tiny_runtime));
+        linker.link(object.getMemBufferRef(), opts->getLastArgValue(options::OPT_o, "a.out").str());
+    }
+}
+
+static bool threadCount(unsigned &n_threads)
+{
+    n_threads = std::max(1u, std::thread::hardware_concurrency());
+    llvm::StringRef threads_arg = opts->getLastArgValue(options::OPT_j);
+    if (!threads_arg.empty() && (threads_arg.getAsInteger(10, n_threads) || n_threads == 0))
+    {
+        std::cerr << "Invalid thread count " << threads_arg.str() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Compiles one .li file to <stem>.o without touching anything shared but
+// the cache, so that it can run on several threads at once.
+static void compileInput(const std::string &in_filename, const CompileSettings &settings,
+                         BCCompiler &bc_compiler, DiskObjectCache *cache)
+{
+    std::ifstream program_file(in_filename);
+    if (!program_file)
+    {
+        throw std::runtime_error{"Cannot open " + in_filename};
+    }
+    std::string source {std::istreambuf_iterator<char>(program_file),
+                        std::istreambuf_iterator<char>()};
+    std::string program_name = llvm::sys::path::stem(in_filename).str();
+
+    if (cache)
+    {
+        bc_compiler.setCache(cache, DiskObjectCache::key(source,
+                                                         cacheConfig(settings, false, in_filename)));
+        if (std::unique_ptr<llvm::MemoryBuffer> object = bc_compiler.lookupCache())
+        {
+            bc_compiler.writeOutput(object->getBuffer(), program_name);
+            return;
+        }
+    }
+
+    std::istringstream program(source);
+    Lexer lexer(program);
+    Parser parser;
+    std::unique_ptr<Program> ast;
+    {
+        PhaseScope phase("parse");
+        ast.reset(parser.parse(&lexer, &program, program_name));
+    }
+
+    ASTToIRVisitor codegenner;
+    setUpCodegen(codegenner, settings);
+    codegenner.setDebugInfo(debugSourcePath(settings, in_filename));
+    std::unique_ptr<llvm::Module> module;
+    {
+        PhaseScope phase("codegen");
+        module.reset(codegenner.codegenIR(*ast));
+        if (settings.emit_batch)
+        {
+            BatchIRGenerator batch_generator (*module);
+            batch_generator.generate(*ast);
+        }
+    }
+
+    if (emitBitcode(settings, bc_compiler, module.get()))
+    {
+        return;
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer> object = bc_compiler.emit(module.get());
+    bc_compiler.writeOutput(object->getBuffer(), program_name);
+}
+
+// Every input gets its own object named after it, so the outputs are the
+// same whatever order the workers finish in. Errors are reported together
+// afterwards, in input order.
+static int compileInputs(const std::vector<std::string> &inputs, const ProfileData *profile)
+{
+    if (!opts->hasArg(options::OPT_c) || opts->hasArg(options::OPT_o))
+    {
+        std::cerr << "Multiple inputs can only be compiled with -c and without -o" << std::endl;
+        return 1;
+    }
+
+    std::set<std::string> stems;
+    for (const std::string &input : inputs)
+    {
+        if (!stems.insert(llvm::sys::path::stem(input).str()).second)
+        {
+            std::cerr << "Inputs would overwrite each other's output: " << input << std::endl;
+            return 1;
+        }
+    }
+
+    unsigned n_threads;
+    if (!threadCount(n_threads))
+    {
+        return 1;
+    }
+    n_threads = std::min<size_t>(n_threads, inputs.size());
+
+    std::unique_ptr<DiskObjectCache> cache;
+    if (opts->hasArg(options::OPT_cache_dir))
+    {
+        cache.reset(new DiskObjectCache(opts->getLastArgValue(options::OPT_cache_dir).str()));
+    }
+
+    const CompileSettings settings = compileSettings(profile);
+    std::vector<std::string> errors (inputs.size());
+    std::atomic<size_t> next_input (0);
+    auto work = [&]
+    {
+        BCCompiler bc_compiler (settings.codegen_level, llvm::CodeGenFileType::CGFT_ObjectFile);
+        bc_compiler.setOptimization(settings.opt_level);
+        bc_compiler.useDefaultOutput();
+        for (size_t i; (i = next_input++) < inputs.size();)
+        {
+            try
+            {
+                compileInput(inputs[i], settings, bc_compiler, cache.get());
+            }
+            catch (std::exception &e)
+            {
+                errors[i] = e.what();
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < n_threads; i++)
+    {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        if (!errors[i].empty())
+        {
+            std::cerr << inputs[i] << ": " << errors[i] << std::endl;
+            failed++;
+        }
+    }
+
+    if (failed)
+    {
+        std::cerr << failed << " of " << inputs.size() << " inputs failed to compile" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// The one edit which turns before into after, replacing whatever is
+// between what they start and end with in common.
+static TextEdit findEdit(const std::string &before, const std::string &after)
+{
+    size_t prefix = 0;
+    size_t max_common = std::min(before.size(), after.size());
+    while (prefix < max_common && before[prefix] == after[prefix])
+    {
+        prefix++;
+    }
+    size_t suffix = 0;
+    while (suffix < max_common - prefix
+           && before[before.size() - suffix - 1] == after[after.size() - suffix - 1])
+    {
+        suffix++;
+    }
+    return {prefix, before.size() - prefix - suffix,
+            after.substr(prefix, after.size() - prefix - suffix)};
+}
+
+static void runWatched(const Program &ast, const ProfileData *profile)
+{
+    if (opts->hasArg(options::OPT_interp))
+    {
+        BytecodeCompiler bytecode_compiler;
+        BytecodeProgram bytecode = bytecode_compiler.compile(ast);
+        VM vm(bytecode);
+        std::cout << std::endl << static_cast<uint32_t>(vm.run()) << std::endl;
+        return;
+    }
+
+    ASTToIRVisitor codegenner;
+    setUpCodegen(codegenner, compileSettings(profile));
+    std::unique_ptr<llvm::Module> module (codegenner.codegenIR(ast));
+    std::string missing = findMissingExtern(*module);
+    if (!missing.empty())
+    {
+        std::cerr << "Cannot find extern function " << missing
+                  << ", --load the library defining it" << std::endl;
+        return;
+    }
+
+    llvm::EngineBuilder target_builder;
+    applyTarget(target_builder);
+    std::unique_ptr<llvm::TargetMachine> target_machine {target_builder.selectTarget()};
+    module->setDataLayout(target_machine->createDataLayout());
+    if (opt_level)
+    {
+        optimizeModule(*module, opt_level, target_machine.get());
+    }
+
+    llvm::Function *main_function = module->getFunction("IIII");
+    llvm::EngineBuilder builder(std::move(module));
+    applyTarget(builder);
+    builder.setOptLevel(codegenLevel());
+    std::unique_ptr<llvm::ExecutionEngine> ee {builder.create()};
+    registerJITListeners(*ee);
+    ee->finalizeObject();
+    printResult(*ee->runFunction(main_function, {}).IntVal.getRawData());
+}
+
+// --watch runs the program, then waits for the file to change and runs it
+// again, forever. Only the definitions an edit touched are parsed again,
+// and which of them changed is reported, so a big program which is being
+// edited doesn't have to be parsed from scratch each time.
+static int watchProgram(const std::string &in_filename, const std::string &program_name,
+                        const ProfileData *profile)
+{
+    IncrementalParser parser(program_name);
+    std::string source;
+    llvm::sys::TimePoint<> modified;
+    bool parsed = false;
+    while (true)
+    {
+        std::string new_source;
+        while (true)
+        {
+            llvm::sys::fs::file_status status;
+            if (!llvm::sys::fs::status(in_filename, status)
+                && (!parsed || status.getLastModificationTime() != modified))
+            {
+                modified = status.getLastModificationTime();
+                std::ifstream file(in_filename);
+                new_source.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+                if (!parsed || new_source != source)
+                {
+                    break;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        try
+        {
+            auto start = std::chrono::steady_clock::now();
+            DefinitionChanges changes = parsed ? parser.edit(findEdit(source, new_source))
+                : parser.parse(new_source);
+            std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+            source = std::move(new_source);
+            parsed = true;
+
+            std::cerr << "Parsed " << changes.reparsed_bytes << " bytes in " << took.count() << "ms";
+            for (const std::string &name : changes.changed)
+            {
+                std::cerr << ", changed " << name;
+            }
+            for (const std::string &name : changes.removed)
+            {
+                std::cerr << ", removed " << name;
+            }
+            std::cerr << std::endl;
+
+            runWatched(parser.program(), profile);
+        }
+        catch (std::exception &e)
+        {
+            // The parser keeps the edit even when it doesn't parse.
+            source = parser.source();
+            parsed = true;
+            std::cerr << e.what() << std::endl;
+        }
+    }
+}
+
+// --repl reads definitions and expressions from standard input, starting
+// from the program in_filename if there is one, and compiles each as it
+// comes. Input which stops partway through one is read on to the next
+// line.
+static int runRepl(const std::string &in_filename, const std::string &program_name)
+{
+    ReplSession session(program_name.empty() ? "repl" : program_name, opt_level, codegenLevel(),
+                        opts->hasArg(options::OPT_bigint));
+    if (!in_filename.empty())
+    {
+        std::ifstream program_file(in_filename);
+        Lexer lexer(program_file);
+        Parser parser;
+        try
+        {
+            session.load(std::unique_ptr<Program>(parser.parse(&lexer, &program_file, program_name)));
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    bool prompt = llvm::sys::Process::StandardInIsUserInput();
+    std::string input;
+    std::string line;
+    while (true)
+    {
+        if (prompt)
+        {
+            std::cout << (input.empty() ? "li1I> " : "...> ") << std::flush;
+        }
+        if (!std::getline(std::cin, line))
+        {
+            break;
+        }
+
+        input += line + "\n";
+        try
+        {
+            if (session.evaluate(input))
+            {
+                input.clear();
+            }
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            input.clear();
+        }
+    }
+
+    if (!input.empty())
+    {
+        std::cerr << "Input ended partway through a definition or expression" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     llvm::InitializeNativeTarget();
@@ -50,28 +857,315 @@ int main(int argc, char **argv)
     unsigned missing_arg_index;
     unsigned missing_arg_count;
 
-    llvm::ArrayRef<char*> argv_ref(argv, argc);
+    llvm::ArrayRef<char*> argv_ref(argv + 1, argc - 1);
     opts = new llvm::opt::InputArgList{opt_table.ParseArgs(argv_ref, missing_arg_index, missing_arg_count)};
     opts->ClaimAllArgs();
+
+    PhaseTiming phase_timing (opts->hasArg(options::OPT_time_phases),
+                              opts->getLastArgValue(options::OPT_trace_out).str());
+
+    setCodegenTarget(selectTarget(opts->getLastArgValue(options::OPT_march),
+                                  opts->getLastArgValue(options::OPT_mcpu),
+                                  opts->getLastArgValue(options::OPT_mattr)));
+    for (const std::string &library : opts->getAllArgValues(options::OPT_load))
+    {
+        std::string error;
+        if (isSharedLibrary(library)
+            && llvm::sys::DynamicLibrary::LoadLibraryPermanently(library.c_str(), &error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    }
+    setPerfListeners(opts->hasArg(options::OPT_perf));
+    setGDBListener(opts->hasArg(options::OPT_g));
+    if (!parseOptLevel() || !parseEvalBudget() || !checkBigint() || !checkTinyRuntime()
+        || !checkRunOptions() || !checkNoLink())
+    {
+        return 1;
+    }
+    if (opts->hasArg(options::OPT_bigint))
+    {
+        llvm::SmallString<256> runtime_path (llvm::sys::path::parent_path(
+            llvm::sys::fs::getMainExecutable(argv[0], reinterpret_cast<void*>(&linkLibraries))));
+        llvm::sys::path::append(runtime_path, "libli1I_runtime.a");
+        bigint_runtime = runtime_path.str().str();
+        registerBigintRuntime();
+    }
+    std::unique_ptr<ProfileData> profile;
+    if (!loadProfile(profile))
+    {
+        return 1;
+    }
+
+    if (opts->hasArg(options::OPT_daemon))
+    {
+        size_t memory_cap = 256;
+        llvm::StringRef memory_arg = opts->getLastArgValue(options::OPT_daemon_memory);
+        if (!memory_arg.empty() && memory_arg.getAsInteger(10, memory_cap))
+        {
+            std::cerr << "Invalid daemon memory cap " << memory_arg.str() << std::endl;
+            return 1;
+        }
+
+        unsigned time_limit = 60;
+        llvm::StringRef time_limit_arg = opts->getLastArgValue(options::OPT_daemon_timeout);
+        if (!time_limit_arg.empty()
+            && (time_limit_arg.getAsInteger(10, time_limit) || time_limit == 0))
+        {
+            std::cerr << "Invalid daemon time limit " << time_limit_arg.str() << std::endl;
+            return 1;
+        }
+
+        unsigned n_threads;
+        if (!threadCount(n_threads))
+        {
+            return 1;
+        }
+
+        Daemon daemon(opts->getLastArgValue(options::OPT_socket, default_socket_path).str(),
+                      memory_cap << 20, n_threads, time_limit,
+                      opts->hasArg(options::OPT_daemon_isolate));
+        daemon.serve();
+        return 0;
+    }
+
+    std::vector<std::string> inputs = opts->getAllArgValues(options::OPT_INPUT);
+    if (inputs.size() > 1)
+    {
+        return compileInputs(inputs, profile.get());
+    }
+
     std::string in_filename = opts->getLastArgValue(options::OPT_INPUT);
-    std::ifstream program(in_filename);
+    std::ifstream program_file(in_filename);
     std::string program_name = llvm::sys::path::stem(in_filename);
-    std::string object_path(in_filename);
-    bool object_file_is_temp = false;
+
+    if (opts->hasArg(options::OPT_repl))
+    {
+        return runRepl(in_filename, program_name);
+    }
 
     if (llvm::sys::path::extension(in_filename).equals(".li"))
     {
-        Lexer lexer(program);
+        if (opts->hasArg(options::OPT_watch))
+        {
+            return watchProgram(in_filename, program_name, profile.get());
+        }
+
+        std::string source {std::istreambuf_iterator<char>(program_file),
+                            std::istreambuf_iterator<char>()};
+        std::istringstream program(source);
+
+        const CompileSettings settings = compileSettings(profile.get());
+        BCCompiler bc_compiler (settings.codegen_level, llvm::CodeGenFileType::CGFT_ObjectFile);
+        bc_compiler.setOptimization(settings.opt_level);
+
+        // Cache hits skip the frontend entirely, so there is nothing to
+        // cache when it has been asked to emit something, or to count.
+        bool jit = opts->hasArg(options::OPT_e) && !opts->hasArg(options::OPT_tier)
+            && !opts->hasArg(options::OPT_baseline);
+        std::unique_ptr<DiskObjectCache> cache;
+        std::string cache_key;
+        if (opts->hasArg(options::OPT_cache_dir) && !opts->hasArg(options::OPT_interp)
+            && !hasEmitOption() && (jit || !opts->hasArg(options::OPT_e))
+            && profileGeneratePath().empty() && !opts->hasArg(options::OPT_profile))
+        {
+            cache.reset(new DiskObjectCache(opts->getLastArgValue(options::OPT_cache_dir).str()));
+            cache_key = DiskObjectCache::key(source, cacheConfig(settings, jit, in_filename));
+
+            if (jit)
+            {
+                if (std::unique_ptr<llvm::MemoryBuffer> object = cache->lookup(cache_key))
+                {
+                    printResult(runObject(std::move(object)));
+                    return 0;
+                }
+            }
+            else
+            {
+                bc_compiler.setCache(cache.get(), cache_key);
+                if (std::unique_ptr<llvm::MemoryBuffer> object = bc_compiler.lookupCache())
+                {
+                    outputObject(bc_compiler, *object, program_name);
+                    return 0;
+                }
+            }
+        }
+
+        Lexer lexer(program, opts->hasArg(options::OPT_emit_tokens));
         Parser parser;
-        Program *ast = parser.parse(&lexer, &program, program_name);
+        Program *ast;
+        {
+            PhaseScope phase("parse");
+            ast = parser.parse(&lexer, &program, program_name);
+        }
 
         if (opts->hasArg(options::OPT_emit_ast))
         {
             ASTDumper dumper (&std::cout, *ast);
         }
 
+        if (opts->hasArg(options::OPT_cost_report))
+        {
+            CostModel cost_model(*ast);
+            cost_model.report(std::cout);
+            delete ast;
+            return 0;
+        }
+
+        if ((opts->hasArg(options::OPT_interp) || opts->hasArg(options::OPT_baseline)
+             || opts->hasArg(options::OPT_tier)) && !findExterns(*ast))
+        {
+            delete ast;
+            return 1;
+        }
+
+        if (opts->hasArg(options::OPT_interp) || opts->hasArg(options::OPT_emit_bytecode))
+        {
+            BytecodeCompiler bytecode_compiler;
+            BytecodeProgram bytecode;
+            {
+                PhaseScope phase("bytecode compile");
+                bytecode = bytecode_compiler.compile(*ast);
+            }
+            delete ast;
+
+            if (opts->hasArg(options::OPT_emit_bytecode))
+            {
+                bytecode.dump(std::cout);
+            }
+
+            if (opts->hasArg(options::OPT_interp))
+            {
+                VM vm(bytecode);
+                Value result;
+                {
+                    PhaseScope phase("run");
+                    result = vm.run();
+                }
+                std::cout << std::endl << static_cast<uint32_t>(result) << std::endl;
+            }
+            return 0;
+        }
+
+        if (opts->hasArg(options::OPT_e) && opts->hasArg(options::OPT_baseline))
+        {
+            BaselineJIT jit;
+            {
+                PhaseScope phase("baseline compile");
+                jit.compile(*ast);
+            }
+            delete ast;
+
+            Value result;
+            {
+                PhaseScope phase("run");
+                result = jit.run();
+            }
+            std::cout << std::endl << static_cast<uint32_t>(result) << std::endl;
+            return 0;
+        }
+
+        if (opts->hasArg(options::OPT_e) && opts->hasArg(options::OPT_tier))
+        {
+            uint64_t threshold = 1000;
+            llvm::StringRef threshold_arg = opts->getLastArgValue(options::OPT_tier_threshold);
+            if (!threshold_arg.empty() && threshold_arg.getAsInteger(10, threshold))
+            {
+                std::cerr << "Invalid tier threshold " << threshold_arg.str() << std::endl;
+                return 1;
+            }
+
+            uint64_t llvm_threshold = 10000;
+            threshold_arg = opts->getLastArgValue(options::OPT_tier_llvm_threshold);
+            if (!threshold_arg.empty() && threshold_arg.getAsInteger(10, llvm_threshold))
+            {
+                std::cerr << "Invalid tier threshold " << threshold_arg.str() << std::endl;
+                return 1;
+            }
+
+            Value result;
+            {
+                PhaseScope phase("run");
+                TieredExecutor executor(*ast, threshold, llvm_threshold);
+                result = executor.run();
+            }
+            delete ast;
+            std::cout << std::endl << static_cast<uint32_t>(result) << std::endl;
+            return 0;
+        }
+
+        if (opts->hasArg(options::OPT_batch))
+        {
+            unsigned n_threads;
+            if (!threadCount(n_threads))
+            {
+                return 1;
+            }
+
+            std::unique_ptr<BatchRunner> runner;
+            {
+                PhaseScope phase("JIT compile");
+                runner.reset(new BatchRunner(*ast, opts->getLastArgValue(options::OPT_batch).str(), n_threads));
+            }
+            delete ast;
+
+            PhaseScope phase("run");
+            std::string input_path = opts->getLastArgValue(options::OPT_input).str();
+            if (opts->hasArg(options::OPT_o))
+            {
+                std::ofstream out(opts->getLastArgValue(options::OPT_o).str(), std::ios::binary);
+                runner->run(input_path, out);
+            }
+            else
+            {
+                runner->run(input_path, std::cout);
+            }
+            return 0;
+        }
+
+        // Incremental builds only make objects and executables; anything
+        // else builds the whole module as usual.
+        if (opts->hasArg(options::OPT_incremental) && !opts->hasArg(options::OPT_e)
+            && !hasEmitOption() && !opts->hasArg(options::OPT_emit_batch)
+            && !opts->hasArg(options::OPT_flto) && profileGeneratePath().empty() && !eval_budget
+            && !opts->hasArg(options::OPT_bigint))
+        {
+            // The whole program cache only holds whole program objects.
+            bc_compiler.setCache(nullptr, "");
+            IncrementalBuilder builder(opts->getLastArgValue(options::OPT_incremental).str(),
+                                       bc_compiler, cacheConfig(settings, false, in_filename));
+            builder.setDebugInfo(debugSourcePath(settings, in_filename));
+            builder.setTinyRuntime(settings.tiny_runtime);
+            builder.setMain(settings.main);
+            std::vector<std::string> objects = builder.build(*ast, profile.get());
+            delete ast;
+
+            li1I::Linker linker (linkLibraries(), opts->hasArg(options::OPT_tiny_runtime));
+            if (opts->hasArg(options::OPT_c))
+            {
+                linker.combine(objects, opts->getLastArgValue(options::OPT_o, program_name + ".o").str());
+            }
+            else
+            {
+                linker.link(objects, opts->getLastArgValue(options::OPT_o, "a.out").str());
+            }
+            return 0;
+        }
+
         ASTToIRVisitor codegenner;
-        std::unique_ptr<llvm::Module> module {codegenner.codegenIR(*ast)};
+        setUpCodegen(codegenner, settings);
+        codegenner.setDebugInfo(debugSourcePath(settings, in_filename));
+        std::unique_ptr<llvm::Module> module;
+        {
+            PhaseScope phase("codegen");
+            module.reset(codegenner.codegenIR(*ast));
+            if (opts->hasArg(options::OPT_emit_batch))
+            {
+                BatchIRGenerator batch_generator (*module);
+                batch_generator.generate(*ast);
+            }
+        }
         delete ast;
     
         if (opts->hasArg(options::OPT_emit_llvm))
@@ -81,33 +1175,90 @@ int main(int argc, char **argv)
 
         if (opts->hasArg(options::OPT_e))
         {
+            std::string missing = findMissingExtern(*module);
+            if (!missing.empty())
+            {
+                std::cerr << "Cannot find extern function " << missing
+                          << ", --load the library defining it" << std::endl;
+                return 1;
+            }
+
+            if (opt_level)
+            {
+                llvm::EngineBuilder target_builder;
+                applyTarget(target_builder);
+                std::unique_ptr<llvm::TargetMachine> target_machine {target_builder.selectTarget()};
+                module->setDataLayout(target_machine->createDataLayout());
+                optimizeModule(*module, opt_level, target_machine.get());
+            }
+
+            bool sample = opts->hasArg(options::OPT_profile);
+            if (sample)
+            {
+                keepFramePointers(*module);
+            }
+
             llvm::ExecutionEngine *ee;
             llvm::Function *main_function = module->getFunction(llvm::StringRef("IIII"));
-            ee = llvm::EngineBuilder(std::move(module)).create();
+            if (cache)
+            {
+                cache->assign(module.get(), cache_key);
+            }
+            llvm::EngineBuilder builder(std::move(module));
+            applyTarget(builder);
+            if (opt_level)
+            {
+                builder.setOptLevel(codegenLevel());
+            }
+            JITSymbolTable symbols;
+            {
+                PhaseScope phase("JIT compile");
+                ee = builder.create();
+                ee->setObjectCache(cache.get());
+                registerJITListeners(*ee);
+                if (sample)
+                {
+                    ee->RegisterJITEventListener(&symbols);
+                }
+                ee->finalizeObject();
+            }
             std::vector<llvm::GenericValue> args;
-            llvm::GenericValue result = ee->runFunction(main_function, args);
-            std::cout << std::endl << *result.IntVal.getRawData() << std::endl;
+            llvm::GenericValue result;
+            SamplingProfiler profiler (symbols);
+            {
+                PhaseScope phase("run");
+                if (sample)
+                {
+                    profiler.start();
+                }
+                result = ee->runFunction(main_function, args);
+                profiler.stop();
+            }
+            printResult(*result.IntVal.getRawData());
+            if (sample)
+            {
+                profiler.report(std::cerr);
+            }
+            if (!profileGeneratePath().empty())
+            {
+                writeJITProfile(*ee, codegenner);
+            }
             return 0;
         }
 
-        BCCompiler bc_compiler (llvm::CodeGenOpt::Level::None,
-                                llvm::CodeGenFileType::CGFT_ObjectFile);
-        object_path = bc_compiler.compile(module.get());
-        object_file_is_temp = true;
+        if (emitBitcode(settings, bc_compiler, module.get()))
+        {
+            return 0;
         }
-    else if (llvm::sys::path::extension(in_filename).equals(".o"))
-    {
-        object_file_is_temp = false;
+
+        std::unique_ptr<llvm::MemoryBuffer> object = bc_compiler.emit(module.get());
+        outputObject(bc_compiler, *object, module->getModuleIdentifier());
     }
-    
-    if (!opts->hasArg(options::OPT_c))
+    else if (llvm::sys::path::extension(in_filename).equals(".o") && !opts->hasArg(options::OPT_c))
     {
-        li1I::Linker linker;
-        linker.link(object_path, opts->getLastArgValue(options::OPT_o, "a.out"));
-        if (object_file_is_temp)
-        {
-            std::remove(object_path.c_str());
-        }
+        li1I::Linker linker (linkLibraries(), opts->hasArg(options::OPT_tiny_runtime));
+        linker.link(in_filename, opts->getLastArgValue(options::OPT_o, "a.out").str());
     }
+
     return 0;
 }
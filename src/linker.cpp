@@ -1,14 +1,161 @@
 #include <vector>
 #include <memory>
 #include <exception>
+#include <system_error>
 
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/Program.h>
+#include <llvm/Support/raw_ostream.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "linker.hpp"
+#include "phase_timer.hpp"
 
 using std::string;
 
 void li1I::Linker::link(string input_object, string output_file)
 {
-    throw std::runtime_error{"Not implemented yet, use your system linker"};
+    runLinker({input_object}, output_file);
+}
+
+void li1I::Linker::link(const std::vector<string> &input_objects, string output_file)
+{
+    runLinker(input_objects, output_file);
+}
+
+void li1I::Linker::combine(const std::vector<string> &input_objects, string output_file)
+{
+    runLinker(input_objects, output_file, true);
+}
+
+void li1I::Linker::link(llvm::MemoryBufferRef object, string output_file)
+{
+#ifdef __linux__
+    int memfd = memfd_create("li1I-object", 0);
+    if (memfd >= 0)
+    {
+        {
+            llvm::raw_fd_ostream out(memfd, false);
+            out << object.getBuffer();
+        }
+
+        // Our own pid rather than self, as the linker is a grandchild of
+        // the compiler driver and we keep the fd open until it is done.
+        string path = "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(memfd);
+        try
+        {
+            runLinker({path}, output_file);
+        }
+        catch (...)
+        {
+            close(memfd);
+            throw;
+        }
+        close(memfd);
+        return;
+    }
+#endif
+
+    int fd;
+    llvm::SmallString<128> temp_path;
+    if (std::error_code error = llvm::sys::fs::createTemporaryFile("li1I", "o", fd, temp_path))
+    {
+        throw LinkError("Cannot create temporary object: " + error.message());
+    }
+
+    {
+        llvm::raw_fd_ostream out(fd, true);
+        out << object.getBuffer();
+    }
+
+    try
+    {
+        runLinker({temp_path.str().str()}, output_file);
+    }
+    catch (...)
+    {
+        llvm::sys::fs::remove(temp_path);
+        throw;
+    }
+    llvm::sys::fs::remove(temp_path);
+}
+
+// Many objects are passed in a response file, so there's no limit on how
+// many a program can be split into.
+static string writeResponseFile(const std::vector<string> &input_objects)
+{
+    int fd;
+    llvm::SmallString<128> path;
+    if (std::error_code error = llvm::sys::fs::createTemporaryFile("li1I", "rsp", fd, path))
+    {
+        throw li1I::LinkError("Cannot create response file: " + error.message());
+    }
+
+    llvm::raw_fd_ostream out(fd, true);
+    for (const string &object : input_objects)
+    {
+        out << '"';
+        for (char c : object)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out << '\\';
+            }
+            out << c;
+        }
+        out << "\"\n";
+    }
+    return path.str().str();
+}
+
+void li1I::Linker::runLinker(const std::vector<string> &input_objects,
+                             const string &output_file, bool relocatable)
+{
+    PhaseScope phase("link");
+    auto cc = llvm::sys::findProgramByName("cc");
+    if (!cc)
+    {
+        throw LinkError("Cannot find cc to link with: " + cc.getError().message());
+    }
+
+    // Objects are compiled with the static relocation model.
+    std::vector<llvm::StringRef> args {*cc, relocatable ? "-r" : "-no-pie"};
+    if (m_tiny_runtime && !relocatable)
+    {
+        args.push_back("-static");
+        args.push_back("-nostdlib");
+    }
+
+    string response_file;
+    if (input_objects.size() > 1)
+    {
+        response_file = "@" + writeResponseFile(input_objects);
+        args.push_back(response_file);
+    }
+    else
+    {
+        args.insert(args.end(), input_objects.begin(), input_objects.end());
+    }
+    if (!relocatable)
+    {
+        args.insert(args.end(), m_libraries.begin(), m_libraries.end());
+    }
+    args.push_back("-o");
+    args.push_back(output_file);
+
+    string error;
+    int result = llvm::sys::ExecuteAndWait(*cc, args, llvm::None, {}, 0, 0, &error);
+    if (!response_file.empty())
+    {
+        llvm::sys::fs::remove(response_file.substr(1));
+    }
+    if (result != 0)
+    {
+        throw LinkError(error.empty() ? "Linking " + output_file + " failed" : error);
+    }
 }
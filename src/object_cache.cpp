@@ -0,0 +1,99 @@
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "object_cache.hpp"
+
+using namespace li1I;
+
+DiskObjectCache::DiskObjectCache(std::string directory)
+    : m_directory(std::move(directory)), m_keys()
+{
+    llvm::sys::fs::create_directories(m_directory);
+}
+
+std::string DiskObjectCache::key(llvm::StringRef source, llvm::StringRef config)
+{
+    llvm::MD5 hash;
+    hash.update(LI1I_VERSION);
+    hash.update(llvm::StringRef("\0", 1));
+    hash.update(LLVM_VERSION_STRING);
+    hash.update(llvm::StringRef("\0", 1));
+    hash.update(config);
+    hash.update(llvm::StringRef("\0", 1));
+    hash.update(source);
+
+    llvm::MD5::MD5Result result;
+    hash.final(result);
+    return result.digest().str().str();
+}
+
+std::string DiskObjectCache::path(const std::string &key)
+{
+    llvm::SmallString<128> path(m_directory);
+    llvm::sys::path::append(path, key + ".o");
+    return path.str().str();
+}
+
+void DiskObjectCache::assign(const llvm::Module *module, std::string key)
+{
+    m_keys[module] = std::move(key);
+}
+
+std::unique_ptr<llvm::MemoryBuffer> DiskObjectCache::lookup(const std::string &key)
+{
+    auto buffer = llvm::MemoryBuffer::getFile(path(key));
+    if (!buffer)
+    {
+        return nullptr;
+    }
+
+    return std::move(*buffer);
+}
+
+void DiskObjectCache::store(const std::string &key, llvm::StringRef object)
+{
+    // Write to a unique file and rename it into place, so concurrent
+    // compilers never see a partial object.
+    int fd;
+    llvm::SmallString<128> temp_path;
+    llvm::SmallString<128> model(m_directory);
+    llvm::sys::path::append(model, key + "-%%%%%%.tmp");
+    if (llvm::sys::fs::createUniqueFile(model, fd, temp_path))
+    {
+        return;
+    }
+
+    {
+        llvm::raw_fd_ostream out(fd, true);
+        out << object;
+    }
+
+    if (llvm::sys::fs::rename(temp_path, path(key)))
+    {
+        llvm::sys::fs::remove(temp_path);
+    }
+}
+
+void DiskObjectCache::notifyObjectCompiled(const llvm::Module *module,
+                                           llvm::MemoryBufferRef object)
+{
+    auto it = m_keys.find(module);
+    if (it != m_keys.end())
+    {
+        store(it->second, object.getBuffer());
+    }
+}
+
+std::unique_ptr<llvm::MemoryBuffer> DiskObjectCache::getObject(const llvm::Module *module)
+{
+    auto it = m_keys.find(module);
+    if (it == m_keys.end())
+    {
+        return nullptr;
+    }
+
+    return lookup(it->second);
+}
@@ -0,0 +1,56 @@
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+
+#include "optimizer.hpp"
+#include "phase_timer.hpp"
+
+using namespace li1I;
+
+void li1I::optimizeModule(llvm::Module &module, unsigned level,
+                          llvm::TargetMachine *target_machine)
+{
+    PhaseScope phase("optimize");
+    llvm::PassManagerBuilder builder;
+    builder.OptLevel = level;
+    builder.SizeLevel = 0;
+    builder.Inliner = llvm::createFunctionInliningPass(level, 0, false);
+    builder.LoopVectorize = level > 1;
+    builder.SLPVectorize = level > 1;
+    if (target_machine)
+    {
+        target_machine->adjustPassManager(builder);
+    }
+
+    llvm::legacy::FunctionPassManager function_passes (&module);
+    llvm::legacy::PassManager module_passes;
+    if (target_machine)
+    {
+        function_passes.add(llvm::createTargetTransformInfoWrapperPass(
+                                target_machine->getTargetIRAnalysis()));
+        module_passes.add(llvm::createTargetTransformInfoWrapperPass(
+                              target_machine->getTargetIRAnalysis()));
+    }
+    builder.populateFunctionPassManager(function_passes);
+    builder.populateModulePassManager(module_passes);
+
+    // Without a profile every block looks equally warm, so there is
+    // nothing for the splitter to go on.
+    if (module.getProfileSummary(false))
+    {
+        module_passes.add(llvm::createHotColdSplittingPass());
+    }
+
+    function_passes.doInitialization();
+    for (llvm::Function &function : module)
+    {
+        function_passes.run(function);
+    }
+    function_passes.doFinalization();
+
+    module_passes.run(module);
+}
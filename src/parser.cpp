@@ -1,6 +1,5 @@
 #include <queue>
 #include <memory>
-#include "llvm/Support/raw_ostream.h"
 
 #include "parser.hpp"
 #include "lexer.hpp"
@@ -12,25 +11,17 @@ using std::string;
 using std::istream;
 using std::endl;
 
-static Lexer *the_lexer;
-static istream *lexed_file;
+// Per thread, so that several files can be parsed at once.
+static thread_local Lexer *the_lexer;
+static thread_local istream *lexed_file;
 
-ParseError::ParseError (const TokenLocation &loc, std::string expected)
+ParseError::ParseError (const TokenLocation &loc, std::string expected) : m_location(loc)
 {
     std::stringstream ss;
     ss << endl << "Parse error: expected " << expected << endl;
 
-    std::streampos pos = loc.file_pos;
-    lexed_file->seekg(loc.file_pos);
-    while (lexed_file->peek() != '\n')
-    {
-        lexed_file->seekg(-1, std::ios_base::cur);
-    }
-    lexed_file->get();
-    std::streamoff token_start = pos-lexed_file->tellg();
-
-    char line[256];
-    lexed_file->getline(line, 256);
+    std::streamoff token_start;
+    string line = lineAt(*lexed_file, loc.file_pos - the_lexer->offset(), token_start);
     ss << "At location " << loc.line << ":" << loc.column << endl;
     ss << line << endl;
     string carat (token_start+1, ' ');
@@ -52,6 +43,7 @@ IntExpr::IntExpr()
 {
     std::unique_ptr<const Token> t = the_lexer->lex();
     mandatoryToken(TokenTag::NUM, *t);
+    m_location = t->location();
     m_value = t->int_data();
 }
 
@@ -59,6 +51,7 @@ CallExpr::CallExpr()
 {
     std::unique_ptr<const Token> t = the_lexer->lex();
     mandatoryToken(TokenTag::FID, *t);
+    m_location = t->location();
     m_fid = t->string_data();
 }
 
@@ -66,12 +59,14 @@ VarExpr::VarExpr()
 {
     std::unique_ptr<const Token> t = the_lexer->lex();
     mandatoryToken(TokenTag::VID, *t);
+    m_location = t->location();
     m_vid = t->string_data();
 }
 
 OpExpr::OpExpr()
 {
     std::unique_ptr<const Token> t = the_lexer->lex();
+    m_location = t->location();
 
     switch (t->token())
     {
@@ -90,9 +85,11 @@ OpExpr::OpExpr()
 
 DeclExpr::DeclExpr()
 {
-    mandatoryToken(TokenTag::VAR, *the_lexer->lex());
-
     std::unique_ptr<const Token> t = the_lexer->lex();
+    mandatoryToken(TokenTag::VAR, *t);
+    m_location = t->location();
+
+    t = the_lexer->lex();
     mandatoryToken(TokenTag::VID, *t);
     m_vid = t->string_data();
 
@@ -103,7 +100,9 @@ DeclExpr::DeclExpr()
 
 IfExpr::IfExpr ()
 {
-    mandatoryToken(TokenTag::IF, *the_lexer->lex());
+    std::unique_ptr<const Token> t = the_lexer->lex();
+    mandatoryToken(TokenTag::IF, *t);
+    m_location = t->location();
     mandatoryToken(TokenTag::LPAREN, *the_lexer->lex());
     m_condition = std::unique_ptr<RPNExpr>(new RPNExpr);
     mandatoryToken(TokenTag::RPAREN, *the_lexer->lex());
@@ -117,6 +116,7 @@ IfExpr::IfExpr ()
 
 RPNExpr::RPNExpr ()
 {
+    m_location = the_lexer->peekLex().location();
     while (true)
     {
         const Token &t = the_lexer->peekLex();
@@ -155,9 +155,11 @@ RPNExpr::RPNExpr ()
 
 Function::Function()
 {
-    mandatoryToken(TokenTag::FUNCTION, *the_lexer->lex());
-
     std::unique_ptr<const Token> t = the_lexer->lex();
+    mandatoryToken(TokenTag::FUNCTION, *t);
+    m_location = t->location();
+
+    t = the_lexer->lex();
     mandatoryToken(TokenTag::FID, *t);
     m_name = t->string_data();
 
@@ -174,18 +176,45 @@ Function::Function()
     m_expr = std::unique_ptr<RPNExpr>(new RPNExpr);
 }
 
+ExternFunction::ExternFunction()
+{
+    std::unique_ptr<const Token> t = the_lexer->lex();
+    mandatoryToken(TokenTag::EXTERN, *t);
+    m_location = t->location();
+
+    t = the_lexer->lex();
+    mandatoryToken(TokenTag::FID, *t);
+    m_name = t->string_data();
+
+    t = the_lexer->lex();
+    mandatoryToken(TokenTag::NUM, *t);
+    m_n_args = t->int_data();
+
+    mandatoryToken(TokenTag::SEMI, *the_lexer->lex());
+}
+
 Program::Program(std::string name) : m_name(std::move(name))
 {
-    mandatoryToken(TokenTag::PROGRAM, *the_lexer->lex());
+    std::unique_ptr<const Token> program = the_lexer->lex();
+    mandatoryToken(TokenTag::PROGRAM, *program);
+    m_location = program->location();
     mandatoryToken(TokenTag::LBRACE, *the_lexer->lex());
 
     while (the_lexer->peekLex().token() != TokenTag::RBRACE)
     {
-        m_functions.push_back(std::unique_ptr<Function>(new Function));
+        if (the_lexer->peekLex().token() == TokenTag::EXTERN)
+        {
+            m_externs.push_back(std::unique_ptr<ExternFunction>(new ExternFunction));
+        }
+        else
+        {
+            m_functions.push_back(std::unique_ptr<Function>(new Function));
+        }
     }
 
     std::unique_ptr<const Token> t = the_lexer->lex();
     mandatoryToken(TokenTag::RBRACE, *t);
+    m_end = t->location();
 
     for (auto &f : m_functions)
     {
@@ -204,3 +233,42 @@ Program *Parser::parse (Lexer *lexer, istream *in, std::string program_name)
     lexed_file = in;
     return new Program(std::move(program_name));
 }
+
+vector<Definition> Parser::parseDefinitions (Lexer *lexer, istream *in)
+{
+    vector<Definition> definitions;
+    while (true)
+    {
+        const Token &t = lexer->peekLex();
+        if (t.token() == TokenTag::RBRACE || t.token() == TokenTag::END)
+        {
+            return definitions;
+        }
+        definitions.push_back(parseDefinition(lexer, in));
+    }
+}
+
+Definition Parser::parseDefinition (Lexer *lexer, istream *in)
+{
+    the_lexer = lexer;
+    lexed_file = in;
+
+    Definition definition;
+    definition.start = the_lexer->peekLex().location().file_pos;
+    if (the_lexer->peekLex().token() == TokenTag::EXTERN)
+    {
+        definition.extern_function = std::unique_ptr<ExternFunction>(new ExternFunction);
+    }
+    else
+    {
+        definition.function = std::unique_ptr<Function>(new Function);
+    }
+    return definition;
+}
+
+std::unique_ptr<RPNExpr> Parser::parseExpression (Lexer *lexer, istream *in)
+{
+    the_lexer = lexer;
+    lexed_file = in;
+    return std::unique_ptr<RPNExpr>(new RPNExpr);
+}
@@ -0,0 +1,58 @@
+#include "partial_eval.hpp"
+
+using namespace li1I;
+
+// Each call nests a few interpreter frames on the C++ stack, so deep
+// recursion has to stop well before the stack does.
+static const size_t max_depth = 4096;
+
+PartialEvaluator::PartialEvaluator(const Program &program, uint64_t budget)
+    : m_interpreter(program), m_budget(budget), m_functions(), m_results()
+{
+    for (auto &func : program)
+    {
+        m_functions[func.name()] = &func;
+    }
+}
+
+bool PartialEvaluator::defines(const std::string &fid) const
+{
+    return m_functions.count(fid);
+}
+
+const Function &PartialEvaluator::function(const std::string &fid) const
+{
+    return *m_functions.at(fid);
+}
+
+PartialEvaluator::Outcome PartialEvaluator::evaluate(const std::string &fid,
+                                                     const std::vector<Value> &args, Value &result)
+{
+    auto key = std::make_pair(fid, args);
+    auto it = m_results.find(key);
+    if (it == m_results.end())
+    {
+        std::pair<Outcome, Value> outcome {Outcome::OUT_OF_BUDGET, 0};
+        if (m_budget)
+        {
+            m_interpreter.setBudget(m_budget, max_depth);
+            try
+            {
+                outcome.second = m_interpreter.call(m_interpreter.slot(fid), args);
+                outcome.first = Outcome::EVALUATED;
+            }
+            catch (BudgetError &e)
+            {
+            }
+            catch (InterpretError &e)
+            {
+                outcome.first = Outcome::FAILED;
+            }
+            m_budget = m_interpreter.budget();
+        }
+        it = m_results.emplace(key, outcome).first;
+    }
+
+    result = it->second.second;
+    return it->second.first;
+}
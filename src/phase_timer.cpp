@@ -0,0 +1,163 @@
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "phase_timer.hpp"
+
+using namespace li1I;
+
+static const unsigned trace_granularity_us = 500;
+
+namespace
+{
+    struct Phase
+    {
+        std::string name;
+        double wall;
+        double cpu;
+        long peak_rss_kb;
+    };
+
+    // Phases in the order they first finished.
+    std::mutex phases_mutex;
+    std::vector<Phase> phases;
+    bool timing = false;
+    std::string trace_path;
+    std::thread::id trace_thread;
+}
+
+static double wallSeconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static double threadCPUSeconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static long peakRSSKilobytes()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+PhaseTiming::PhaseTiming(bool report, std::string trace)
+{
+    timing = report || !trace.empty();
+    trace_path = std::move(trace);
+    trace_thread = std::this_thread::get_id();
+
+    // Pass timers have to be on before any pass manager is made.
+    llvm::TimePassesIsEnabled = report;
+    if (!trace_path.empty())
+    {
+        // Events shorter than this are dropped, as in clang's -ftime-trace,
+        // or a large program's trace is mostly single pass runs.
+        llvm::timeTraceProfilerInitialize(trace_granularity_us, "li1I");
+    }
+}
+
+PhaseTiming::~PhaseTiming()
+{
+    if (llvm::TimePassesIsEnabled)
+    {
+        llvm::errs() << "===-------------------------------------------------------------------------===\n"
+                     << "                              li1I phase timings\n"
+                     << "===-------------------------------------------------------------------------===\n";
+        char line[128];
+        std::snprintf(line, sizeof(line), "  %-24s %12s %12s %14s\n",
+                      "Phase", "Wall (ms)", "CPU (ms)", "Peak RSS (MB)");
+        llvm::errs() << line;
+
+        double total_wall = 0, total_cpu = 0;
+        for (const Phase &phase : phases)
+        {
+            std::snprintf(line, sizeof(line), "  %-24s %12.3f %12.3f %14.1f\n",
+                          phase.name.c_str(), phase.wall * 1e3, phase.cpu * 1e3,
+                          phase.peak_rss_kb / 1024.0);
+            llvm::errs() << line;
+            total_wall += phase.wall;
+            total_cpu += phase.cpu;
+        }
+        std::snprintf(line, sizeof(line), "  %-24s %12.3f %12.3f %14.1f\n\n",
+                      "Total", total_wall * 1e3, total_cpu * 1e3, peakRSSKilobytes() / 1024.0);
+        llvm::errs() << line;
+
+        llvm::reportAndResetTimings(&llvm::errs());
+        llvm::TimePassesIsEnabled = false;
+    }
+
+    if (!trace_path.empty())
+    {
+        std::error_code error;
+        llvm::raw_fd_ostream out(trace_path, error, llvm::sys::fs::F_Text);
+        if (error)
+        {
+            llvm::errs() << "Cannot write trace " << trace_path << ": " << error.message() << "\n";
+        }
+        else
+        {
+            llvm::timeTraceProfilerWrite(out);
+        }
+        llvm::timeTraceProfilerCleanup();
+    }
+
+    timing = false;
+}
+
+PhaseScope::PhaseScope(const char *name)
+    : m_name(name), m_active(timing), m_wall_start(0), m_cpu_start(0), m_trace()
+{
+    if (!m_active)
+    {
+        return;
+    }
+
+    if (!trace_path.empty() && std::this_thread::get_id() == trace_thread)
+    {
+        m_trace.reset(new llvm::TimeTraceScope(name));
+    }
+    m_wall_start = wallSeconds();
+    m_cpu_start = threadCPUSeconds();
+}
+
+PhaseScope::~PhaseScope()
+{
+    if (!m_active)
+    {
+        return;
+    }
+
+    double wall = wallSeconds() - m_wall_start;
+    double cpu = threadCPUSeconds() - m_cpu_start;
+    long peak = peakRSSKilobytes();
+    m_trace.reset();
+
+    std::lock_guard<std::mutex> lock(phases_mutex);
+    for (Phase &phase : phases)
+    {
+        if (phase.name == m_name)
+        {
+            phase.wall += wall;
+            phase.cpu += cpu;
+            phase.peak_rss_kb = std::max(phase.peak_rss_kb, peak);
+            return;
+        }
+    }
+    phases.push_back(Phase{m_name, wall, cpu, peak});
+}
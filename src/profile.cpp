@@ -0,0 +1,134 @@
+#include <llvm/IR/ProfileSummary.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+#include "profile.hpp"
+
+using namespace li1I;
+
+// The same percentiles LLVM's own profile readers summarise at.
+static const uint32_t summary_cutoffs[] = {
+    10000, 100000, 200000, 300000, 400000, 500000, 600000, 700000,
+    800000, 900000, 950000, 990000, 999000, 999900, 999990, 999999
+};
+
+ProfileData ProfileData::read(const std::string &path)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        throw ProfileError("Cannot open profile " + path);
+    }
+
+    ProfileData data;
+    std::string line;
+    for (size_t line_number = 1; std::getline(in, line); line_number++)
+    {
+        std::istringstream words(line);
+        std::string fid;
+        if (!(words >> fid))
+        {
+            continue;
+        }
+
+        FunctionProfile profile {0, {}};
+        if (!(words >> profile.entry))
+        {
+            std::stringstream ss;
+            ss << path << ":" << line_number << ": expected an entry count";
+            throw ProfileError(ss.str());
+        }
+
+        for (uint64_t count; words >> count;)
+        {
+            profile.branches.push_back(count);
+        }
+
+        if (!words.eof() || profile.branches.size() % 2)
+        {
+            std::stringstream ss;
+            ss << path << ":" << line_number << ": expected pairs of branch counts";
+            throw ProfileError(ss.str());
+        }
+
+        data.add(fid, std::move(profile));
+    }
+
+    return data;
+}
+
+void ProfileData::write(const std::string &path) const
+{
+    std::ofstream out(path);
+    for (auto &function : m_functions)
+    {
+        out << function.first << " " << function.second.entry;
+        for (uint64_t count : function.second.branches)
+        {
+            out << " " << count;
+        }
+        out << "\n";
+    }
+
+    if (!out)
+    {
+        throw ProfileError("Cannot write profile " + path);
+    }
+}
+
+void ProfileData::add(const std::string &fid, FunctionProfile profile)
+{
+    m_functions[fid] = std::move(profile);
+}
+
+const FunctionProfile *ProfileData::find(const std::string &fid) const
+{
+    auto it = m_functions.find(fid);
+    return it == m_functions.end() ? nullptr : &it->second;
+}
+
+llvm::Metadata *ProfileData::summary(llvm::LLVMContext &context) const
+{
+    std::vector<uint64_t> counts;
+    uint64_t total = 0, max_count = 0, max_internal = 0, max_entry = 0;
+    for (auto &function : m_functions)
+    {
+        counts.push_back(function.second.entry);
+        max_entry = std::max(max_entry, function.second.entry);
+        for (uint64_t count : function.second.branches)
+        {
+            counts.push_back(count);
+            max_internal = std::max(max_internal, count);
+        }
+    }
+
+    for (uint64_t count : counts)
+    {
+        total += count;
+        max_count = std::max(max_count, count);
+    }
+
+    // Each cutoff gives the smallest count among the hottest counters
+    // which together make up that fraction of all counts.
+    std::sort(counts.begin(), counts.end(), std::greater<uint64_t>());
+    llvm::SummaryEntryVector detailed;
+    size_t n = 0;
+    uint64_t covered = 0;
+    for (uint32_t cutoff : summary_cutoffs)
+    {
+        uint64_t wanted = static_cast<uint64_t>(
+            static_cast<double>(total) * cutoff / llvm::ProfileSummary::Scale);
+        while (n < counts.size() && (n == 0 || covered < wanted))
+        {
+            covered += counts[n++];
+        }
+        detailed.emplace_back(cutoff, n ? counts[n - 1] : 0, n);
+    }
+
+    llvm::ProfileSummary summary (llvm::ProfileSummary::PSK_Instr, detailed, total,
+                                  max_count, max_internal, max_entry,
+                                  counts.size(), m_functions.size());
+    return summary.getMD(context);
+}
@@ -0,0 +1,480 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Target/TargetMachine.h>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#include "repl.hpp"
+#include "codegen_target.hpp"
+#include "jit_profiling.hpp"
+#include "lexer.hpp"
+#include "li1I_bigint.h"
+#include "optimizer.hpp"
+#include "parser.hpp"
+
+using namespace li1I;
+
+// Puts definition in place of the one named fid, or removes it if
+// definition is null, returning whatever was there before.
+template <typename T>
+static std::unique_ptr<T> replaceDefinition(std::vector<std::unique_ptr<T> > &definitions,
+                                            const std::string &fid, std::unique_ptr<T> definition)
+{
+    for (auto it = definitions.begin(); it != definitions.end(); ++it)
+    {
+        if ((*it)->name() == fid)
+        {
+            std::swap(*it, definition);
+            if (!*it)
+            {
+                definitions.erase(it);
+            }
+            return definition;
+        }
+    }
+
+    if (definition)
+    {
+        definitions.push_back(std::move(definition));
+    }
+    return nullptr;
+}
+
+static void collectCalls(const RPNExpr &node, std::set<std::string> &callees)
+{
+    for (auto &expr : node)
+    {
+        if (auto call = dynamic_cast<const CallExpr*>(&expr))
+        {
+            callees.insert(call->fid());
+        }
+        else if (auto decl = dynamic_cast<const DeclExpr*>(&expr))
+        {
+            collectCalls(decl->value(), callees);
+        }
+        else if (auto if_expr = dynamic_cast<const IfExpr*>(&expr))
+        {
+            collectCalls(if_expr->condition(), callees);
+            collectCalls(if_expr->if_forms(), callees);
+            collectCalls(if_expr->else_forms(), callees);
+        }
+    }
+}
+
+static void checkExtern(const ExternFunction &extern_function)
+{
+    if (!llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(extern_function.name()))
+    {
+        throw ReplError("Cannot find extern function " + extern_function.name()
+                        + ", --load the library defining it");
+    }
+}
+
+ReplSession::ReplSession(std::string name, unsigned opt_level,
+                         llvm::CodeGenOpt::Level codegen_level, bool bigint)
+    : m_program(new Program), m_functions(), m_uncompiled(), m_codegenner(),
+      m_target_machine(), m_engine(), m_opt_level(opt_level), m_codegen_level(codegen_level),
+      m_bigint(bigint), m_slots(), m_n_modules(0)
+{
+    m_program->m_name = std::move(name);
+    m_codegenner.setBigint(bigint);
+
+    llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+    llvm::EngineBuilder target_builder;
+    applyTarget(target_builder);
+    m_target_machine.reset(target_builder.selectTarget());
+}
+
+ReplSession::~ReplSession()
+{
+}
+
+void ReplSession::load(std::unique_ptr<Program> program)
+{
+    for (auto &extern_function : program->externs())
+    {
+        checkExtern(*extern_function);
+    }
+
+    m_program = std::move(program);
+    m_functions.clear();
+    m_uncompiled.clear();
+    for (const Function &function : *m_program)
+    {
+        m_functions[function.name()] = &function;
+        m_uncompiled.insert(function.name());
+    }
+}
+
+bool ReplSession::evaluate(const std::string &input)
+{
+    // Each step is either a run of definitions or one expression.
+    std::vector<std::pair<std::vector<Definition>, std::unique_ptr<RPNExpr> > > steps;
+    std::istringstream in (input);
+    Lexer lexer (in);
+    Parser parser;
+    try
+    {
+        while (lexer.peekLex().token() != TokenTag::END)
+        {
+            TokenTag tag = lexer.peekLex().token();
+            if (tag == TokenTag::FUNCTION || tag == TokenTag::EXTERN)
+            {
+                if (steps.empty() || steps.back().second)
+                {
+                    steps.emplace_back();
+                }
+                steps.back().first.push_back(parser.parseDefinition(&lexer, &in));
+            }
+            else
+            {
+                steps.emplace_back(std::vector<Definition>(), parser.parseExpression(&lexer, &in));
+            }
+        }
+    }
+    catch (ParseError &e)
+    {
+        // Only running out of input can leave the error past the last token.
+        std::streamoff at = e.location().file_pos;
+        if (at < 0 || static_cast<size_t>(at) > input.find_last_not_of(" \t\r\n"))
+        {
+            return false;
+        }
+        throw;
+    }
+
+    for (auto &step : steps)
+    {
+        if (step.second)
+        {
+            evaluateExpression(std::move(step.second));
+        }
+        else
+        {
+            define(std::move(step.first));
+        }
+    }
+    return true;
+}
+
+void ReplSession::define(std::vector<Definition> definitions)
+{
+    for (auto &definition : definitions)
+    {
+        if (definition.extern_function)
+        {
+            checkExtern(*definition.extern_function);
+        }
+    }
+
+    // What each definition replaced, to be put back if any of them doesn't
+    // compile.
+    struct OldFunction
+    {
+        std::string fid;
+        std::unique_ptr<Function> function;
+        bool uncompiled;
+    };
+    std::vector<OldFunction> old_functions;
+    std::vector<std::pair<std::string, std::unique_ptr<ExternFunction> > > old_externs;
+    for (auto &definition : definitions)
+    {
+        if (definition.function)
+        {
+            std::string fid = definition.function->name();
+            bool uncompiled = !m_uncompiled.insert(fid).second;
+            m_functions[fid] = definition.function.get();
+            old_functions.push_back({fid, replaceDefinition(m_program->m_functions, fid,
+                                                            std::move(definition.function)),
+                                     uncompiled});
+        }
+        else
+        {
+            std::string fid = definition.extern_function->name();
+            old_externs.emplace_back(fid, replaceDefinition(m_program->m_externs, fid,
+                                                            std::move(definition.extern_function)));
+        }
+    }
+
+    std::vector<const Function*> ready;
+    std::set<std::string> fids;
+    std::set<std::string> compiled;
+    for (auto &old : old_functions)
+    {
+        if (!fids.insert(old.fid).second)
+        {
+            continue;
+        }
+
+        std::pair<std::string, std::string> missing;
+        std::vector<const Function*> functions = uncompiledFrom({old.fid}, missing);
+        if (!missing.second.empty())
+        {
+            std::cerr << old.fid << " is waiting for " << missing.second << " to be defined"
+                      << std::endl;
+            continue;
+        }
+        for (const Function *function : functions)
+        {
+            if (compiled.insert(function->name()).second)
+            {
+                ready.push_back(function);
+            }
+        }
+    }
+
+    std::unique_ptr<llvm::Module> module;
+    try
+    {
+        if (!ready.empty())
+        {
+            module.reset(m_codegenner.codegenFunctions(*m_program, ready));
+        }
+    }
+    catch (...)
+    {
+        // In reverse, so that anything defined twice ends up as it was.
+        for (auto it = old_functions.rbegin(); it != old_functions.rend(); ++it)
+        {
+            if (it->function)
+            {
+                m_functions[it->fid] = it->function.get();
+            }
+            else
+            {
+                m_functions.erase(it->fid);
+            }
+            if (!it->uncompiled)
+            {
+                m_uncompiled.erase(it->fid);
+            }
+            replaceDefinition(m_program->m_functions, it->fid, std::move(it->function));
+        }
+        for (auto it = old_externs.rbegin(); it != old_externs.rend(); ++it)
+        {
+            replaceDefinition(m_program->m_externs, it->first, std::move(it->second));
+        }
+        throw;
+    }
+
+    if (module)
+    {
+        install(std::move(module));
+    }
+    for (auto &fid : compiled)
+    {
+        m_uncompiled.erase(fid);
+    }
+
+    fids.clear();
+    for (auto &old : old_functions)
+    {
+        // Only the first definition of it here says what its callers expect.
+        size_t n_args = m_functions[old.fid]->nArgs();
+        if (fids.insert(old.fid).second && old.function && old.function->nArgs() != n_args
+            && m_slots.count({old.fid, old.function->nArgs()}))
+        {
+            std::cerr << old.fid << " now takes " << n_args << " arguments, but functions"
+                      << " defined before it still call its old definition" << std::endl;
+        }
+    }
+}
+
+void ReplSession::evaluateExpression(std::unique_ptr<RPNExpr> expr)
+{
+    std::set<std::string> callees;
+    collectCalls(*expr, callees);
+    std::pair<std::string, std::string> missing;
+    std::vector<const Function*> functions = uncompiledFrom(callees, missing);
+    if (!missing.second.empty())
+    {
+        throw ReplError(missing.first.empty() ? "No such function as " + missing.second
+                        : missing.first + " is waiting for " + missing.second + " to be defined");
+    }
+
+    // Not an FID, so nothing can call it.
+    std::string name = "repl." + std::to_string(m_n_modules);
+    m_program->m_functions.emplace_back(new Function(name, std::move(expr)));
+    functions.push_back(m_program->m_functions.back().get());
+    std::unique_ptr<llvm::Module> module;
+    try
+    {
+        module.reset(m_codegenner.codegenFunctions(*m_program, functions));
+    }
+    catch (...)
+    {
+        m_program->m_functions.pop_back();
+        throw;
+    }
+    m_program->m_functions.pop_back();
+    install(std::move(module));
+    functions.pop_back();
+    for (const Function *function : functions)
+    {
+        m_uncompiled.erase(function->name());
+    }
+
+    uint64_t address = m_engine->getFunctionAddress(name);
+    if (m_bigint)
+    {
+        std::cout << std::flush;
+        li1I_bigint_print(reinterpret_cast<uint64_t (*)()>(address)());
+        std::fflush(stdout);
+    }
+    else
+    {
+        std::cout << static_cast<uint32_t>(reinterpret_cast<Value (*)()>(address)()) << std::endl;
+    }
+}
+
+// The uncompiled functions among fids and whatever they call, stopping at
+// compiled functions, which only call compiled functions. missing is set
+// to a caller and callee which isn't defined, if any; the caller is empty
+// when the callee was one of fids.
+std::vector<const Function*> ReplSession::uncompiledFrom(
+    std::set<std::string> fids, std::pair<std::string, std::string> &missing) const
+{
+    std::vector<const Function*> functions;
+    std::vector<std::pair<std::string, std::string> > queue;
+    for (auto &fid : fids)
+    {
+        queue.emplace_back("", fid);
+    }
+    while (!queue.empty() && missing.second.empty())
+    {
+        auto call = queue.back();
+        queue.pop_back();
+        auto function = m_functions.find(call.second);
+        if (function == m_functions.end())
+        {
+            if (!isExtern(call.second))
+            {
+                missing = call;
+            }
+            continue;
+        }
+        if (!m_uncompiled.count(call.second))
+        {
+            continue;
+        }
+
+        functions.push_back(function->second);
+        std::set<std::string> callees;
+        collectCalls(function->second->expr(), callees);
+        for (auto &callee : callees)
+        {
+            if (fids.insert(callee).second)
+            {
+                queue.emplace_back(call.second, callee);
+            }
+        }
+    }
+    return functions;
+}
+
+bool ReplSession::isExtern(const std::string &fid) const
+{
+    for (auto &extern_function : m_program->externs())
+    {
+        if (extern_function->name() == fid)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void *&ReplSession::slot(const std::string &fid, size_t n_args)
+{
+    return m_slots[{fid, n_args}];
+}
+
+// Sends calls from one li1I function to another through the callee's
+// slot, renames the functions module defines so that MCJIT can tell them
+// from earlier definitions, then compiles it and points their slots at
+// the new code. A function's calls to itself stay direct.
+void ReplSession::install(std::unique_ptr<llvm::Module> module)
+{
+    std::vector<llvm::Function*> defined;
+    std::vector<llvm::Function*> declared;
+    std::vector<llvm::CallInst*> calls;
+    for (llvm::Function &function : *module)
+    {
+        // Anything else, the bignum runtime included, isn't named like an
+        // FID.
+        llvm::StringRef fid = function.getName();
+        if (function.isIntrinsic() || !fid.startswith("I") || isExtern(fid.str()))
+        {
+            continue;
+        }
+
+        (function.isDeclaration() ? declared : defined).push_back(&function);
+        for (llvm::User *user : function.users())
+        {
+            auto call = llvm::dyn_cast<llvm::CallInst>(user);
+            if (call && call->getCalledFunction() == &function && call->getFunction() != &function)
+            {
+                calls.push_back(call);
+            }
+        }
+    }
+
+    for (llvm::CallInst *call : calls)
+    {
+        llvm::Function *callee = call->getCalledFunction();
+        llvm::IRBuilder<> builder (call);
+        uint64_t address = reinterpret_cast<uint64_t>(&slot(callee->getName().str(), callee->arg_size()));
+        llvm::Value *slot_pointer = builder.CreateIntToPtr(builder.getInt64(address),
+                                                           callee->getType()->getPointerTo());
+        llvm::Value *target = builder.CreateLoad(callee->getType(), slot_pointer,
+                                                 callee->getName() + ".slot");
+        call->setCalledFunction(callee->getFunctionType(), target);
+    }
+    for (llvm::Function *function : declared)
+    {
+        function->eraseFromParent();
+    }
+
+    std::vector<std::pair<std::string, size_t> > fids;
+    std::string suffix = "." + std::to_string(m_n_modules++);
+    for (llvm::Function *function : defined)
+    {
+        fids.emplace_back(function->getName().str(), function->arg_size());
+        function->setName(fids.back().first + suffix);
+    }
+
+    module->setDataLayout(m_target_machine->createDataLayout());
+    if (m_opt_level)
+    {
+        optimizeModule(*module, m_opt_level, m_target_machine.get());
+    }
+
+    if (m_engine)
+    {
+        m_engine->addModule(std::move(module));
+    }
+    else
+    {
+        llvm::EngineBuilder builder (std::move(module));
+        applyTarget(builder);
+        if (m_opt_level)
+        {
+            builder.setOptLevel(m_codegen_level);
+        }
+        m_engine.reset(builder.create());
+        registerJITListeners(*m_engine);
+    }
+    m_engine->finalizeObject();
+
+    for (auto &fid : fids)
+    {
+        slot(fid.first, fid.second) = reinterpret_cast<void*>(
+            m_engine->getFunctionAddress(fid.first + suffix));
+    }
+}
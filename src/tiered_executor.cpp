@@ -0,0 +1,189 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <vector>
+
+#include "tiered_executor.hpp"
+#include "ast_to_ir.hpp"
+#include "codegen_target.hpp"
+#include "jit_profiling.hpp"
+
+using namespace li1I;
+
+// Gives every li1I function an `<fid>.tier` entry point which takes its
+// arguments as an array, so the interpreter can call it whatever the arity.
+static void addTierEntries(const Program &program, llvm::Module &module)
+{
+    llvm::LLVMContext &context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Type *value_type = llvm::Type::getInt32Ty(context);
+    llvm::FunctionType *entry_type =
+        llvm::FunctionType::get(value_type, {value_type->getPointerTo()}, false);
+
+    for (auto &func : program)
+    {
+        llvm::Function *callee = module.getFunction(func.name());
+        llvm::Function *entry = llvm::Function::Create(entry_type,
+                                                       llvm::Function::ExternalLinkage,
+                                                       func.name() + ".tier", &module);
+        builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", entry));
+
+        llvm::Value *argv = &*entry->arg_begin();
+        std::vector<llvm::Value*> args;
+        for (unsigned i = 0; i < func.nArgs(); i++)
+        {
+            llvm::Value *arg_ptr = builder.CreateConstGEP1_32(value_type, argv, i);
+            args.push_back(builder.CreateLoad(value_type, arg_ptr));
+        }
+
+        builder.CreateRet(builder.CreateCall(callee, args));
+    }
+
+    recordTarget(module);
+}
+
+TieredExecutor::TieredExecutor(const Program &program, uint64_t threshold,
+                               uint64_t llvm_threshold)
+    : m_program(program), m_interpreter(program), m_llvm_threshold(llvm_threshold),
+      m_baseline(), m_baseline_failed(false), m_mutex(), m_wakeup(), m_queue(),
+      m_done(false), m_compiler()
+{
+    m_interpreter.setHotHandler(threshold, [this](FunctionSlot &slot)
+    {
+        promote(slot);
+    });
+}
+
+TieredExecutor::~TieredExecutor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_wakeup.notify_one();
+
+    if (m_compiler.joinable())
+    {
+        m_compiler.join();
+    }
+}
+
+Value TieredExecutor::run()
+{
+    return m_interpreter.run();
+}
+
+// The first function to get hot in the interpreter has the baseline JIT
+// compile the whole program, which is quick enough to do there and then.
+void TieredExecutor::promote(FunctionSlot &slot)
+{
+    if (!m_baseline && !m_baseline_failed)
+    {
+        std::unique_ptr<BaselineJIT> baseline(new BaselineJIT);
+        try
+        {
+            baseline->compileTier(m_program, m_interpreter.slots(), m_llvm_threshold,
+                                  [this](FunctionSlot &slot)
+            {
+                enqueue(slot);
+            });
+            m_baseline = std::move(baseline);
+        }
+        catch (std::exception &e)
+        {
+            m_baseline_failed = true;
+        }
+    }
+
+    if (!m_baseline)
+    {
+        enqueue(slot);
+        return;
+    }
+
+    // Baseline code may have got the function to LLVM already.
+    NativeEntry interpreted = NULL;
+    slot.native.compare_exchange_strong(interpreted, m_baseline->entry(slot.function->name()),
+                                        std::memory_order_acq_rel);
+}
+
+void TieredExecutor::enqueue(FunctionSlot &slot)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(&slot);
+    }
+
+    // Programs which never get hot never pay for the compiler thread.
+    if (!m_compiler.joinable())
+    {
+        m_compiler = std::thread(&TieredExecutor::compileLoop, this);
+    }
+    m_wakeup.notify_one();
+}
+
+void TieredExecutor::compileLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_wakeup.wait(lock, [this] { return m_done || !m_queue.empty(); });
+        if (m_done)
+        {
+            return;
+        }
+
+        FunctionSlot *slot = m_queue.front();
+        m_queue.pop_front();
+        lock.unlock();
+
+        if (!m_engine && m_compile_error.empty())
+        {
+            try
+            {
+                compileProgram();
+            }
+            catch (std::exception &e)
+            {
+                // The interpreter reports the error itself if it reaches it.
+                m_compile_error = e.what();
+            }
+        }
+
+        if (m_engine)
+        {
+            uint64_t address = m_engine->getFunctionAddress(slot->function->name() + ".tier");
+            slot->native.store(reinterpret_cast<NativeEntry>(address),
+                               std::memory_order_release);
+            if (m_baseline)
+            {
+                m_baseline->redirect(*slot);
+            }
+        }
+
+        lock.lock();
+    }
+}
+
+// The first hot function pulls in the whole program, compiled at full
+// optimisation; later ones only need their entry point looked up.
+void TieredExecutor::compileProgram()
+{
+    m_codegenner.reset(new ASTToIRVisitor);
+    std::unique_ptr<llvm::Module> module {m_codegenner->codegenIR(m_program)};
+    addTierEntries(m_program, *module);
+
+    std::string error;
+    llvm::EngineBuilder builder(std::move(module));
+    builder.setErrorStr(&error).setOptLevel(llvm::CodeGenOpt::Aggressive);
+    applyTarget(builder);
+    m_engine.reset(builder.create());
+    if (!m_engine)
+    {
+        throw IRTransformError(error);
+    }
+    registerJITListeners(*m_engine);
+
+    m_engine->finalizeObject();
+}
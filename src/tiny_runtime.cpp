@@ -0,0 +1,116 @@
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Host.h>
+#include <vector>
+
+#include "tiny_runtime.hpp"
+
+using namespace li1I;
+
+// "-2147483648\n"
+static const uint64_t buffer_size = 12;
+
+TinyRuntimeIR::TinyRuntimeIR(llvm::IRBuilder<> &builder)
+    : m_builder(builder), m_aarch64(false)
+{
+    llvm::Triple triple (llvm::sys::getDefaultTargetTriple());
+    if (!triple.isOSLinux() || (triple.getArch() != llvm::Triple::x86_64
+                                && triple.getArch() != llvm::Triple::aarch64))
+    {
+        throw TinyRuntimeError("--tiny-runtime only supports x86-64 and AArch64 Linux, not "
+                               + triple.str());
+    }
+    m_aarch64 = triple.getArch() == llvm::Triple::aarch64;
+}
+
+llvm::Function *TinyRuntimeIR::createStart(llvm::Module &module)
+{
+    llvm::FunctionType *type = llvm::FunctionType::get(m_builder.getVoidTy(), false);
+    llvm::Function *start = llvm::Function::Create(type, llvm::Function::ExternalLinkage,
+                                                   "_start", module);
+    start->setDoesNotReturn();
+    start->setDoesNotThrow();
+    // The kernel enters _start with the stack 16 byte aligned, not just
+    // after a call as code expects.
+    start->addFnAttr("stackrealign");
+
+    m_builder.SetInsertPoint(llvm::BasicBlock::Create(module.getContext(), "entry", start));
+    return start;
+}
+
+// Arguments go in the registers the kernel takes them in, and the result
+// comes back in the first.
+llvm::Value *TinyRuntimeIR::syscall(uint64_t number, llvm::ArrayRef<llvm::Value*> args)
+{
+    static const char *const x86_64_registers[] = {"{rdi}", "{rsi}", "{rdx}"};
+    static const char *const aarch64_registers[] = {"{x0}", "{x1}", "{x2}"};
+
+    std::string constraints = m_aarch64 ? "={x0},{x8}" : "={rax},{rax}";
+    std::vector<llvm::Type*> types {m_builder.getInt64Ty()};
+    std::vector<llvm::Value*> values {m_builder.getInt64(number)};
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        constraints += std::string(",") + (m_aarch64 ? aarch64_registers : x86_64_registers)[i];
+        types.push_back(args[i]->getType());
+        values.push_back(args[i]);
+    }
+    constraints += m_aarch64 ? ",~{memory}" : ",~{rcx},~{r11},~{memory}";
+
+    llvm::InlineAsm *instruction = llvm::InlineAsm::get(
+        llvm::FunctionType::get(m_builder.getInt64Ty(), types, false),
+        m_aarch64 ? "svc #0" : "syscall", constraints, true);
+    return m_builder.CreateCall(instruction, values);
+}
+
+// Digits are written backwards from the end of a buffer on the stack,
+// then the sign in front of them whether or not it's needed, so only the
+// digit loop branches.
+void TinyRuntimeIR::printAndExit(llvm::Value *value)
+{
+    llvm::LLVMContext &context = m_builder.getContext();
+    llvm::Function *function = m_builder.GetInsertBlock()->getParent();
+    llvm::Type *i8 = m_builder.getInt8Ty();
+    llvm::Type *i64 = m_builder.getInt64Ty();
+
+    llvm::Type *buffer_type = llvm::ArrayType::get(i8, buffer_size);
+    llvm::Value *buffer = m_builder.CreateAlloca(buffer_type);
+    auto at = [&](llvm::Value *index)
+    {
+        return m_builder.CreateInBoundsGEP(buffer_type, buffer, {m_builder.getInt64(0), index});
+    };
+    m_builder.CreateStore(m_builder.getInt8('\n'), at(m_builder.getInt64(buffer_size - 1)));
+
+    llvm::Value *negative = m_builder.CreateICmpSLT(value, m_builder.getInt32(0));
+    llvm::Value *magnitude = m_builder.CreateSelect(negative, m_builder.CreateNeg(value), value);
+
+    llvm::BasicBlock *entry = m_builder.GetInsertBlock();
+    llvm::BasicBlock *digits = llvm::BasicBlock::Create(context, "digits", function);
+    llvm::BasicBlock *write = llvm::BasicBlock::Create(context, "write", function);
+    m_builder.CreateBr(digits);
+
+    m_builder.SetInsertPoint(digits);
+    llvm::PHINode *position = m_builder.CreatePHI(i64, 2, "position");
+    llvm::PHINode *rest = m_builder.CreatePHI(value->getType(), 2, "rest");
+    llvm::Value *ten = llvm::ConstantInt::get(value->getType(), 10);
+    llvm::Value *next_position = m_builder.CreateSub(position, m_builder.getInt64(1));
+    llvm::Value *digit = m_builder.CreateTrunc(m_builder.CreateURem(rest, ten), i8);
+    m_builder.CreateStore(m_builder.CreateAdd(digit, m_builder.getInt8('0')), at(next_position));
+    llvm::Value *next_rest = m_builder.CreateUDiv(rest, ten);
+    m_builder.CreateCondBr(m_builder.CreateIsNotNull(next_rest), digits, write);
+    position->addIncoming(m_builder.getInt64(buffer_size - 1), entry);
+    position->addIncoming(next_position, digits);
+    rest->addIncoming(magnitude, entry);
+    rest->addIncoming(next_rest, digits);
+
+    m_builder.SetInsertPoint(write);
+    llvm::Value *sign_position = m_builder.CreateSub(next_position, m_builder.getInt64(1));
+    m_builder.CreateStore(m_builder.getInt8('-'), at(sign_position));
+    llvm::Value *first = m_builder.CreateSelect(negative, sign_position, next_position);
+
+    // write(1, buffer + first, size - first), then exit_group(0).
+    syscall(m_aarch64 ? 64 : 1, {m_builder.getInt64(1), at(first),
+                                 m_builder.CreateSub(m_builder.getInt64(buffer_size), first)});
+    syscall(m_aarch64 ? 94 : 231, {m_builder.getInt64(0)});
+    m_builder.CreateUnreachable();
+}
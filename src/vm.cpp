@@ -0,0 +1,205 @@
+#include "vm.hpp"
+#include "extern_call.hpp"
+
+using namespace li1I;
+
+#if defined(__GNUC__)
+#define LI1I_THREADED_DISPATCH
+#endif
+
+VM::VM(const BytecodeProgram &program, size_t stack_size)
+    : m_program(program), m_entries(), m_externs(), m_stack_size(stack_size),
+      m_stack(new Value[stack_size]), m_frames(new Frame[stack_size / 4 + 1])
+{
+    for (auto &function : m_program.functions)
+    {
+        m_entries.push_back(function.code.data());
+    }
+    for (auto &external : m_program.externs)
+    {
+        m_externs.push_back(findExtern(external.name, external.n_args));
+    }
+}
+
+Value VM::run()
+{
+    return call(m_program.main_index, {});
+}
+
+Value VM::call(size_t function, const std::vector<Value> &args)
+{
+    const BytecodeFunction &entry = m_program.functions[function];
+    if (args.size() != entry.n_args)
+    {
+        throw VMError("Wrong number of arguments to " + entry.name);
+    }
+    if (entry.frame_size > m_stack_size)
+    {
+        throw VMError("Stack overflow");
+    }
+
+    const BytecodeFunction *const functions = m_program.functions.data();
+    const Instruction *const *const entries = m_entries.data();
+    const BytecodeExtern *const externs = m_program.externs.data();
+    void *const *const extern_addresses = m_externs.data();
+    Value *const stack_end = m_stack.get() + m_stack_size;
+    Frame *const frames_begin = m_frames.get();
+    Frame *const frames_end = frames_begin + m_stack_size / 4;
+
+    Value *base = m_stack.get();
+    Frame *frame = frames_begin;
+    const Instruction *code = entries[function];
+    const Instruction *pc = code;
+
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        base[i] = args[i];
+    }
+
+#ifdef LI1I_THREADED_DISPATCH
+    static const void *const labels[] = {
+        &&op_LOADI, &&op_MOVE,
+        &&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV, &&op_EXP,
+        &&op_GT, &&op_LT, &&op_EQ, &&op_NEQ,
+        &&op_ADDI, &&op_SUBI, &&op_MULI, &&op_DIVI, &&op_EXPI,
+        &&op_GTI, &&op_LTI, &&op_EQI, &&op_NEQI,
+        &&op_JUMP, &&op_JUMPF,
+        &&op_JNGT, &&op_JNLT, &&op_JNEQ, &&op_JNNE,
+        &&op_JNGTI, &&op_JNLTI, &&op_JNEQI, &&op_JNNEI,
+        &&op_CALL, &&op_CALLX, &&op_RET, &&op_RETI
+    };
+    static_assert(sizeof(labels) / sizeof(labels[0])
+                  == static_cast<size_t>(Opcode::N_OPCODES),
+                  "Dispatch table out of sync with Opcode");
+
+#define VM_CASE(name) op_##name:
+#define VM_NEXT() goto *labels[static_cast<size_t>(pc->op)]
+    VM_NEXT();
+#else
+#define VM_CASE(name) case Opcode::name:
+#define VM_NEXT() goto dispatch
+dispatch:
+    switch (pc->op)
+    {
+#endif
+
+#define VM_BINARY(name, op) \
+    VM_CASE(name) \
+        base[pc->a] = applyOperator(op, base[pc->b], base[pc->c]); \
+        ++pc; \
+        VM_NEXT(); \
+    VM_CASE(name##I) \
+        base[pc->a] = applyOperator(op, base[pc->b], pc->imm); \
+        ++pc; \
+        VM_NEXT();
+
+#define VM_BRANCH(name, op) \
+    VM_CASE(JN##name) \
+        pc = applyOperator(op, base[pc->a], base[pc->b]) ? pc + 1 : code + pc->target; \
+        VM_NEXT(); \
+    VM_CASE(JN##name##I) \
+        pc = applyOperator(op, base[pc->a], pc->imm) ? pc + 1 : code + pc->target; \
+        VM_NEXT();
+
+    VM_CASE(LOADI)
+        base[pc->a] = pc->imm;
+        ++pc;
+        VM_NEXT();
+
+    VM_CASE(MOVE)
+        base[pc->a] = base[pc->b];
+        ++pc;
+        VM_NEXT();
+
+    VM_BINARY(ADD, Operator::PLUS)
+    VM_BINARY(SUB, Operator::MINUS)
+    VM_BINARY(MUL, Operator::TIMES)
+    VM_BINARY(DIV, Operator::DIV)
+    VM_BINARY(EXP, Operator::EXP)
+    VM_BINARY(GT, Operator::GT)
+    VM_BINARY(LT, Operator::LT)
+    VM_BINARY(EQ, Operator::EQ)
+    VM_BINARY(NEQ, Operator::NEQ)
+
+    VM_CASE(JUMP)
+        pc = code + pc->target;
+        VM_NEXT();
+
+    VM_CASE(JUMPF)
+        pc = isTruthy(base[pc->a]) ? pc + 1 : code + pc->target;
+        VM_NEXT();
+
+    VM_BRANCH(GT, Operator::GT)
+    VM_BRANCH(LT, Operator::LT)
+    VM_BRANCH(EQ, Operator::EQ)
+    VM_BRANCH(NE, Operator::NEQ)
+
+    VM_CASE(CALL)
+    {
+        Value *callee_base = base + pc->c;
+        if (callee_base + functions[pc->b].frame_size > stack_end
+            || frame + 1 == frames_end)
+        {
+            throw VMError("Stack overflow");
+        }
+
+        ++frame;
+        frame->return_pc = pc + 1;
+        frame->code = code;
+        frame->base = base;
+        frame->result = pc->a;
+
+        base = callee_base;
+        code = pc = entries[pc->b];
+        VM_NEXT();
+    }
+
+    VM_CASE(CALLX)
+        base[pc->a] = callExtern(extern_addresses[pc->b], base + pc->c, externs[pc->b].n_args);
+        ++pc;
+        VM_NEXT();
+
+    VM_CASE(RET)
+    {
+        Value result = base[pc->a];
+        if (frame == frames_begin)
+        {
+            return result;
+        }
+
+        base = frame->base;
+        base[frame->result] = result;
+        code = frame->code;
+        pc = frame->return_pc;
+        --frame;
+        VM_NEXT();
+    }
+
+    VM_CASE(RETI)
+    {
+        Value result = pc->imm;
+        if (frame == frames_begin)
+        {
+            return result;
+        }
+
+        base = frame->base;
+        base[frame->result] = result;
+        code = frame->code;
+        pc = frame->return_pc;
+        --frame;
+        VM_NEXT();
+    }
+
+#ifndef LI1I_THREADED_DISPATCH
+    case Opcode::N_OPCODES: break;
+    }
+#endif
+
+#undef VM_BRANCH
+#undef VM_BINARY
+#undef VM_NEXT
+#undef VM_CASE
+
+    throw VMError("Invalid opcode");
+}
@@ -0,0 +1,20 @@
+#include <stdint.h>
+
+/* Extern functions for ffi.li. Arguments come off the li1I stack in
+   order, so the first is whatever was pushed last. */
+
+/* base to the power exponent, modulo modulus */
+int Ili(int exponent, int base, int modulus)
+{
+    uint64_t result = 1;
+    uint64_t square = (uint32_t)base % (uint32_t)modulus;
+    for (uint32_t e = exponent; e; e >>= 1)
+    {
+        if (e & 1)
+        {
+            result = result * square % (uint32_t)modulus;
+        }
+        square = square * square % (uint32_t)modulus;
+    }
+    return (int)result;
+}
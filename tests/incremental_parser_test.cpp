@@ -0,0 +1,317 @@
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ast_dumper.hpp"
+#include "incremental_parser.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+// Makes the same random edits to a generated program and each program in
+// the directories given, through an IncrementalParser and by parsing the
+// whole source again, and fails if they ever disagree about the source or
+// what it parses to, including the error when it doesn't. The edits are
+// seeded, so any failure can be reproduced.
+//
+//     incremental_parser_test [--edits=<n>] [--seed=<n>] <file or directory>...
+
+using namespace li1I;
+
+namespace
+{
+    // Whole tokens, so that some edits leave the program parsing, along
+    // with the pieces of them which don't.
+    const char *const pieces[] = {
+        "lI1i ", "lI1l ", "li1l ", "lil1 ", "l1ii ", "l1i1 ", "l1il ", "llli ", "llii ",
+        "liil ", "ll11 ", "1 ", "11 ", "111 ", "I ", "Ii ", "IIII ", "l1iI\n", "l1Ii\n",
+        "\n", " ", "l", "1", "i",
+    };
+
+    class EditGenerator
+    {
+    public:
+        EditGenerator(unsigned seed) : m_random(seed) {}
+
+        TextEdit next(const std::string &source)
+        {
+            size_t offset = this->offset(source);
+            switch (m_random() % 7)
+            {
+            case 0:
+            {
+                std::string text;
+                for (size_t n = 1 + m_random() % 3; n; n--)
+                {
+                    text += pieces[m_random() % (sizeof(pieces) / sizeof(pieces[0]))];
+                }
+                return {offset, 0, text};
+            }
+            case 1:
+                return {offset, std::min<size_t>(1 + m_random() % 16, source.size() - offset), ""};
+            case 2:
+            {
+                // Copies of the source's own text make whole definitions
+                // appear and disappear.
+                size_t from = this->offset(source);
+                size_t length = std::min<size_t>(1 + m_random() % 64, source.size() - from);
+                size_t replaced = m_random() % 2 ? 0 : std::min(length, source.size() - offset);
+                return {offset, replaced, source.substr(from, length)};
+            }
+            case 3:
+            {
+                // Adding zero to an expression leaves it parsing.
+                size_t end = find(source, " l1ii");
+                if (end != std::string::npos)
+                {
+                    return {end, 0, " 1 llli"};
+                }
+                break;
+            }
+            case 4:
+            case 5:
+            {
+                // A whole definition, copied before another or removed.
+                size_t begin = find(source, "lI1i ");
+                if (begin == std::string::npos)
+                {
+                    break;
+                }
+                size_t end = std::min(source.find("lI1i ", begin + 1), source.find("l1Ii", begin));
+                end = std::min(end, source.size());
+                if (m_random() % 2)
+                {
+                    return {begin, end - begin, ""};
+                }
+                return {find(source, "lI1i "), 0, source.substr(begin, end - begin)};
+            }
+            }
+
+            // Whitespace between tokens changes nothing but locations.
+            offset = source.find_first_of(" \n", offset);
+            return {offset == std::string::npos ? source.size() : offset, 0, m_random() % 2 ? " " : "\n"};
+        }
+
+        // Whether to undo the last of depth edits rather than make another,
+        // so that the source keeps going back to the program, which parses.
+        bool undo(size_t depth) { return depth && (depth > 2 || m_random() % 2 == 0); }
+
+    private:
+        // Half the time just after whitespace, where tokens start.
+        size_t offset(const std::string &source)
+        {
+            size_t offset = m_random() % (source.size() + 1);
+            if (m_random() % 2)
+            {
+                size_t space = source.find_first_of(" \n", offset);
+                offset = space == std::string::npos ? source.size() : space + 1;
+            }
+            return offset;
+        }
+
+        // Where text is, after a random offset or else before it.
+        size_t find(const std::string &source, const std::string &text)
+        {
+            size_t found = source.find(text, m_random() % (source.size() + 1));
+            return found == std::string::npos ? source.find(text) : found;
+        }
+
+        std::mt19937 m_random;
+    };
+
+    std::string dump(const Program &program)
+    {
+        std::ostringstream out;
+        ASTDumper dumper (&out, program);
+        // Every dump but the first starts on a new line.
+        std::string text = out.str();
+        return text.substr(text.find_first_not_of('\n'));
+    }
+
+    // The dump of source parsed from scratch, or its error.
+    std::string parseAll(const std::string &source)
+    {
+        std::istringstream in(source);
+        Lexer lexer(in);
+        Parser parser;
+        try
+        {
+            std::unique_ptr<Program> program {parser.parse(&lexer, &in, "test")};
+            return dump(*program);
+        }
+        catch (const std::exception &e)
+        {
+            return e.what();
+        }
+    }
+
+    std::string quote(const std::string &text)
+    {
+        std::string quoted = "\"";
+        for (char c : text)
+        {
+            quoted += c == '\n' ? std::string("\\n") : std::string(1, c);
+        }
+        return quoted + "\"";
+    }
+
+    // The tests' programs only have a few definitions, so edits to them
+    // mostly parse everything again; this one has enough that most only
+    // parse a few. Each function calls the one before, some through an if,
+    // and there is an extern among them.
+    std::string generate(size_t n_functions)
+    {
+        auto name = [](size_t index)
+        {
+            std::string name = "I";
+            for (; index; index /= 2)
+            {
+                name += index % 2 ? '1' : 'i';
+            }
+            return name;
+        };
+
+        std::string source = "li1I\nl1iI\n";
+        for (size_t i = 0; i < n_functions; i++)
+        {
+            source += "        lI1i " + name(i) + " li1l i lil1\n                ";
+            if (i == 0)
+            {
+                source += "i l1ii\n\n";
+            }
+            else if (i % 3)
+            {
+                source += "i 1 llli " + name(i - 1) + " l1ii\n\n";
+            }
+            else
+            {
+                source += "l1i1 li1l i 1 ll11 l1ii lil1 1 l1ii l1il i " + name(i - 1) + " l1ii l1ii\n\n";
+            }
+            if (i == n_functions / 2)
+            {
+                source += "        lI1l Ili 1111 l1ii\n\n";
+            }
+        }
+        return source + "        lI1i IIII\n                11 " + name(n_functions - 1)
+            + " l1ii\nl1Ii\n";
+    }
+
+    // The number of edits after which the parsers disagreed, or 0.
+    size_t check(const std::string &file, std::string source, unsigned edits, unsigned seed)
+    {
+        IncrementalParser parser ("test");
+        try
+        {
+            parser.parse(source);
+        }
+        catch (const std::exception &)
+        {
+        }
+
+        EditGenerator generator (seed);
+        std::vector<TextEdit> undo;
+        for (size_t i = 1; i <= edits; i++)
+        {
+            TextEdit edit;
+            if (generator.undo(undo.size()))
+            {
+                edit = undo.back();
+                undo.pop_back();
+            }
+            else
+            {
+                edit = generator.next(source);
+                undo.push_back({edit.offset, edit.text.size(), source.substr(edit.offset, edit.length)});
+            }
+            source.replace(edit.offset, edit.length, edit.text);
+
+            std::string got;
+            try
+            {
+                parser.edit(edit);
+                got = dump(parser.program());
+            }
+            catch (const std::exception &e)
+            {
+                got = e.what();
+            }
+
+            std::string expected = parseAll(source);
+            const char *problem = parser.source() != source ? "its source"
+                : got != expected ? "what it parses to" : nullptr;
+            if (problem)
+            {
+                std::cerr << file << ": edit " << i << " with --seed=" << seed << ", replacing "
+                          << edit.length << " bytes at " << edit.offset << " with "
+                          << quote(edit.text) << ", changed " << problem << "\n"
+                          << "Source: " << quote(source) << "\n"
+                          << "Parsed from scratch:\n" << expected << "\n"
+                          << "Parsed incrementally:\n" << got
+                          << std::endl;
+                return i;
+            }
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned edits = 500, seed = 1;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 8, "--edits=") == 0)
+        {
+            edits = std::atoi(arg.c_str() + 8);
+        }
+        else if (arg.compare(0, 7, "--seed=") == 0)
+        {
+            seed = std::atoi(arg.c_str() + 7);
+        }
+        else if (!llvm::sys::fs::is_directory(arg))
+        {
+            files.push_back(arg);
+        }
+        else
+        {
+            std::error_code error;
+            for (llvm::sys::fs::directory_iterator it (arg, error), end; it != end && !error;
+                 it.increment(error))
+            {
+                if (llvm::sys::path::extension(it->path()) == ".li")
+                {
+                    files.push_back(it->path());
+                }
+            }
+        }
+    }
+    if (files.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " [--edits=<n>] [--seed=<n>] <file or directory>..."
+                  << std::endl;
+        return 1;
+    }
+    std::sort(files.begin(), files.end());
+
+    size_t failures = check("generated", generate(40), edits, seed) != 0;
+    for (const std::string &file : files)
+    {
+        std::ifstream in(file);
+        std::string source ((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        failures += check(file, source, edits, seed) != 0;
+    }
+    std::cout << files.size() + 1 << " programs, " << edits << " edits each: " << failures
+              << " mismatches" << std::endl;
+    return failures != 0;
+}
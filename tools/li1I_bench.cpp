@@ -0,0 +1,459 @@
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Option/ArgList.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/TargetSelect.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "ast_to_ir.hpp"
+#include "bc_compiler.hpp"
+#include "bytecode.hpp"
+#include "baseline_jit.hpp"
+#include "codegen_target.hpp"
+#include "driver_options.hpp"
+#include "incremental_parser.hpp"
+
+using namespace li1I;
+
+// Compiler throughput benchmark. Generates programs which stress one
+// dimension of the frontend or backends at a time, then measures lexing,
+// parsing, incremental re-parsing and IR generation rates and the end to
+// end compile time (from source to something runnable) of every backend,
+// writing JSON.
+//
+//     li1I_bench [--scale=<x>] [--repeat=<n>] [--workload=<name>] [--parse-only] [-o <file>]
+namespace
+{
+    struct Workload
+    {
+        const char *name;
+        size_t size;
+        std::function<std::string(size_t)> generate;
+    };
+
+    struct Backend
+    {
+        const char *name;
+        std::function<void(const Program&)> compile;
+    };
+
+    // Counts every node the parser produced.
+    class NodeCounter : public ASTNodeVisitor
+    {
+    public:
+        NodeCounter() : m_count(0) {}
+
+        void visit(const Program &node) { m_count++; for (auto &func : node) func.accept(this); }
+        void visit(const Function &node)
+        {
+            m_count++;
+            for (auto &arg : node) arg.accept(this);
+            node.expr().accept(this);
+        }
+        void visit(const VarExpr &node) { m_count++; }
+        void visit(const RPNExpr &node) { m_count++; for (auto &expr : node) expr.accept(this); }
+        void visit(const IntExpr &node) { m_count++; }
+        void visit(const CallExpr &node) { m_count++; }
+        void visit(const DeclExpr &node) { m_count++; node.value().accept(this); }
+        void visit(const OpExpr &node) { m_count++; }
+        void visit(const IfExpr &node)
+        {
+            m_count++;
+            node.condition().accept(this);
+            node.if_forms().accept(this);
+            node.else_forms().accept(this);
+        }
+
+        inline size_t count() const { return m_count; }
+
+    private:
+        size_t m_count;
+    };
+}
+
+// Identifiers are written in binary with two of the identifier characters.
+static std::string identifier(char first, size_t n)
+{
+    std::string id (1, first);
+    do
+    {
+        id += n & 1 ? 'l' : 'i';
+        n >>= 1;
+    } while (n);
+    return id;
+}
+
+static std::string program(const std::string &functions)
+{
+    return "li1I\nl1iI\n" + functions + "l1Ii\n";
+}
+
+// Il(i) = i + i + ... + i, on an argument so that IRBuilder can't fold it.
+static std::string deepRPN(size_t n)
+{
+    std::string body = "i";
+    for (size_t k = 0; k < n; k++)
+    {
+        body += " i llli";
+    }
+    return program("    lI1i Il li1l i lil1\n        " + body + " l1ii\n"
+                   "    lI1i IIII\n        11 Il l1ii\n");
+}
+
+// A chain of one argument functions, each calling the one before.
+static std::string manyFunctions(size_t n)
+{
+    std::string functions = "    lI1i " + identifier('I', 0) + " li1l i lil1\n        i 11 llli l1ii\n";
+    for (size_t k = 1; k < n; k++)
+    {
+        functions += "    lI1i " + identifier('I', k) + " li1l i lil1\n        i "
+            + identifier('I', k - 1) + " 11 llli l1ii\n";
+    }
+    functions += "    lI1i IIII\n        11 " + identifier('I', n - 1) + " l1ii\n";
+    return program(functions);
+}
+
+// A single literal n ones long.
+static std::string hugeLiteral(size_t n)
+{
+    return program("    lI1i IIII\n        " + std::string(n, '1') + " l1ii\n");
+}
+
+// if 1 then (if 1 then (...) else 0) else 0, n deep.
+static std::string nestedIfs(size_t n)
+{
+    std::string body = "11 l1ii";
+    for (size_t i = 0; i < n; i++)
+    {
+        body = "l1i1 li1l 11 l1ii lil1 " + body + " l1il 1 l1ii l1ii";
+    }
+    return program("    lI1i IIII\n        " + body + "\n");
+}
+
+// One function summing n arguments, called once.
+static std::string wideArguments(size_t n)
+{
+    std::string args, sum, call;
+    for (size_t k = 0; k < n; k++)
+    {
+        args += " " + identifier('i', k);
+        sum += " " + identifier('i', k) + (k ? " llli" : "");
+        call += "11 ";
+    }
+    return program("    lI1i Il li1l" + args + " lil1\n       " + sum + " l1ii\n"
+                   "    lI1i IIII\n        " + call + "Il l1ii\n");
+}
+
+static Program *parse(const std::string &source)
+{
+    std::istringstream in(source);
+    Lexer lexer(in);
+    Parser parser;
+    return parser.parse(&lexer, &in, "bench");
+}
+
+// The fastest of repeat runs, in seconds.
+static double time(unsigned repeat, const std::function<void()> &run)
+{
+    double best = 0;
+    for (unsigned i = 0; i < repeat; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = i == 0 ? seconds : std::min(best, seconds);
+    }
+    return best;
+}
+
+static std::string jsonString(const std::string &s)
+{
+    std::string quoted = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        }
+        else
+        {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+// How long an IncrementalParser takes over an edit to the statement in the
+// middle of source, adding zero to it, and how much it parsed again. Edits
+// which only parse a little again are too quick to time one at a time.
+static double editTime(const std::string &source, unsigned repeat, size_t &reparsed_bytes)
+{
+    static const std::string text = "1 llli ";
+
+    IncrementalParser parser ("bench");
+    parser.parse(source);
+    size_t offset = source.find("l1ii", source.size() / 2);
+    if (offset == std::string::npos)
+    {
+        offset = source.rfind("l1ii");
+    }
+
+    reparsed_bytes = parser.edit(TextEdit{offset, 0, text}).reparsed_bytes;
+    parser.edit(TextEdit{offset, text.size(), ""});
+    size_t edits = std::min<size_t>(100, std::max<size_t>(1, 100000 / (reparsed_bytes + 1)));
+
+    double seconds = time(repeat, [&]
+    {
+        for (size_t i = 0; i < edits; i++)
+        {
+            parser.edit(TextEdit{offset, 0, text});
+            parser.edit(TextEdit{offset, text.size(), ""});
+        }
+    });
+    return seconds / (2 * edits);
+}
+
+static void benchmark(const Workload &workload, const std::vector<Backend> &backends,
+                      unsigned repeat, bool parse_only, std::ostream &out)
+{
+    std::string source = workload.generate(workload.size);
+
+    size_t tokens = 0;
+    double lex_seconds = time(repeat, [&]
+    {
+        std::istringstream in(source);
+        Lexer lexer(in);
+        for (tokens = 1; lexer.lex()->token() != TokenTag::END; tokens++)
+        {
+        }
+    });
+
+    std::unique_ptr<Program> ast;
+    double parse_seconds = time(repeat, [&] { ast.reset(parse(source)); });
+    NodeCounter counter;
+    ast->accept(&counter);
+
+    size_t reparsed_bytes = 0;
+    double edit_seconds = editTime(source, repeat, reparsed_bytes);
+
+    out << "    {\n"
+        << "      \"name\": " << jsonString(workload.name) << ",\n"
+        << "      \"size\": " << workload.size << ",\n"
+        << "      \"source_bytes\": " << source.size() << ",\n"
+        << "      \"tokens\": " << tokens << ",\n"
+        << "      \"ast_nodes\": " << counter.count() << ",\n"
+        << "      \"lex_seconds\": " << lex_seconds << ",\n"
+        << "      \"parse_seconds\": " << parse_seconds << ",\n"
+        << "      \"edit_seconds\": " << edit_seconds << ",\n"
+        << "      \"edit_reparsed_bytes\": " << reparsed_bytes << ",\n"
+        << "      \"tokens_per_second\": " << tokens / lex_seconds << ",\n"
+        << "      \"ast_nodes_per_second\": " << counter.count() / parse_seconds;
+    if (parse_only)
+    {
+        out << "\n    }";
+        return;
+    }
+
+    size_t instructions = 0;
+    double codegen_seconds = time(repeat, [&]
+    {
+        ASTToIRVisitor codegenner;
+        std::unique_ptr<llvm::Module> module {codegenner.codegenIR(*ast)};
+        instructions = module->getInstructionCount();
+    });
+
+    out << ",\n"
+        << "      \"ir_instructions\": " << instructions << ",\n"
+        << "      \"codegen_seconds\": " << codegen_seconds << ",\n"
+        << "      \"ir_instructions_per_second\": " << instructions / codegen_seconds << ",\n"
+        << "      \"backends\": {";
+
+    // Each backend is timed from the source, so parsing is included.
+    for (size_t i = 0; i < backends.size(); i++)
+    {
+        out << (i ? ",\n" : "\n") << "        " << jsonString(backends[i].name) << ": ";
+        try
+        {
+            double seconds = time(repeat, [&]
+            {
+                std::unique_ptr<Program> program {parse(source)};
+                backends[i].compile(*program);
+            });
+            out << "{\"seconds\": " << seconds << "}";
+        }
+        catch (std::exception &e)
+        {
+            out << "{\"error\": " << jsonString(e.what()) << "}";
+        }
+    }
+    out << "\n      }\n    }";
+}
+
+int main(int argc, char **argv)
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+    setCodegenTarget(selectTarget("", "", ""));
+
+    // BCCompiler reads the driver's options, which are all left at their
+    // defaults.
+    DriverOptTable opt_table;
+    unsigned missing_arg_index, missing_arg_count;
+    options::opts = new llvm::opt::InputArgList{
+        opt_table.ParseArgs(llvm::ArrayRef<const char*>(), missing_arg_index, missing_arg_count)};
+
+    double scale = 1;
+    unsigned repeat = 3;
+    bool parse_only = false;
+    std::string only, output;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 8, "--scale=") == 0)
+        {
+            scale = std::atof(arg.c_str() + 8);
+        }
+        else if (arg.compare(0, 9, "--repeat=") == 0)
+        {
+            repeat = std::max(1, std::atoi(arg.c_str() + 9));
+        }
+        else if (arg.compare(0, 11, "--workload=") == 0)
+        {
+            only = arg.substr(11);
+        }
+        else if (arg == "--parse-only")
+        {
+            parse_only = true;
+        }
+        else if (arg == "-o" && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--scale=<x>] [--repeat=<n>] [--workload=<name>] [--parse-only] [-o <file>]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    auto scaled = [scale](size_t size) { return std::max<size_t>(1, size * scale); };
+    std::vector<Workload> workloads {
+        {"deep_rpn", scaled(100000), deepRPN},
+        {"many_functions", scaled(5000), manyFunctions},
+        {"huge_literal", scaled(10000000), hugeLiteral},
+        {"nested_ifs", scaled(500), nestedIfs},
+        {"wide_arguments", scaled(1000), wideArguments},
+    };
+
+    std::vector<Backend> backends {
+        {"llvm_aot", [](const Program &program)
+        {
+            ASTToIRVisitor codegenner;
+            std::unique_ptr<llvm::Module> module {codegenner.codegenIR(program)};
+            BCCompiler compiler (llvm::CodeGenOpt::None, llvm::CodeGenFileType::CGFT_ObjectFile);
+            compiler.emit(module.get());
+        }},
+        {"llvm_aot_O2", [](const Program &program)
+        {
+            ASTToIRVisitor codegenner;
+            std::unique_ptr<llvm::Module> module {codegenner.codegenIR(program)};
+            BCCompiler compiler (llvm::CodeGenOpt::Default, llvm::CodeGenFileType::CGFT_ObjectFile);
+            compiler.setOptimization(2);
+            compiler.emit(module.get());
+        }},
+        {"llvm_jit", [](const Program &program)
+        {
+            ASTToIRVisitor codegenner;
+            std::string error;
+            llvm::EngineBuilder builder(std::unique_ptr<llvm::Module>(codegenner.codegenIR(program)));
+            builder.setErrorStr(&error);
+            applyTarget(builder);
+            std::unique_ptr<llvm::ExecutionEngine> engine {builder.create()};
+            if (!engine)
+            {
+                throw std::runtime_error(error);
+            }
+            engine->finalizeObject();
+        }},
+        {"bytecode", [](const Program &program)
+        {
+            BytecodeCompiler compiler;
+            compiler.compile(program);
+        }},
+        {"baseline", [](const Program &program)
+        {
+            BaselineJIT jit;
+            jit.compile(program);
+        }},
+    };
+
+    std::ofstream file;
+    if (!output.empty())
+    {
+        file.open(output);
+        if (!file)
+        {
+            std::cerr << "Cannot open " << output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &out = output.empty() ? std::cout : file;
+
+    out << std::setprecision(6)
+        << "{\n"
+        << "  \"li1I_version\": " << jsonString(LI1I_VERSION) << ",\n"
+        << "  \"llvm_version\": " << jsonString(LLVM_VERSION_STRING) << ",\n"
+        << "  \"repeat\": " << repeat << ",\n"
+        << "  \"workloads\": [\n";
+
+    bool first = true;
+    for (const Workload &workload : workloads)
+    {
+        if (!only.empty() && only != workload.name)
+        {
+            continue;
+        }
+
+        if (!first)
+        {
+            out << ",\n";
+        }
+        first = false;
+
+        try
+        {
+            benchmark(workload, backends, repeat, parse_only, out);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << workload.name << ": " << e.what() << std::endl;
+            return 1;
+        }
+        out.flush();
+    }
+
+    out << "\n  ]\n}\n";
+    return 0;
+}
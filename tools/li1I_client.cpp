@@ -0,0 +1,140 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.hpp"
+
+using namespace li1I;
+
+static bool writeAll(int fd, const std::string &bytes)
+{
+    for (size_t done = 0; done < bytes.size();)
+    {
+        ssize_t n = write(fd, bytes.data() + done, bytes.size() - done);
+        if (n <= 0)
+        {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+// Runs a program on a `li1I --daemon`, printing what `li1I <file> -e`
+// would. Any further arguments call that function with those arguments
+// instead of IIII.
+int main(int argc, char **argv)
+{
+    std::string socket_path = default_socket_path;
+    int first = 1;
+    if (argc > 1 && std::strncmp(argv[1], "--socket=", 9) == 0)
+    {
+        socket_path = argv[1] + 9;
+        first++;
+    }
+
+    if (argc <= first)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--socket=<path>] <input file> [<fid> <arg>*]" << std::endl;
+        return 1;
+    }
+
+    std::ifstream program(argv[first]);
+    if (!program)
+    {
+        std::cerr << "Cannot open " << argv[first] << std::endl;
+        return 1;
+    }
+    std::string source {std::istreambuf_iterator<char>(program), std::istreambuf_iterator<char>()};
+
+    std::stringstream request;
+    request << "eval";
+    if (argc > first + 1)
+    {
+        for (int i = first + 1; i < argc; i++)
+        {
+            request << " " << argv[i];
+        }
+    }
+    else
+    {
+        request << " IIII";
+    }
+    request << " " << source.size() << "\n" << source;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+    {
+        std::cerr << "Cannot connect to " << socket_path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    if (!writeAll(fd, request.str()))
+    {
+        std::cerr << "Lost connection to " << socket_path << std::endl;
+        return 1;
+    }
+
+    // The reply is `<status> <length>\n` and then length bytes.
+    std::string response;
+    std::string status;
+    size_t length = 0;
+    size_t header_end = std::string::npos;
+    char chunk[4096];
+    for (ssize_t n; (n = read(fd, chunk, sizeof(chunk))) > 0;)
+    {
+        response.append(chunk, n);
+
+        if (header_end == std::string::npos)
+        {
+            size_t newline = response.find('\n');
+            if (newline == std::string::npos)
+            {
+                continue;
+            }
+
+            std::istringstream header(response.substr(0, newline));
+            std::string rest;
+            if (!(header >> status >> length) || (header >> rest)
+                || (status != "ok" && status != "error"))
+            {
+                close(fd);
+                std::cerr << "Malformed reply from " << socket_path << std::endl;
+                return 1;
+            }
+            header_end = newline + 1;
+        }
+
+        if (response.size() - header_end >= length)
+        {
+            break;
+        }
+    }
+    close(fd);
+
+    if (header_end == std::string::npos || response.size() - header_end < length)
+    {
+        std::cerr << "Lost connection to " << socket_path << std::endl;
+        return 1;
+    }
+
+    std::string payload = response.substr(header_end, length);
+    if (status != "ok")
+    {
+        std::cerr << payload << std::endl;
+        return 1;
+    }
+
+    std::cout << std::endl << payload << std::endl;
+    return 0;
+}
@@ -0,0 +1,858 @@
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// Differential testing of the backends. Runs each program through the JIT,
+// AOT compiled executables, the bytecode interpreter and the other tiers,
+// in parallel, and checks that they all print the same result. Compile and
+// run times are recorded for each, and compared with a baseline from an
+// earlier run so that performance regressions are caught along with
+// miscompiles.
+//
+//     li1I_diff [-j <n>] [--generate=<n>] [--seed=<n>] [--repeat=<n>] [--timeout=<s>]
+//               [--baseline=<file>] [--update-baseline] [--tolerance=<x>]
+//               [--load=<library>] [--li1I=<path>] [--li1I-interp=<path>] [-v]
+//               <file or directory>...
+namespace
+{
+    struct Path
+    {
+        const char *name;
+        std::vector<std::string> args;
+        bool aot;
+        // Compiled with -c --no-main and linked with a C main, which fails
+        // if the object defines main too.
+        bool no_main;
+        bool standalone;
+        // Static --tiny-runtime executables can't link the library defining
+        // extern functions.
+        bool externs;
+    };
+
+    struct Source
+    {
+        std::string name;
+        std::string file;
+        bool externs;
+        // From <name>.expected beside it: the result every path has to
+        // print, or lines every path's error message has to contain.
+        std::string expected;
+    };
+
+    struct Run
+    {
+        size_t source;
+        const Path *path;
+        std::string result;
+        // What it printed to stderr, compiling included, when it failed.
+        std::string error;
+        // In seconds, or negative when the path doesn't separate them.
+        double compile;
+        double run;
+    };
+
+    struct Settings
+    {
+        std::string li1I;
+        std::string interp;
+        std::string cc;
+        // The C main for no_main paths.
+        std::string crt;
+        std::string work;
+        std::vector<std::string> load;
+        unsigned repeat;
+        unsigned timeout;
+    };
+
+    const double min_regression = 0.005;
+
+    // Random programs using every operator, with calls between functions
+    // and recursion. Calls only go to functions defined earlier and every
+    // recursion counts a literal down to zero, so the programs finish, and
+    // only positive literals are divided by, so they don't trap.
+    class Generator
+    {
+    public:
+        Generator(unsigned seed) : m_random(seed) {}
+
+        std::string program()
+        {
+            m_arities.clear();
+            m_recursive.clear();
+            size_t n_functions = 2 + pick(6);
+            std::string functions;
+            for (size_t k = 0; k < n_functions; k++)
+            {
+                functions += pick(4) == 0 ? recursive() : function();
+            }
+
+            std::vector<std::string> none;
+            functions += "    lI1i IIII\n        " + expression(4, none) + " l1ii\n";
+            return "li1I\nl1iI\n" + functions + "l1Ii\n";
+        }
+
+    private:
+        size_t pick(size_t n)
+        {
+            return std::uniform_int_distribution<size_t>(0, n - 1)(m_random);
+        }
+
+        // Identifiers are written in binary with two of the identifier
+        // characters, as in li1I_bench.
+        static std::string identifier(char first, size_t n)
+        {
+            std::string id (1, first);
+            do
+            {
+                id += n & 1 ? 'l' : 'i';
+                n >>= 1;
+            } while (n);
+            return id;
+        }
+
+        static std::string literal(size_t value)
+        {
+            return std::string(value + 1, '1');
+        }
+
+        std::string operand(const std::vector<std::string> &vars)
+        {
+            if (!vars.empty() && pick(2))
+            {
+                return vars[pick(vars.size())];
+            }
+            return literal(pick(4) ? pick(12) : pick(300));
+        }
+
+        std::string expression(size_t depth, const std::vector<std::string> &vars)
+        {
+            static const char *const arithmetic[] = {"llli", "llii", "liil", "liii"};
+            static const char *const comparisons[] = {"ll1i", "ll11", "ll1I", "l111"};
+
+            switch (depth ? pick(8) : 0)
+            {
+            case 0:
+                return operand(vars);
+            case 1:
+                return expression(depth - 1, vars) + " " + literal(1 + pick(9)) + " llil";
+            case 2:
+                return "l1i1 li1l " + expression(depth - 1, vars) + " l1ii lil1 "
+                    + expression(depth - 1, vars) + " l1ii l1il "
+                    + expression(depth - 1, vars) + " l1ii";
+            case 3:
+                if (!m_arities.empty())
+                {
+                    size_t callee = pick(m_arities.size());
+                    std::string call;
+                    for (size_t i = 0; i < m_arities[callee]; i++)
+                    {
+                        // The first argument of a recursive function is
+                        // what it counts down.
+                        call += (m_recursive[callee] && i + 1 == m_arities[callee]
+                                 ? literal(pick(12)) : expression(depth - 1, vars)) + " ";
+                    }
+                    return call + identifier('I', callee);
+                }
+                // Fall through.
+            default:
+                // Comparisons are rarer, or most results would be 0 or -1.
+                return expression(depth - 1, vars) + " " + expression(depth - 1, vars) + " "
+                    + (pick(4) ? arithmetic : comparisons)[pick(4)];
+            }
+        }
+
+        std::string function()
+        {
+            std::vector<std::string> vars;
+            std::string head = "    lI1i " + identifier('I', m_arities.size());
+            size_t n_args = pick(4);
+            if (n_args)
+            {
+                head += " li1l";
+                for (size_t i = 0; i < n_args; i++)
+                {
+                    vars.push_back(identifier('i', i));
+                    head += " " + vars.back();
+                }
+                head += " lil1";
+            }
+
+            // Declarations leave their value on the stack, so each is
+            // folded into the result.
+            std::string body, fold;
+            for (size_t n_decls = pick(3); n_decls; n_decls--)
+            {
+                std::string var = identifier('i', vars.size());
+                body += "liI1 " + var + " lIi1 " + expression(2, vars) + " l1ii ";
+                vars.push_back(var);
+                fold += pick(2) ? " llli" : " liil";
+            }
+            body += expression(3, vars) + fold;
+
+            m_arities.push_back(n_args);
+            m_recursive.push_back(false);
+            return head + "\n        " + body + " l1ii\n";
+        }
+
+        // f(n, a) = n == 0 ? g(a) : h(f(n - 1, a'), a), only calling
+        // itself once so that the calls are linear in n.
+        std::string recursive()
+        {
+            std::string name = identifier('I', m_arities.size());
+            std::vector<std::string> vars {"il"};
+            std::string step = expression(1, vars) + " ii 11 llii " + name + " "
+                + expression(1, vars) + " llli";
+            std::string body = "l1i1 li1l ii 1 ll11 l1ii lil1 " + expression(2, vars)
+                + " l1ii l1il " + step + " l1ii";
+
+            m_arities.push_back(2);
+            m_recursive.push_back(true);
+            return "    lI1i " + name + " li1l ii il lil1\n        " + body + " l1ii\n";
+        }
+
+        std::mt19937 m_random;
+        std::vector<size_t> m_arities;
+        std::vector<bool> m_recursive;
+    };
+}
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::string readFile(const std::string &path)
+{
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    return buffer ? (*buffer)->getBuffer().str() : std::string();
+}
+
+// Runs program with its output going to files named after out, setting
+// wall to how long it took. False if it had to be killed for taking too
+// long.
+static bool execute(const std::string &program, const std::vector<std::string> &args,
+                   const std::string &out, const Settings &settings, double &wall)
+{
+    std::vector<llvm::StringRef> argv {program};
+    argv.insert(argv.end(), args.begin(), args.end());
+    std::string stdout_path = out + ".out", stderr_path = out + ".err";
+    llvm::Optional<llvm::StringRef> redirects[] = {llvm::StringRef(""), llvm::StringRef(stdout_path),
+                                                    llvm::StringRef(stderr_path)};
+
+    auto start = std::chrono::steady_clock::now();
+    std::string error;
+    llvm::sys::ExecuteAndWait(program, argv, llvm::None, redirects, settings.timeout, 0, &error);
+    wall = seconds(start);
+    return error.find("timed out") == std::string::npos;
+}
+
+// The last line printed, as a 32 bit int: -e prints it unsigned and an
+// executable signed.
+static std::string result(const std::string &out, bool finished)
+{
+    std::istringstream lines (readFile(out + ".out"));
+    std::string line, last;
+    while (std::getline(lines, line))
+    {
+        if (!line.empty())
+        {
+            last = line;
+        }
+    }
+
+    char *end = nullptr;
+    long long value = std::strtoll(last.c_str(), &end, 10);
+    if (last.empty() || *end)
+    {
+        return finished ? "error" : "timeout";
+    }
+    return std::to_string(static_cast<int32_t>(static_cast<uint32_t>(value)));
+}
+
+// Reads the --time-phases table, giving the total time and the time spent
+// running the program in seconds. CPU time is steadier with other jobs
+// running, but misses the linker, which runs in a child process.
+static bool phaseTimes(const std::string &out, bool cpu, double &total, double &run)
+{
+    std::istringstream lines (readFile(out + ".err"));
+    std::string line;
+    bool in_table = false;
+    run = 0;
+    while (std::getline(lines, line))
+    {
+        if (!in_table)
+        {
+            in_table = line.find("Phase") != std::string::npos
+                && line.find("Wall (ms)") != std::string::npos;
+            continue;
+        }
+
+        std::istringstream words (line);
+        std::vector<std::string> fields;
+        std::string word;
+        while (words >> word)
+        {
+            fields.push_back(word);
+        }
+        if (fields.size() < 4)
+        {
+            break;
+        }
+
+        double time = std::atof(fields[fields.size() - (cpu ? 2 : 3)].c_str()) / 1e3;
+        std::string name = fields[0];
+        for (size_t i = 1; i + 3 < fields.size(); i++)
+        {
+            name += " " + fields[i];
+        }
+
+        if (name == "run")
+        {
+            run = time;
+        }
+        else if (name == "Total")
+        {
+            total = time;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void runOnce(const Source &source, const Path &path, const std::string &out,
+                    const Settings &settings, Run &run)
+{
+    std::vector<std::string> args {source.file};
+    args.insert(args.end(), path.args.begin(), path.args.end());
+    if (source.externs)
+    {
+        for (const std::string &library : settings.load)
+        {
+            args.push_back("--load=" + library);
+        }
+    }
+
+    double wall = 0;
+    if (path.standalone)
+    {
+        bool finished = execute(settings.interp, args, out, settings, wall);
+        run.result = result(out, finished);
+        run.compile = -1;
+        run.run = wall;
+        return;
+    }
+
+    args.push_back("--time-phases");
+    if (path.aot)
+    {
+        std::string executable = out + ".exe";
+        std::string object = out + ".o";
+        llvm::sys::fs::remove(executable);
+        llvm::sys::fs::remove(object);
+        if (path.no_main)
+        {
+            args.insert(args.end(), {"-c", "--no-main"});
+        }
+        args.push_back("-o");
+        args.push_back(path.no_main ? object : executable);
+        bool finished = execute(settings.li1I, args, out + ".compile", settings, wall);
+        double total = 0, unused;
+        run.compile = phaseTimes(out + ".compile", false, total, unused) ? total : wall;
+        if (path.no_main && llvm::sys::fs::exists(object))
+        {
+            std::vector<std::string> link {"-no-pie", settings.crt, object, "-o", executable};
+            if (source.externs)
+            {
+                link.insert(link.end(), settings.load.begin(), settings.load.end());
+            }
+            finished = execute(settings.cc, link, out + ".link", settings, wall);
+            run.compile += wall;
+        }
+        if (!llvm::sys::fs::exists(executable))
+        {
+            run.result = finished ? "error" : "timeout";
+            run.run = -1;
+            return;
+        }
+
+        finished = execute(executable, {}, out, settings, wall);
+        run.result = result(out, finished);
+        run.run = wall;
+        return;
+    }
+
+    bool finished = execute(settings.li1I, args, out, settings, wall);
+    run.result = result(out, finished);
+    double total = 0, running = 0;
+    if (phaseTimes(out, true, total, running))
+    {
+        run.compile = total - running;
+        run.run = running;
+    }
+    else
+    {
+        run.compile = -1;
+        run.run = wall;
+    }
+}
+
+// The fastest of the repeats. Differing results between repeats are a bug
+// too, so the first that doesn't match the first run is kept. How long a
+// failure took doesn't matter, so those aren't timed.
+static void measure(const Source &source, const Path &path, size_t index,
+                    const Settings &settings, Run &run)
+{
+    std::string out = settings.work + "/" + std::to_string(index) + "." + path.name;
+    runOnce(source, path, out, settings, run);
+    if (run.result == "error" || run.result == "timeout")
+    {
+        run.error = readFile(out + ".compile.err") + readFile(out + ".link.err")
+            + readFile(out + ".err");
+        run.compile = run.run = -1;
+        return;
+    }
+    for (unsigned i = 1; i < settings.repeat; i++)
+    {
+        Run again = run;
+        runOnce(source, path, out, settings, again);
+        if (again.result != run.result)
+        {
+            run.result += "/" + again.result;
+            return;
+        }
+        run.compile = std::min(run.compile, again.compile);
+        run.run = std::min(run.run, again.run);
+    }
+}
+
+static std::string expectation(const std::string &file)
+{
+    llvm::SmallString<128> expected (file);
+    llvm::sys::path::replace_extension(expected, "expected");
+    return readFile(expected.str().str());
+}
+
+// A number is the result to print, and anything else lines of the error.
+static bool matchesExpected(const std::string &expected, const Run &run)
+{
+    std::vector<std::string> lines;
+    std::istringstream in (expected);
+    for (std::string line; std::getline(in, line);)
+    {
+        if (!line.empty())
+        {
+            lines.push_back(line);
+        }
+    }
+
+    if (lines.size() == 1)
+    {
+        char *end = nullptr;
+        std::strtoll(lines[0].c_str(), &end, 10);
+        if (!*end)
+        {
+            return run.result == lines[0];
+        }
+    }
+
+    for (const std::string &line : lines)
+    {
+        if (run.error.find(line) == std::string::npos)
+        {
+            return false;
+        }
+    }
+    return run.result == "error";
+}
+
+static void collect(const std::string &path, std::vector<Source> &sources)
+{
+    if (!llvm::sys::fs::is_directory(path))
+    {
+        sources.push_back({llvm::sys::path::filename(path).str(), path, false, expectation(path)});
+        return;
+    }
+
+    std::vector<std::string> files;
+    std::error_code error;
+    for (llvm::sys::fs::directory_iterator it (path, error), end; it != end && !error; it.increment(error))
+    {
+        if (llvm::sys::path::extension(it->path()) == ".li")
+        {
+            files.push_back(it->path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    for (const std::string &file : files)
+    {
+        sources.push_back({llvm::sys::path::filename(file).str(), file, false, expectation(file)});
+    }
+}
+
+static std::string milliseconds(double seconds)
+{
+    if (seconds < 0)
+    {
+        return "-";
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.3f", seconds * 1e3);
+    return text;
+}
+
+// Lines of `<program> <path> <compile seconds> <run seconds>`.
+static std::map<std::string, std::pair<double, double> > readBaseline(const std::string &file)
+{
+    std::map<std::string, std::pair<double, double> > baseline;
+    std::ifstream in(file);
+    std::string program, path;
+    double compile, run;
+    while (in >> program >> path >> compile >> run)
+    {
+        baseline[program + " " + path] = std::make_pair(compile, run);
+    }
+    return baseline;
+}
+
+static bool regressed(double now, double before, double tolerance)
+{
+    return now >= 0 && before >= 0 && now > before * (1 + tolerance) && now - before > min_regression;
+}
+
+int main(int argc, char **argv)
+{
+    Settings settings;
+    settings.repeat = 3;
+    settings.timeout = 60;
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    unsigned generate = 20, seed = 1;
+    double tolerance = 0.25;
+    bool update = false, verbose = false;
+    std::string baseline_file;
+    std::vector<std::string> inputs;
+
+    // The compiler and interpreter are built next to this.
+    std::string self = llvm::sys::fs::getMainExecutable(argv[0], reinterpret_cast<void*>(&readFile));
+    std::string dir = llvm::sys::path::parent_path(self).str();
+    settings.li1I = dir + "/li1I";
+    settings.interp = dir + "/li1I-interp";
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc)
+        {
+            jobs = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg.compare(0, 2, "-j") == 0 && arg.size() > 2)
+        {
+            jobs = std::max(1, std::atoi(arg.c_str() + 2));
+        }
+        else if (arg.compare(0, 11, "--generate=") == 0)
+        {
+            generate = std::atoi(arg.c_str() + 11);
+        }
+        else if (arg.compare(0, 7, "--seed=") == 0)
+        {
+            seed = std::atoi(arg.c_str() + 7);
+        }
+        else if (arg.compare(0, 9, "--repeat=") == 0)
+        {
+            settings.repeat = std::max(1, std::atoi(arg.c_str() + 9));
+        }
+        else if (arg.compare(0, 10, "--timeout=") == 0)
+        {
+            settings.timeout = std::max(1, std::atoi(arg.c_str() + 10));
+        }
+        else if (arg.compare(0, 11, "--baseline=") == 0)
+        {
+            baseline_file = arg.substr(11);
+        }
+        else if (arg == "--update-baseline")
+        {
+            update = true;
+        }
+        else if (arg.compare(0, 12, "--tolerance=") == 0)
+        {
+            tolerance = std::atof(arg.c_str() + 12);
+        }
+        else if (arg.compare(0, 7, "--load=") == 0)
+        {
+            settings.load.push_back(arg.substr(7));
+        }
+        else if (arg.compare(0, 7, "--li1I=") == 0)
+        {
+            settings.li1I = arg.substr(7);
+        }
+        else if (arg.compare(0, 14, "--li1I-interp=") == 0)
+        {
+            settings.interp = arg.substr(14);
+        }
+        else if (arg == "-v")
+        {
+            verbose = true;
+        }
+        else if (!arg.empty() && arg[0] != '-')
+        {
+            inputs.push_back(arg);
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " [-j <n>] [--generate=<n>] [--seed=<n>] [--repeat=<n>] [--timeout=<s>]"
+                         " [--baseline=<file>] [--update-baseline] [--tolerance=<x>]"
+                         " [--load=<library>] [--li1I=<path>] [--li1I-interp=<path>] [-v]"
+                         " <file or directory>..." << std::endl;
+            return 1;
+        }
+    }
+
+    // Otherwise every path would fail alike, which passes.
+    for (const std::string &program : {settings.li1I, settings.interp})
+    {
+        if (!llvm::sys::fs::can_execute(program))
+        {
+            std::cerr << "Cannot run " << program << std::endl;
+            return 1;
+        }
+    }
+
+    llvm::SmallString<128> work;
+    if (std::error_code error = llvm::sys::fs::createUniqueDirectory("li1I_diff", work))
+    {
+        std::cerr << "Cannot make a work directory: " << error.message() << std::endl;
+        return 1;
+    }
+    settings.work = work.str().str();
+
+    auto cc = llvm::sys::findProgramByName("cc");
+    settings.cc = cc ? *cc : "cc";
+    settings.crt = settings.work + "/crtli1I.c";
+    std::ofstream(settings.crt) << "#include <stdio.h>\n"
+                                   "int IIII();\n"
+                                   "int main() { printf(\"%d\\n\", IIII()); }\n";
+
+    std::vector<Source> sources;
+    for (const std::string &input : inputs)
+    {
+        collect(input, sources);
+    }
+    Generator generator (seed);
+    for (unsigned k = 0; k < generate; k++)
+    {
+        std::string name = "generated-" + std::to_string(seed) + "-" + std::to_string(k) + ".li";
+        std::string file = settings.work + "/" + name;
+        std::ofstream(file) << generator.program();
+        sources.push_back({name, file, false, ""});
+    }
+
+    // --bigint isn't here: its values only agree with these while they fit
+    // in 32 bits.
+    const std::vector<Path> paths {
+        {"jit", {"-e"}, false, false, false, true},
+        {"jit_O2", {"-e", "-O2"}, false, false, false, true},
+        {"partial_eval", {"-e", "-O2", "--partial-eval"}, false, false, false, true},
+        {"aot", {}, true, false, false, true},
+        {"aot_O2", {"-O2"}, true, false, false, true},
+        {"aot_tiny", {"-O2", "--tiny-runtime"}, true, false, false, false},
+        {"aot_no_main", {"-O2"}, true, true, false, true},
+        {"incremental_no_main", {"-O2", "--incremental=" + settings.work + "/incremental"},
+         true, true, false, true},
+        {"baseline", {"-e", "--baseline"}, false, false, false, true},
+        {"tier", {"-e", "--tier", "--tier-threshold=2", "--tier-llvm-threshold=2"},
+         false, false, false, true},
+        {"interp", {"--interp"}, false, false, false, true},
+        {"li1I-interp", {}, false, false, true, true},
+    };
+
+    std::vector<Run> runs;
+    size_t skipped = 0;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        Source &source = sources[i];
+        source.externs = readFile(source.file).find("lI1l") != std::string::npos;
+        if (source.externs && settings.load.empty())
+        {
+            std::cerr << source.name << ": skipped, it needs --load" << std::endl;
+            skipped++;
+            continue;
+        }
+        for (const Path &path : paths)
+        {
+            if (!source.externs || path.externs)
+            {
+                runs.push_back({i, &path, "", "", -1, -1});
+            }
+        }
+    }
+
+    // Timings are taken with every job running, so they're only comparable
+    // with a baseline taken with the same -j.
+    std::atomic<size_t> next (0);
+    std::vector<std::thread> workers;
+    for (unsigned j = 0; j < jobs; j++)
+    {
+        workers.emplace_back([&]
+        {
+            for (size_t i; (i = next++) < runs.size();)
+            {
+                measure(sources[runs[i].source], *runs[i].path, i, settings, runs[i]);
+            }
+        });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+
+    std::map<std::string, std::pair<double, double> > baseline;
+    if (!baseline_file.empty() && llvm::sys::fs::exists(baseline_file))
+    {
+        baseline = readBaseline(baseline_file);
+    }
+
+    if (verbose)
+    {
+        std::printf("%-28s %-20s %12s %14s %12s\n", "Program", "Path", "Result", "Compile (ms)", "Run (ms)");
+        for (const Run &run : runs)
+        {
+            std::printf("%-28s %-20s %12s %14s %12s\n", sources[run.source].name.c_str(), run.path->name,
+                        run.result.c_str(), milliseconds(run.compile).c_str(), milliseconds(run.run).c_str());
+        }
+        std::printf("\n");
+    }
+
+    // Every path has to agree with every other, so a program which fails
+    // everywhere passes, but one which only fails somewhere doesn't. Only
+    // an .expected file catches the frontend, which they all share, going
+    // wrong.
+    size_t miscompiles = 0, unexpected = 0, regressions = 0;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        std::map<std::string, std::string> by_result;
+        for (const Run &run : runs)
+        {
+            if (run.source == i)
+            {
+                std::string &names = by_result[run.result];
+                names += (names.empty() ? "" : ", ") + std::string(run.path->name);
+            }
+        }
+        if (by_result.size() > 1)
+        {
+            miscompiles++;
+            std::printf("MISCOMPILE %s:", sources[i].file.c_str());
+            const char *separator = "";
+            for (auto &group : by_result)
+            {
+                std::printf("%s %s = %s", separator, group.second.c_str(), group.first.c_str());
+                separator = ";";
+            }
+            std::printf("\n");
+        }
+
+        for (const Run &run : runs)
+        {
+            if (run.source == i && !sources[i].expected.empty()
+                && !matchesExpected(sources[i].expected, run))
+            {
+                unexpected++;
+                std::printf("UNEXPECTED %s: %s = %s\n", sources[i].file.c_str(), run.path->name,
+                            run.result.c_str());
+            }
+        }
+    }
+
+    // Single runs are too noisy with every job running, so regressions
+    // are in each path's total over the programs in the baseline.
+    struct Totals
+    {
+        double compile, run;
+        // Only programs in the baseline count here.
+        double compared_compile, compared_run, baseline_compile, baseline_run;
+    };
+    std::map<std::string, Totals> totals;
+    for (const Run &run : runs)
+    {
+        Totals &total = totals[run.path->name];
+        total.compile += std::max(run.compile, 0.0);
+        total.run += std::max(run.run, 0.0);
+
+        auto before = baseline.find(sources[run.source].name + " " + run.path->name);
+        if (before != baseline.end())
+        {
+            total.compared_compile += std::max(run.compile, 0.0);
+            total.compared_run += std::max(run.run, 0.0);
+            total.baseline_compile += std::max(before->second.first, 0.0);
+            total.baseline_run += std::max(before->second.second, 0.0);
+        }
+    }
+
+    std::printf("%-20s %20s %16s\n", "Path", "Total compile (ms)", "Total run (ms)");
+    for (const Path &path : paths)
+    {
+        if (!totals.count(path.name))
+        {
+            continue;
+        }
+
+        Totals &total = totals[path.name];
+        std::printf("%-20s %20s %16s\n", path.name, milliseconds(total.compile).c_str(),
+                    milliseconds(total.run).c_str());
+        if (regressed(total.compared_compile, total.baseline_compile, tolerance))
+        {
+            regressions++;
+            std::printf("REGRESSION %s compile: %s ms, baseline %s ms\n", path.name,
+                        milliseconds(total.compared_compile).c_str(),
+                        milliseconds(total.baseline_compile).c_str());
+        }
+        if (regressed(total.compared_run, total.baseline_run, tolerance))
+        {
+            regressions++;
+            std::printf("REGRESSION %s run: %s ms, baseline %s ms\n", path.name,
+                        milliseconds(total.compared_run).c_str(),
+                        milliseconds(total.baseline_run).c_str());
+        }
+    }
+    std::printf("%zu programs (%zu skipped), %zu runs: %zu miscompiles, %zu unexpected, "
+                "%zu regressions\n", sources.size() - skipped, skipped, runs.size(), miscompiles,
+                unexpected, regressions);
+
+    if (!baseline_file.empty() && (update || !llvm::sys::fs::exists(baseline_file)))
+    {
+        std::ofstream out(baseline_file);
+        for (const Run &run : runs)
+        {
+            out << sources[run.source].name << " " << run.path->name << " "
+                << run.compile << " " << run.run << "\n";
+        }
+        std::printf("Wrote %s\n", baseline_file.c_str());
+    }
+
+    // Programs which miscompiled are kept to be looked at.
+    if (miscompiles || unexpected)
+    {
+        std::printf("Programs and outputs are in %s\n", settings.work.c_str());
+    }
+    else
+    {
+        llvm::sys::fs::remove_directories(settings.work);
+    }
+    return miscompiles || unexpected || regressions ? 1 : 0;
+}
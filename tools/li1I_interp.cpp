@@ -0,0 +1,73 @@
+#include <cstring>
+#include <dlfcn.h>
+#include <fstream>
+#include <iostream>
+
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "bytecode.hpp"
+#include "vm.hpp"
+
+using namespace li1I;
+
+// Standalone bytecode interpreter: the same as `li1I <file> --interp`, but
+// without LLVM codegen or target initialisation linked in. Libraries
+// defining extern functions are loaded with --load, as for li1I.
+int main(int argc, char **argv)
+{
+    const char *input = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strncmp(argv[i], "--load=", 7) == 0)
+        {
+            if (!dlopen(argv[i] + 7, RTLD_NOW | RTLD_GLOBAL))
+            {
+                std::cerr << dlerror() << std::endl;
+                return 1;
+            }
+        }
+        else if (!input)
+        {
+            input = argv[i];
+        }
+        else
+        {
+            input = NULL;
+            break;
+        }
+    }
+
+    if (!input)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--load=<library>]... <input file>" << std::endl;
+        return 1;
+    }
+
+    std::ifstream program(input);
+    if (!program)
+    {
+        std::cerr << "Cannot open " << input << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        Lexer lexer(program);
+        Parser parser;
+        std::unique_ptr<Program> ast {parser.parse(&lexer, &program, "main")};
+
+        BytecodeCompiler bytecode_compiler;
+        BytecodeProgram bytecode = bytecode_compiler.compile(*ast);
+        ast.reset();
+
+        VM vm(bytecode);
+        std::cout << std::endl << static_cast<uint32_t>(vm.run()) << std::endl;
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}